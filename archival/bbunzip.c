@@ -64,6 +64,7 @@ int FAST_FUNC bbunpack(char **argv,
 			if (open_to_or_warn(STDIN_FILENO, filename, O_RDONLY, 0))
 				goto err;
 		}
+		IF_FEATURE_SEEK_INDEX(info.src_name = filename;)
 
 		/* Special cases: test, stdout */
 		if (option_mask32 & (OPT_STDOUT|OPT_TEST)) {
@@ -101,6 +102,7 @@ int FAST_FUNC bbunpack(char **argv,
 
 		/* memset(&info, 0, sizeof(info)); */
 		info.mtime = 0; /* so far it has one member only */
+		IF_FEATURE_SEEK_INDEX(info.dst_name = new_name;)
 		status = unpacker(&info);
 		if (status < 0)
 			exitcode = 1;
@@ -147,6 +149,27 @@ int FAST_FUNC bbunpack(char **argv,
 	return exitcode;
 }
 
+#if ENABLE_FEATURE_SEEK_INDEX && (ENABLE_GUNZIP || ENABLE_UNXZ)
+/* -O OFS: unpack from uncompressed offset OFS on */
+static off_t seek_offset;
+
+/* Magic already read. Jump with an index if the file has one */
+static IF_DESKTOP(long long) int unpack_at_offset(unpack_info_t *info,
+	IF_DESKTOP(long long) int FAST_FUNC (*unpack_at)(int src_fd, int dst_fd, off_t skip))
+{
+	seek_index_t *idx = NULL;
+	IF_DESKTOP(long long) int status;
+
+	if (info->src_name)
+		idx = seek_index_open(info->src_name);
+	if (!idx)
+		return unpack_at(STDIN_FILENO, STDOUT_FILENO, seek_offset);
+	status = seek_index_unpack(idx, STDOUT_FILENO, seek_offset);
+	seek_index_close(idx);
+	return status;
+}
+#endif
+
 #if ENABLE_UNCOMPRESS || ENABLE_BUNZIP2 || ENABLE_UNLZMA || ENABLE_UNXZ
 static
 char* FAST_FUNC make_new_name_generic(char *filename, const char *expected_ext)
@@ -245,6 +268,13 @@ char* FAST_FUNC make_new_name_gunzip(char *filename, const char *expected_ext UN
 	}
 	return filename;
 }
+#if ENABLE_FEATURE_SEEK_INDEX
+static
+IF_DESKTOP(long long) int FAST_FUNC unpack_gz_from(int src_fd, int dst_fd, off_t skip)
+{
+	return unpack_gz_at(src_fd, dst_fd, NULL, 0, skip);
+}
+#endif
 static
 IF_DESKTOP(long long) int FAST_FUNC unpack_gunzip(unpack_info_t *info)
 {
@@ -258,6 +288,11 @@ IF_DESKTOP(long long) int FAST_FUNC unpack_gunzip(unpack_info_t *info)
 		if (ENABLE_FEATURE_SEAMLESS_Z && magic2 == 0x9d) {
 			status = unpack_Z_stream(STDIN_FILENO, STDOUT_FILENO);
 		} else if (magic2 == 0x8b) {
+#if ENABLE_FEATURE_SEEK_INDEX
+			if (seek_offset)
+				status = unpack_at_offset(info, unpack_gz_from);
+			else
+#endif
 			status = unpack_gz_stream_with_info(STDIN_FILENO, STDOUT_FILENO, info);
 		} else {
 			goto bad_magic;
@@ -288,7 +323,14 @@ IF_DESKTOP(long long) int FAST_FUNC unpack_gunzip(unpack_info_t *info)
 int gunzip_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int gunzip_main(int argc UNUSED_PARAM, char **argv)
 {
+#if ENABLE_FEATURE_SEEK_INDEX
+	const char *ofs_str;
+
+	if (getopt32(argv, "cfvdtnO:", &ofs_str) & (1 << 6))
+		seek_offset = XATOOFF(ofs_str);
+#else
 	getopt32(argv, "cfvdtn");
+#endif
 	argv += optind;
 	/* if called as zcat */
 	if (applet_name[1] == 'c')
@@ -312,6 +354,9 @@ int gunzip_main(int argc UNUSED_PARAM, char **argv)
 //usage:     "\nOptions:"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
+//usage:	IF_FEATURE_BUNZIP2_PARALLEL(
+//usage:     "\n	-p N	Use N worker processes (default: one per CPU)"
+//usage:	)
 //usage:#define bzcat_trivial_usage
 //usage:       "FILE"
 //usage:#define bzcat_full_usage "\n\n"
@@ -327,7 +372,9 @@ IF_DESKTOP(long long) int FAST_FUNC unpack_bunzip2(unpack_info_t *info UNUSED_PA
 int bunzip2_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int bunzip2_main(int argc UNUSED_PARAM, char **argv)
 {
-	getopt32(argv, "cfvdt");
+	IF_FEATURE_BUNZIP2_PARALLEL(opt_complementary = "p+";)
+	getopt32(argv, "cfvdt" IF_FEATURE_BUNZIP2_PARALLEL("p:", &bunzip2_procs));
+	IF_FEATURE_BUNZIP2_PARALLEL(bunzip2_procs = MIN(bunzip2_procs, 64);)
 	argv += optind;
 	if (applet_name[2] == 'c') /* bzcat */
 		option_mask32 |= OPT_STDOUT;
@@ -371,6 +418,13 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 
 
 #if ENABLE_UNXZ
+# if ENABLE_FEATURE_SEEK_INDEX
+static
+IF_DESKTOP(long long) int FAST_FUNC unpack_xz_from(int src_fd, int dst_fd, off_t skip)
+{
+	return unpack_xz_at(src_fd, dst_fd, NULL, 0, skip);
+}
+# endif
 static
 IF_DESKTOP(long long) int FAST_FUNC unpack_unxz(unpack_info_t *info UNUSED_PARAM)
 {
@@ -400,13 +454,29 @@ IF_DESKTOP(long long) int FAST_FUNC unpack_unxz(unpack_info_t *info UNUSED_PARAM
 		bb_error_msg("invalid magic");
 		return -1;
 	}
+#endif
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (seek_offset)
+		return unpack_at_offset(info, unpack_xz_from);
 #endif
 	return unpack_xz_stream(STDIN_FILENO, STDOUT_FILENO);
 }
 int unxz_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int unxz_main(int argc UNUSED_PARAM, char **argv)
 {
-	IF_XZ(int opts =) getopt32(argv, "cfvdt");
+	IF_XZ(int opts;)
+# if ENABLE_FEATURE_SEEK_INDEX
+	const char *ofs_str;
+# endif
+
+	IF_FEATURE_UNXZ_PARALLEL(opt_complementary = "p+";)
+	IF_XZ(opts =) getopt32(argv, "cfvdt" IF_FEATURE_SEEK_INDEX("O:") IF_FEATURE_UNXZ_PARALLEL("p:")
+			IF_FEATURE_SEEK_INDEX(, &ofs_str) IF_FEATURE_UNXZ_PARALLEL(, &unxz_procs));
+	IF_FEATURE_UNXZ_PARALLEL(unxz_procs = MIN(unxz_procs, 64);)
+# if ENABLE_FEATURE_SEEK_INDEX
+	if (option_mask32 & (1 << 5))
+		seek_offset = XATOOFF(ofs_str);
+# endif
 # if ENABLE_XZ
 	/* xz without -d or -t? */
 	if (applet_name[2] == '\0' && !(opts & (OPT_DECOMPRESS|OPT_TEST)))
@@ -340,8 +340,30 @@ struct globals {
 	ulg bits_sent;			/* bit length of the compressed data */
 #endif
 
-	uint32_t *crc_32_tab;
 	uint32_t crc;	/* shift register contents */
+
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	unsigned par_procs;	/* -p N */
+
+/* Worker side of -p N: input is taken from in_ptr instead of ifd,
+ * output is collected in par_out instead of being written to ofd,
+ * and the last block of a piece is not marked final.
+ */
+	smallint worker;
+	unsigned in_left;
+	uch *in_ptr;
+	uch *par_out;
+	unsigned par_outlen;
+	unsigned par_outsize;
+# if ENABLE_FEATURE_SEEK_INDEX
+	smallint want_index;	/* -i */
+	int idx_fd;		/* FILE.gz.idx, -1 if none */
+	uint32_t idx_count;
+	uint64_t idx_next;	/* uncompressed offset due for the next point */
+	uint64_t upos;		/* uncompressed bytes read so far (isize wraps) */
+	uint64_t zpos;		/* compressed bytes written so far */
+# endif
+#endif
 };
 
 #define G1 (*(ptr_to_globals - 1))
@@ -356,6 +378,18 @@ static void flush_outbuf(void)
 	if (G1.outcnt == 0)
 		return;
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.worker) {
+		if (G1.par_outlen + G1.outcnt > G1.par_outsize) {
+			G1.par_outsize = G1.par_outlen + G1.outcnt + 32 * 1024;
+			G1.par_out = xrealloc(G1.par_out, G1.par_outsize);
+		}
+		memcpy(G1.par_out + G1.par_outlen, G1.outbuf, G1.outcnt);
+		G1.par_outlen += G1.outcnt;
+		G1.outcnt = 0;
+		return;
+	}
+#endif
 	xwrite(ofd, (char *) G1.outbuf, G1.outcnt);
 	G1.outcnt = 0;
 }
@@ -395,13 +429,8 @@ static void put_32bit(ulg n)
  */
 static uint32_t updcrc(uch * s, unsigned n)
 {
-	uint32_t c = G1.crc;
-	while (n) {
-		c = G1.crc_32_tab[(uch)(c ^ *s++)] ^ (c >> 8);
-		n--;
-	}
-	G1.crc = c;
-	return c;
+	G1.crc = crc32_block_endian0(G1.crc, s, n);
+	return G1.crc;
 }
 
 
@@ -416,6 +445,16 @@ static unsigned file_read(void *buf, unsigned size)
 
 	Assert(G1.insize == 0, "l_buf not empty");
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.worker) {
+		/* The worker computes the crc of its piece itself */
+		len = MIN(size, G1.in_left);
+		memcpy(buf, G1.in_ptr, len);
+		G1.in_ptr += len;
+		G1.in_left -= len;
+		return len;
+	}
+#endif
 	len = safe_read(ifd, buf, size);
 	if (len == (unsigned)(-1) || len == 0)
 		return len;
@@ -1807,7 +1846,12 @@ static ulg deflate(void)
 	if (match_available)
 		ct_tally(0, G1.window[G1.strstart - 1]);
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	/* A worker's piece is not the end of the stream */
+	return FLUSH_BLOCK(!G1.worker);
+#else
 	return FLUSH_BLOCK(1);	/* eof */
+#endif
 }
 
 
@@ -1995,10 +2039,243 @@ static void zip(ulg time_stamp)
 	flush_outbuf();
 }
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+/* ===========================================================================
+ * Parallel deflate (-p N).
+ * The input is cut into PAR_CHUNK pieces which are deflated by up to
+ * N forked workers (all of the deflate state lives in G1/G2, so each
+ * worker is a process, not a thread). Every piece is primed with the
+ * last 32k of the piece before it and ends with an empty stored block,
+ * which leaves it on a byte boundary: the pieces are simply concatenated
+ * and the stream is closed with an empty final block. The crc of each
+ * piece is computed by its worker and combined in the parent.
+ */
+enum { PAR_CHUNK = 128 * 1024 };
+
+/* Parent -> worker: dict_len + len bytes follow.
+ * Worker -> parent: crc of the piece, then len bytes of deflate data. */
+struct par_msg {
+	uint32_t crc_or_dict_len;
+	uint32_t len;
+};
+
+struct par_slot {
+	pid_t pid;
+	int to_fd;
+	int from_fd;
+	uint32_t len;	/* uncompressed size of the piece in flight, 0 if idle */
+#if ENABLE_FEATURE_SEEK_INDEX
+	/* the piece starts a seek point: its offset and dictionary */
+	smallint point;
+	uint64_t point_uoff;
+	uch *point_win;
+#endif
+};
+
+/* Deflate pieces read from ifd, write them to ofd. Never returns */
+static void NORETURN par_worker(void)
+{
+	struct par_msg m;
+	uch *in = xmalloc(WSIZE + PAR_CHUNK);
+	ush deflate_flags;
+	unsigned j;
+
+	G1.worker = 1;
+	while (full_read(ifd, &m, sizeof(m)) == sizeof(m)) {
+		if (m.crc_or_dict_len > WSIZE || m.len > PAR_CHUNK)
+			bb_error_msg_and_die("bad piece");
+		xread(ifd, in, m.crc_or_dict_len + m.len);
+		G1.crc = ~0;
+		updcrc(in + m.crc_or_dict_len, m.len);
+		G1.in_ptr = in;
+		G1.in_left = m.crc_or_dict_len + m.len;
+		G1.outcnt = 0;
+		G1.par_outlen = 0;
+
+		bi_init();
+		lm_init(&deflate_flags);
+		/* Load the dictionary: hash it, but start output after it */
+		for (j = 0; j < m.crc_or_dict_len; j++) {
+			UPDATE_HASH(G1.ins_h, G1.window[j + MIN_MATCH-1]);
+			G1.prev[j & WMASK] = head[G1.ins_h];
+			head[G1.ins_h] = j;
+		}
+		G1.strstart = j;
+		G1.block_start = j;
+		G1.lookahead -= j;
+		while (G1.lookahead < MIN_LOOKAHEAD && !G1.eofile)
+			fill_window();
+
+		deflate();
+		/* Empty stored block: align the piece on a byte boundary */
+		send_bits(STORED_BLOCK << 1, 3);
+		copy_block(NULL, 0, 1);
+		flush_outbuf();
+
+		m.crc_or_dict_len = ~G1.crc;
+		m.len = G1.par_outlen;
+		xwrite(ofd, &m, sizeof(m));
+		xwrite(ofd, G1.par_out, G1.par_outlen);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+static void par_spawn(struct par_slot *slots, unsigned i)
+{
+	struct fd_pair to, from;
+	pid_t pid;
+
+	xpiped_pair(to);
+	xpiped_pair(from);
+	pid = fork();
+	if (pid < 0)
+		bb_perror_msg_and_die("fork");
+	if (pid == 0) {
+		/* Other workers must see EOF when the parent closes their pipes */
+		while (i != 0) {
+			i--;
+			close(slots[i].to_fd);
+			close(slots[i].from_fd);
+		}
+		close(to.wr);
+		close(from.rd);
+		xmove_fd(to.rd, ifd);
+		xmove_fd(from.wr, ofd);
+		par_worker();
+	}
+	close(to.rd);
+	close(from.wr);
+	slots[i].pid = pid;
+	slots[i].to_fd = to.wr;
+	slots[i].from_fd = from.rd;
+}
+
+/* Copy the deflated piece of slot to ofd, return the updated crc */
+static uint32_t par_collect(struct par_slot *slot, uint32_t crc)
+{
+	struct par_msg m;
+
+	xread(slot->from_fd, &m, sizeof(m));
+#if ENABLE_FEATURE_SEEK_INDEX
+	/* Pieces are byte aligned: one can start inflating here */
+	if (slot->point) {
+		uint64_t v[2];
+
+		v[0] = SWAP_LE64(slot->point_uoff);
+		v[1] = SWAP_LE64(G1.zpos);
+		xwrite(G1.idx_fd, v, sizeof(v));
+		xwrite(G1.idx_fd, slot->point_win, WSIZE);
+		G1.idx_count++;
+		slot->point = 0;
+	}
+	G1.zpos += m.len;
+#endif
+	bb_copyfd_exact_size(slot->from_fd, ofd, m.len);
+	crc = crc32_combine(crc, m.crc_or_dict_len, slot->len);
+	slot->len = 0;
+	return crc;
+}
+
+static void zip_parallel(ulg time_stamp)
+{
+	struct par_slot *slots;
+	uch *buf;
+	struct par_msg m;
+	ssize_t len;
+	unsigned i, n;
+	uint32_t crc;
+
+	n = G1.par_procs;
+	slots = xzalloc(n * sizeof(slots[0]));
+	/* the 32k dictionary of a piece sits right in front of it */
+	buf = xmalloc(WSIZE + PAR_CHUNK);
+
+	G1.outcnt = 0;
+	put_32bit(0x00088b1f);
+	put_32bit(time_stamp);
+	put_8bit(2);	/* extra flags, as lm_init sets them */
+	put_8bit(3);	/* OS identifier = 3 (Unix) */
+	flush_outbuf();
+#if ENABLE_FEATURE_SEEK_INDEX
+	G1.zpos = 10;
+	G1.upos = 0;
+	G1.idx_count = 0;
+	G1.idx_next = SEEK_INDEX_SPAN;
+#endif
+
+	/* Static trees are needed by the workers and for the last block */
+	bi_init();
+	ct_init();
+
+	crc = 0;
+	m.crc_or_dict_len = 0;
+	i = 0;
+	do {
+		len = full_read(ifd, buf + WSIZE, PAR_CHUNK);
+		if (len < 0)
+			bb_perror_msg_and_die(bb_msg_read_error);
+		if (len == 0)
+			break;
+		/* Slot i holds the oldest piece; wait for it before reusing */
+		if (slots[i].len)
+			crc = par_collect(&slots[i], crc);
+		else if (!slots[i].pid)
+			par_spawn(slots, i);
+#if ENABLE_FEATURE_SEEK_INDEX
+		if (G1.idx_fd >= 0 && G1.upos >= G1.idx_next) {
+			if (!slots[i].point_win)
+				slots[i].point_win = xmalloc(WSIZE);
+			memcpy(slots[i].point_win, buf, WSIZE);
+			slots[i].point_uoff = G1.upos;
+			slots[i].point = 1;
+			G1.idx_next = G1.upos + SEEK_INDEX_SPAN;
+		}
+		G1.upos += len;
+#endif
+		m.len = len;
+		xwrite(slots[i].to_fd, &m, sizeof(m));
+		xwrite(slots[i].to_fd, buf + WSIZE - m.crc_or_dict_len,
+				m.crc_or_dict_len + len);
+		slots[i].len = len;
+		G1.isize += len;
+		if (++i == n)
+			i = 0;
+		memcpy(buf, buf + PAR_CHUNK, WSIZE);
+		m.crc_or_dict_len = WSIZE;
+	} while (len == PAR_CHUNK);
+
+	for (n = 0; n < G1.par_procs; n++) {
+		if (slots[i].len)
+			crc = par_collect(&slots[i], crc);
+		if (++i == G1.par_procs)
+			i = 0;
+	}
+	for (i = 0; i < G1.par_procs; i++) {
+		if (slots[i].pid) {
+			close(slots[i].to_fd);
+			close(slots[i].from_fd);
+			safe_waitpid(slots[i].pid, NULL, 0);
+		}
+		IF_FEATURE_SEEK_INDEX(free(slots[i].point_win);)
+	}
+	free(buf);
+	free(slots);
+
+	/* Empty final block with static trees */
+	send_bits((STATIC_TREES << 1) + 1, 3);
+	send_bits(G2.static_ltree[END_BLOCK].Code, G2.static_ltree[END_BLOCK].Len);
+	bi_windup();
+
+	put_32bit(crc);
+	put_32bit(G1.isize);
+	flush_outbuf();
+}
+#endif
+
 
 /* ======================================================================== */
 static
-IF_DESKTOP(long long) int FAST_FUNC pack_gzip(unpack_info_t *info UNUSED_PARAM)
+IF_DESKTOP(long long) int FAST_FUNC pack_gzip(unpack_info_t *info IF_NOT_FEATURE_SEEK_INDEX(UNUSED_PARAM))
 {
 	struct stat s;
 
@@ -2035,6 +2312,39 @@ IF_DESKTOP(long long) int FAST_FUNC pack_gzip(unpack_info_t *info UNUSED_PARAM)
 
 	s.st_ctime = 0;
 	fstat(STDIN_FILENO, &s);
+#if ENABLE_FEATURE_SEEK_INDEX && ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.want_index) {
+		struct seek_index_header h;
+		char *name;
+
+		if (!info->dst_name)
+			bb_error_msg_and_die("-i needs an output file");
+		name = xasprintf("%s.idx", info->dst_name);
+		G1.idx_fd = xopen3(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		free(name);
+		/* The header is filled in when the size is known */
+		memset(&h, 0, sizeof(h));
+		xwrite(G1.idx_fd, &h, sizeof(h));
+		zip_parallel(s.st_ctime);
+
+		memcpy(h.magic, SEEK_INDEX_MAGIC, sizeof(h.magic));
+		fstat(ofd, &s);
+		h.gz_size = SWAP_LE64((uint64_t)s.st_size);
+		h.count = SWAP_LE32(G1.idx_count);
+		h.span = SWAP_LE32(SEEK_INDEX_SPAN);
+		xlseek(G1.idx_fd, 0, SEEK_SET);
+		xwrite(G1.idx_fd, &h, sizeof(h));
+		xclose(G1.idx_fd);
+		G1.idx_fd = -1;
+		return 0;
+	}
+#endif
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.par_procs > 1) {
+		zip_parallel(s.st_ctime);
+		return 0;
+	}
+#endif
 	zip(s.st_ctime);
 	return 0;
 }
@@ -2053,6 +2363,12 @@ static const char gzip_longopts[] ALIGN1 =
 	"quiet\0"               No_argument       "q"
 	"fast\0"                No_argument       "1"
 	"best\0"                No_argument       "9"
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	"processes\0"           Required_argument "p"
+# if ENABLE_FEATURE_SEEK_INDEX
+	"index\0"               No_argument       "i"
+# endif
+#endif
 	;
 #endif
 
@@ -2078,12 +2394,14 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 #endif
 {
 	unsigned opt;
+	IF_FEATURE_GZIP_PARALLEL(const char *par_procs = "1";)
 
 #if ENABLE_FEATURE_GZIP_LONG_OPTIONS
 	applet_long_options = gzip_longopts;
 #endif
 	/* Must match bbunzip's constants OPT_STDOUT, OPT_FORCE! */
-	opt = getopt32(argv, "cfv" IF_GUNZIP("dt") "q123456789n");
+	opt = getopt32(argv, "cfv" IF_GUNZIP("dt") "q123456789n"
+			IF_FEATURE_GZIP_PARALLEL("p:" IF_FEATURE_SEEK_INDEX("i"), &par_procs));
 #if ENABLE_GUNZIP /* gunzip_main may not be visible... */
 	if (opt & 0x18) // -d and/or -t
 		return gunzip_main(argc, argv);
@@ -2104,8 +2422,14 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 	ALLOC(uch, G1.window, 2L * WSIZE);
 	ALLOC(ush, G1.prev, 1L << BITS);
 
-	/* Initialise the CRC32 table */
-	G1.crc_32_tab = crc32_filltable(NULL, 0);
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	G1.par_procs = xatou_range(par_procs, 1, 64);
+# if ENABLE_FEATURE_SEEK_INDEX
+	/* -i comes after -p */
+	G1.want_index = (opt >> (ENABLE_GUNZIP ? 17 : 15)) & 1;
+	G1.idx_fd = -1;
+# endif
+#endif
 
 	return bbunpack(argv, pack_gzip, append_ext, "gz");
 }
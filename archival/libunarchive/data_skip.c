@@ -8,5 +8,14 @@
 
 void FAST_FUNC data_skip(archive_handle_t *archive_handle)
 {
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (archive_handle->seek_index
+	 && seek_index_skip(archive_handle->seek_index, archive_handle->src_fd,
+			archive_handle->offset,
+			archive_handle->offset + archive_handle->file_header->size)
+	) {
+		return;
+	}
+#endif
 	archive_handle->seek(archive_handle->src_fd, archive_handle->file_header->size);
 }
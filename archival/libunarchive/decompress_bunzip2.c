@@ -647,17 +647,347 @@ void FAST_FUNC dealloc_bunzip(bunzip_data *bd)
 }
 
 
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+/* Parallel decompression.
+ *
+ * Blocks are neither byte aligned nor preceded by their length, but each one
+ * starts with the 48-bit magic 0x314159265359, and the stream ends with
+ * 0x177245385090 followed by the stream CRC. The parent scans the input for
+ * both at every bit offset and cuts it into segments, one per block. Each
+ * segment is shifted to a byte boundary, closed with an end-of-stream marker
+ * carrying the block's own CRC and handed to a worker process, which decodes
+ * it as a one-block stream and sends back the output. Results are collected
+ * in order, so at most one segment per worker is in flight; the block CRCs
+ * are chained into the stream CRC just like read_bunzip() does.
+ *
+ * The magic can also occur by chance inside compressed data. A segment cut
+ * short by such a false match fails to decode, and since results are taken
+ * in order, it is the first one to fail. The parent then stops the workers
+ * and lets the sequential decoder carry on from the start of that segment,
+ * which also reports genuine data errors the usual way.
+ */
+
+/* 0 means the number of online CPUs */
+unsigned bunzip2_procs;
+
+#define BLOCK_MAGIC     0x314159265359ULL
+#define EOS_MAGIC       0x177245385090ULL
+#define MAGIC_MASK      0xffffffffffffULL
+#define PAR_READ_SIZE   (64 * 1024)
+
+/* Worker -> parent, followed by len bytes of output */
+struct bz_par_msg {
+	uint32_t crc;
+	uint32_t len;	/* ~0: segment did not decode */
+};
+
+struct bz_par_slot {
+	pid_t pid;
+	int to_fd, from_fd;
+	int busy;
+	uint64_t start;	/* bit offset of the segment */
+};
+
+static NOINLINE void bz_par_worker(bunzip_data *bd, int in_fd, int out_fd)
+{
+	struct bz_par_msg m;
+	unsigned char *in = NULL;
+	char *out = NULL;
+	uint32_t len, size = 0;
+	int i;
+
+	while (full_read(in_fd, &len, sizeof(len)) == sizeof(len)) {
+		in = xrealloc(in, len);
+		xread(in_fd, in, len);
+		bd->in_fd = -1;
+		bd->inbuf = in;
+		bd->inbufCount = len;
+		bd->inbufPos = 0;
+		bd->inbufBitCount = 0;
+		bd->writeCopies = 0;
+		bd->writeCount = 0;
+		bd->totalCRC = 0;
+		m.len = 0;
+		do {
+			if (size - m.len < IOBUF_SIZE) {
+				size += 1024 * 1024;
+				out = xrealloc(out, size);
+			}
+			i = read_bunzip(bd, out + m.len, size - m.len);
+			if (i > 0)
+				m.len += i;
+		} while (i > 0);
+		m.crc = bd->totalCRC;
+		/* The marker we appended must follow the block exactly */
+		if (i != RETVAL_LAST_BLOCK || bd->headerCRC != bd->totalCRC)
+			m.len = (uint32_t)-1;
+		xwrite(out_fd, &m, sizeof(m));
+		if (m.len != (uint32_t)-1)
+			xwrite(out_fd, out, m.len);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void bz_par_spawn(struct bz_par_slot *slots, unsigned i, bunzip_data *bd)
+{
+	struct fd_pair to, from;
+	pid_t pid;
+
+	xpiped_pair(to);
+	xpiped_pair(from);
+	pid = fork();
+	if (pid < 0)
+		bb_perror_msg_and_die("fork");
+	if (pid == 0) {
+		/* Other workers must see EOF when the parent closes their pipes */
+		while (i != 0) {
+			i--;
+			if (slots[i].pid) {
+				close(slots[i].to_fd);
+				close(slots[i].from_fd);
+			}
+		}
+		close(to.wr);
+		close(from.rd);
+		bz_par_worker(bd, to.rd, from.wr);
+	}
+	close(to.rd);
+	close(from.wr);
+	slots[i].pid = pid;
+	slots[i].to_fd = to.wr;
+	slots[i].from_fd = from.rd;
+}
+
+/* Read n (<= 32) bits at bit offset pos of p */
+static uint32_t bz_peek_bits(const unsigned char *p, uint64_t pos, int n)
+{
+	uint32_t v = 0;
+
+	while (--n >= 0) {
+		v = (v << 1) | ((p[pos >> 3] >> (7 - (pos & 7))) & 1);
+		pos++;
+	}
+	return v;
+}
+
+static void bz_put_bits(unsigned char *p, uint32_t *pos, uint32_t v, int n)
+{
+	while (--n >= 0) {
+		if ((v >> n) & 1)
+			p[*pos >> 3] |= 0x80 >> (*pos & 7);
+		(*pos)++;
+	}
+}
+
+/* Send nbits of p starting at bit offset pos to a worker, realigned and
+ * followed by an end-of-stream marker with the block's CRC */
+static void bz_par_send(int fd, const unsigned char *p, uint64_t pos, uint32_t nbits)
+{
+	unsigned char *seg;
+	uint32_t len, i, crc, out;
+	unsigned sh = pos & 7;
+
+	p += pos >> 3;
+	/* Segments shorter than a block header are garbage, the worker says so */
+	crc = (nbits >= 80) ? bz_peek_bits(p, sh + 48, 32) : 0;
+	len = (nbits + 80 + 7) / 8;
+	seg = xzalloc(sizeof(len) + len);
+	memcpy(seg, &len, sizeof(len));
+	/* p[] is valid up to the next magic, so reading one byte past is ok */
+	for (i = 0; i < (nbits + 7) / 8; i++) {
+		seg[sizeof(len) + i] = sh ? (p[i] << sh) | (p[i + 1] >> (8 - sh)) : p[i];
+	}
+	if (nbits & 7)
+		seg[sizeof(len) + i - 1] &= 0xff00 >> (nbits & 7);
+	out = nbits;
+	bz_put_bits(seg + sizeof(len), &out, EOS_MAGIC >> 24, 24);
+	bz_put_bits(seg + sizeof(len), &out, EOS_MAGIC & 0xffffff, 24);
+	bz_put_bits(seg + sizeof(len), &out, crc, 32);
+	xwrite(fd, seg, sizeof(len) + len);
+	free(seg);
+}
+
+/* Write out the oldest segment. Returns 0 if it did not decode */
+static int bz_par_collect(struct bz_par_slot *slot, int dst_fd, uint32_t *crc
+		IF_DESKTOP(, long long *total_written))
+{
+	struct bz_par_msg m;
+
+	if (full_read(slot->from_fd, &m, sizeof(m)) != sizeof(m)
+	 || m.len == (uint32_t)-1
+	) {
+		return 0;
+	}
+	bb_copyfd_exact_size(slot->from_fd, dst_fd, m.len);
+	IF_DESKTOP(*total_written += m.len;)
+	*crc = ((*crc << 1) | (*crc >> 31)) ^ m.crc;
+	slot->busy = 0;
+	return 1;
+}
+
+/* Called right after start_bunzip(). Decompresses as much as it can in
+ * parallel and leaves bd either at the end of the stream or positioned for
+ * read_bunzip() to continue sequentially. Returns the input buffer, which
+ * bd->inbuf may point into, for the caller to free. */
+static unsigned char *unpack_bz2_parallel(bunzip_data *bd, int dst_fd
+		IF_DESKTOP(, long long *total_written))
+{
+	struct bz_par_slot *slots;
+	unsigned char *buf;
+	uint64_t buf_start;	/* input offset of buf[0], in bytes */
+	uint64_t scan;		/* next byte to scan */
+	uint64_t seg;		/* bit offset of the pending segment */
+	uint64_t eos, shreg, magic;
+	uint32_t buf_len, buf_size, crc;
+	unsigned procs, head, tail, i;
+	int s;
+
+	procs = bunzip2_procs;
+	if (!procs) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		procs = (cpus > 1) ? MIN(cpus, 64) : 1;
+	}
+	if (procs < 2)
+		return NULL;
+
+	slots = xzalloc(procs * sizeof(slots[0]));
+	/* start_bunzip() has read "hN", the first block is byte aligned */
+	buf_size = PAR_READ_SIZE * 4;
+	buf = xmalloc(buf_size);
+	buf_len = bd->inbufCount - bd->inbufPos;
+	memcpy(buf, bd->inbuf + bd->inbufPos, buf_len);
+	buf_start = 0;
+	scan = 0;
+	shreg = 0;
+	seg = 0;
+	eos = (uint64_t)-1;
+	crc = 0;
+	head = tail = 0;
+
+	for (;;) {
+		if (scan == buf_start + buf_len) {
+			uint64_t keep = slots[tail].busy ? slots[tail].start : seg;
+			ssize_t n;
+
+			if (eos != (uint64_t)-1 && scan * 8 >= eos + 80)
+				break;
+			keep /= 8;
+			if (buf_size - buf_len < PAR_READ_SIZE) {
+				/* Drop what no segment needs any more, or grow */
+				if (keep - buf_start >= buf_size / 2) {
+					buf_len -= keep - buf_start;
+					memmove(buf, buf + (keep - buf_start), buf_len);
+					buf_start = keep;
+				} else {
+					buf_size *= 2;
+					buf = xrealloc(buf, buf_size);
+				}
+			}
+			n = safe_read(bd->in_fd, buf + buf_len, PAR_READ_SIZE);
+			if (n <= 0) {
+				/* Truncated or not bzip2 at all: let the sequential
+				 * decoder tell which */
+				eos = (uint64_t)-1;
+				goto fallback;
+			}
+			buf_len += n;
+		}
+		if (eos != (uint64_t)-1) {
+			/* Just waiting for the stream CRC */
+			scan = buf_start + buf_len;
+			continue;
+		}
+		shreg = (shreg << 8) | buf[scan - buf_start];
+		scan++;
+		/* Check every magic which ends within this byte, in order */
+		for (s = 7; s >= 0; s--) {
+			uint64_t pos;
+
+			if (scan * 8 < 48 + (unsigned)s)
+				continue;
+			magic = (shreg >> s) & MAGIC_MASK;
+			if (magic != BLOCK_MAGIC && magic != EOS_MAGIC)
+				continue;
+			pos = scan * 8 - s - 48;
+			if (pos != seg) {
+				struct bz_par_slot *slot = &slots[head];
+
+				/* Slots are used round robin: a busy one is the oldest */
+				if (slot->busy) {
+					if (!bz_par_collect(slot, dst_fd, &crc IF_DESKTOP(, total_written)))
+						goto fallback;
+					tail = (tail + 1) % procs;
+				}
+				if (!slot->pid)
+					bz_par_spawn(slots, head, bd);
+				bz_par_send(slot->to_fd, buf, seg - buf_start * 8, pos - seg);
+				slot->busy = 1;
+				slot->start = seg;
+				head = (head + 1) % procs;
+			}
+			seg = pos;
+			if (magic == EOS_MAGIC) {
+				eos = pos;
+				break;
+			}
+		}
+	}
+
+	/* All segments are out, collect what is still in flight */
+	while (slots[tail].busy) {
+		if (!bz_par_collect(&slots[tail], dst_fd, &crc IF_DESKTOP(, total_written)))
+			goto fallback;
+		tail = (tail + 1) % procs;
+	}
+	bd->headerCRC = bz_peek_bits(buf, eos - buf_start * 8 + 48, 32);
+	bd->totalCRC = crc;
+	bd->writeCount = RETVAL_LAST_BLOCK;
+	goto done;
+
+ fallback:
+	/* Restart read_bunzip() at the oldest segment not yet written */
+	if (slots[tail].busy)
+		seg = slots[tail].start;
+	i = seg / 8 - buf_start;
+	bd->inbuf = buf;
+	bd->inbufCount = buf_len;
+	bd->inbufPos = i;
+	bd->inbufBitCount = 0;
+	if (seg & 7) {
+		bd->inbufBits = buf[i];
+		bd->inbufBitCount = 8 - (seg & 7);
+		bd->inbufPos = i + 1;
+	}
+	bd->totalCRC = crc;
+ done:
+	for (i = 0; i < procs; i++) {
+		if (slots[i].pid) {
+			close(slots[i].to_fd);
+			close(slots[i].from_fd);
+			safe_waitpid(slots[i].pid, NULL, 0);
+		}
+	}
+	free(slots);
+	return buf;
+}
+#endif
+
 /* Decompress src_fd to dst_fd.  Stops at end of bzip data, not end of file. */
 IF_DESKTOP(long long) int FAST_FUNC
 unpack_bz2_stream(int src_fd, int dst_fd)
 {
 	IF_DESKTOP(long long total_written = 0;)
+	IF_FEATURE_BUNZIP2_PARALLEL(unsigned char *par_buf = NULL;)
 	char *outbuf;
 	bunzip_data *bd;
 	int i;
 
 	outbuf = xmalloc(IOBUF_SIZE);
 	i = start_bunzip(&bd, src_fd, NULL, 0);
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+	if (!i)
+		par_buf = unpack_bz2_parallel(bd, dst_fd IF_DESKTOP(, &total_written));
+#endif
 	if (!i) {
 		for (;;) {
 			i = read_bunzip(bd, outbuf, IOBUF_SIZE);
@@ -684,6 +1014,7 @@ unpack_bz2_stream(int src_fd, int dst_fd)
 		bb_error_msg("bunzip error %d", i);
 	}
 	dealloc_bunzip(bd);
+	IF_FEATURE_BUNZIP2_PARALLEL(free(par_buf);)
 	free(outbuf);
 
 	return i ? i : IF_DESKTOP(total_written) + 0;
@@ -23,17 +23,9 @@
 
 /* We use our own crc32 function */
 #define XZ_INTERNAL_CRC32 0
-static uint32_t *crc32_table;
 static uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
 {
-	crc = ~crc;
-
-	while (size != 0) {
-		crc = crc32_table[*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
-		--size;
-	}
-
-	return ~crc;
+	return ~crc32_block_endian0(~crc, buf, size);
 }
 
 /* We use arch-optimized unaligned accessors */
@@ -46,24 +38,36 @@ static uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
 #include "unxz/xz_dec_lzma2.c"
 #include "unxz/xz_dec_stream.c"
 
-IF_DESKTOP(long long) int FAST_FUNC
-unpack_xz_stream(int src_fd, int dst_fd)
+/* Where the decoder input comes from: pre, then the file, then post */
+struct unxz_src {
+	int fd;
+	const uint8_t *pre;
+	unsigned pre_len;
+	off_t pos;		/* pread() from here, -1: read() */
+	off_t left;		/* bytes to read from fd, -1: up to EOF */
+	const uint8_t *post;
+	unsigned post_len;
+};
+
+/* Output goes to dst_fd, or into mem if dst_fd < 0 */
+static IF_DESKTOP(long long) int unxz_run(struct unxz_src *src,
+		int dst_fd, uint8_t *mem, size_t mem_size, off_t skip)
 {
 	struct xz_buf iobuf;
 	struct xz_dec *state;
 	unsigned char *membuf;
 	IF_DESKTOP(long long) int total = 0;
 
-	if (!crc32_table)
-		crc32_table = crc32_filltable(NULL, /*endian:*/ 0);
-
 	memset(&iobuf, 0, sizeof(iobuf));
-	/* Preload XZ file signature */
-	membuf = (void*) strcpy(xmalloc(2 * BUFSIZ), HEADER_MAGIC);
-	iobuf.in = membuf;
-	iobuf.in_size = HEADER_MAGIC_SIZE;
+	membuf = xmalloc(2 * BUFSIZ);
+	iobuf.in = src->pre;
+	iobuf.in_size = src->pre_len;
 	iobuf.out = membuf + BUFSIZ;
 	iobuf.out_size = BUFSIZ;
+	if (dst_fd < 0) {
+		iobuf.out = mem;
+		iobuf.out_size = mem_size;
+	}
 
 	/* Limit memory usage to about 64 MiB. */
 	state = xz_dec_init(XZ_DYNALLOC, 64*1024*1024);
@@ -72,26 +76,54 @@ unpack_xz_stream(int src_fd, int dst_fd)
 		enum xz_ret r;
 
 		if (iobuf.in_pos == iobuf.in_size) {
-			int rd = safe_read(src_fd, membuf, BUFSIZ);
-			if (rd < 0) {
-				bb_error_msg(bb_msg_read_error);
-				total = -1;
-				break;
+			int rd = 0;
+			if (src->left != 0) {
+				size_t sz = BUFSIZ;
+				if (src->left > 0 && src->left < (off_t)sz)
+					sz = src->left;
+				if (src->pos >= 0)
+					rd = pread(src->fd, membuf, sz, src->pos);
+				else
+					rd = safe_read(src->fd, membuf, sz);
+				if (rd < 0) {
+					bb_error_msg(bb_msg_read_error);
+					total = -1;
+					break;
+				}
+				if (rd == 0)
+					src->left = 0;
+				if (src->left > 0)
+					src->left -= rd;
+				if (src->pos >= 0)
+					src->pos += rd;
 			}
+			iobuf.in = membuf;
 			iobuf.in_size = rd;
 			iobuf.in_pos = 0;
+			if (rd == 0 && src->post_len) {
+				iobuf.in = src->post;
+				iobuf.in_size = src->post_len;
+				src->post_len = 0;
+			}
 		}
 //		bb_error_msg(">in pos:%d size:%d out pos:%d size:%d",
 //				iobuf.in_pos, iobuf.in_size, iobuf.out_pos, iobuf.out_size);
 		r = xz_dec_run(state, &iobuf);
 //		bb_error_msg("<in pos:%d size:%d out pos:%d size:%d r:%d",
 //				iobuf.in_pos, iobuf.in_size, iobuf.out_pos, iobuf.out_size, r);
-		if (iobuf.out_pos) {
-			xwrite(dst_fd, iobuf.out, iobuf.out_pos);
-			IF_DESKTOP(total += iobuf.out_pos;)
+		if (iobuf.out_pos && dst_fd >= 0) {
+			size_t drop = 0;
+			if (skip) {
+				drop = skip < (off_t)iobuf.out_pos ? skip : iobuf.out_pos;
+				skip -= drop;
+			}
+			xwrite(dst_fd, iobuf.out + drop, iobuf.out_pos - drop);
+			IF_DESKTOP(total += iobuf.out_pos - drop;)
 			iobuf.out_pos = 0;
 		}
 		if (r == XZ_STREAM_END) {
+			if (dst_fd < 0)
+				total = iobuf.out_pos;
 			break;
 		}
 		if (r != XZ_OK && r != XZ_UNSUPPORTED_CHECK) {
@@ -105,3 +137,361 @@ unpack_xz_stream(int src_fd, int dst_fd)
 
 	return total;
 }
+
+#if ENABLE_FEATURE_SEEK_INDEX || ENABLE_FEATURE_UNXZ_PARALLEL
+/*
+ * Every .xz stream ends with an index: the unpadded compressed size and
+ * the uncompressed size of each block. Blocks start with a fresh
+ * dictionary, so any block can be decoded alone. The decoder insists on
+ * a complete stream, so it gets the stream header, the wanted blocks,
+ * and an index and footer made up for just those blocks.
+ */
+static uint64_t get_vli(const uint8_t **pp, const uint8_t *end)
+{
+	const uint8_t *p = *pp;
+	uint64_t v = 0;
+	unsigned shift = 0;
+
+	do {
+		if (p == end || shift > 56)
+			return (uint64_t)-1;
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*pp = p;
+	return v;
+}
+
+static uint8_t *put_vli(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	v = SWAP_LE32(v);
+	move_to_unaligned32(p, v);
+}
+
+/* Fill idx->pt from the index of a single-stream .xz file. 0 if can't */
+int FAST_FUNC unxz_read_index(int fd, seek_index_t *idx)
+{
+	uint8_t buf[12];
+	struct stat st;
+	off_t end, ipos;
+	uint64_t isize, count, i, uoff, coff;
+	uint8_t *index;
+	const uint8_t *p, *iend;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return 0;
+	end = st.st_size;
+	/* Skip stream padding */
+	while (1) {
+		if (end < 24 || pread(fd, buf, 4, end - 4) != 4)
+			return 0;
+		if (buf[0] | buf[1] | buf[2] | buf[3])
+			break;
+		end -= 4;
+	}
+	if (pread(fd, buf, 12, end - 12) != 12
+	 || memcmp(buf + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE) != 0
+	 || xz_crc32(buf + 4, 6, 0) != get_unaligned_le32(buf)
+	) {
+		return 0;
+	}
+	isize = ((uint64_t)get_unaligned_le32(buf + 4) + 1) * 4;
+	ipos = end - 12 - isize;
+	if (ipos < 12 || isize > 64*1024*1024)
+		return 0;
+	/* Only one stream: its header must have the same flags */
+	if (pread(fd, buf + 2, 8, 0) != 8 || buf[10] != buf[8] || buf[11] != buf[9])
+		return 0;
+
+	index = xmalloc(isize);
+	if (pread(fd, index, isize, ipos) != (ssize_t)isize
+	 || index[0] != 0
+	 || xz_crc32(index, isize - 4, 0) != get_unaligned_le32(index + isize - 4)
+	) {
+		goto bad;
+	}
+	p = index + 1;
+	iend = index + isize - 4;
+	count = get_vli(&p, iend);
+	if (count == 0 || count > isize / 2)
+		goto bad;
+	idx->pt = xmalloc((count + 1) * sizeof(idx->pt[0]));
+	uoff = 0;
+	coff = 12;
+	for (i = 0; i < count; i++) {
+		uint64_t unpadded = get_vli(&p, iend);
+		uint64_t usize = get_vli(&p, iend);
+		if (unpadded == (uint64_t)-1 || usize == (uint64_t)-1)
+			goto bad;
+		idx->pt[i].uoff = uoff;
+		idx->pt[i].coff = coff;
+		idx->pt[i].aux = unpadded;
+		uoff += usize;
+		coff += (unpadded + 3) & ~(uint64_t)3;
+	}
+	idx->pt[count].uoff = uoff;
+	idx->pt[count].coff = coff;
+	idx->pt[count].aux = 0;
+	/* Concatenated streams and such are not indexed */
+	if (coff != (uint64_t)ipos)
+		goto bad;
+	idx->count = count;
+	free(index);
+	return 1;
+ bad:
+	free(idx->pt);
+	idx->pt = NULL;
+	free(index);
+	return 0;
+}
+
+/* Decode blocks first..last-1 of idx, which describes src_fd */
+static IF_DESKTOP(long long) int unxz_blocks(int src_fd, int dst_fd, uint8_t *mem,
+		const seek_index_t *idx, unsigned first, unsigned last, off_t skip)
+{
+	struct unxz_src src;
+	uint8_t head[12];
+	uint8_t *tail, *p;
+	unsigned i, isize;
+	IF_DESKTOP(long long) int n;
+
+	if (pread(src_fd, head, 12, 0) != 12) {
+		bb_error_msg(bb_msg_read_error);
+		return -1;
+	}
+	/* Index: indicator, count, records, padding, crc. Then the footer */
+	p = tail = xmalloc(1 + 10 + (last - first) * 20 + 3 + 4 + 12);
+	*p++ = 0;
+	p = put_vli(p, last - first);
+	for (i = first; i < last; i++) {
+		p = put_vli(p, idx->pt[i].aux);
+		p = put_vli(p, idx->pt[i + 1].uoff - idx->pt[i].uoff);
+	}
+	while ((p - tail) & 3)
+		*p++ = 0;
+	put_le32(p, xz_crc32(tail, p - tail, 0));
+	p += 4;
+	isize = p - tail;
+	put_le32(p + 4, isize / 4 - 1);
+	p[8] = head[6];
+	p[9] = head[7];
+	put_le32(p, xz_crc32(p + 4, 6, 0));
+	memcpy(p + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE);
+
+	memset(&src, 0, sizeof(src));
+	src.fd = src_fd;
+	src.pre = head;
+	src.pre_len = 12;
+	src.pos = idx->pt[first].coff;
+	src.left = idx->pt[last].coff - idx->pt[first].coff;
+	src.post = tail;
+	src.post_len = isize + 12;
+	n = unxz_run(&src, dst_fd, mem,
+			idx->pt[last].uoff - idx->pt[first].uoff, skip);
+	free(tail);
+	return n;
+}
+#endif
+
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+/*
+ * Parallel decompression of multi-block streams (xz -T makes them).
+ * The index gives where each block is and how big it unpacks, so
+ * blocks are handed out round robin to worker processes, decoded
+ * straight into a buffer of that size, and written out in order.
+ * At most one block per worker is in flight. Any failure is a data
+ * error: the sequential decoder would stop at the same block.
+ */
+
+/* 0 means the number of online CPUs */
+unsigned unxz_procs;
+
+/* Don't keep more than this unpacked per worker */
+#define PAR_MAX_BLOCK (256 * 1024 * 1024)
+
+struct xz_par_slot {
+	pid_t pid;
+	int to_fd, from_fd;
+	int busy;
+};
+
+static void NORETURN xz_par_worker(int src_fd, const seek_index_t *idx, int in_fd, int out_fd)
+{
+	uint8_t *out = NULL;
+	uint32_t k, len;
+
+	while (full_read(in_fd, &k, sizeof(k)) == sizeof(k)) {
+		IF_DESKTOP(long long) int n;
+
+		len = idx->pt[k + 1].uoff - idx->pt[k].uoff;
+		out = xrealloc(out, len);
+		n = unxz_blocks(src_fd, -1, out, idx, k, k + 1, 0);
+		if (n < 0 || (uint32_t)n != len)
+			len = (uint32_t)-1;
+		xwrite(out_fd, &len, sizeof(len));
+		if (len != (uint32_t)-1)
+			xwrite(out_fd, out, len);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void xz_par_spawn(struct xz_par_slot *slots, unsigned i,
+		int src_fd, const seek_index_t *idx)
+{
+	struct fd_pair to, from;
+	pid_t pid;
+
+	xpiped_pair(to);
+	xpiped_pair(from);
+	pid = fork();
+	if (pid < 0)
+		bb_perror_msg_and_die("fork");
+	if (pid == 0) {
+		/* Other workers must see EOF when the parent closes their pipes */
+		while (i != 0) {
+			i--;
+			if (slots[i].pid) {
+				close(slots[i].to_fd);
+				close(slots[i].from_fd);
+			}
+		}
+		close(to.wr);
+		close(from.rd);
+		xz_par_worker(src_fd, idx, to.rd, from.wr);
+	}
+	close(to.rd);
+	close(from.wr);
+	slots[i].pid = pid;
+	slots[i].to_fd = to.wr;
+	slots[i].from_fd = from.rd;
+}
+
+/* Write out the oldest block. Returns 0 if it did not decode */
+static int xz_par_collect(struct xz_par_slot *slot, int dst_fd
+		IF_DESKTOP(, long long *total_written))
+{
+	uint32_t len;
+
+	if (full_read(slot->from_fd, &len, sizeof(len)) != sizeof(len)
+	 || len == (uint32_t)-1
+	) {
+		return 0;
+	}
+	bb_copyfd_exact_size(slot->from_fd, dst_fd, len);
+	IF_DESKTOP(*total_written += len;)
+	slot->busy = 0;
+	return 1;
+}
+
+/* -2 if src_fd is not a multi-block stream in a file */
+static IF_DESKTOP(long long) int unpack_xz_parallel(int src_fd, int dst_fd)
+{
+	seek_index_t idx;
+	struct xz_par_slot *slots;
+	unsigned procs, i;
+	uint32_t k;
+	long long total = 0;
+
+	procs = unxz_procs;
+	if (!procs) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		procs = (cpus > 1) ? MIN(cpus, 64) : 1;
+	}
+	memset(&idx, 0, sizeof(idx));
+	if (procs < 2 || !unxz_read_index(src_fd, &idx))
+		return -2;
+	for (k = 0; k < idx.count; k++) {
+		if (idx.pt[k + 1].uoff - idx.pt[k].uoff > PAR_MAX_BLOCK) {
+			free(idx.pt);
+			return -2;
+		}
+	}
+	if (idx.count < 2) {
+		free(idx.pt);
+		return -2;
+	}
+	procs = MIN(procs, idx.count);
+
+	slots = xzalloc(procs * sizeof(slots[0]));
+	for (k = 0; k < idx.count; k++) {
+		struct xz_par_slot *slot = &slots[k % procs];
+
+		if (slot->busy && !xz_par_collect(slot, dst_fd IF_DESKTOP(, &total)))
+			goto bad;
+		if (!slot->pid)
+			xz_par_spawn(slots, k % procs, src_fd, &idx);
+		xwrite(slot->to_fd, &k, sizeof(k));
+		slot->busy = 1;
+	}
+	for (i = 0; i < procs; i++) {
+		struct xz_par_slot *slot = &slots[(k + i) % procs];
+
+		if (slot->busy && !xz_par_collect(slot, dst_fd IF_DESKTOP(, &total)))
+			goto bad;
+	}
+ ret:
+	for (i = 0; i < procs; i++) {
+		if (slots[i].pid) {
+			close(slots[i].to_fd);
+			close(slots[i].from_fd);
+			safe_waitpid(slots[i].pid, NULL, 0);
+		}
+	}
+	free(slots);
+	free(idx.pt);
+	return total;
+ bad:
+	/* The worker has said what was wrong */
+	total = -1;
+	goto ret;
+}
+#endif
+
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_xz_stream(int src_fd, int dst_fd)
+{
+	struct unxz_src src;
+
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+	IF_DESKTOP(long long) int n = unpack_xz_parallel(src_fd, dst_fd);
+	if (n != -2)
+		return n;
+#endif
+	/* Preload XZ file signature */
+	memset(&src, 0, sizeof(src));
+	src.fd = src_fd;
+	src.pre = (const uint8_t *)HEADER_MAGIC;
+	src.pre_len = HEADER_MAGIC_SIZE;
+	src.pos = -1;
+	src.left = -1;
+	return unxz_run(&src, dst_fd, NULL, 0, 0);
+}
+
+#if ENABLE_FEATURE_SEEK_INDEX
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_xz_at(int src_fd, int dst_fd, const seek_index_t *idx, unsigned first, off_t skip)
+{
+	struct unxz_src src;
+
+	if (idx)
+		return unxz_blocks(src_fd, dst_fd, NULL, idx, first, idx->count, skip);
+
+	memset(&src, 0, sizeof(src));
+	src.fd = src_fd;
+	src.pre = (const uint8_t *)HEADER_MAGIC;
+	src.pre_len = HEADER_MAGIC_SIZE;
+	src.pos = -1;
+	src.left = -1;
+	return unxz_run(&src, dst_fd, NULL, 0, skip);
+}
+#endif
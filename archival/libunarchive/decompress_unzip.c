@@ -77,7 +77,6 @@ typedef struct state_t {
 
 	unsigned char *gunzip_window;
 
-	uint32_t *gunzip_crc_table;
 
 	/* bitbuffer */
 	unsigned gunzip_bb; /* bit buffer */
@@ -118,13 +117,19 @@ typedef struct state_t {
 
 	const char *error_msg;
 	jmp_buf error_jmp;
+
+#if ENABLE_FEATURE_SEEK_INDEX
+	/* unpack_gz_at(): history to start with, output to drop */
+	const unsigned char *seek_window;
+	unsigned seek_window_len;
+	off_t seek_skip;
+#endif
 } state_t;
 #define gunzip_bytes_out    (S()gunzip_bytes_out   )
 #define gunzip_crc          (S()gunzip_crc         )
 #define gunzip_src_fd       (S()gunzip_src_fd      )
 #define gunzip_outbuf_count (S()gunzip_outbuf_count)
 #define gunzip_window       (S()gunzip_window      )
-#define gunzip_crc_table    (S()gunzip_crc_table   )
 #define gunzip_bb           (S()gunzip_bb          )
 #define gunzip_bk           (S()gunzip_bk          )
 #define to_read             (S()to_read            )
@@ -155,6 +160,9 @@ typedef struct state_t {
 #define inflate_stored_w    (S()inflate_stored_w   )
 #define error_msg           (S()error_msg          )
 #define error_jmp           (S()error_jmp          )
+#define seek_window         (S()seek_window        )
+#define seek_window_len     (S()seek_window_len    )
+#define seek_skip           (S()seek_skip          )
 
 /* This is a generic part */
 #if STATE_IN_BSS /* Use global data segment */
@@ -925,10 +933,7 @@ static int inflate_block(STATE_PARAM smallint *e)
 /* Two callsites, both in inflate_get_next_window */
 static void calculate_gunzip_crc(STATE_PARAM_ONLY)
 {
-	unsigned n;
-	for (n = 0; n < gunzip_outbuf_count; n++) {
-		gunzip_crc = gunzip_crc_table[((int) gunzip_crc ^ (gunzip_window[n])) & 0xff] ^ (gunzip_crc >> 8);
-	}
+	gunzip_crc = crc32_block_endian0(gunzip_crc, gunzip_window, gunzip_outbuf_count);
 	gunzip_bytes_out += gunzip_outbuf_count;
 }
 
@@ -972,6 +977,514 @@ static int inflate_get_next_window(STATE_PARAM_ONLY)
 }
 
 
+#if ENABLE_FEATURE_GUNZIP_FAST_INFLATE
+/*
+ * Table-driven inflate.
+ *
+ * The classic decoder above walks multi-level huft_t tables, refills its
+ * bit buffer a byte at a time and produces output through the 32k window.
+ * This one keeps up to 63 bits in a 64-bit buffer, refilled eight bytes at
+ * a time, which is enough for a whole length/distance pair. Huffman codes
+ * are looked up in one table indexed by the next FAST_LBITS (FAST_DBITS for
+ * distances) bits; an entry tells what the code means and how many bits it
+ * takes. Where two short literal codes fit into the index bits, the entry
+ * holds both. The rare longer codes are decoded canonically, bit by bit.
+ * Output goes straight into a buffer which keeps the last 32k as history,
+ * so matches are copied without wrapping, eight bytes at a time when the
+ * distance allows.
+ */
+
+/* inflatebench sets this to time the classic decoder */
+smallint inflate_classic;
+
+enum {
+	FAST_LBITS = 10,	/* index bits of the literal/length table */
+	FAST_DBITS = 8,		/* index bits of the distance table */
+	FAST_OUTSIZE = 4 * GUNZIP_WSIZE,
+	/* longest match, plus what copies and literal pairs may overshoot */
+	FAST_SLACK = 258 + 16,
+};
+
+/* Table entry: value << 16 | extra bits << 12 | type << 8 | code length */
+#define FENTRY(value, extra, type, len) \
+	(((uint32_t)(value) << 16) | ((extra) << 12) | ((type) << 8) | (len))
+enum {
+	FT_LIT,		/* literal in value */
+	FT_LIT2,	/* two literals, first one in the low byte */
+	FT_BASE,	/* length or distance base in value, plus extra bits */
+	FT_EOB,
+	FT_LONG,	/* code longer than the index bits */
+	FT_BAD,		/* unused code */
+};
+enum { FK_LITLEN, FK_DIST, FK_CODELEN };
+
+struct fast_huff {
+	uint16_t count[BMAX + 1];	/* number of codes of each length */
+	uint16_t symbol[N_MAX];		/* symbols in canonical order */
+};
+
+static uint32_t fast_entry(int kind, unsigned sym, unsigned len)
+{
+	if (kind == FK_DIST) {
+		if (sym >= 30)
+			return FENTRY(0, 0, FT_BAD, 0);
+		return FENTRY(cpdist[sym], cpdext[sym], FT_BASE, len);
+	}
+	if (sym < 256 || kind == FK_CODELEN)
+		return FENTRY(sym, 0, FT_LIT, len);
+	if (sym == 256)
+		return FENTRY(0, 0, FT_EOB, len);
+	if (sym >= 286)
+		return FENTRY(0, 0, FT_BAD, 0);
+	return FENTRY(cplens[sym - 257], cplext[sym - 257], FT_BASE, len);
+}
+
+/* Decode a code longer than the index bits, as in zlib's contrib/puff */
+static uint32_t fast_long(const struct fast_huff *h, uint64_t bits, int kind)
+{
+	int code, first, index, count;
+	unsigned len;
+
+	code = first = index = 0;
+	for (len = 1; len <= BMAX; len++) {
+		code |= bits & 1;
+		bits >>= 1;
+		count = h->count[len];
+		if (code - first < count)
+			return fast_entry(kind, h->symbol[index + code - first], len);
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return FENTRY(0, 0, FT_BAD, 0);
+}
+
+/* Build the lookup table for n code lengths. Returns 0 if the lengths
+ * are oversubscribed; an incomplete set leaves FT_BAD entries */
+static int fast_build(uint32_t *table, unsigned tbits, struct fast_huff *h,
+		const unsigned *lens, unsigned n, int kind)
+{
+	uint16_t offs[BMAX + 1];
+	unsigned i, len, code, rev, size;
+	int left;
+
+	memset(h->count, 0, sizeof(h->count));
+	for (i = 0; i < n; i++)
+		h->count[lens[i]]++;
+	left = 1;
+	for (len = 1; len <= BMAX; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return 0;
+	}
+	offs[1] = 0;
+	for (len = 1; len < BMAX; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (i = 0; i < n; i++)
+		if (lens[i])
+			h->symbol[offs[lens[i]]++] = i;
+
+	size = 1 << tbits;
+	for (i = 0; i < size; i++)
+		table[i] = FENTRY(0, 0, FT_BAD, 0);
+	/* Deflate sends codes MSB first into an LSB first stream, so the
+	 * table is indexed by the bit-reversed canonical code */
+	code = 0;
+	i = 0;
+	for (len = 1; len <= BMAX; len++) {
+		unsigned cnt = h->count[len];
+
+		while (cnt--) {
+			unsigned j;
+
+			rev = 0;
+			for (j = 0; j < len; j++)
+				rev |= ((code >> j) & 1) << (len - 1 - j);
+			if (len <= tbits) {
+				uint32_t e = fast_entry(kind, h->symbol[i], len);
+				for (j = rev; j < size; j += 1 << len)
+					table[j] = e;
+			} else {
+				table[rev & (size - 1)] = FENTRY(0, 0, FT_LONG, 0);
+			}
+			code++;
+			i++;
+		}
+		code <<= 1;
+	}
+
+	if (kind == FK_LITLEN) {
+		/* Merge literal pairs. Going down, table[i >> len1] (<= i)
+		 * still holds a single code when it is looked at */
+		i = size;
+		while (i--) {
+			uint32_t e1 = table[i], e2;
+			unsigned len1 = e1 & 0xff;
+
+			if (((e1 >> 8) & 0xf) != FT_LIT || len1 >= tbits)
+				continue;
+			e2 = table[i >> len1];
+			if (((e2 >> 8) & 0xf) != FT_LIT || len1 + (e2 & 0xff) > tbits)
+				continue;
+			table[i] = FENTRY((e1 >> 16) | (e2 >> 16) << 8, 0, FT_LIT2,
+					len1 + (e2 & 0xff));
+		}
+	}
+	return 1;
+}
+
+struct fast_tables {
+	uint32_t ltable[1 << FAST_LBITS];
+	uint32_t dtable[1 << FAST_DBITS];
+	struct fast_huff lhuff;
+	struct fast_huff dhuff;
+	smallint fixed;		/* tables hold the fixed codes */
+};
+
+/* Refill the input buffer; keeps the last 8 bytes in front of it,
+ * so that bytes still in the bit buffer can be given back */
+static unsigned fast_read_input(STATE_PARAM unsigned char *end)
+{
+	unsigned keep, sz;
+	int n;
+
+	keep = end - bytebuffer;
+	if (keep > 8)
+		keep = 8;
+	memmove(bytebuffer, end - keep, keep);
+	sz = bytebuffer_max - keep;
+	if (to_read >= 0 && to_read < sz) /* unzip only */
+		sz = to_read;
+	n = 0;
+	if (sz) {
+		n = safe_read(gunzip_src_fd, bytebuffer + keep, sz);
+		if (n < 0) {
+			error_msg = "read error";
+			abort_unzip(PASS_STATE_ONLY);
+		}
+	}
+	if (to_read >= 0)
+		to_read -= n;
+	bytebuffer_offset = keep;
+	bytebuffer_size = keep + n;
+	return n;
+}
+
+/* Decode the whole deflate stream to out. Returns bytes written or -1 */
+static NOINLINE IF_DESKTOP(long long) int inflate_fast(STATE_PARAM int out)
+{
+	struct fast_tables *tab;
+	unsigned char *in, *in_end;
+	unsigned char *obuf = gunzip_window;
+	unsigned opos, oflushed;
+	uint64_t bitbuf;
+	unsigned bitcnt;
+	unsigned overrun;	/* zero bytes fed in past the end of input */
+	IF_DESKTOP(long long) int n = 0;
+	smallint last;
+
+	/* abort_unzip() frees nothing of ours: tab lives in gunzip_window */
+	tab = (void*)(obuf + FAST_OUTSIZE);
+	tab->fixed = 0;
+	in = bytebuffer + bytebuffer_offset;
+	in_end = bytebuffer + bytebuffer_size;
+	if (in > in_end)
+		in = in_end;
+	bitbuf = 0;
+	bitcnt = 0;
+	overrun = 0;
+	opos = oflushed = 0;
+#if ENABLE_FEATURE_SEEK_INDEX
+	/* inflate_unzip_internal() put the history there */
+	opos = oflushed = seek_window_len;
+# define SKIP_OUTPUT() do { \
+	if (seek_skip) { \
+		unsigned drop = seek_skip < todo ? seek_skip : todo; \
+		seek_skip -= drop; \
+		oflushed += drop; \
+		todo -= drop; \
+	} \
+} while (0)
+#else
+# define SKIP_OUTPUT() ((void)0)
+#endif
+
+#define FLUSH() do { \
+	unsigned todo = opos - oflushed; \
+	gunzip_crc = crc32_block_endian0(gunzip_crc, obuf + oflushed, todo); \
+	gunzip_bytes_out += todo; \
+	SKIP_OUTPUT(); \
+	if (full_write(out, obuf + oflushed, todo) != (ssize_t)todo) { \
+		bb_perror_msg("write"); \
+		n = -1; \
+		goto ret; \
+	} \
+	IF_DESKTOP(n += todo;) \
+	oflushed = opos; \
+} while (0)
+#define REFILL() do { \
+	if (in_end - in >= 8) { \
+		uint64_t v; \
+		memcpy(&v, in, 8); \
+		bitbuf |= SWAP_LE64(v) << bitcnt; \
+		in += (63 - bitcnt) >> 3; \
+		bitcnt |= 56; \
+	} else { \
+		while (bitcnt <= 56) { \
+			if (in == in_end) { \
+				unsigned got = fast_read_input(PASS_STATE in); \
+				in = bytebuffer + bytebuffer_offset; \
+				in_end = bytebuffer + bytebuffer_size; \
+				if (!got) { \
+					/* past the end: feed zeros, fail if used */ \
+					if (++overrun > 8) \
+						goto truncated; \
+					bitcnt += 8; \
+					continue; \
+				} \
+			} \
+			bitbuf |= (uint64_t)*in++ << bitcnt; \
+			bitcnt += 8; \
+		} \
+	} \
+} while (0)
+#define DROP(nb) do { bitbuf >>= (nb); bitcnt -= (nb); } while (0)
+#define BITS(nb) ((unsigned)bitbuf & ((1U << (nb)) - 1))
+/* Give whole bytes in the bit buffer back to the input buffer */
+#define UNREAD() do { \
+	DROP(bitcnt & 7); \
+	if ((bitcnt >> 3) < overrun) \
+		goto truncated; \
+	in -= (bitcnt >> 3) - overrun; \
+	bitbuf = 0; \
+	bitcnt = 0; \
+	overrun = 0; \
+} while (0)
+
+	do {
+		unsigned type;
+
+		REFILL();
+		last = BITS(1);
+		type = (unsigned)(bitbuf >> 1) & 3;
+		DROP(3);
+
+		if (type == 0) {
+			/* Stored */
+			unsigned len;
+
+			UNREAD();
+			REFILL();
+			len = BITS(16);
+			if (len != (~(unsigned)(bitbuf >> 16) & 0xffff))
+				abort_unzip(PASS_STATE_ONLY);
+			DROP(32);
+			UNREAD();
+			while (len) {
+				unsigned cnt;
+
+				if (in == in_end) {
+					if (!fast_read_input(PASS_STATE in))
+						goto truncated;
+					in = bytebuffer + bytebuffer_offset;
+					in_end = bytebuffer + bytebuffer_size;
+				}
+				if (opos > FAST_OUTSIZE - FAST_SLACK) {
+					FLUSH();
+					memmove(obuf, obuf + opos - GUNZIP_WSIZE, GUNZIP_WSIZE);
+					opos = oflushed = GUNZIP_WSIZE;
+				}
+				cnt = MIN(len, (unsigned)(in_end - in));
+				cnt = MIN(cnt, FAST_OUTSIZE - FAST_SLACK - opos + 1);
+				memcpy(obuf + opos, in, cnt);
+				opos += cnt;
+				in += cnt;
+				len -= cnt;
+			}
+			continue;
+		}
+
+		if (type == 1) {
+			if (!tab->fixed) {
+				unsigned ll[288];
+				unsigned i;
+
+				for (i = 0; i < 144; i++)
+					ll[i] = 8;
+				for (; i < 256; i++)
+					ll[i] = 9;
+				for (; i < 280; i++)
+					ll[i] = 7;
+				for (; i < 288; i++)
+					ll[i] = 8;
+				fast_build(tab->ltable, FAST_LBITS, &tab->lhuff, ll, 288, FK_LITLEN);
+				for (i = 0; i < 30; i++)
+					ll[i] = 5;
+				fast_build(tab->dtable, FAST_DBITS, &tab->dhuff, ll, 30, FK_DIST);
+				tab->fixed = 1;
+			}
+		} else if (type == 2) {
+			/* Dynamic: read the code lengths */
+			unsigned ll[286 + 30];
+			uint32_t ctable[1 << 7];
+			unsigned nl, nd, nb, i;
+
+			REFILL();
+			nl = 257 + BITS(5);
+			nd = 1 + ((unsigned)(bitbuf >> 5) & 0x1f);
+			nb = 4 + ((unsigned)(bitbuf >> 10) & 0xf);
+			DROP(14);
+			if (nl > 286 || nd > 30)
+				abort_unzip(PASS_STATE_ONLY);
+			for (i = 0; i < 19; i++)
+				ll[i] = 0;
+			for (i = 0; i < nb; i++) {
+				REFILL();
+				ll[border[i]] = BITS(3);
+				DROP(3);
+			}
+			/* the lengths of the code length code are at most 7 */
+			if (!fast_build(ctable, 7, &tab->lhuff, ll, 19, FK_CODELEN))
+				abort_unzip(PASS_STATE_ONLY);
+			i = 0;
+			while (i < nl + nd) {
+				uint32_t e;
+				unsigned sym, rep, val;
+
+				REFILL();
+				e = ctable[BITS(7)];
+				if (((e >> 8) & 0xf) != FT_LIT)
+					abort_unzip(PASS_STATE_ONLY);
+				DROP(e & 0xff);
+				sym = e >> 16;
+				if (sym < 16) {
+					ll[i++] = sym;
+					continue;
+				}
+				if (sym == 16) {
+					if (i == 0)
+						abort_unzip(PASS_STATE_ONLY);
+					val = ll[i - 1];
+					rep = 3 + BITS(2);
+					DROP(2);
+				} else if (sym == 17) {
+					val = 0;
+					rep = 3 + BITS(3);
+					DROP(3);
+				} else {
+					val = 0;
+					rep = 11 + BITS(7);
+					DROP(7);
+				}
+				if (i + rep > nl + nd)
+					abort_unzip(PASS_STATE_ONLY);
+				while (rep--)
+					ll[i++] = val;
+			}
+			if (!fast_build(tab->ltable, FAST_LBITS, &tab->lhuff, ll, nl, FK_LITLEN)
+			 || !fast_build(tab->dtable, FAST_DBITS, &tab->dhuff, ll + nl, nd, FK_DIST)
+			) {
+				abort_unzip(PASS_STATE_ONLY);
+			}
+			tab->fixed = 0;
+		} else {
+			abort_unzip(PASS_STATE_ONLY);
+		}
+
+		/* Huffman coded data */
+		for (;;) {
+			uint32_t e;
+			unsigned len, dist, extra;
+			unsigned char *dst;
+			const unsigned char *src;
+
+			if (opos > FAST_OUTSIZE - FAST_SLACK) {
+				FLUSH();
+				memmove(obuf, obuf + opos - GUNZIP_WSIZE, GUNZIP_WSIZE);
+				opos = oflushed = GUNZIP_WSIZE;
+			}
+			REFILL();
+			e = tab->ltable[BITS(FAST_LBITS)];
+			if (((e >> 8) & 0xf) == FT_LONG)
+				e = fast_long(&tab->lhuff, bitbuf, FK_LITLEN);
+			DROP(e & 0xff);
+			switch ((e >> 8) & 0xf) {
+			case FT_LIT:
+			case FT_LIT2:
+				/* The second byte of a single literal is junk
+				 * which the next symbol overwrites */
+				obuf[opos] = e >> 16;
+				obuf[opos + 1] = e >> 24;
+				opos += 1 + ((e >> 8) & 1);
+				continue;
+			case FT_BASE:
+				break;
+			case FT_EOB:
+				goto end_of_block;
+			default:
+				abort_unzip(PASS_STATE_ONLY);
+			}
+			extra = (e >> 12) & 0xf;
+			len = (e >> 16) + BITS(extra);
+			DROP(extra);
+
+			e = tab->dtable[BITS(FAST_DBITS)];
+			if (((e >> 8) & 0xf) == FT_LONG)
+				e = fast_long(&tab->dhuff, bitbuf, FK_DIST);
+			if (((e >> 8) & 0xf) != FT_BASE)
+				abort_unzip(PASS_STATE_ONLY);
+			DROP(e & 0xff);
+			extra = (e >> 12) & 0xf;
+			dist = (e >> 16) + BITS(extra);
+			DROP(extra);
+			if (dist > opos)
+				abort_unzip(PASS_STATE_ONLY);
+
+			dst = obuf + opos;
+			src = dst - dist;
+			opos += len;
+			if (dist >= 8) {
+				/* may copy up to 7 bytes too many, into the slack */
+				do {
+					uint64_t v;
+					memcpy(&v, src, 8);
+					memcpy(dst, &v, 8);
+					src += 8;
+					dst += 8;
+				} while (dst < obuf + opos);
+			} else if (dist == 1) {
+				memset(dst, *src, len);
+			} else {
+				do
+					*dst++ = *src++;
+				while (--len);
+			}
+		}
+ end_of_block: ;
+	} while (!last);
+
+	FLUSH();
+	UNREAD();
+	bytebuffer_offset = in - bytebuffer;
+	goto ret;
+
+ truncated:
+	error_msg = "unexpected end of file";
+	abort_unzip(PASS_STATE_ONLY);
+ ret:
+	return n;
+#undef SKIP_OUTPUT
+#undef FLUSH
+#undef REFILL
+#undef DROP
+#undef BITS
+#undef UNREAD
+}
+#endif
+
+
 /* Called from unpack_gz_stream() and inflate_unzip() */
 static IF_DESKTOP(long long) int
 inflate_unzip_internal(STATE_PARAM int in, int out)
@@ -980,7 +1493,16 @@ inflate_unzip_internal(STATE_PARAM int in, int out)
 	ssize_t nwrote;
 
 	/* Allocate all global buffers (for DYN_ALLOC option) */
+#if ENABLE_FEATURE_GUNZIP_FAST_INFLATE
+	if (!inflate_classic IF_FEATURE_SEEK_INDEX(|| seek_window || seek_skip))
+		gunzip_window = xmalloc(FAST_OUTSIZE + sizeof(struct fast_tables));
+	else
+#endif
 	gunzip_window = xmalloc(GUNZIP_WSIZE);
+#if ENABLE_FEATURE_SEEK_INDEX
+	if (seek_window)
+		memcpy(gunzip_window, seek_window, seek_window_len);
+#endif
 	gunzip_outbuf_count = 0;
 	gunzip_bytes_out = 0;
 	gunzip_src_fd = in;
@@ -992,8 +1514,6 @@ inflate_unzip_internal(STATE_PARAM int in, int out)
 	gunzip_bk = 0;
 	gunzip_bb = 0;
 
-	/* Create the crc table */
-	gunzip_crc_table = crc32_filltable(NULL, 0);
 	gunzip_crc = ~0;
 
 	error_msg = "corrupted data";
@@ -1003,6 +1523,12 @@ inflate_unzip_internal(STATE_PARAM int in, int out)
 		goto ret;
 	}
 
+#if ENABLE_FEATURE_GUNZIP_FAST_INFLATE
+	if (!inflate_classic IF_FEATURE_SEEK_INDEX(|| seek_window || seek_skip)) {
+		n = inflate_fast(PASS_STATE out);
+		goto ret;
+	}
+#endif
 	while (1) {
 		int r = inflate_get_next_window(PASS_STATE_ONLY);
 		nwrote = full_write(out, gunzip_window, gunzip_outbuf_count);
@@ -1027,7 +1553,6 @@ inflate_unzip_internal(STATE_PARAM int in, int out)
  ret:
 	/* Cleanup */
 	free(gunzip_window);
-	free(gunzip_crc_table);
 	return n;
 }
 
@@ -1184,19 +1709,13 @@ static int check_header_gzip(STATE_PARAM unpack_info_t *info)
 	return 1;
 }
 
-IF_DESKTOP(long long) int FAST_FUNC
-unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
+static IF_DESKTOP(long long) int
+unpack_gz_members(STATE_PARAM int in, int out, unpack_info_t *info)
 {
 	uint32_t v32;
 	IF_DESKTOP(long long) int n;
-	DECLARE_STATE;
 
 	n = 0;
-
-	ALLOC_STATE;
-	to_read = -1;
-//	bytebuffer_max = 0x8000;
-	bytebuffer = xmalloc(bytebuffer_max);
 	gunzip_src_fd = in;
 
  again:
@@ -1243,6 +1762,20 @@ unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
 	/*bb_error_msg("decompression OK, trailing garbage ignored");*/
 
  ret:
+	return n;
+}
+
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_gz_stream_with_info(int in, int out, unpack_info_t *info)
+{
+	IF_DESKTOP(long long) int n;
+	DECLARE_STATE;
+
+	ALLOC_STATE;
+	to_read = -1;
+//	bytebuffer_max = 0x8000;
+	bytebuffer = xmalloc(bytebuffer_max);
+	n = unpack_gz_members(PASS_STATE in, out, info);
 	free(bytebuffer);
 	DEALLOC_STATE;
 	return n;
@@ -1253,3 +1786,28 @@ unpack_gz_stream(int in, int out)
 {
 	return unpack_gz_stream_with_info(in, out, NULL);
 }
+
+#if ENABLE_FEATURE_SEEK_INDEX
+/* Start at a seek point: raw deflate data, with the output which
+ * preceded it as history. Without a window, a whole gzip stream */
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_gz_at(int in, int out, const void *window, unsigned win_len, off_t skip)
+{
+	IF_DESKTOP(long long) int n;
+	DECLARE_STATE;
+
+	ALLOC_STATE;
+	to_read = -1;
+	bytebuffer = xmalloc(bytebuffer_max);
+	seek_window = window;
+	seek_window_len = win_len;
+	seek_skip = skip;
+	if (window)
+		n = inflate_unzip_internal(PASS_STATE in, out);
+	else
+		n = unpack_gz_members(PASS_STATE in, out, NULL);
+	free(bytebuffer);
+	DEALLOC_STATE;
+	return n;
+}
+#endif
@@ -0,0 +1,201 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Random access to .gz and .xz files
+ *
+ * A .gz file can only be decompressed from the start, unless one knows
+ * where a deflate block begins and what the 32k of output before it
+ * were: gzip -i records that every SEEK_INDEX_SPAN bytes in FILE.gz.idx.
+ * An .xz file made of several blocks carries its own index.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
+ */
+#include "libbb.h"
+#include "unarchive.h"
+
+#define HAVE_GZ (ENABLE_GUNZIP || ENABLE_FEATURE_SEAMLESS_GZ)
+#define HAVE_XZ (ENABLE_UNXZ || ENABLE_FEATURE_SEAMLESS_XZ)
+
+#if HAVE_GZ
+static int gz_read_index(seek_index_t *idx, const char *filename, const struct stat *st)
+{
+	struct seek_index_header h;
+	struct stat idx_st;
+	char *name;
+	unsigned i;
+
+	name = xasprintf("%s.idx", filename);
+	idx->idx_fd = open(name, O_RDONLY);
+	if (idx->idx_fd < 0)
+		goto ret;
+	if (full_read(idx->idx_fd, &h, sizeof(h)) != sizeof(h)
+	 || memcmp(h.magic, SEEK_INDEX_MAGIC, sizeof(h.magic)) != 0
+	 || SWAP_LE64(h.gz_size) != (uint64_t)st->st_size
+	 || fstat(idx->idx_fd, &idx_st) != 0
+	) {
+		goto bad;
+	}
+	idx->count = SWAP_LE32(h.count);
+	if (idx_st.st_size != sizeof(h) + (off_t)idx->count * SEEK_INDEX_POINT)
+		goto bad;
+
+	idx->pt = xmalloc((idx->count + 1) * sizeof(idx->pt[0]));
+	for (i = 0; i < idx->count; i++) {
+		uint64_t v[2];
+		off_t pos = sizeof(h) + (off_t)i * SEEK_INDEX_POINT;
+
+		if (pread(idx->idx_fd, v, sizeof(v), pos) != sizeof(v))
+			goto bad;
+		idx->pt[i].uoff = SWAP_LE64(v[0]);
+		idx->pt[i].coff = SWAP_LE64(v[1]);
+		idx->pt[i].aux = pos + sizeof(v);
+	}
+	/* The uncompressed size is not needed */
+	idx->pt[i].uoff = (uint64_t)-1;
+	idx->pt[i].coff = st->st_size;
+	idx->pt[i].aux = 0;
+	free(name);
+	return 1;
+ bad:
+	bb_error_msg("%s: stale or corrupted, ignored", name);
+	close(idx->idx_fd);
+	idx->idx_fd = -1;
+ ret:
+	free(name);
+	return 0;
+}
+#endif
+
+/* NULL if filename has no usable index */
+seek_index_t* FAST_FUNC seek_index_open(const char *filename)
+{
+	seek_index_t *idx;
+	struct stat st;
+	unsigned char magic[6];
+	int ok = 0;
+
+	idx = xzalloc(sizeof(*idx));
+	idx->idx_fd = -1;
+	idx->fd = open(filename, O_RDONLY);
+	if (idx->fd < 0)
+		goto fail;
+	if (fstat(idx->fd, &st) != 0 || !S_ISREG(st.st_mode)
+	 || pread(idx->fd, magic, sizeof(magic), 0) != sizeof(magic)
+	) {
+		goto fail;
+	}
+#if HAVE_GZ
+	if (magic[0] == 0x1f && magic[1] == 0x8b)
+		ok = gz_read_index(idx, filename, &st);
+#endif
+#if HAVE_XZ
+	/* With one block there is nowhere to jump to */
+	if (memcmp(magic, "\3757zXZ\0", 6) == 0)
+		ok = unxz_read_index(idx->fd, idx) && idx->count > 1;
+#endif
+	if (ok)
+		return idx;
+ fail:
+	if (idx->fd >= 0)
+		close(idx->fd);
+	free(idx->pt);
+	free(idx);
+	return NULL;
+}
+
+void FAST_FUNC seek_index_close(seek_index_t *idx)
+{
+	if (idx->pid) {
+		kill(idx->pid, SIGKILL);
+		safe_waitpid(idx->pid, NULL, 0);
+	}
+	close(idx->fd);
+	if (idx->idx_fd >= 0)
+		close(idx->idx_fd);
+	free(idx->pt);
+	free(idx);
+}
+
+/* Last point at or before target, -1 if none */
+static int seek_index_find(const seek_index_t *idx, off_t target)
+{
+	int lo = 0, hi = idx->count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (idx->pt[mid].uoff <= (uint64_t)target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+IF_DESKTOP(long long) int FAST_FUNC seek_index_unpack(seek_index_t *idx, int dst_fd, off_t target)
+{
+	int i = seek_index_find(idx, target);
+
+#if HAVE_XZ
+	if (idx->idx_fd < 0) /* block 0 starts at 0: i >= 0 */
+		return unpack_xz_at(idx->fd, dst_fd, idx, i, target - idx->pt[i].uoff);
+#endif
+#if HAVE_GZ
+	if (i >= 0) {
+		IF_DESKTOP(long long) int n;
+		unsigned char *win = xmalloc(SEEK_INDEX_WINDOW);
+
+		if (pread(idx->idx_fd, win, SEEK_INDEX_WINDOW, idx->pt[i].aux) != SEEK_INDEX_WINDOW) {
+			bb_error_msg(bb_msg_read_error);
+			free(win);
+			return -1;
+		}
+		xlseek(idx->fd, idx->pt[i].coff, SEEK_SET);
+		n = unpack_gz_at(idx->fd, dst_fd, win, SEEK_INDEX_WINDOW, target - idx->pt[i].uoff);
+		free(win);
+		return n;
+	}
+	/* Before the first point: from the start, past the magic */
+	xlseek(idx->fd, 2, SEEK_SET);
+	return unpack_gz_at(idx->fd, dst_fd, NULL, 0, target);
+#else
+	return -1;
+#endif
+}
+
+int FAST_FUNC seek_index_jump(seek_index_t *idx, int fd, off_t target)
+{
+	struct fd_pair fd_pipe;
+	pid_t pid;
+
+	/* It shares the file offset with the next one */
+	if (idx->pid) {
+		kill(idx->pid, SIGKILL);
+		safe_waitpid(idx->pid, NULL, 0);
+	}
+	xpiped_pair(fd_pipe);
+	pid = fork();
+	if (pid < 0)
+		bb_perror_msg_and_die("fork");
+	if (pid == 0) {
+		close(fd_pipe.rd);
+		if (fd >= 0)
+			close(fd);
+		_exit(seek_index_unpack(idx, fd_pipe.wr, target) < 0);
+	}
+	close(fd_pipe.wr);
+	idx->pid = pid;
+	if (fd < 0)
+		return fd_pipe.rd;
+	xmove_fd(fd_pipe.rd, fd);
+	return fd;
+}
+
+int FAST_FUNC seek_index_skip(seek_index_t *idx, int fd, off_t cur, off_t target)
+{
+	int i = seek_index_find(idx, target);
+
+	/* Only if it saves decompressing something */
+	if (i < 0 || idx->pt[i].uoff <= (uint64_t)cur)
+		return 0;
+	seek_index_jump(idx, fd, target);
+	return 1;
+}
@@ -510,6 +510,20 @@ static void NOINLINE vfork_compressor(int tar_fd, int gzip)
 # define WAIT_FOR_CHILD 0
 	volatile int vfork_exec_errno = 0;
 	struct fd_pair gzipDataPipe;
+# if ENABLE_FEATURE_SEAMLESS_GZ && ENABLE_FEATURE_GZIP_PARALLEL
+	/* gzip -pN on all online CPUs */
+	char procs_opt[sizeof("-p") + sizeof(int)*3];
+	const char *procs = NULL;
+	long cpus;
+
+	if (zip_exec[0] == 'g') {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus > 1) {
+			sprintf(procs_opt, "-p%u", (unsigned) MIN(cpus, 64));
+			procs = procs_opt;
+		}
+	}
+# endif
 # if WAIT_FOR_CHILD
 	struct fd_pair gzipStatusPipe;
 	xpiped_pair(gzipStatusPipe);
@@ -521,6 +535,9 @@ static void NOINLINE vfork_compressor(int tar_fd, int gzip)
 # if defined(__GNUC__) && __GNUC__
 	/* Avoid vfork clobbering */
 	(void) &zip_exec;
+#  if ENABLE_FEATURE_SEAMLESS_GZ && ENABLE_FEATURE_GZIP_PARALLEL
+	(void) &procs;
+#  endif
 # endif
 
 	gzipPid = vfork();
@@ -540,6 +557,13 @@ static void NOINLINE vfork_compressor(int tar_fd, int gzip)
 		xmove_fd(gzipDataPipe.rd, 0);
 		xmove_fd(tar_fd, 1);
 		/* exec gzip/bzip2 program/applet */
+# if ENABLE_FEATURE_SEAMLESS_GZ && ENABLE_FEATURE_GZIP_PARALLEL
+		/* Only our gzip knows -pN, BB_EXECLP may find
+		 * GNU gzip in PATH. If we can't exec ourself
+		 * (no /proc?), go on without -pN */
+		if (procs)
+			execl(bb_busybox_exec_path, zip_exec, "-f", procs, NULL);
+# endif
 		BB_EXECLP(zip_exec, zip_exec, "-f", NULL);
 		vfork_exec_errno = errno;
 		_exit(EXIT_FAILURE);
@@ -1063,6 +1087,16 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 			tar_handle->src_fd = tar_fd;
 			tar_handle->seek = seek_by_read;
 		} else {
+#if ENABLE_FEATURE_SEEK_INDEX
+			if (flags == O_RDONLY)
+				tar_handle->seek_index = seek_index_open(tar_filename);
+			if (tar_handle->seek_index) {
+				/* Decompress it ourself, data_skip() will jump */
+				get_header_ptr = get_header_tar;
+				tar_handle->src_fd = seek_index_jump(tar_handle->seek_index, -1, 0);
+				tar_handle->seek = seek_by_read;
+			} else
+#endif
 			if (ENABLE_FEATURE_TAR_AUTODETECT && flags == O_RDONLY) {
 				get_header_ptr = get_header_tar;
 				tar_handle->src_fd = open_zipped(tar_filename);
@@ -11,12 +11,11 @@
 int cksum_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int cksum_main(int argc UNUSED_PARAM, char **argv)
 {
-	uint32_t *crc32_table = crc32_filltable(NULL, 1);
 	uint32_t crc;
 	off_t length, filesize;
 	int bytes_read;
 	int exit_code = EXIT_SUCCESS;
-	uint8_t *cp;
+	uint8_t c;
 
 #if ENABLE_DESKTOP
 	getopt32(argv, ""); /* coreutils 6.9 compat */
@@ -37,18 +36,16 @@ int cksum_main(int argc UNUSED_PARAM, char **argv)
 
 #define read_buf bb_common_bufsiz1
 		while ((bytes_read = safe_read(fd, read_buf, sizeof(read_buf))) > 0) {
-			cp = (uint8_t *) read_buf;
 			length += bytes_read;
-			do {
-				crc = (crc << 8) ^ crc32_table[(crc >> 24) ^ *cp++];
-			} while (--bytes_read);
+			crc = crc32_block_endian1(crc, read_buf, bytes_read);
 		}
 		close(fd);
 
 		filesize = length;
 
 		while (length) {
-			crc = (crc << 8) ^ crc32_table[(uint8_t)(crc >> 24) ^ (uint8_t)length];
+			c = length;
+			crc = crc32_block_endian1(crc, &c, 1);
 			/* must ensure that shift is unsigned! */
 			if (sizeof(length) <= sizeof(unsigned))
 				length = (unsigned)length >> 8;
@@ -40,7 +40,7 @@ static uint8_t *hash_file(const char *filename /*, hash_algo_t hash_algo*/)
 		md5_ctx_t md5;
 	} context;
 	uint8_t *hash_value = NULL;
-	RESERVE_CONFIG_UBUFFER(in_buf, 4096);
+	RESERVE_CONFIG_UBUFFER(in_buf, 64 * 1024);
 	void FAST_FUNC (*update)(const void*, size_t, void*);
 	void FAST_FUNC (*final)(void*, void*);
 	hash_algo_t hash_algo = applet_name[3];
@@ -75,7 +75,7 @@ static uint8_t *hash_file(const char *filename /*, hash_algo_t hash_algo*/)
 		bb_error_msg_and_die("algorithm not supported");
 	}
 
-	while (0 < (count = safe_read(src_fd, in_buf, 4096))) {
+	while (0 < (count = safe_read(src_fd, in_buf, 64 * 1024))) {
 		update(in_buf, count, &context);
 	}
 
@@ -93,17 +93,102 @@ static uint8_t *hash_file(const char *filename /*, hash_algo_t hash_algo*/)
 	return hash_value;
 }
 
+/* Split "HASH  NAME" (or "HASH *NAME") line of -c list,
+ * return NAME or NULL if line is malformed */
+static char *split_check_line(char *line)
+{
+	char *filename_ptr;
+
+	filename_ptr = strstr(line, "  ");
+	/* handle format for binary checksums */
+	if (filename_ptr == NULL) {
+		filename_ptr = strstr(line, " *");
+	}
+	if (filename_ptr == NULL)
+		return NULL;
+	*filename_ptr = '\0';
+	return filename_ptr + 2;
+}
+
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+/* -j N: worker w of N hashes names[w], names[w+N]... and writes one
+ * line per name to its pipe: the hex hash, or nothing on error (the
+ * worker has already complained). The parent reads the lines back in
+ * name order, so output looks exactly as without -j. */
+static FILE **workers;
+static unsigned num_workers;
+
+static void start_workers(char **names, unsigned cnt)
+{
+	unsigned w, i;
+
+	if (num_workers > cnt)
+		num_workers = cnt;
+	if (num_workers <= 1)
+		return;
+	workers = xmalloc(num_workers * sizeof(workers[0]));
+	fflush_all();
+	for (w = 0; w < num_workers; w++) {
+		struct fd_pair p;
+		pid_t pid;
+
+		xpiped_pair(p);
+		pid = fork();
+		if (pid < 0)
+			bb_perror_msg_and_die("fork");
+		if (pid == 0) {
+			FILE *fp;
+
+			close(p.rd);
+			for (i = 0; i < w; i++)
+				fclose(workers[i]);
+			fp = xfdopen_for_write(p.wr);
+			for (i = w; i < cnt; i += num_workers) {
+				uint8_t *hash_value = names[i] ? hash_file(names[i]) : NULL;
+				fprintf(fp, "%s\n", hash_value ? (char*)hash_value : "");
+				free(hash_value);
+			}
+			fflush(fp);
+			_exit(EXIT_SUCCESS);
+		}
+		close(p.wr);
+		workers[w] = xfdopen_for_read(p.rd);
+	}
+}
+
+static uint8_t *hash_nth(char **names, unsigned i)
+{
+	char *line;
+
+	if (num_workers <= 1)
+		return names[i] ? hash_file(names[i]) : NULL;
+	line = xmalloc_fgetline(workers[i % num_workers]);
+	if (!line)
+		bb_error_msg_and_die("worker died");
+	if (!line[0]) {
+		free(line);
+		return NULL;
+	}
+	return (uint8_t *)line;
+}
+#else
+# define start_workers(names, cnt) ((void)0)
+# define hash_nth(names, i) ((names)[i] ? hash_file((names)[i]) : NULL)
+#endif
+
 int md5_sha1_sum_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 {
 	int return_value = EXIT_SUCCESS;
 	uint8_t *hash_value;
 	unsigned flags;
+	unsigned i, cnt;
 	/*hash_algo_t hash_algo = applet_name[3];*/
 
 	if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK) {
 		/* -b "binary", -t "text" are ignored (shaNNNsum compat) */
-		flags = getopt32(argv, "scwbt");
+		IF_FEATURE_MD5_SHA1_SUM_PARALLEL(opt_complementary = "j+";)
+		flags = getopt32(argv, "scwbt" IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:", &num_workers));
 	}
 	else optind = 1;
 	argv += optind;
@@ -125,6 +210,8 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 		FILE *pre_computed_stream;
 		int count_total = 0;
 		int count_failed = 0;
+		char **lines = NULL;
+		char **names = NULL;
 		char *line;
 
 		if (argv[1]) {
@@ -134,16 +221,41 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 
 		pre_computed_stream = xfopen_stdin(argv[0]);
 
-		while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+		if (num_workers > 1) {
+			/* Read the whole list first: all names
+			 * are handed out to the workers up front */
+			cnt = 0;
+			while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
+				lines = xrealloc_vector(lines, 6, cnt);
+				lines[cnt++] = line;
+			}
+			names = xzalloc((cnt + 1) * sizeof(names[0]));
+			for (i = 0; i < cnt; i++)
+				names[i] = split_check_line(lines[i]);
+			start_workers(names, cnt);
+		}
+#endif
+
+		for (i = 0; ; i++) {
 			char *filename_ptr;
 
-			count_total++;
-			filename_ptr = strstr(line, "  ");
-			/* handle format for binary checksums */
-			if (filename_ptr == NULL) {
-				filename_ptr = strstr(line, " *");
+			if (lines) {
+				if (i == cnt)
+					break;
+				line = lines[i];
+				filename_ptr = names[i];
+			} else {
+				line = xmalloc_fgetline(pre_computed_stream);
+				if (!line)
+					break;
+				filename_ptr = split_check_line(line);
 			}
+			count_total++;
 			if (filename_ptr == NULL) {
+				/* let the worker's empty line go */
+				if (lines)
+					free(hash_nth(names, i));
 				if (flags & FLAG_WARN) {
 					bb_error_msg("invalid format");
 				}
@@ -152,10 +264,8 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 				free(line);
 				continue;
 			}
-			*filename_ptr = '\0';
-			filename_ptr += 2;
 
-			hash_value = hash_file(filename_ptr /*, hash_algo*/);
+			hash_value = lines ? hash_nth(names, i) : hash_file(filename_ptr);
 
 			if (hash_value && (strcmp((char*)hash_value, line) == 0)) {
 				if (!(flags & FLAG_SILENT))
@@ -170,6 +280,10 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 			free(hash_value);
 			free(line);
 		}
+		if (ENABLE_FEATURE_CLEAN_UP) {
+			free(names);
+			free(lines);
+		}
 		if (count_failed && !(flags & FLAG_SILENT)) {
 			bb_error_msg("WARNING: %d of %d computed checksums did NOT match",
 						 count_failed, count_total);
@@ -180,15 +294,19 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 		}
 		*/
 	} else {
-		do {
-			hash_value = hash_file(*argv/*, hash_algo*/);
+		cnt = 0;
+		while (argv[cnt])
+			cnt++;
+		start_workers(argv, cnt);
+		for (i = 0; i < cnt; i++) {
+			hash_value = hash_nth(argv, i);
 			if (hash_value == NULL) {
 				return_value = EXIT_FAILURE;
 			} else {
-				printf("%s  %s\n", hash_value, *argv);
+				printf("%s  %s\n", hash_value, argv[i]);
 				free(hash_value);
 			}
-		} while (*++argv);
+		}
 	}
 	return return_value;
 }
@@ -23,7 +23,7 @@
 */
 
 /* These are sort types */
-static const char OPT_STR[] ALIGN1 = "ngMucszbrdfimS:T:o:k:t:";
+static const char OPT_STR[] ALIGN1 = "ngMucszbrdfimS:T:o:k:t:" IF_FEATURE_SORT_EXTERNAL("\xff:");
 enum {
 	FLAG_n  = 1,            /* Numeric sort */
 	FLAG_g  = 2,            /* Sort using strtod() */
@@ -39,12 +39,13 @@ enum {
 	FLAG_d  = 0x200,        /* Ignore !(isalnum()|isspace()) */
 	FLAG_f  = 0x400,        /* Force uppercase */
 	FLAG_i  = 0x800,        /* Ignore !isprint() */
-	FLAG_m  = 0x1000,       /* ignored: merge already sorted files; do not sort */
-	FLAG_S  = 0x2000,       /* ignored: -S, --buffer-size=SIZE */
-	FLAG_T  = 0x4000,       /* ignored: -T, --temporary-directory=DIR */
+	FLAG_m  = 0x1000,       /* Merge already sorted files; do not sort */
+	FLAG_S  = 0x2000,       /* -S, --buffer-size=SIZE */
+	FLAG_T  = 0x4000,       /* -T, --temporary-directory=DIR */
 	FLAG_o  = 0x8000,
 	FLAG_k  = 0x10000,
 	FLAG_t  = 0x20000,
+	FLAG_parallel = 0x40000, /* --parallel=N */
 	FLAG_bb = 0x80000000,   /* Ignore trailing blanks  */
 };
 
@@ -56,6 +57,8 @@ static struct sort_key {
 	unsigned range[4];	/* start word, start char, end word, end char */
 	unsigned flags;
 } *key_list;
+static unsigned num_keys;
+static char **key_tmp;
 
 static char *get_key(char *str, struct sort_key *key, int flags)
 {
@@ -145,15 +148,68 @@ static struct sort_key *add_key(void)
 	struct sort_key **pkey = &key_list;
 	while (*pkey)
 		pkey = &((*pkey)->next_key);
+	num_keys++;
 	return *pkey = xzalloc(sizeof(struct sort_key));
 }
 
+/* Every line carries its keys, extracted once when the line is read,
+ * so compare_keys() doesn't have to run get_key() on each comparison:
+ *   uint32_t ofs[num_keys]; char line[]; char key1[]; ...
+ * The line is referred to by a pointer to line[]. ofs[k] is the offset
+ * of the k-th key from there, 0 if the key is the whole line.
+ */
+#define KEY_OFS(line) ((uint32_t *)(line) - num_keys)
+
+/* Extract keys of line into key_tmp[], return size of the block
+ * needed to store both */
+static size_t extract_keys(char *line)
+{
+	struct sort_key *key;
+	char **kp = key_tmp;
+	size_t size = num_keys * sizeof(uint32_t) + strlen(line) + 1;
+
+	for (key = key_list; key; key = key->next_key, kp++) {
+		*kp = get_key(line, key, key->flags ? key->flags : option_mask32);
+		if (*kp != line)
+			size += strlen(*kp) + 1;
+	}
+	return (size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+/* Copy line and the keys left by extract_keys() into block, free them */
+static char *store_line(void *block, char *line)
+{
+	uint32_t *ofs = block;
+	char *start = (char *)(ofs + num_keys);
+	char *p = stpcpy(start, line) + 1;
+	unsigned k;
+
+	for (k = 0; k < num_keys; k++) {
+		ofs[k] = 0;
+		if (key_tmp[k] != line) {
+			ofs[k] = p - start;
+			p = stpcpy(p, key_tmp[k]) + 1;
+			free(key_tmp[k]);
+		}
+	}
+	free(line);
+	return start;
+}
+
+static char *make_line(char *line)
+{
+	return store_line(xmalloc(extract_keys(line)), line);
+}
+#define free_line(line) free(KEY_OFS(line))
+
 #define GET_LINE(fp) \
 	((option_mask32 & FLAG_z) \
 	? bb_get_chunk_from_file(fp, NULL) \
 	: xmalloc_fgetline(fp))
 #else
 #define GET_LINE(fp) xmalloc_fgetline(fp)
+#define make_line(line) (line)
+#define free_line(line) free(line)
 #endif
 
 /* Iterate through keys list and perform comparisons */
@@ -164,12 +220,14 @@ static int compare_keys(const void *xarg, const void *yarg)
 
 #if ENABLE_FEATURE_SORT_BIG
 	struct sort_key *key;
+	uint32_t *xofs = KEY_OFS(*(char **)xarg);
+	uint32_t *yofs = KEY_OFS(*(char **)yarg);
 
 	for (key = key_list; !retval && key; key = key->next_key) {
 		flags = key->flags ? key->flags : option_mask32;
-		/* Chop out and modify key chunks, handling -dfib */
-		x = get_key(*(char **)xarg, key, flags);
-		y = get_key(*(char **)yarg, key, flags);
+		/* Keys were chopped out (handling -dfib) when lines were read */
+		x = *(char **)xarg + *xofs++;
+		y = *(char **)yarg + *yofs++;
 #else
 	/* This curly bracket serves no purpose but to match the nesting
 	   level of the for () loop we're not using */
@@ -241,9 +299,6 @@ static int compare_keys(const void *xarg, const void *yarg)
 			break;
 		}
 		} /* switch */
-		/* Free key copies. */
-		if (x != *(char **)xarg) free(x);
-		if (y != *(char **)yarg) free(y);
 		/* if (retval) break; - done by for () anyway */
 #else
 		/* Integer version of -n for tiny systems */
@@ -275,23 +330,310 @@ static unsigned str2u(char **str)
 }
 #endif
 
+static char **lines;
+static unsigned linecount;
+
+#if ENABLE_FEATURE_SORT_EXTERNAL
+/* Lines are collected in an arena which, together with lines[],
+ * may take at most run_size bytes. When it fills up, the lines are
+ * sorted and spilled to an unlinked temp file (a "run"), and in the end
+ * the runs are merged. With --parallel N, up to N runs are sorted and
+ * written by forked children while we go on reading input.
+ */
+#define MERGE_FANIN 16
+
+static char *arena;
+static size_t arena_size, arena_used, run_size;
+static const char *tmp_dir;
+static int *run_fd;
+static unsigned run_cnt;
+static unsigned max_procs, num_procs;
+
+static size_t parse_buffer_size(const char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(str, &end, 10);
+	if (end == str || (*end && end[1]))
+		bb_error_msg_and_die("invalid buffer size '%s'", str);
+	switch (*end) {
+	case '%': {
+		struct sysinfo info;
+
+		if (sysinfo(&info) != 0 || !info.totalram)
+			return (size_t)-1 / 2;
+		size = size * info.totalram / 100 * (info.mem_unit ? info.mem_unit : 1);
+		break;
+	}
+	case 'b':
+		break;
+	case '\0': /* default unit is KiB, as in coreutils */
+	case 'k': case 'K':
+		size <<= 10;
+		break;
+	case 'm': case 'M':
+		size <<= 20;
+		break;
+	case 'g': case 'G':
+		size <<= 30;
+		break;
+	default:
+		bb_error_msg_and_die("invalid buffer size '%s'", str);
+	}
+	if (size > (size_t)-1 / 2)
+		size = (size_t)-1 / 2;
+	return size;
+}
+
+static int make_temp_file(void)
+{
+	char *name = concat_path_file(tmp_dir, "sortXXXXXX");
+	int fd = mkstemp(name);
+
+	if (fd < 0)
+		bb_perror_msg_and_die("can't create temp file in %s", tmp_dir);
+	unlink(name);
+	free(name);
+	return fd;
+}
+
+static void write_run(int fd)
+{
+	FILE *fp = xfdopen_for_write(dup(fd));
+	int eol = (option_mask32 & FLAG_z) ? '\0' : '\n';
+	unsigned i;
+
+	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
+	for (i = 0; i < linecount; i++)
+		fprintf(fp, "%s%c", lines[i], eol);
+	if (fclose(fp))
+		bb_perror_msg_and_die("can't write temp file");
+}
+
+static void wait_run(void)
+{
+	int status;
+
+	if (safe_waitpid(-1, &status, 0) < 0 || status != 0)
+		bb_error_msg_and_die("can't sort run");
+	num_procs--;
+}
+
+static void spill_run(void)
+{
+	int fd = make_temp_file();
+
+	run_fd = xrealloc_vector(run_fd, 4, run_cnt);
+	run_fd[run_cnt++] = fd;
+	if (max_procs > 1) {
+		pid_t pid;
+
+		while (num_procs >= max_procs)
+			wait_run();
+		pid = fork();
+		if (pid < 0)
+			bb_perror_msg_and_die("fork");
+		if (pid == 0) {
+			write_run(fd);
+			_exit(EXIT_SUCCESS);
+		}
+		num_procs++;
+		/* The child has its own copy of the lines. Drop ours
+		 * without touching it, so that nothing gets COW-copied */
+		munmap(arena, arena_size);
+		arena = NULL;
+		arena_size = 0;
+	} else {
+		write_run(fd);
+	}
+	free(lines);
+	lines = NULL;
+	linecount = 0;
+	arena_used = 0;
+}
+
+static void add_line(char *line)
+{
+	size_t size = extract_keys(line);
+
+	if (linecount && arena_used + size + (linecount + 1) * sizeof(lines[0]) > run_size)
+		spill_run();
+	if (arena_used + size > arena_size) {
+		/* Arena is empty here: not mapped yet, given to a child,
+		 * or too small for this (huge) line */
+		if (arena)
+			munmap(arena, arena_size);
+		arena_size = MAX(run_size, size);
+		arena = mmap(NULL, arena_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (arena == MAP_FAILED)
+			bb_error_msg_and_die(bb_msg_memory_exhausted);
+	}
+	lines = xrealloc_vector(lines, 6, linecount);
+	lines[linecount++] = store_line(arena + arena_used, line);
+	arena_used += size;
+}
+
+struct merge_src {
+	FILE *fp;
+	char *line;
+	unsigned idx;
+};
+
+/* Equal lines come out in the order of their streams */
+static int merge_cmp(struct merge_src *a, struct merge_src *b)
+{
+	int r = compare_keys(&a->line, &b->line);
+	return r ? r : (int)(a->idx - b->idx);
+}
+
+static void sift_down(struct merge_src **heap, unsigned n, unsigned i, struct merge_src *src)
+{
+	unsigned c;
+
+	while ((c = 2*i + 1) < n) {
+		if (c + 1 < n && merge_cmp(heap[c + 1], heap[c]) < 0)
+			c++;
+		if (merge_cmp(src, heap[c]) <= 0)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = src;
+}
+
+static void merge_next(struct merge_src *src)
+{
+	char *line = GET_LINE(src->fp);
+	src->line = line ? make_line(line) : NULL;
+}
+
+/* Merge sorted streams into out, closing them */
+static void merge_files(FILE **in, unsigned cnt, FILE *out, int unique)
+{
+	struct merge_src *src = xmalloc(cnt * sizeof(src[0]));
+	struct merge_src **heap = xmalloc(cnt * sizeof(heap[0]));
+	int eol = (option_mask32 & FLAG_z) ? '\0' : '\n';
+	char *prev = NULL;
+	unsigned i, n = 0;
+
+	for (i = 0; i < cnt; i++) {
+		src[i].fp = in[i];
+		src[i].idx = i;
+		merge_next(&src[i]);
+		if (src[i].line)
+			heap[n++] = &src[i];
+		else
+			fclose_if_not_stdin(in[i]);
+	}
+	for (i = n / 2; i-- != 0;)
+		sift_down(heap, n, i, heap[i]);
+
+	while (n) {
+		struct merge_src *s = heap[0];
+
+		if (unique && prev) {
+			/* Like -u after qsort: drop lines with the same keys */
+			unsigned save = option_mask32;
+			int r;
+
+			option_mask32 |= FLAG_s;
+			r = compare_keys(&prev, &s->line);
+			option_mask32 = save;
+			if (r == 0) {
+				free_line(s->line);
+				goto next;
+			}
+		}
+		fprintf(out, "%s%c", s->line, eol);
+		if (unique) {
+			if (prev)
+				free_line(prev);
+			prev = s->line;
+		} else
+			free_line(s->line);
+ next:
+		merge_next(s);
+		if (!s->line) {
+			fclose_if_not_stdin(s->fp);
+			if (!--n)
+				break;
+			s = heap[n];
+		}
+		sift_down(heap, n, 0, s);
+	}
+	if (prev)
+		free_line(prev);
+	free(heap);
+	free(src);
+}
+
+static void merge_runs(int unique)
+{
+	FILE *in[MERGE_FANIN];
+	unsigned i;
+
+	while (num_procs)
+		wait_run();
+	/* Too many runs to have them all open: merge the first ones into
+	 * one which takes their place, so runs stay in input order */
+	while (run_cnt > MERGE_FANIN) {
+		int fd = make_temp_file();
+		FILE *out;
+
+		for (i = 0; i < MERGE_FANIN; i++) {
+			xlseek(run_fd[i], 0, SEEK_SET);
+			in[i] = xfdopen_for_read(run_fd[i]);
+		}
+		out = xfdopen_for_write(dup(fd));
+		merge_files(in, MERGE_FANIN, out, 0);
+		if (fclose(out))
+			bb_perror_msg_and_die("can't write temp file");
+		run_fd[0] = fd;
+		run_cnt -= MERGE_FANIN - 1;
+		memmove(&run_fd[1], &run_fd[MERGE_FANIN], (run_cnt - 1) * sizeof(run_fd[0]));
+	}
+	for (i = 0; i < run_cnt; i++) {
+		xlseek(run_fd[i], 0, SEEK_SET);
+		in[i] = xfdopen_for_read(run_fd[i]);
+	}
+	merge_files(in, run_cnt, stdout, unique);
+}
+#else
+static void add_line(char *line)
+{
+	lines = xrealloc_vector(lines, 6, linecount);
+	lines[linecount++] = make_line(line);
+}
+#endif
+
 int sort_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int sort_main(int argc UNUSED_PARAM, char **argv)
 {
-	char *line, **lines;
-	char *str_ignored, *str_o, *str_t;
+	char *line;
+	char *str_S, *str_T, *str_o, *str_t;
+	IF_FEATURE_SORT_EXTERNAL(char *str_parallel;)
 	llist_t *lst_k = NULL;
-	int i, flag;
-	int linecount;
+	unsigned i;
+	int flag;
 	unsigned opts;
 
 	xfunc_error_retval = 2;
 
 	/* Parse command line options */
+#if ENABLE_FEATURE_SORT_EXTERNAL && ENABLE_LONG_OPTS
+	applet_long_options =
+		"buffer-size\0"         Required_argument "S"
+		"temporary-directory\0" Required_argument "T"
+		"parallel\0"            Required_argument "\xff"
+		;
+#endif
 	/* -o and -t can be given at most once */
 	opt_complementary = "o--o:t--t:" /* -t, -o: at most one of each */
 			"k::"; /* -k takes list */
-	opts = getopt32(argv, OPT_STR, &str_ignored, &str_ignored, &str_o, &lst_k, &str_t);
+	opts = getopt32(argv, OPT_STR, &str_S, &str_T, &str_o, &lst_k, &str_t
+			IF_FEATURE_SORT_EXTERNAL(, &str_parallel));
 	/* global b strips leading and trailing spaces */
 	if (opts & FLAG_b)
 		option_mask32 |= FLAG_bb;
@@ -352,14 +694,69 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 	}
+
+	/* if no key, perform alphabetic sort */
+	if (!key_list)
+		add_key()->range[0] = 1;
+	key_tmp = xmalloc(num_keys * sizeof(key_tmp[0]));
+#endif
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	tmp_dir = (opts & FLAG_T) ? str_T : getenv("TMPDIR");
+	if (!tmp_dir || !tmp_dir[0])
+		tmp_dir = "/tmp";
+	/* Like coreutils, take at most a quarter of RAM by default */
+	run_size = parse_buffer_size((opts & FLAG_S) ? str_S : "25%");
+	max_procs = (opts & FLAG_parallel) ? xatou_range(str_parallel, 1, 64) : 1;
+	run_size /= max_procs;
+	if (run_size < 1024)
+		run_size = 1024;
 #endif
 
 	/* Open input files and read data */
 	argv += optind;
 	if (!*argv)
 		*--argv = (char*)"-";
-	linecount = 0;
-	lines = NULL;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	/* -m: merge the files as they are. With -o, the output file
+	 * may be one of the inputs, so it is read in full first */
+	if ((option_mask32 & (FLAG_m | FLAG_c | FLAG_o)) == FLAG_m) {
+		FILE **in;
+
+		for (i = 0; argv[i]; i++)
+			continue;
+		in = xmalloc(i * sizeof(in[0]));
+		for (i = 0; argv[i]; i++)
+			in[i] = xfopen_stdin(argv[i]);
+		merge_files(in, i, stdout, option_mask32 & FLAG_u);
+		fflush_stdout_and_exit(EXIT_SUCCESS);
+	}
+#endif
+#if ENABLE_FEATURE_SORT_BIG
+	/* handle -c: only two lines need to be kept */
+	if (option_mask32 & FLAG_c) {
+		int j = (option_mask32 & FLAG_u) ? -1 : 0;
+		char *prev = NULL;
+
+		i = 0;
+		do {
+			FILE *fp = xfopen_stdin(*argv);
+			while ((line = GET_LINE(fp)) != NULL) {
+				line = make_line(line);
+				if (prev) {
+					if (compare_keys(&prev, &line) > j) {
+						fprintf(stderr, "Check line %u\n", i);
+						return EXIT_FAILURE;
+					}
+					free_line(prev);
+				}
+				prev = line;
+				i++;
+			}
+			fclose_if_not_stdin(fp);
+		} while (*++argv);
+		return EXIT_SUCCESS;
+	}
+#endif
 	do {
 		/* coreutils 6.9 compat: abort on first open error,
 		 * do not continue to next file: */
@@ -368,26 +765,19 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			line = GET_LINE(fp);
 			if (!line)
 				break;
-			lines = xrealloc_vector(lines, 6, linecount);
-			lines[linecount++] = line;
+			add_line(line);
 		}
 		fclose_if_not_stdin(fp);
 	} while (*++argv);
 
-#if ENABLE_FEATURE_SORT_BIG
-	/* if no key, perform alphabetic sort */
-	if (!key_list)
-		add_key()->range[0] = 1;
-	/* handle -c */
-	if (option_mask32 & FLAG_c) {
-		int j = (option_mask32 & FLAG_u) ? -1 : 0;
-		for (i = 1; i < linecount; i++) {
-			if (compare_keys(&lines[i-1], &lines[i]) > j) {
-				fprintf(stderr, "Check line %u\n", i);
-				return EXIT_FAILURE;
-			}
-		}
-		return EXIT_SUCCESS;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	if (run_cnt) {
+		if (linecount)
+			spill_run();
+		if (option_mask32 & FLAG_o)
+			xmove_fd(xopen3(str_o, O_WRONLY, 0666), STDOUT_FILENO);
+		merge_runs(option_mask32 & FLAG_u);
+		fflush_stdout_and_exit(EXIT_SUCCESS);
 	}
 #endif
 	/* Perform the actual sort */
@@ -399,15 +789,15 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 		/* -- disabling last-resort compare... */
 		option_mask32 |= FLAG_s;
 		for (i = 1; i < linecount; i++) {
-			if (compare_keys(&lines[flag], &lines[i]) == 0)
-				free(lines[i]);
-			else
+			if (compare_keys(&lines[flag], &lines[i]) == 0) {
+				/* arena lines are not freed one by one */
+				IF_NOT_FEATURE_SORT_EXTERNAL(free_line(lines[i]);)
+			} else
 				lines[++flag] = lines[i];
 		}
 		if (linecount)
 			linecount = flag+1;
 	}
-
 	/* Print it */
 #if ENABLE_FEATURE_SORT_BIG
 	/* Open output file _after_ we read all input ones */
@@ -24,7 +24,7 @@
 #define	VF_CACHED       0x0100	/* 1 = num/str value has cached str/num eq */
 #define	VF_USER         0x0200	/* 1 = user input (may be numeric string) */
 #define	VF_SPECIAL      0x0400	/* 1 = requires extra handling when changed */
-#define	VF_WALK         0x0800	/* 1 = variable has alloc'd x.walker list */
+#define	VF_WALK         0x0800	/* 1 = variable has alloc'd x.walker */
 #define	VF_FSTR         0x1000	/* 1 = var::string points to fstring buffer */
 #define	VF_CHILD        0x2000	/* 1 = function arg; x.parent points to source */
 #define	VF_DIRTY        0x4000	/* 1 = variable was set explicitly */
@@ -41,7 +41,7 @@ typedef struct var_s {
 		int aidx;               /* func arg idx (for compilation stage) */
 		struct xhash_s *array;  /* array ptr */
 		struct var_s *parent;   /* for func args, ptr to actual parameter */
-		char **walker;          /* list of array elements (for..in) */
+		struct hash_walker_s *walker; /* position in array (for..in) */
 	} x;
 } var;
 
@@ -74,16 +74,48 @@ typedef struct hash_item_s {
 		struct rstream_s rs;    /* redirect streams hash */
 		struct func_s f;        /* functions hash */
 	} data;
-	struct hash_item_s *next;       /* next in chain */
+	struct hash_item_s *next;       /* next in insertion order */
+	struct hash_item_s *prev;
+	unsigned ord;                   /* insertion number */
 	char name[1];                   /* really it's longer */
 } hash_item;
 
+typedef struct hash_slot_s {
+	unsigned hval;
+	struct hash_item_s *hi;         /* NULL if free */
+} hash_slot;
+
+/* for..in goes along the insertion order list */
+typedef struct hash_walker_s {
+	struct xhash_s *array;          /* NULL if it was freed */
+	struct hash_item_s *cur;        /* next item to visit */
+	unsigned end;                   /* items from this ord on came later */
+	struct hash_walker_s *next;     /* others walking the same array */
+} hash_walker;
+
+/* Items are carved from chunks and kept on free lists by size
+ * when deleted: no malloc per element */
+#define HASH_ITEM_ALIGN   16
+#define HASH_ITEM_CLASSES 16
+#define HASH_FIRST_CHUNK  1024
+#define HASH_MAX_CHUNK    (64 * 1024)
+
+/* Open addressing with linear probing. When it has to grow, slots of
+ * the old table move over to the new one a few per insertion */
 typedef struct xhash_s {
 	unsigned nel;           /* num of elements */
-	unsigned csize;         /* current hash size */
-	unsigned nprime;        /* next hash size in PRIMES[] */
-	unsigned glen;          /* summary length of item names */
-	struct hash_item_s **items;
+	unsigned mask;          /* number of slots - 1 */
+	struct hash_slot_s *slots;
+	struct hash_slot_s *old;        /* being emptied, or NULL */
+	unsigned old_mask;
+	unsigned old_pos;               /* slots before it have moved */
+	struct hash_item_s *first, *last;
+	unsigned next_ord;              /* for the next item */
+	struct hash_walker_s *walkers;
+	char *chunk;                    /* newest, linked by first word */
+	char *chunk_pos, *chunk_end;
+	unsigned chunk_size;
+	struct hash_item_s *free_items[HASH_ITEM_CLASSES];
 } xhash;
 
 /* Tree node */
@@ -122,6 +154,17 @@ typedef struct tsplitter_s {
 	regex_t re[2];
 } tsplitter;
 
+#if ENABLE_FEATURE_AWK_REGEX_CACHE
+/* Compiled dynamic regex */
+typedef struct re_cache_s {
+	struct re_cache_s *next; /* less recently used */
+	unsigned hash;
+	int cflags;
+	regex_t re;
+	char pat[1];
+} re_cache;
+#endif
+
 /* simple token classes */
 /* Order and hex values are very important!!!  See next_token() */
 #define	TC_SEQSTART	 1				/* ( */
@@ -383,9 +426,12 @@ static const char vValues[] ALIGN1 =
 	"\n\0"      "\n\0"      "\0"        "\0"
 	"\034\0"    "\0"        "\377";
 
-/* hash size may grow to these values */
-#define FIRST_PRIME 61
-static const uint16_t PRIMES[] ALIGN2 = { 251, 1021, 4093, 16381, 65521 };
+/* initial number of hash slots, must be a power of 2 */
+#define HASH_FIRST_SIZE 16
+/* slots moved to the new table per insertion while growing */
+#define HASH_MOVE_STEP  4
+/* marks emptied slots of the old table, its probe chains must stay intact */
+#define HASH_MOVED      ((hash_item *)1)
 
 
 /* Globals. Split in two parts so that first one is addressed
@@ -442,6 +488,15 @@ struct globals2 {
 
 	tsplitter exec_builtin__tspl;
 
+#if ENABLE_FEATURE_AWK_REGEX_CACHE
+	re_cache *re_cache_head;
+	unsigned re_cache_len;
+	unsigned re_cache_max;
+	unsigned re_cache_hits;
+	unsigned re_cache_misses;
+	unsigned re_cache_evictions;
+#endif
+
 	/* biggest and least used members go last */
 	tsplitter fsplitter, rsplitter;
 };
@@ -489,6 +544,7 @@ struct globals2 {
 	SET_PTR_TO_GLOBALS((char*)xzalloc(sizeof(G1)+sizeof(G)) + sizeof(G1)); \
 	G.next_token__ltclass = TC_OPTERM; \
 	G.evaluate__seed = 1; \
+	IF_FEATURE_AWK_REGEX_CACHE(G.re_cache_max = 64;) \
 } while (0)
 
 
@@ -538,81 +594,184 @@ static unsigned hashidx(const char *name)
 	return idx;
 }
 
+static unsigned hash_mix(const char *name)
+{
+	unsigned h = hashidx(name);
+
+	/* slots are picked by the low bits, which hashidx() spreads badly */
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h;
+}
+
 /* create new hash */
 static xhash *hash_init(void)
 {
 	xhash *newhash;
 
 	newhash = xzalloc(sizeof(*newhash));
-	newhash->csize = FIRST_PRIME;
-	newhash->items = xzalloc(FIRST_PRIME * sizeof(newhash->items[0]));
+	newhash->mask = HASH_FIRST_SIZE - 1;
+	newhash->slots = xzalloc(HASH_FIRST_SIZE * sizeof(newhash->slots[0]));
 
 	return newhash;
 }
 
-/* find item in hash, return ptr to data, NULL if not found */
-static void *hash_search(xhash *hash, const char *name)
+static unsigned hash_item_size(const char *name)
 {
+	return (sizeof(hash_item) + strlen(name) + HASH_ITEM_ALIGN - 1) & ~(HASH_ITEM_ALIGN - 1);
+}
+
+static hash_item *hash_item_alloc(xhash *hash, const char *name)
+{
+	unsigned size = hash_item_size(name);
+	unsigned cl = size / HASH_ITEM_ALIGN - 1;
 	hash_item *hi;
 
-	hi = hash->items[hashidx(name) % hash->csize];
-	while (hi) {
-		if (strcmp(hi->name, name) == 0)
-			return &(hi->data);
-		hi = hi->next;
+	if (cl >= HASH_ITEM_CLASSES)
+		return xzalloc(size);
+	hi = hash->free_items[cl];
+	if (hi) {
+		hash->free_items[cl] = hi->next;
+	} else {
+		if (hash->chunk_end - hash->chunk_pos < (int)size) {
+			char *c;
+
+			if (hash->chunk_size < HASH_MAX_CHUNK)
+				hash->chunk_size = hash->chunk_size ? hash->chunk_size * 2 : HASH_FIRST_CHUNK;
+			c = xmalloc(hash->chunk_size);
+			*(char **)c = hash->chunk;
+			hash->chunk = c;
+			hash->chunk_pos = c + HASH_ITEM_ALIGN;
+			hash->chunk_end = c + hash->chunk_size;
+		}
+		hi = (hash_item *)hash->chunk_pos;
+		hash->chunk_pos += size;
 	}
-	return NULL;
+	memset(hi, 0, size);
+	return hi;
 }
 
-/* grow hash if it becomes too big */
-static void hash_rebuild(xhash *hash)
+static void hash_item_free(xhash *hash, hash_item *hi)
 {
-	unsigned newsize, i, idx;
-	hash_item **newitems, *hi, *thi;
+	unsigned cl = hash_item_size(hi->name) / HASH_ITEM_ALIGN - 1;
 
-	if (hash->nprime == ARRAY_SIZE(PRIMES))
+	if (cl >= HASH_ITEM_CLASSES) {
+		free(hi);
 		return;
+	}
+	hi->next = hash->free_items[cl];
+	hash->free_items[cl] = hi;
+}
 
-	newsize = PRIMES[hash->nprime++];
-	newitems = xzalloc(newsize * sizeof(newitems[0]));
-
-	for (i = 0; i < hash->csize; i++) {
-		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = thi->next;
-			idx = hashidx(thi->name) % newsize;
-			thi->next = newitems[idx];
-			newitems[idx] = thi;
+/* find slot of name in table, NULL if not there */
+static hash_slot *hash_probe(hash_slot *slots, unsigned mask, unsigned h, const char *name)
+{
+	unsigned i = h & mask;
+
+	while (slots[i].hi) {
+		if (slots[i].hval == h && slots[i].hi != HASH_MOVED
+		 && strcmp(slots[i].hi->name, name) == 0
+		) {
+			return &slots[i];
 		}
+		i = (i + 1) & mask;
 	}
-
-	free(hash->items);
-	hash->csize = newsize;
-	hash->items = newitems;
+	return NULL;
 }
 
-/* find item in hash, add it if necessary. Return ptr to data */
-static void *hash_find(xhash *hash, const char *name)
+static void hash_put(xhash *hash, unsigned h, hash_item *hi)
 {
-	hash_item *hi;
-	unsigned idx;
-	int l;
+	unsigned i = h & hash->mask;
 
-	hi = hash_search(hash, name);
-	if (!hi) {
-		if (++hash->nel / hash->csize > 10)
-			hash_rebuild(hash);
+	while (hash->slots[i].hi)
+		i = (i + 1) & hash->mask;
+	hash->slots[i].hval = h;
+	hash->slots[i].hi = hi;
+}
 
-		l = strlen(name) + 1;
-		hi = xzalloc(sizeof(*hi) + l);
-		strcpy(hi->name, name);
+/* move a few more slots of the old table */
+static void hash_move(xhash *hash, unsigned n)
+{
+	hash_slot *sl;
 
-		idx = hashidx(name) % hash->csize;
-		hi->next = hash->items[idx];
-		hash->items[idx] = hi;
-		hash->glen += l;
+	while (n--) {
+		if (hash->old_pos > hash->old_mask) {
+			free(hash->old);
+			hash->old = NULL;
+			return;
+		}
+		sl = &hash->old[hash->old_pos++];
+		if (sl->hi && sl->hi != HASH_MOVED) {
+			hash_put(hash, sl->hval, sl->hi);
+			sl->hi = HASH_MOVED;
+		}
 	}
+}
+
+/* grow hash if it becomes too big */
+static void hash_rebuild(xhash *hash)
+{
+	unsigned size = (hash->mask + 1) * 2;
+
+	/* It is done long before the table fills up again */
+	if (hash->old)
+		hash_move(hash, hash->old_mask + 2);
+
+	hash->old = hash->slots;
+	hash->old_mask = hash->mask;
+	hash->old_pos = 0;
+	hash->slots = xzalloc(size * sizeof(hash->slots[0]));
+	hash->mask = size - 1;
+}
+
+static hash_slot *hash_lookup(xhash *hash, unsigned h, const char *name)
+{
+	hash_slot *sl;
+
+	sl = hash_probe(hash->slots, hash->mask, h, name);
+	if (!sl && hash->old)
+		sl = hash_probe(hash->old, hash->old_mask, h, name);
+	return sl;
+}
+
+/* find item in hash, return ptr to data, NULL if not found */
+static void *hash_search(xhash *hash, const char *name)
+{
+	hash_slot *sl;
+
+	sl = hash_lookup(hash, hash_mix(name), name);
+	return sl ? &(sl->hi->data) : NULL;
+}
+
+/* find item in hash, add it if necessary. Return ptr to data */
+static void *hash_find(xhash *hash, const char *name)
+{
+	hash_slot *sl;
+	hash_item *hi;
+	unsigned h;
+
+	h = hash_mix(name);
+	sl = hash_lookup(hash, h, name);
+	if (sl)
+		return &(sl->hi->data);
+
+	if (hash->old)
+		hash_move(hash, HASH_MOVE_STEP);
+	if (++hash->nel * 4 > (hash->mask + 1) * 3)
+		hash_rebuild(hash);
+
+	hi = hash_item_alloc(hash, name);
+	strcpy(hi->name, name);
+	hi->ord = hash->next_ord++;
+	hash_put(hash, h, hi);
+
+	hi->prev = hash->last;
+	if (hash->last)
+		hash->last->next = hi;
+	else
+		hash->first = hi;
+	hash->last = hi;
 	return &(hi->data);
 }
 
@@ -621,22 +780,56 @@ static void *hash_find(xhash *hash, const char *name)
 #define newfile(name)       ((rstream*)hash_find(fdhash, (name)))
 #define newfunc(name)       ((func*)   hash_find(fnhash, (name)))
 
-static void hash_remove(xhash *hash, const char *name)
+/* empty the slot, moving up the items whose probe chain went through it */
+static void hash_unslot(xhash *hash, hash_slot *sl)
 {
-	hash_item *hi, **phi;
+	unsigned i, j, k;
 
-	phi = &(hash->items[hashidx(name) % hash->csize]);
-	while (*phi) {
-		hi = *phi;
-		if (strcmp(hi->name, name) == 0) {
-			hash->glen -= (strlen(name) + 1);
-			hash->nel--;
-			*phi = hi->next;
-			free(hi);
+	if (hash->old && sl >= hash->old && sl <= hash->old + hash->old_mask) {
+		sl->hi = HASH_MOVED;
+		return;
+	}
+	i = j = sl - hash->slots;
+	for (;;) {
+		j = (j + 1) & hash->mask;
+		if (!hash->slots[j].hi)
 			break;
-		}
-		phi = &(hi->next);
+		k = hash->slots[j].hval & hash->mask;
+		/* k cyclically in (i, j]: it is still reachable */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		hash->slots[i] = hash->slots[j];
+		i = j;
 	}
+	hash->slots[i].hi = NULL;
+}
+
+static void hash_remove(xhash *hash, const char *name)
+{
+	hash_slot *sl;
+	hash_item *hi;
+	hash_walker *w;
+
+	sl = hash_lookup(hash, hash_mix(name), name);
+	if (!sl)
+		return;
+	hi = sl->hi;
+	hash_unslot(hash, sl);
+	hash->nel--;
+
+	/* for (k in a) delete a[k] */
+	for (w = hash->walkers; w; w = w->next)
+		if (w->cur == hi)
+			w->cur = hi->next;
+	if (hi->prev)
+		hi->prev->next = hi->next;
+	else
+		hash->first = hi->next;
+	if (hi->next)
+		hi->next->prev = hi->prev;
+	else
+		hash->last = hi->prev;
+	hash_item_free(hash, hi);
 }
 
 /* ------ some useful functions ------ */
@@ -713,20 +906,55 @@ static xhash *iamarray(var *v)
 
 static void clear_array(xhash *array)
 {
-	unsigned i;
 	hash_item *hi, *thi;
+	hash_walker *w;
+	char *c;
 
-	for (i = 0; i < array->csize; i++) {
-		hi = array->items[i];
-		while (hi) {
-			thi = hi;
-			hi = hi->next;
-			free(thi->data.v.string);
-			free(thi);
-		}
-		array->items[i] = NULL;
+	hi = array->first;
+	while (hi) {
+		thi = hi;
+		hi = hi->next;
+		free(thi->data.v.string);
+		hash_item_free(array, thi);
+	}
+	while ((c = array->chunk) != NULL) {
+		array->chunk = *(char **)c;
+		free(c);
+	}
+	array->chunk_pos = array->chunk_end = NULL;
+	memset(array->free_items, 0, sizeof(array->free_items));
+	free(array->old);
+	array->old = NULL;
+	memset(array->slots, 0, (array->mask + 1) * sizeof(array->slots[0]));
+	array->first = array->last = NULL;
+	array->nel = 0;
+	for (w = array->walkers; w; w = w->next)
+		w->cur = NULL;
+}
+
+static void hash_free(xhash *array)
+{
+	hash_walker *w;
+
+	clear_array(array);
+	for (w = array->walkers; w; w = w->next)
+		w->array = NULL;
+	free(array->slots);
+	free(array);
+}
+
+static void hashwalk_end(var *v)
+{
+	hash_walker *w, **pw;
+
+	w = v->x.walker;
+	if (w->array) {
+		pw = &w->array->walkers;
+		while (*pw != w)
+			pw = &(*pw)->next;
+		*pw = w->next;
+		w->array = NULL;
 	}
-	array->glen = array->nel = 0;
 }
 
 /* clear a variable */
@@ -907,13 +1135,12 @@ static void nvfree(var *v)
 		syntax_error(EMSG_INTERNAL_ERROR);
 
 	for (p = v; p < g_cb->pos; p++) {
-		if ((p->type & (VF_ARRAY | VF_CHILD)) == VF_ARRAY) {
-			clear_array(iamarray(p));
-			free(p->x.array->items);
-			free(p->x.array);
-		}
-		if (p->type & VF_WALK)
+		if ((p->type & (VF_ARRAY | VF_CHILD)) == VF_ARRAY)
+			hash_free(iamarray(p));
+		if (p->type & VF_WALK) {
+			hashwalk_end(p);
 			free(p->x.walker);
+		}
 
 		clrvar(p);
 	}
@@ -1467,7 +1694,8 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 	re = &spl->re[0];
 	ire = &spl->re[1];
 	n = &spl->n;
-	if ((n->info & OPCLSMASK) == OC_REGEXP) {
+	/* (not if it was pointed to cached ones) */
+	if ((n->info & OPCLSMASK) == OC_REGEXP && n->l.re == re) {
 		regfree(re);
 		regfree(ire); // TODO: nuke ire, use re+1?
 	}
@@ -1480,32 +1708,101 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 	return n;
 }
 
+static regex_t *re_compile(const char *s, int cflags, regex_t *preg)
+{
+	/* Testcase where REG_EXTENDED fails (unpaired '{'):
+	 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
+	 * gawk 3.1.5 eats this. We revert to ~REG_EXTENDED
+	 * (maybe gsub is not supposed to use REG_EXTENDED?).
+	 */
+	if (regcomp(preg, s, cflags)) {
+		cflags &= ~REG_EXTENDED;
+		xregcomp(preg, s, cflags);
+	}
+	return preg;
+}
+
+#if ENABLE_FEATURE_AWK_REGEX_CACHE
+/* Dynamic regexes tend to be the same few strings for every record.
+ * Keep up to re_cache_max of them compiled, most recently used first.
+ * Returns preg (to be regfree'd by the caller) only if caching is off.
+ */
+static regex_t *re_cache_get(const char *s, int cflags, regex_t *preg)
+{
+	re_cache **pp, **tail, *c;
+	unsigned h;
+
+	if (!G.re_cache_max)
+		return re_compile(s, cflags, preg);
+
+	h = hashidx(s);
+	tail = NULL;
+	for (pp = &G.re_cache_head; (c = *pp) != NULL; pp = &c->next) {
+		if (c->hash == h && c->cflags == cflags && strcmp(c->pat, s) == 0) {
+			G.re_cache_hits++;
+			*pp = c->next;
+			goto front;
+		}
+		tail = pp;
+	}
+	G.re_cache_misses++;
+	if (G.re_cache_len >= G.re_cache_max) {
+		c = *tail;
+		*tail = NULL;
+		regfree(&c->re);
+		free(c);
+		G.re_cache_evictions++;
+		G.re_cache_len--;
+	}
+	c = xmalloc(sizeof(*c) + strlen(s));
+	strcpy(c->pat, s);
+	c->hash = h;
+	c->cflags = cflags;
+	re_compile(s, cflags, &c->re);
+	G.re_cache_len++;
+ front:
+	c->next = G.re_cache_head;
+	G.re_cache_head = c;
+	return &c->re;
+}
+
+/* split() with a separator which is not a regex literal */
+static node *mk_dyn_splitter(const char *s, tsplitter *spl)
+{
+	node *n;
+
+	if (!G.re_cache_max || strlen(s) <= 1)
+		return mk_splitter(s, spl);
+	n = &spl->n;
+	if ((n->info & OPCLSMASK) == OC_REGEXP && n->l.re == &spl->re[0]) {
+		regfree(&spl->re[0]);
+		regfree(&spl->re[1]);
+	}
+	/* icase can't change before awk_split() picks one */
+	n->info = OC_REGEXP;
+	n->l.re = n->r.ire = re_cache_get(s,
+			icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED, NULL);
+	return n;
+}
+#else
+#define re_cache_get(s, cflags, preg) re_compile(s, cflags, preg)
+#define mk_dyn_splitter(s, spl) mk_splitter(s, spl)
+#endif
+
 /* use node as a regular expression. Supplied with node ptr and regex_t
  * storage space. Return ptr to regex (if result points to preg, it should
  * be later regfree'd manually
  */
 static regex_t *as_regex(node *op, regex_t *preg)
 {
-	int cflags;
 	var *v;
-	const char *s;
 
 	if ((op->info & OPCLSMASK) == OC_REGEXP) {
 		return icase ? op->r.ire : op->l.re;
 	}
 	v = nvalloc(1);
-	s = getvar_s(evaluate(op, v));
-
-	cflags = icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED;
-	/* Testcase where REG_EXTENDED fails (unpaired '{'):
-	 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
-	 * gawk 3.1.5 eats this. We revert to ~REG_EXTENDED
-	 * (maybe gsub is not supposed to use REG_EXTENDED?).
-	 */
-	if (regcomp(preg, s, cflags)) {
-		cflags &= ~REG_EXTENDED;
-		xregcomp(preg, s, cflags);
-	}
+	preg = re_cache_get(getvar_s(evaluate(op, v)),
+			icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED, preg);
 	nvfree(v);
 	return preg;
 }
@@ -1721,35 +2018,37 @@ static node *nextarg(node **pn)
 
 static void hashwalk_init(var *v, xhash *array)
 {
-	char **w;
-	hash_item *hi;
-	unsigned i;
-
-	if (v->type & VF_WALK)
-		free(v->x.walker);
-
-	v->type |= VF_WALK;
-	w = v->x.walker = xzalloc(2 + 2*sizeof(char *) + array->glen);
-	w[0] = w[1] = (char *)(w + 2);
-	for (i = 0; i < array->csize; i++) {
-		hi = array->items[i];
-		while (hi) {
-			strcpy(*w, hi->name);
-			nextword(w);
-			hi = hi->next;
-		}
+	hash_walker *w;
+
+	if (v->type & VF_WALK) {
+		hashwalk_end(v);
+	} else {
+		v->type |= VF_WALK;
+		v->x.walker = xmalloc(sizeof(*w));
 	}
+	w = v->x.walker;
+	w->array = array;
+	w->cur = array->first;
+	w->end = array->next_ord;
+	w->next = array->walkers;
+	array->walkers = w;
 }
 
 static int hashwalk_next(var *v)
 {
-	char **w;
+	hash_walker *w;
+	hash_item *hi;
 
 	w = v->x.walker;
-	if (w[1] == w[0])
+	hi = w->cur;
+	/* Not the ones added by the loop body */
+	if (!hi || (int)(hi->ord - w->end) >= 0) {
+		hashwalk_end(v);
 		return FALSE;
-
-	setvar_s(v, nextword(w+1));
+	}
+	/* before setvar_s: the loop body may delete it */
+	w->cur = hi->next;
+	setvar_s(v, hi->name);
 	return TRUE;
 }
 
@@ -1861,7 +2160,8 @@ static int fmt_num(char *b, int size, const char *format, double n, int int_as_i
 	const char *s = format;
 
 	if (int_as_int && n == (int)n) {
-		r = snprintf(b, size, "%d", (int)n);
+		/* the usual case, snprintf is slow at it */
+		r = stpcpy(b, itoa((int)n)) - b;
 	} else {
 		do { c = *s; } while (c && *++s);
 		if (strchr("diouxX", c)) {
@@ -2083,7 +2383,7 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 	case B_sp:
 		if (nargs > 2) {
 			spl = (an[2]->info & OPCLSMASK) == OC_REGEXP ?
-				an[2] : mk_splitter(getvar_s(evaluate(an[2], &tv[2])), &tspl);
+				an[2] : mk_dyn_splitter(getvar_s(evaluate(an[2], &tv[2])), &tspl);
 		} else {
 			spl = &fsplitter.n;
 		}
@@ -2256,6 +2556,17 @@ static var *evaluate(node *op, var *res)
 	if (!op)
 		return setvar_s(res, NULL);
 
+	/* Most operands are scalar variables and constants:
+	 * they need neither temporaries nor the loop below */
+	if (!op->r.n) {
+		g_lineno = op->lineno;
+		opinfo = op->info & OPCLSMASK;
+		if (opinfo == OC_VAR && op->l.v != intvar[NF])
+			return op->l.v;
+		if (opinfo == OC_FNARG)
+			return &fnargs[op->l.i];
+	}
+
 	v1 = nvalloc(2);
 
 	while (op) {
@@ -2746,7 +3057,6 @@ static var *evaluate(node *op, var *res)
 static int awk_exit(int r)
 {
 	var tv;
-	unsigned i;
 	hash_item *hi;
 
 	zero_out_var(&tv);
@@ -2758,15 +3068,16 @@ static int awk_exit(int r)
 	}
 
 	/* waiting for children */
-	for (i = 0; i < fdhash->csize; i++) {
-		hi = fdhash->items[i];
-		while (hi) {
-			if (hi->data.rs.F && hi->data.rs.is_pipe)
-				pclose(hi->data.rs.F);
-			hi = hi->next;
-		}
+	for (hi = fdhash->first; hi; hi = hi->next) {
+		if (hi->data.rs.F && hi->data.rs.is_pipe)
+			pclose(hi->data.rs.F);
 	}
 
+#if ENABLE_FEATURE_AWK_REGEX_CACHE
+	if (getenv("AWK_REGEX_STATS"))
+		bb_error_msg("regex cache: %u hits, %u misses, %u evictions",
+				G.re_cache_hits, G.re_cache_misses, G.re_cache_evictions);
+#endif
 	exit(r);
 }
 
@@ -2852,6 +3163,14 @@ int awk_main(int argc, char **argv)
 
 	zero_out_var(&tv);
 
+#if ENABLE_FEATURE_AWK_REGEX_CACHE
+	{
+		const char *e = getenv("AWK_REGEX_CACHE");
+		if (e)
+			G.re_cache_max = xatou_range(e, 0, 0xffff);
+	}
+#endif
+
 	/* allocate global buffer */
 	g_buf = xmalloc(MAXVARFMT + 1);
 
@@ -74,6 +74,12 @@
  * are (in words) 2*length(file0) + length(file1) +
  * 3*(number of k-candidates installed), typically about
  * 6n words for files of length n.
+ *
+ * For big files (or with -H) J is found with the algorithm of
+ * Eugene W. Myers, "An O(ND) Difference Algorithm and Its Variations",
+ * in its linear space form: the "middle snake" of the shortest edit
+ * script splits the problem in two, recursively. It works on the line
+ * hashes and needs only two vectors of diagonals on top of them.
  */
 
 #include "libbb.h"
@@ -109,6 +115,7 @@ enum {                  /* Commandline flags */
 	FLAG_p,         /* not implemented */
 	FLAG_B,
 	FLAG_E,         /* not implemented */
+	IF_FEATURE_DIFF_MYERS(FLAG_H,)
 };
 #define FLAG(x) (1 << FLAG_##x)
 
@@ -118,8 +125,12 @@ typedef struct FILE_and_pos_t {
 	off_t ft_pos;
 } FILE_and_pos_t;
 
+/* -H is implied when both files together are bigger than that */
+#define MYERS_THRESHOLD (1024 * 1024)
+
 struct globals {
 	smallint exit_status;
+	IF_FEATURE_DIFF_MYERS(smallint use_myers;)
 	int opt_U_context;
 	char *label[2];
 	struct stat stb[2];
@@ -361,6 +372,177 @@ static void unsort(const struct line *f, int l, int *b)
 	free(a);
 }
 
+#if ENABLE_FEATURE_DIFF_MYERS
+struct myers {
+	const struct line *a, *b;
+	int *fd, *bd;   /* furthest x reached on each diagonal x - y */
+	int *J;
+	int too_expensive;
+};
+
+/* Find the midpoint of the shortest edit script between
+ * a[xoff..xlim) and b[yoff..ylim), or a good enough point if that
+ * costs too much. The ends must not match (myers_seq() took care).
+ * Adapted from diffseq.h of GNU diffutils. */
+static void myers_split(struct myers *m, int xoff, int xlim, int yoff, int ylim,
+		int *xmid, int *ymid)
+{
+	const struct line *a = m->a, *b = m->b;
+	int *fd = m->fd, *bd = m->bd;
+	const int dmin = xoff - ylim;
+	const int dmax = xlim - yoff;
+	const int fmid = xoff - yoff;
+	const int bmid = xlim - ylim;
+	int fmin = fmid, fmax = fmid;
+	int bmin = bmid, bmax = bmid;
+	const bool odd = (fmid - bmid) & 1;
+	int c, d, x, y;
+
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+	for (c = 1;; c++) {
+		/* One more edit forward */
+		if (fmin > dmin)
+			fd[--fmin - 1] = -1;
+		else
+			fmin++;
+		if (fmax < dmax)
+			fd[++fmax + 1] = -1;
+		else
+			fmax--;
+		for (d = fmax; d >= fmin; d -= 2) {
+			int tlo = fd[d - 1], thi = fd[d + 1];
+
+			x = tlo >= thi ? tlo + 1 : thi;
+			y = x - d;
+			while (x < xlim && y < ylim && a[x].value == b[y].value)
+				x++, y++;
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x)
+				goto found;
+		}
+
+		/* and backward */
+		if (bmin > dmin)
+			bd[--bmin - 1] = INT_MAX;
+		else
+			bmin++;
+		if (bmax < dmax)
+			bd[++bmax + 1] = INT_MAX;
+		else
+			bmax--;
+		for (d = bmax; d >= bmin; d -= 2) {
+			int tlo = bd[d - 1], thi = bd[d + 1];
+
+			x = tlo < thi ? tlo : thi - 1;
+			y = x - d;
+			while (x > xoff && y > yoff && a[x - 1].value == b[y - 1].value)
+				x--, y--;
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d])
+				goto found;
+		}
+
+		if (c >= m->too_expensive) {
+			/* Settle for the diagonal which got furthest,
+			 * forward or backward */
+			int fxybest = -1, fxbest = 0;
+			int bxybest = INT_MAX, bxbest = 0;
+
+			for (d = fmax; d >= fmin; d -= 2) {
+				x = MIN(fd[d], xlim);
+				y = x - d;
+				if (ylim < y) {
+					x = ylim + d;
+					y = ylim;
+				}
+				if (fxybest < x + y) {
+					fxybest = x + y;
+					fxbest = x;
+				}
+			}
+			for (d = bmax; d >= bmin; d -= 2) {
+				x = MAX(xoff, bd[d]);
+				y = x - d;
+				if (y < yoff) {
+					x = yoff + d;
+					y = yoff;
+				}
+				if (x + y < bxybest) {
+					bxybest = x + y;
+					bxbest = x;
+				}
+			}
+			if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+				x = fxbest;
+				y = fxybest - fxbest;
+			} else {
+				x = bxbest;
+				y = bxybest - bxbest;
+			}
+			goto found;
+		}
+	}
+ found:
+	*xmid = x;
+	*ymid = y;
+}
+
+static void myers_seq(struct myers *m, int xoff, int xlim, int yoff, int ylim)
+{
+	int xmid, ymid;
+
+	while (1) {
+		/* Matching lines at both ends go straight to J */
+		while (xoff < xlim && yoff < ylim && m->a[xoff].value == m->b[yoff].value)
+			m->J[xoff++] = ++yoff;
+		while (xlim > xoff && ylim > yoff && m->a[xlim - 1].value == m->b[ylim - 1].value)
+			m->J[--xlim] = ylim--;
+		/* Only insertions or only deletions left? */
+		if (xoff == xlim || yoff == ylim)
+			return;
+		myers_split(m, xoff, xlim, yoff, ylim, &xmid, &ymid);
+		myers_seq(m, xoff, xmid, yoff, ymid);
+		/* Second half without recursion */
+		xoff = xmid;
+		yoff = ymid;
+	}
+}
+
+/* Fills J for lines pref+1..pref+n of file0 (n, m: number of lines
+ * between prefix and suffix) */
+static void myers(struct line *nfile[2], int pref, int n, int m, int *J)
+{
+	struct myers ms;
+	int *diags;
+	unsigned i;
+
+	ms.a = nfile[0] + pref + 1;
+	ms.b = nfile[1] + pref + 1;
+	/* J[pref + 1 + x] = pref + 1 + y, myers_seq() stores y + 1 */
+	ms.J = J + pref + 1;
+	diags = xmalloc(2 * (n + m + 3) * sizeof(diags[0]));
+	ms.fd = diags + m + 1;
+	ms.bd = diags + (n + m + 3) + m + 1;
+	/* Beyond about the square root of the number of diagonals, finding
+	 * the minimal script is not worth it, unless -d */
+	ms.too_expensive = INT_MAX;
+	if (!(option_mask32 & FLAG(d))) {
+		ms.too_expensive = 1;
+		for (i = n + m + 3; i != 0; i >>= 2)
+			ms.too_expensive <<= 1;
+		ms.too_expensive = MAX(4096, ms.too_expensive);
+	}
+	myers_seq(&ms, 0, n, 0, m);
+	if (pref) {
+		for (i = 1; i <= (unsigned)n; i++)
+			if (J[pref + i])
+				J[pref + i] += pref;
+	}
+	free(diags);
+}
+#endif
+
 static int line_compar(const void *a, const void *b)
 {
 #define l0 ((const struct line*)a)
@@ -398,6 +580,23 @@ static void fetch(FILE_and_pos_t *ft, const off_t *ix, int a, int b, int ch)
 	}
 }
 
+/* The elements of J which fall inside the prefix and suffix regions
+ * are marked as unchanged, while the ones which fall outside
+ * are initialized with 0 (no matches), so that function stone can
+ * then assign them their right values
+ */
+static int *init_J(int nlen[2], int pref, int suff)
+{
+	int *J, i, delta;
+
+	J = xmalloc((nlen[0] + 2) * sizeof(J[0]));
+	for (i = 0, delta = nlen[1] - nlen[0]; i <= nlen[0]; i++)
+		J[i] = i <= pref            ?  i :
+		       i > (nlen[0] - suff) ? (i + delta) : 0;
+	J[nlen[0] + 1] = nlen[1] + 1;
+	return J;
+}
+
 /* Creates the match vector J, where J[i] is the index
  * of the line in the new file corresponding to the line i
  * in the old file. Lines start at 1 instead of 0, that value
@@ -416,7 +615,7 @@ static NOINLINE int *create_J(FILE_and_pos_t ft[2], int nlen[2], off_t *ix[2])
 {
 	int *J, slen[2], *class, *member;
 	struct line *nfile[2], *sfile[2];
-	int pref = 0, suff = 0, i, j, delta;
+	int pref = 0, suff = 0, i, j;
 
 	/* Lines of both files are hashed, and in the process
 	 * their offsets are stored in the array ix[fileno]
@@ -478,6 +677,15 @@ start:
 	for (; suff < nlen[0] - pref && suff < nlen[1] - pref &&
 	       nfile[0][nlen[0] - suff].value == nfile[1][nlen[1] - suff].value;
 	       suff++);
+#if ENABLE_FEATURE_DIFF_MYERS
+	if (G.use_myers) {
+		J = init_J(nlen, pref, suff);
+		myers(nfile, pref, nlen[0] - pref - suff, nlen[1] - pref - suff, J);
+		free(nfile[0]);
+		free(nfile[1]);
+		goto check;
+	}
+#endif
 	/* Arrays are pruned by the suffix and prefix lenght,
 	 * the result being sorted and stored in sfile[fileno],
 	 * and their sizes are stored in slen[fileno]
@@ -513,18 +721,9 @@ start:
 	unsort(sfile[0], slen[0], (int *)nfile[0]);
 	class = xrealloc(class, (slen[0] + 2) * sizeof(class[0]));
 #endif
-	J = xmalloc((nlen[0] + 2) * sizeof(J[0]));
-	/* The elements of J which fall inside the prefix and suffix regions
-	 * are marked as unchanged, while the ones which fall outside
-	 * are initialized with 0 (no matches), so that function stone can
-	 * then assign them their right values
-	 */
-	for (i = 0, delta = nlen[1] - nlen[0]; i <= nlen[0]; i++)
-		J[i] = i <= pref            ?  i :
-		       i > (nlen[0] - suff) ? (i + delta) : 0;
+	J = init_J(nlen, pref, suff);
 	/* Here the magic is performed */
 	stone(class, slen[0], member, J, pref);
-	J[nlen[0] + 1] = nlen[1] + 1;
 
 	free(class);
 	free(member);
@@ -533,6 +732,9 @@ start:
 	 * which, due to limitations intrinsic to any hashing algorithm,
 	 * are different but ended up confounded as the same
 	 */
+#if ENABLE_FEATURE_DIFF_MYERS
+ check:
+#endif
 	for (i = 1; i <= nlen[0]; i++) {
 		if (!J[i])
 			continue;
@@ -674,6 +876,10 @@ static int diffreg(char *file[2])
 	FILE *fp[2] = { stdin, stdin };
 	bool binary = false, differ = false;
 	int status = STATUS_SAME, i;
+#if ENABLE_FEATURE_DIFF_MYERS
+	off_t size = 0;
+	struct stat st;
+#endif
 
 	for (i = 0; i < 2; i++) {
 		int fd = open_or_warn_stdin(file[i]);
@@ -694,8 +900,15 @@ static int diffreg(char *file[2])
 				close(fd);
 			fd = fd_tmp;
 		}
+#if ENABLE_FEATURE_DIFF_MYERS
+		if (fstat(fd, &st) == 0)
+			size += st.st_size;
+#endif
 		fp[i] = fdopen(fd, "r");
 	}
+#if ENABLE_FEATURE_DIFF_MYERS
+	G.use_myers = (option_mask32 & FLAG(H)) || size > MYERS_THRESHOLD;
+#endif
 
 	while (1) {
 		const size_t sz = COMMON_BUFSIZE / 2;
@@ -891,6 +1104,9 @@ static const char diff_longopts[] ALIGN1 =
 	"report-identical-files\0"   No_argument       "s"
 	"starting-file\0"            Required_argument "S"
 	"minimal\0"                  No_argument       "d"
+#if ENABLE_FEATURE_DIFF_MYERS
+	"speed-large-files\0"        No_argument       "H"
+#endif
 	;
 #endif
 
@@ -908,7 +1124,7 @@ int diff_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_DIFF_LONG_OPTIONS
 	applet_long_options = diff_longopts;
 #endif
-	getopt32(argv, "abdiL:NqrsS:tTU:wupBE",
+	getopt32(argv, "abdiL:NqrsS:tTU:wupBE" IF_FEATURE_DIFF_MYERS("H"),
 			&L_arg, &s_start, &opt_U_context);
 	argv += optind;
 	while (L_arg)
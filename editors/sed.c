@@ -63,7 +63,7 @@
 
 /* Each sed command turns into one of these structures. */
 typedef struct sed_cmd_s {
-	/* Ordered by alignment requirements: currently 36 bytes on x86 */
+	/* Ordered by alignment requirements: currently 40 bytes on x86 */
 	struct sed_cmd_s *next; /* Next command (linked list, NULL terminated) */
 
 	/* address storage */
@@ -72,6 +72,7 @@ typedef struct sed_cmd_s {
 	regex_t *sub_match;     /* For 's/sub_match/string/' */
 	int beg_line;           /* 'sed 1p'   0 == apply commands to all lines */
 	int end_line;           /* 'sed 1,3p' 0 == one line only. -1 = last line ($) */
+	int beg_line_orig;      /* beg_line before the range was used up */
 
 	FILE *sw_file;          /* File (sw) command writes to, -1 for none. */
 	char *string;           /* Data string for (saicytb) commands. */
@@ -117,6 +118,10 @@ struct globals {
 		int idx;	/* Space used */
 		int len;	/* Space allocated */
 	} pipeline;
+
+	/* Biggest freed line buffer, reused for the next one */
+	char *spare_line;
+	unsigned spare_len;
 };
 #define G (*(struct globals*)&bb_common_bufsiz1)
 void BUG_sed_globals_too_big(void);
@@ -158,6 +163,7 @@ static void sed_free_and_close_stuff(void)
 	}
 
 	free(G.hold_space);
+	free(G.spare_line);
 
 	while (G.current_input_file < G.input_file_count)
 		fclose(G.input_file_list[G.current_input_file++]);
@@ -533,6 +539,7 @@ static void add_cmd(const char *cmdstr)
 
 		/* first part (if present) is an address: either a '$', a number or a /regex/ */
 		cmdstr += get_address(cmdstr, &sed_cmd->beg_line, &sed_cmd->beg_match);
+		sed_cmd->beg_line_orig = sed_cmd->beg_line;
 
 		/* second part (if present) will begin with a comma */
 		if (*cmdstr == ',') {
@@ -573,18 +580,60 @@ static void add_cmd(const char *cmdstr)
 	G.add_cmd_line = NULL;
 }
 
+/* Lines come and go at a high rate and are mostly alike in size:
+ * keep the biggest freed buffer instead of going to malloc for each */
+static void line_free_sized(char *s, unsigned size)
+{
+	if (size > G.spare_len) {
+		free(G.spare_line);
+		G.spare_line = s;
+		G.spare_len = size;
+	} else {
+		free(s);
+	}
+}
+
+static void line_free(char *s)
+{
+	if (s)
+		line_free_sized(s, strlen(s) + 1);
+}
+
+/* At least *size bytes, *size is set to what there is */
+static char *line_alloc(unsigned *size)
+{
+	char *s = G.spare_line;
+
+	if (s) {
+		G.spare_line = NULL;
+		if (G.spare_len >= *size) {
+			*size = G.spare_len;
+			G.spare_len = 0;
+			return s;
+		}
+		free(s);
+		G.spare_len = 0;
+	}
+	return xmalloc(*size);
+}
+
 /* Append to a string, reallocating memory as necessary. */
 
 #define PIPE_GROW 64
 
-static void pipe_putc(char c)
+static void pipe_puts(const char *s, int n)
 {
-	if (G.pipeline.idx == G.pipeline.len) {
-		G.pipeline.buf = xrealloc(G.pipeline.buf,
-				G.pipeline.len + PIPE_GROW);
-		G.pipeline.len += PIPE_GROW;
+	if (G.pipeline.len - G.pipeline.idx < n) {
+		G.pipeline.len = (G.pipeline.idx + n) * 2;
+		G.pipeline.buf = xrealloc(G.pipeline.buf, G.pipeline.len);
 	}
-	G.pipeline.buf[G.pipeline.idx++] = c;
+	memcpy(G.pipeline.buf + G.pipeline.idx, s, n);
+	G.pipeline.idx += n;
+}
+
+static void pipe_putc(char c)
+{
+	pipe_puts(&c, 1);
 }
 
 static void do_subst_w_backrefs(char *line, char *replace)
@@ -600,8 +649,7 @@ static void do_subst_w_backrefs(char *line, char *replace)
 				/* print out the text held in G.regmatch[backref] */
 				if (G.regmatch[backref].rm_so != -1) {
 					j = G.regmatch[backref].rm_so;
-					while (j < G.regmatch[backref].rm_eo)
-						pipe_putc(line[j++]);
+					pipe_puts(line + j, G.regmatch[backref].rm_eo - j);
 				}
 				continue;
 			}
@@ -615,12 +663,13 @@ static void do_subst_w_backrefs(char *line, char *replace)
 		/* if we find an unescaped '&' print out the whole matched text. */
 		if (replace[i] == '&') {
 			j = G.regmatch[0].rm_so;
-			while (j < G.regmatch[0].rm_eo)
-				pipe_putc(line[j++]);
+			pipe_puts(line + j, G.regmatch[0].rm_eo - j);
 			continue;
 		}
-		/* Otherwise just output the character. */
-		pipe_putc(replace[i]);
+		/* Otherwise output the characters up to the next special one. */
+		j = strcspn(replace + i, "\\&");
+		pipe_puts(replace + i, j);
+		i += j - 1;
 	}
 }
 
@@ -645,14 +694,15 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 		return 0;
 
 	/* Initialize temporary output buffer. */
-	G.pipeline.buf = xmalloc(PIPE_GROW);
-	G.pipeline.len = PIPE_GROW;
-	G.pipeline.idx = 0;
+	{
+		unsigned len = strlen(line) + PIPE_GROW;
+		G.pipeline.buf = line_alloc(&len);
+		G.pipeline.len = len;
+		G.pipeline.idx = 0;
+	}
 
 	/* Now loop through, substituting for matches */
 	do {
-		int i;
-
 		/* Work around bug in glibc regexec, demonstrated by:
 		   echo " a.b" | busybox sed 's [^ .]* x g'
 		   The match_count check is so not to break
@@ -669,14 +719,13 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 		if (sed_cmd->which_match
 		 && (sed_cmd->which_match != match_count)
 		) {
-			for (i = 0; i < G.regmatch[0].rm_eo; i++)
-				pipe_putc(*line++);
+			pipe_puts(line, G.regmatch[0].rm_eo);
+			line += G.regmatch[0].rm_eo;
 			continue;
 		}
 
 		/* print everything before the match */
-		for (i = 0; i < G.regmatch[0].rm_so; i++)
-			pipe_putc(line[i]);
+		pipe_puts(line, G.regmatch[0].rm_so);
 
 		/* then print the substitution string */
 		do_subst_w_backrefs(line, sed_cmd->string);
@@ -694,14 +743,9 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 	} while (*line && regexec(current_regex, line, 10, G.regmatch, REG_NOTBOL) != REG_NOMATCH);
 
 	/* Copy rest of string into output pipeline */
-	while (1) {
-		char c = *line++;
-		pipe_putc(c);
-		if (c == '\0')
-			break;
-	}
+	pipe_puts(line, strlen(line) + 1);
 
-	free(*line_p);
+	line_free(*line_p);
 	*line_p = G.pipeline.buf;
 	return altered;
 }
@@ -748,6 +792,32 @@ enum {
 	NO_EOL_CHAR = 1,
 	LAST_IS_NUL = 2,
 };
+/* Read line up to a newline or NUL byte, inclusive. Length of the chunk
+ * read is stored in len. NULL if EOF/error */
+static char *read_chunk(FILE *fp, int *len_p)
+{
+	unsigned size = 128;
+	char *buf = line_alloc(&size);
+	int ch, len = 0;
+
+	while ((ch = getc(fp)) != EOF) {
+		if (len + 1 >= (int)size) {
+			size *= 2;
+			buf = xrealloc(buf, size);
+		}
+		buf[len++] = ch;
+		if (ch == '\n' || ch == '\0')
+			break;
+	}
+	if (!len) {
+		line_free_sized(buf, size);
+		return NULL;
+	}
+	buf[len] = '\0';
+	*len_p = len;
+	return buf;
+}
+
 static char *get_next_line(char *gets_char)
 {
 	char *temp = NULL;
@@ -761,10 +831,7 @@ static char *get_next_line(char *gets_char)
 	gc = NO_EOL_CHAR;
 	while (G.current_input_file < G.input_file_count) {
 		FILE *fp = G.input_file_list[G.current_input_file];
-		/* Read line up to a newline or NUL byte, inclusive,
-		 * return malloc'ed char[]. length of the chunk read
-		 * is stored in len. NULL if EOF/error */
-		temp = bb_get_chunk_from_file(fp, &len);
+		temp = read_chunk(fp, &len);
 		if (temp) {
 			/* len > 0 here, it's ok to do temp[len-1] */
 			char c = temp[len-1];
@@ -856,6 +923,17 @@ static int beg_match(sed_cmd_t *sed_cmd, const char *pattern_space)
 	return retval;
 }
 
+/* sed -i: each file is a stream of its own, ranges start over */
+static void reset_ranges(void)
+{
+	sed_cmd_t *sed_cmd;
+
+	for (sed_cmd = G.sed_cmd_head.next; sed_cmd; sed_cmd = sed_cmd->next) {
+		sed_cmd->beg_line = sed_cmd->beg_line_orig;
+		sed_cmd->in_match = 0;
+	}
+}
+
 /* Process all the lines in all the files */
 
 static void process_files(void)
@@ -992,7 +1070,7 @@ static void process_files(void)
 
 			if (tmp) {
 				tmp = xstrdup(tmp+1);
-				free(pattern_space);
+				line_free(pattern_space);
 				pattern_space = tmp;
 				goto restart;
 			}
@@ -1064,7 +1142,7 @@ static void process_files(void)
 			if (!G.be_quiet)
 				sed_puts(pattern_space, last_gets_char);
 			if (next_line) {
-				free(pattern_space);
+				line_free(pattern_space);
 				pattern_space = next_line;
 				last_gets_char = next_gets_char;
 				next_line = get_next_line(&next_gets_char);
@@ -1077,7 +1155,7 @@ static void process_files(void)
 		/* Quit.  End of script, end of input. */
 		case 'q':
 			/* Exit the outer while loop */
-			free(next_line);
+			line_free(next_line);
 			next_line = NULL;
 			goto discard_commands;
 
@@ -1088,7 +1166,7 @@ static void process_files(void)
 			/* If no next line, jump to end of script and exit. */
 			if (next_line == NULL) {
 				/* Jump to end of script and exit */
-				free(next_line);
+				line_free(next_line);
 				next_line = NULL;
 				goto discard_line;
 			/* append next_line, read new next_line. */
@@ -1134,7 +1212,7 @@ static void process_files(void)
 			break;
 		}
 		case 'g':	/* Replace pattern space with hold space */
-			free(pattern_space);
+			line_free(pattern_space);
 			pattern_space = xstrdup(G.hold_space ? G.hold_space : "");
 			break;
 		case 'G':	/* Append newline and hold space to pattern space */
@@ -1204,7 +1282,7 @@ static void process_files(void)
 	/* Delete and such jump here. */
  discard_line:
 	flush_append();
-	free(pattern_space);
+	line_free(pattern_space);
 
 	goto again;
 }
@@ -1345,6 +1423,7 @@ int sed_main(int argc UNUSED_PARAM, char **argv)
 			fchmod(nonstdoutfd, statbuf.st_mode);
 			fchown(nonstdoutfd, statbuf.st_uid, statbuf.st_gid);
 			add_input_file(file);
+			reset_ranges();
 			process_files();
 			fclose(G.nonstdout);
 
@@ -111,6 +111,9 @@ struct globals {
 	/* globals used internally */
 	llist_t *pattern_head;   /* growable list of patterns to match */
 	const char *cur_file;    /* the current file we are reading */
+#if ENABLE_FEATURE_GREP_FAST_FIXED
+	struct fixed_engine *fixed; /* -F matcher, if the fast path applies */
+#endif
 };
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -144,6 +147,7 @@ struct globals {
 #define last_line_printed (G.last_line_printed   )
 #define pattern_head      (G.pattern_head        )
 #define cur_file          (G.cur_file            )
+#define fixed             (G.fixed               )
 
 
 typedef struct grep_list_data_t {
@@ -218,6 +222,358 @@ static ssize_t FAST_FUNC bb_getline(char **line_ptr, size_t *line_alloc_len, FIL
 }
 #endif
 
+/* special-case file post-processing for options where we don't print line
+ * matches, just filenames and possibly match counts */
+static int grep_file_done(int nmatches)
+{
+	/* grep -c: print [filename:]count, even if count is zero */
+	if (PRINT_MATCH_COUNTS) {
+		if (print_filename)
+			printf("%s:", cur_file);
+		printf("%d\n", nmatches);
+	}
+
+	/* grep -L: print just the filename */
+	if (PRINT_FILES_WITHOUT_MATCHES) {
+		/* nmatches is zero, no need to check it:
+		 * we return 1 early if we detected a match
+		 * and PRINT_FILES_WITHOUT_MATCHES is set */
+		puts(cur_file);
+	}
+
+	return nmatches;
+}
+
+#if ENABLE_FEATURE_GREP_FAST_FIXED
+/* Fixed-string matcher for -F. Instead of reading lines and strstr'ing
+ * every pattern in turn, the file is read in big blocks and each block
+ * is searched at once: Boyer-Moore-Horspool for a single pattern,
+ * Aho-Corasick for several. Lines are only located (with memchr)
+ * around matches, and never copied.
+ */
+struct ac_node {
+	unsigned fail;         /* longest proper suffix which is in the trie */
+	unsigned child;        /* first child... */
+	unsigned sibling;      /* ...and its next sibling, 0: none */
+	unsigned *dense;       /* or all children at once, for busy nodes */
+	unsigned char ch;
+	smallint out;          /* a pattern ends here or at a suffix */
+};
+
+struct fixed_engine {
+	unsigned char fold[256];  /* tolower for -i, identity otherwise */
+	smallint match_all;       /* empty pattern: every line matches */
+	/* one pattern: BMH */
+	unsigned plen;
+	unsigned char *pat;
+	unsigned skip[256];
+	/* several patterns: Aho-Corasick */
+	struct ac_node *node;     /* node[0] is the root */
+	unsigned root[256];       /* root transitions, 0: stay in root */
+};
+
+#define FIXED_BUFSIZE (256 * 1024)
+#define AC_DENSE 8
+
+static unsigned ac_goto(struct fixed_engine *fe, unsigned s, unsigned char c)
+{
+	struct ac_node *n = &fe->node[s];
+
+	if (s == 0)
+		return fe->root[c];
+	if (n->dense)
+		return n->dense[c];
+	for (s = n->child; s; s = fe->node[s].sibling)
+		if (fe->node[s].ch == c)
+			break;
+	return s;
+}
+
+static struct fixed_engine *compile_fixed(void)
+{
+	struct fixed_engine *fe = xzalloc(sizeof(*fe));
+	char eol = NUL_DELIMITED ? '\0' : '\n';
+	llist_t *cur;
+	unsigned i, nnodes, npat;
+	unsigned *queue;
+
+	for (i = 0; i < 256; i++)
+		fe->fold[i] = i;
+	if (option_mask32 & OPT_i)
+		for (i = 'A'; i <= 'Z'; i++)
+			fe->fold[i] = i + ('a' - 'A');
+
+	npat = 0;
+	for (cur = pattern_head; cur; cur = cur->link) {
+		const char *pattern = ((grep_list_data_t *)cur->data)->pattern;
+		/* a pattern spanning lines: leave it to the generic code */
+		if (eol != '\0' && strchr(pattern, eol)) {
+			free(fe);
+			return NULL;
+		}
+		if (!pattern[0])
+			fe->match_all = 1;
+		npat++;
+	}
+	if (fe->match_all)
+		return fe;
+
+	if (npat == 1) {
+		fe->pat = (unsigned char *)xstrdup(((grep_list_data_t *)pattern_head->data)->pattern);
+		fe->plen = strlen((char *)fe->pat);
+		for (i = 0; i < fe->plen; i++)
+			fe->pat[i] = fe->fold[fe->pat[i]];
+		for (i = 0; i < 256; i++)
+			fe->skip[i] = fe->plen;
+		for (i = 0; i < fe->plen - 1; i++)
+			fe->skip[fe->pat[i]] = fe->plen - 1 - i;
+		return fe;
+	}
+
+	/* Build the trie */
+	fe->node = xrealloc_vector(fe->node, 6, 0);
+	nnodes = 1;
+	for (cur = pattern_head; cur; cur = cur->link) {
+		const unsigned char *p = (unsigned char *)((grep_list_data_t *)cur->data)->pattern;
+		unsigned s = 0;
+
+		for (; *p; p++) {
+			unsigned char c = fe->fold[*p];
+			unsigned n = ac_goto(fe, s, c);
+
+			if (!n) {
+				fe->node = xrealloc_vector(fe->node, 6, nnodes);
+				n = nnodes++;
+				fe->node[n].ch = c;
+				if (s == 0)
+					fe->root[c] = n;
+				fe->node[n].sibling = fe->node[s].child;
+				fe->node[s].child = n;
+			}
+			s = n;
+		}
+		fe->node[s].out = 1;
+	}
+
+	/* Compute failure links breadth first, so that a node's suffix
+	 * is always done before the node itself */
+	queue = xmalloc(sizeof(queue[0]) * nnodes);
+	queue[0] = 0;
+	for (i = 0, nnodes = 1; i < nnodes; i++) {
+		unsigned s = queue[i];
+		unsigned n, cnt = 0;
+
+		for (n = fe->node[s].child; n; n = fe->node[n].sibling) {
+			unsigned f = fe->node[s].fail;
+
+			queue[nnodes++] = n;
+			cnt++;
+			if (s != 0) {
+				for (;;) {
+					unsigned t = ac_goto(fe, f, fe->node[n].ch);
+					if (t) {
+						f = t;
+						break;
+					}
+					if (f == 0)
+						break;
+					f = fe->node[f].fail;
+				}
+			}
+			fe->node[n].fail = f;
+			fe->node[n].out |= fe->node[f].out;
+		}
+		if (s != 0 && cnt >= AC_DENSE) {
+			unsigned *dense = xzalloc(256 * sizeof(dense[0]));
+			for (n = fe->node[s].child; n; n = fe->node[n].sibling)
+				dense[fe->node[n].ch] = n;
+			fe->node[s].dense = dense;
+		}
+	}
+	free(queue);
+	return fe;
+}
+
+/* Find a match in [p, end). Returns a pointer to some char of it */
+static const char *fixed_search(const char *p, const char *end)
+{
+	struct fixed_engine *fe = fixed;
+	const unsigned char *t = (const unsigned char *)p;
+	const unsigned char *e = (const unsigned char *)end;
+
+	if (fe->match_all)
+		return p;
+
+	if (!fe->node) {
+		unsigned last = fe->plen - 1;
+		unsigned char lc = fe->pat[last];
+
+		while (e - t > (ptrdiff_t)last) {
+			unsigned char c = fe->fold[t[last]];
+			if (c == lc) {
+				unsigned i = 0;
+				while (i < last && fe->fold[t[i]] == fe->pat[i])
+					i++;
+				if (i == last)
+					return (const char *)t;
+			}
+			t += fe->skip[c];
+		}
+		return NULL;
+	}
+
+	{
+		unsigned s = 0;
+
+		while (t < e) {
+			unsigned char c = fe->fold[*t];
+
+			if (s == 0) {
+				/* Most of the text is spent in the root:
+				 * skip what can't start a pattern quickly */
+				s = fe->root[c];
+				if (!s) {
+					t++;
+					continue;
+				}
+			} else {
+				unsigned n;
+				while ((n = ac_goto(fe, s, c)) == 0 && s != 0)
+					s = fe->node[s].fail;
+				s = n;
+			}
+			if (fe->node[s].out)
+				return (const char *)t;
+			t++;
+		}
+	}
+	return NULL;
+}
+
+static unsigned count_eol(const char *p, const char *end, char eol)
+{
+	unsigned cnt = 0;
+
+	while ((p = memchr(p, eol, end - p)) != NULL) {
+		cnt++;
+		p++;
+	}
+	return cnt;
+}
+
+/* Returns 1 if the rest of the file is not needed */
+static int fixed_line_found(const char *line, const char *le, int linenum, int *nmatches)
+{
+	(*nmatches)++;
+	if (option_mask32 & (OPT_q|OPT_l|OPT_L)) {
+		if (BE_QUIET)
+			exit(EXIT_SUCCESS);
+		return 1;
+	}
+	if (!PRINT_MATCH_COUNTS) {
+		if (print_filename)
+			printf("%s:", cur_file);
+		if (PRINT_LINE_NUM)
+			printf("%i:", linenum);
+		fwrite(line, 1, le - line, stdout);
+		putchar(NUL_DELIMITED ? '\0' : '\n');
+	}
+	return (option_mask32 & OPT_m) && *nmatches == max_matches;
+}
+
+/* Scan complete lines in [pos, end) (the last one may be unterminated
+ * at EOF). Returns 1 if the rest of the file is not needed */
+static int scan_fixed(const char *pos, const char *end, int *linenum, int *nmatches)
+{
+	char eol = NUL_DELIMITED ? '\0' : '\n';
+
+	while (pos < end) {
+		const char *m = fixed_search(pos, end);
+		const char *ls = end;
+		const char *le;
+
+		if (m) {
+			ls = memrchr(pos, eol, m - pos);
+			ls = ls ? ls + 1 : pos;
+		}
+		if (invert_search) {
+			/* all lines up to the matching one are selected */
+			while (pos < ls) {
+				le = memchr(pos, eol, ls - pos);
+				if (!le)
+					le = ls;
+				if (fixed_line_found(pos, le, ++*linenum, nmatches))
+					return 1;
+				pos = le + 1;
+			}
+			if (!m)
+				return 0;
+		} else {
+			if (PRINT_LINE_NUM)
+				*linenum += count_eol(pos, m ? ls : end, eol);
+			if (!m)
+				return 0;
+		}
+		le = memchr(m, eol, end - m);
+		if (!le)
+			le = end;
+		++*linenum;
+		if (!invert_search && fixed_line_found(ls, le, *linenum, nmatches))
+			return 1;
+		pos = le + 1;
+	}
+	return 0;
+}
+
+static int grep_fixed(int fd)
+{
+	char *buf;
+	size_t bufsize, carry;
+	int linenum = 0;
+	int nmatches = 0;
+
+	/* Read big blocks, keeping the incomplete last line.
+	 * Not mmap: a file truncated under us (rotated log)
+	 * would get us SIGBUS instead of a short read */
+	bufsize = FIXED_BUFSIZE;
+	buf = xmalloc(bufsize);
+	carry = 0;
+	for (;;) {
+		ssize_t sz = safe_read(fd, buf + carry, bufsize - carry);
+		const char *last;
+
+		if (sz <= 0) {
+			if (carry)
+				scan_fixed(buf, buf + carry, &linenum, &nmatches);
+			break;
+		}
+		sz += carry;
+		last = memrchr(buf, NUL_DELIMITED ? '\0' : '\n', sz);
+		if (!last) {
+			/* no complete line yet */
+			carry = sz;
+			if (carry == bufsize) {
+				bufsize *= 2;
+				buf = xrealloc(buf, bufsize);
+			}
+			continue;
+		}
+		last++;
+		if (scan_fixed(buf, last, &linenum, &nmatches))
+			break;
+		carry = buf + sz - last;
+		memmove(buf, last, carry);
+	}
+	free(buf);
+	if (nmatches && (option_mask32 & (OPT_l|OPT_L))) {
+		if (PRINT_FILES_WITH_MATCHES)
+			puts(cur_file);
+		return 1;
+	}
+	return grep_file_done(nmatches);
+}
+#endif
+
 static int grep_file(FILE *file)
 {
 	smalluint found;
@@ -240,6 +596,11 @@ static int grep_file(FILE *file)
 	enum { print_n_lines_after = 0 };
 #endif
 
+#if ENABLE_FEATURE_GREP_FAST_FIXED
+	if (fixed)
+		return grep_fixed(fileno(file));
+#endif
+
 	while (
 #if !ENABLE_EXTRA_COMPAT
 		(line = xmalloc_fgetline(file)) != NULL
@@ -255,7 +616,10 @@ static int grep_file(FILE *file)
 		while (pattern_ptr) {
 			gl = (grep_list_data_t *)pattern_ptr->data;
 			if (FGREP_FLAG) {
-				found |= (strstr(line, gl->pattern) != NULL);
+				if (option_mask32 & OPT_i)
+					found |= (strcasestr(line, gl->pattern) != NULL);
+				else
+					found |= (strstr(line, gl->pattern) != NULL);
 			} else {
 				if (!(gl->flg_mem_alocated_compiled & COMPILED)) {
 					gl->flg_mem_alocated_compiled |= COMPILED;
@@ -428,25 +792,7 @@ static int grep_file(FILE *file)
 		}
 	} /* while (read line) */
 
-	/* special-case file post-processing for options where we don't print line
-	 * matches, just filenames and possibly match counts */
-
-	/* grep -c: print [filename:]count, even if count is zero */
-	if (PRINT_MATCH_COUNTS) {
-		if (print_filename)
-			printf("%s:", cur_file);
-		printf("%d\n", nmatches);
-	}
-
-	/* grep -L: print just the filename */
-	if (PRINT_FILES_WITHOUT_MATCHES) {
-		/* nmatches is zero, no need to check it:
-		 * we return 1 early if we detected a match
-		 * and PRINT_FILES_WITHOUT_MATCHES is set */
-		puts(cur_file);
-	}
-
-	return nmatches;
+	return grep_file_done(nmatches);
 }
 
 #if ENABLE_FEATURE_CLEAN_UP
@@ -617,6 +963,14 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 		llist_add_to(&pattern_head, pattern);
 	}
 
+#if ENABLE_FEATURE_GREP_FAST_FIXED
+	if (FGREP_FLAG && !(option_mask32 & (OPT_o|OPT_w))
+	 IF_FEATURE_GREP_CONTEXT(&& !lines_before && !lines_after)
+	) {
+		fixed = compile_fixed();
+	}
+#endif
+
 	/* argv[0..(argc-1)] should be names of file to grep through. If
 	 * there is more than one file to grep, we will print the filenames. */
 	if (argv[0] && argv[1])
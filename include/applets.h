@@ -108,6 +108,7 @@ IF_CMP(APPLET(cmp, _BB_DIR_USR_BIN, _BB_SUID_DROP))
 IF_COMM(APPLET(comm, _BB_DIR_USR_BIN, _BB_SUID_DROP))
 IF_CP(APPLET_NOEXEC(cp, cp, _BB_DIR_BIN, _BB_SUID_DROP, cp))
 IF_CPIO(APPLET(cpio, _BB_DIR_BIN, _BB_SUID_DROP))
+IF_CRC32BENCH(APPLET(crc32bench, _BB_DIR_USR_BIN, _BB_SUID_DROP))
 IF_CROND(APPLET(crond, _BB_DIR_USR_SBIN, _BB_SUID_DROP))
 IF_CRONTAB(APPLET(crontab, _BB_DIR_USR_BIN, _BB_SUID_REQUIRE))
 IF_CRYPTPW(APPLET(cryptpw, _BB_DIR_USR_BIN, _BB_SUID_DROP))
@@ -200,6 +201,7 @@ IF_IFENSLAVE(APPLET(ifenslave, _BB_DIR_SBIN, _BB_SUID_DROP))
 IF_IFPLUGD(APPLET(ifplugd, _BB_DIR_USR_BIN, _BB_SUID_DROP))
 IF_IFUPDOWN(APPLET_ODDNAME(ifup, ifupdown, _BB_DIR_SBIN, _BB_SUID_DROP, ifup))
 IF_INETD(APPLET(inetd, _BB_DIR_USR_SBIN, _BB_SUID_DROP))
+IF_INFLATEBENCH(APPLET(inflatebench, _BB_DIR_USR_BIN, _BB_SUID_DROP))
 IF_INIT(APPLET(init, _BB_DIR_SBIN, _BB_SUID_DROP))
 IF_INOTIFYD(APPLET(inotifyd, _BB_DIR_SBIN, _BB_SUID_DROP))
 IF_INSMOD(APPLET(insmod, _BB_DIR_SBIN, _BB_SUID_DROP))
@@ -309,6 +309,16 @@ extern int get_console_fd_or_die(void) FAST_FUNC;
 extern void console_make_active(int fd, const int vt_num) FAST_FUNC;
 extern char *find_block_device(const char *path) FAST_FUNC;
 /* bb_copyfd_XX print read/write errors and return -1 if they occur */
+/* They move data in kernel (copy_file_range/sendfile/splice) if they can.
+ * bb_copyfd_stats[] tells how many bytes each method moved in the last call */
+enum {
+	COPYFD_READ_WRITE,
+	COPYFD_COPY_FILE_RANGE,
+	COPYFD_SENDFILE,
+	COPYFD_SPLICE,
+	COPYFD_NUM_METHODS
+};
+extern off_t bb_copyfd_stats[COPYFD_NUM_METHODS];
 extern off_t bb_copyfd_eof(int fd1, int fd2) FAST_FUNC;
 extern off_t bb_copyfd_size(int fd1, int fd2, off_t size) FAST_FUNC;
 extern void bb_copyfd_exact_size(int fd1, int fd2, off_t size) FAST_FUNC;
@@ -1031,6 +1041,7 @@ extern struct mntent *find_mount_point(const char *name, int subdir_too) FAST_FU
 
 #ifdef MY_ABC_HERE
 extern void FAST_FUNC kill_process_for_umount(const char *szDir);
+extern void FAST_FUNC kill_process_for_umount_list(const char *const *pszDirs, int cDirs);
 #endif
 
 extern void erase_mtab(const char * name) FAST_FUNC;
@@ -1463,6 +1474,21 @@ void md5_end(void *resbuf, md5_ctx_t *ctx) FAST_FUNC;
 
 
 uint32_t *crc32_filltable(uint32_t *tbl256, int endian) FAST_FUNC;
+/* Update a crc register (no pre/post inversion) with len bytes.
+ * endian0: reflected (gzip, zip, xz), endian1: cksum, bzip2 */
+uint32_t crc32_block_endian0(uint32_t val, const void *buf, unsigned len) FAST_FUNC;
+uint32_t crc32_block_endian1(uint32_t val, const void *buf, unsigned len) FAST_FUNC;
+/* Finished endian0 crc of A+B from those of A and B */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, off_t len2) FAST_FUNC;
+#if ENABLE_FEATURE_FAST_CRC32
+enum {
+	CRC32_IMPL_BYTEWISE = 1,
+	CRC32_IMPL_SLICE8,
+	CRC32_IMPL_PCLMUL,	/* endian0 only */
+};
+/* Best implementation, set on first use (crc32bench lowers it) */
+extern smallint crc32_impl;
+#endif
 
 typedef struct masks_labels_t {
 	const char *labels;
@@ -75,6 +75,11 @@ typedef struct archive_handle_t {
 	/* Count processed bytes */
 	off_t offset;
 
+#if ENABLE_FEATURE_SEEK_INDEX
+	/* Lets data_skip() jump over data in compressed archives */
+	struct seek_index_t *seek_index;
+#endif
+
 	/* Archiver specific. Can make it a union if it ever gets big */
 #if ENABLE_TAR || ENABLE_DPKG || ENABLE_DPKG_DEB
 	smallint tar__end;
@@ -157,6 +162,11 @@ struct BUG_tar_header {
  * timestamps of unpacked files */
 typedef struct unpack_info_t {
 	time_t mtime;
+#if ENABLE_FEATURE_SEEK_INDEX
+	/* bbunpack() fills these, NULL for stdin/stdout */
+	const char *src_name;
+	const char *dst_name;
+#endif
 } unpack_info_t;
 
 extern archive_handle_t *init_handle(void) FAST_FUNC;
@@ -204,6 +214,10 @@ typedef struct inflate_unzip_result {
 } inflate_unzip_result;
 
 IF_DESKTOP(long long) int inflate_unzip(inflate_unzip_result *res, off_t compr_size, int src_fd, int dst_fd) FAST_FUNC;
+#if ENABLE_FEATURE_GUNZIP_FAST_INFLATE
+/* Use the old huft_t decoder (inflatebench compares the two) */
+extern smallint inflate_classic;
+#endif
 /* xz unpacker takes .xz stream from offset 6 */
 IF_DESKTOP(long long) int unpack_xz_stream(int src_fd, int dst_fd) FAST_FUNC;
 /* lzma unpacker takes .lzma stream from offset 0 */
@@ -215,6 +229,70 @@ IF_DESKTOP(long long) int unpack_gz_stream_with_info(int src_fd, int dst_fd, unp
 IF_DESKTOP(long long) int unpack_Z_stream(int src_fd, int dst_fd) FAST_FUNC;
 /* wrapper which checks first two bytes to be "BZ" */
 IF_DESKTOP(long long) int unpack_bz2_stream_prime(int src_fd, int dst_fd) FAST_FUNC;
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+/* worker processes for unpack_bz2_stream, 0: one per online CPU */
+extern unsigned bunzip2_procs;
+#endif
+
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+/* worker processes for unpack_xz_stream, 0: one per online CPU */
+extern unsigned unxz_procs;
+#endif
+
+#if ENABLE_FEATURE_SEEK_INDEX || ENABLE_FEATURE_UNXZ_PARALLEL
+/* Points where decompression of a .gz or .xz file can start.
+ * For .gz they come from FILE.gz.idx written by gzip -i,
+ * for .xz from the block index at the end of the file itself. */
+typedef struct seek_point_t {
+	uint64_t uoff;	/* uncompressed offset */
+	uint64_t coff;	/* offset of the deflate data / xz block */
+	uint64_t aux;	/* .gz: offset of the window in FILE.gz.idx,
+			 * .xz: unpadded size of the block */
+} seek_point_t;
+typedef struct seek_index_t {
+	int fd;		/* the compressed file */
+	int idx_fd;	/* FILE.gz.idx, -1 for .xz */
+	pid_t pid;	/* decompressor started by seek_index_jump() */
+	unsigned count;
+	seek_point_t *pt;	/* count points, then one for the end */
+} seek_index_t;
+
+int unxz_read_index(int fd, seek_index_t *idx) FAST_FUNC;
+#endif
+
+#if ENABLE_FEATURE_SEEK_INDEX
+/* FILE.gz.idx: the header, then count points, each being the
+ * uncompressed and compressed offset (64-bit little endian) and
+ * the SEEK_INDEX_WINDOW bytes of output before it */
+#define SEEK_INDEX_MAGIC "BBGZIDX1"
+enum {
+	SEEK_INDEX_SPAN = 1024 * 1024,	/* gzip -i: a point every 1M */
+	SEEK_INDEX_WINDOW = 32 * 1024,
+	SEEK_INDEX_POINT = 16 + SEEK_INDEX_WINDOW,
+};
+struct seek_index_header {
+	char magic[8];
+	uint64_t gz_size;	/* catches an index left over from another FILE.gz */
+	uint32_t count;
+	uint32_t span;
+};
+
+seek_index_t *seek_index_open(const char *filename) FAST_FUNC;
+void seek_index_close(seek_index_t *idx) FAST_FUNC;
+/* Decompress to dst_fd, starting at uncompressed offset target */
+IF_DESKTOP(long long) int seek_index_unpack(seek_index_t *idx, int dst_fd, off_t target) FAST_FUNC;
+/* Same, in a child, returns the read end of a pipe (moved to fd if fd >= 0) */
+int seek_index_jump(seek_index_t *idx, int fd, off_t target) FAST_FUNC;
+/* Jump if that skips decompressing data between cur and target */
+int seek_index_skip(seek_index_t *idx, int fd, off_t cur, off_t target) FAST_FUNC;
+
+/* unpack_gz_at(): raw deflate data following win_len bytes of output,
+ * or a whole .gz stream (magic already read) if window is NULL.
+ * unpack_xz_at(): blocks first.. of idx, or a whole .xz stream
+ * (from offset 6) if idx is NULL. Both drop skip bytes of output. */
+IF_DESKTOP(long long) int unpack_gz_at(int src_fd, int dst_fd, const void *window, unsigned win_len, off_t skip) FAST_FUNC;
+IF_DESKTOP(long long) int unpack_xz_at(int src_fd, int dst_fd, const seek_index_t *idx, unsigned first, off_t skip) FAST_FUNC;
+#endif
 
 char* append_ext(char *filename, const char *expected_ext) FAST_FUNC;
 int bbunpack(char **argv,
@@ -217,6 +217,9 @@
      "\nOptions:" \
      "\n	-c	Write to stdout" \
      "\n	-f	Force" \
+	IF_FEATURE_BUNZIP2_PARALLEL( \
+     "\n	-p N	Use N worker processes (default: one per CPU)" \
+	) \
 
 #define bzip2_trivial_usage \
        "[OPTIONS] [FILE]..."
@@ -281,6 +284,12 @@
      "\nOptions:" \
      "\n	-c	Write to stdout" \
      "\n	-f	Force" \
+	IF_FEATURE_SEEK_INDEX( \
+     "\n	-O OFS	Start at uncompressed offset OFS" \
+	) \
+	IF_FEATURE_UNXZ_PARALLEL( \
+     "\n	-p N	Use N worker processes (default: one per CPU)" \
+	) \
 
 #define xz_trivial_usage \
        "-d [OPTIONS] [FILE]..."
@@ -292,7 +301,7 @@
      "\n	-f	Force" \
 
 #define xzcat_trivial_usage \
-       "FILE"
+       IF_FEATURE_SEEK_INDEX("[-O OFS] ") "FILE"
 #define xzcat_full_usage "\n\n" \
        "Decompress to stdout"
 
@@ -631,6 +640,13 @@
      "\n	-H newc	Archive format" \
 	) \
 
+#define crc32bench_trivial_usage \
+       "[-s MB]"
+#define crc32bench_full_usage "\n\n" \
+       "Benchmark and cross-check the CRC32 implementations\n" \
+     "\nOptions:" \
+     "\n	-s MB	Checksum MB megabytes per implementation (default 256)" \
+
 #define crond_trivial_usage \
        "-fbS -l N " IF_FEATURE_CROND_D("-d N ") "-L LOGFILE -c DIR"
 #define crond_full_usage "\n\n" \
@@ -894,7 +910,7 @@
        "Relay DHCP requests between clients and server" \
 
 #define diff_trivial_usage \
-       "[-abBdiNqrTstw] [-L LABEL] [-S FILE] [-U LINES] FILE1 FILE2"
+       "[-abBdi"IF_FEATURE_DIFF_MYERS("H")"NqrTstw] [-L LABEL] [-S FILE] [-U LINES] FILE1 FILE2"
 #define diff_full_usage "\n\n" \
        "Compare files line by line and output the differences between them.\n" \
        "This implementation supports unified diffs only.\n" \
@@ -903,6 +919,9 @@
      "\n	-b	Ignore changes in the amount of whitespace" \
      "\n	-B	Ignore changes whose lines are all blank" \
      "\n	-d	Try hard to find a smaller set of changes" \
+	IF_FEATURE_DIFF_MYERS( \
+     "\n	-H	Use the algorithm for large files (default above 1M)" \
+	) \
      "\n	-i	Ignore case differences" \
      "\n	-L	Use LABEL instead of the filename in the unified header" \
      "\n	-N	Treat absent files as empty" \
@@ -1624,6 +1643,10 @@
      "\n	-c	Write to stdout" \
      "\n	-f	Force" \
      "\n	-t	Test file integrity" \
+	IF_FEATURE_SEEK_INDEX( \
+     "\n	-O OFS	Start at uncompressed offset OFS," \
+     "\n		quickly if FILE.idx exists (gzip -i)" \
+	) \
 
 #define gunzip_example_usage \
        "$ ls -la /tmp/BusyBox*\n" \
@@ -1640,6 +1663,12 @@
      "\n	-c	Write to stdout" \
      "\n	-d	Decompress" \
      "\n	-f	Force" \
+	IF_FEATURE_GZIP_PARALLEL( \
+     "\n	-p N	Compress on N processes" \
+	) \
+	IF_FEATURE_SEEK_INDEX(IF_FEATURE_GZIP_PARALLEL( \
+     "\n	-i	Also write FILE.gz.idx for zcat -O and tar" \
+	)) \
 
 #define gzip_example_usage \
        "$ ls -la /tmp/busybox*\n" \
@@ -1781,6 +1810,8 @@
        " [-p [IP:]PORT]" \
 	IF_FEATURE_HTTPD_SETUID(" [-u USER[:GRP]]") \
 	IF_FEATURE_HTTPD_BASIC_AUTH(" [-r REALM]") \
+	IF_FEATURE_HTTPD_KEEPALIVE(" [-P NUM]") \
+	IF_FEATURE_HTTPD_STATIC_CACHE(" [-C KBYTES]") \
        " [-h HOME]\n" \
        "or httpd -d/-e" IF_FEATURE_HTTPD_AUTH_MD5("/-m") " STRING"
 #define httpd_full_usage "\n\n" \
@@ -1796,6 +1827,10 @@
 	IF_FEATURE_HTTPD_BASIC_AUTH( \
      "\n	-r REALM	Authentication Realm for Basic Authentication") \
      "\n	-h HOME		Home directory (default .)" \
+	IF_FEATURE_HTTPD_KEEPALIVE( \
+     "\n	-P NUM		Serve from NUM prefork worker processes") \
+	IF_FEATURE_HTTPD_STATIC_CACHE( \
+     "\n	-C KBYTES	Size of the file cache (0: off)") \
 	IF_FEATURE_HTTPD_AUTH_MD5( \
      "\n	-m STRING	MD5 crypt STRING") \
      "\n	-e STRING	HTML encode STRING" \
@@ -1950,6 +1985,13 @@
      "\n	-R N	Pause services after N connects/min" \
      "\n		(default: 0 - disabled)" \
 
+#define inflatebench_trivial_usage \
+       "[-n N] FILE.gz..."
+#define inflatebench_full_usage "\n\n" \
+       "Time the table-driven and the classic inflate on FILEs\n" \
+     "\nOptions:" \
+     "\n	-n N	Best of N runs per decoder (default 3)" \
+
 #define init_trivial_usage \
        ""
 #define init_full_usage "\n\n" \
@@ -2333,9 +2375,9 @@
 /*   "\n	-s SIG	Yet another way of specifying SIG" */ \
 
 #define killps_trivial_usage \
-	"DIRECTORY"
+	"DIRECTORY..."
 #define killps_full_usage "\n\n" \
-	"Kill processes by file descriptors in specified directory"
+	"Kill processes by file descriptors in specified directories"
 
 #define klogd_trivial_usage \
        "[-c N] [-n]"
@@ -2448,11 +2490,14 @@
        "root\n"
 
 #define logread_trivial_usage \
-       "[OPTIONS]"
+       "[-f] [-s TIME] [-p PRIO]"
 #define logread_full_usage "\n\n" \
        "Show messages in syslogd's circular buffer\n" \
      "\nOptions:" \
      "\n	-f	Output data as log grows" \
+     "\n	-s TIME	Only messages logged since TIME" \
+     "\n		(@SECONDS, -N[smhd] ago, hh:mm[:ss], YYYY-MM-DD hh:mm)" \
+     "\n	-p PRIO	Only messages of priority PRIO (0-7 or name) or higher" \
 
 #define losetup_trivial_usage \
        "[-o OFS] LOOPDEV FILE - associate loop devices\n" \
@@ -2691,6 +2736,9 @@
      "\n	-c	Check sums against given list" \
      "\n	-s	Don't output anything, status code shows success" \
      "\n	-w	Warn about improperly formatted checksum lines" \
+	IF_FEATURE_MD5_SHA1_SUM_PARALLEL( \
+     "\n	-j N	Hash N files in parallel" \
+	) \
 	)
 
 #define md5sum_example_usage \
@@ -2713,6 +2761,9 @@
      "\n	-c	Check sums against given list" \
      "\n	-s	Don't output anything, status code shows success" \
      "\n	-w	Warn about improperly formatted checksum lines" \
+	IF_FEATURE_MD5_SHA1_SUM_PARALLEL( \
+     "\n	-j N	Hash N files in parallel" \
+	) \
 	)
 
 #define sha256sum_trivial_usage \
@@ -2725,6 +2776,9 @@
      "\n	-c	Check sums against given list" \
      "\n	-s	Don't output anything, status code shows success" \
      "\n	-w	Warn about improperly formatted checksum lines" \
+	IF_FEATURE_MD5_SHA1_SUM_PARALLEL( \
+     "\n	-j N	Hash N files in parallel" \
+	) \
 	)
 
 #define sha512sum_trivial_usage \
@@ -2737,12 +2791,19 @@
      "\n	-c	Check sums against given list" \
      "\n	-s	Don't output anything, status code shows success" \
      "\n	-w	Warn about improperly formatted checksum lines" \
+	IF_FEATURE_MD5_SHA1_SUM_PARALLEL( \
+     "\n	-j N	Hash N files in parallel" \
+	) \
 	)
 
 #define mdev_trivial_usage \
-       "[-s]"
+       "[-s]" IF_FEATURE_MDEV_DAEMON(" | [-df]")
 #define mdev_full_usage "\n\n" \
        "	-s	Scan /sys and populate /dev during system boot\n" \
+	IF_FEATURE_MDEV_DAEMON( \
+       "	-d	Daemon, listen on netlink (does -s first)\n" \
+       "	-f	Run daemon in foreground\n" \
+	) \
        "\n" \
        "It can be run by kernel as a hotplug helper. To activate it:\n" \
        " echo /sbin/mdev > /proc/sys/kernel/hotplug\n" \
@@ -4141,7 +4202,17 @@
      "\n	-u	Suppress duplicate lines" \
 	IF_FEATURE_SORT_BIG( \
      "\n	-z	Lines are terminated by NUL, not newline" \
-     "\n	-mST	Ignored for GNU compatibility") \
+	) \
+	IF_FEATURE_SORT_EXTERNAL( \
+     "\n	-m	Merge already sorted files" \
+     "\n	-S SIZE	Keep at most SIZE in memory (suffix b,K,M,G,%)" \
+     "\n	-T DIR	Directory for temporary files" \
+	IF_LONG_OPTS( \
+     "\n	--parallel N	Sort up to N runs at once" \
+	) \
+	) \
+	IF_FEATURE_SORT_BIG(IF_NOT_FEATURE_SORT_EXTERNAL( \
+     "\n	-mST	Ignored for GNU compatibility")) \
 
 #define sort_example_usage \
        "$ echo -e \"e\\nf\\nb\\nd\\nc\\na\" | sort\n" \
@@ -4389,9 +4460,15 @@
      "\n	-c DEV	Reopen stdio to DEV after switch" \
 
 #define synodd_trivial_usage \
-	"DEVICE_LIST ..."
+	"[-r] [-w] [-q DEPTH] [-c DIR] DEVICE_LIST ..."
 #define synodd_full_usage "\n\n" \
-	"Example:" \
+	"Read or write whole devices, concurrently\n" \
+     "\nOptions:" \
+     "\n	-r	Read" \
+     "\n	-w	Write zeroes (default)" \
+     "\n	-q DEPTH	1M I/Os in flight per device" \
+     "\n	-c DIR	Keep checkpoints in DIR, resume from them" \
+	"\n\nExample:" \
 	"\n	$ synodd /dev/hda" \
 	"\n	$ synodd /dev/sda1 /dev/sda2 ..."
 
@@ -5221,7 +5298,7 @@
        "Repeatedly output a line with STRING, or 'y'"
 
 #define zcat_trivial_usage \
-       "FILE"
+       IF_FEATURE_SEEK_INDEX("[-O OFS] ") "FILE"
 #define zcat_full_usage "\n\n" \
        "Uncompress to stdout"
 
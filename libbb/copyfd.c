@@ -8,12 +8,124 @@
  */
 
 #include "libbb.h"
+#if ENABLE_FEATURE_USE_SENDFILE
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+# ifndef SPLICE_F_MOVE
+#  define SPLICE_F_MOVE 1
+# endif
+# ifndef SPLICE_F_MORE
+#  define SPLICE_F_MORE 4
+# endif
+#endif
+
+/* Bytes moved by each copy method during the last bb_copyfd_XX call */
+off_t bb_copyfd_stats[COPYFD_NUM_METHODS];
+
+#if ENABLE_FEATURE_USE_SENDFILE
+/*
+ * Kernel-side copy, so that data never visits our buffer.
+ * Methods are tried in order of preference:
+ * copy_file_range (file -> file, fs may reflink or copy server-side),
+ * sendfile (file -> anything), splice (pipe on either end,
+ * or socket -> regular file through a private pipe).
+ * A method which fails or returns 0 is dropped for the rest
+ * of the call: some pseudo-filesystems (e.g. /proc) report 0 instead
+ * of an error, so EOF is always confirmed by read/write loop,
+ * which also reports real I/O errors.
+ *
+ * Chunk size is moderate so that ^C of a huge copy is not delayed.
+ * Needs to be >= max(CONFIG_FEATURE_COPYBUF_KB), or else
+ * "copy to eof" will make needlessly short transfers.
+ */
+#define KERNEL_COPY_CHUNK (16*1024*1024)
+
+static int first_kernel_method(int src_fd, int dst_fd, int *need_pipe)
+{
+	struct stat src_st, dst_st;
+
+	if (dst_fd < 0 /* fake, just eat the data */
+	 || fstat(src_fd, &src_st) != 0
+	 || fstat(dst_fd, &dst_st) != 0
+	) {
+		return COPYFD_READ_WRITE;
+	}
+	if (S_ISFIFO(src_st.st_mode) || S_ISFIFO(dst_st.st_mode))
+		return COPYFD_SPLICE;
+	if (S_ISSOCK(src_st.st_mode) && S_ISREG(dst_st.st_mode)
+	 /* splice to O_APPEND file fails with EINVAL */
+	 && !(fcntl(dst_fd, F_GETFL) & O_APPEND)
+	) {
+		/* e.g. network uploads */
+		*need_pipe = 1;
+		return COPYFD_SPLICE;
+	}
+	if (!S_ISREG(src_st.st_mode) && !S_ISBLK(src_st.st_mode))
+		return COPYFD_READ_WRITE;
+	if (S_ISREG(src_st.st_mode) && S_ISREG(dst_st.st_mode))
+		return COPYFD_COPY_FILE_RANGE;
+	return COPYFD_SENDFILE;
+}
+
+static ssize_t kernel_copy(int method, int src_fd, int dst_fd, size_t len)
+{
+	switch (method) {
+# ifdef __NR_copy_file_range
+	case COPYFD_COPY_FILE_RANGE:
+		return syscall(__NR_copy_file_range, src_fd, NULL, dst_fd, NULL, len, 0);
+# endif
+	case COPYFD_SENDFILE:
+		return sendfile(dst_fd, src_fd, NULL, len);
+	case COPYFD_SPLICE:
+		return splice(src_fd, NULL, dst_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+	}
+	errno = ENOSYS;
+	return -1;
+}
+
+/* splice from socket to pipe, then from pipe to dst_fd.
+ * Returns bytes taken from socket, *out tells how many of them
+ * went on to dst_fd (the rest is still in the pipe) */
+static ssize_t splice_via_pipe(int pipe_fds[2], int src_fd, int dst_fd, size_t len,
+		size_t *out)
+{
+	ssize_t rd, wr;
+
+	*out = 0;
+	rd = splice(src_fd, NULL, pipe_fds[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+	while (rd > 0 && *out < (size_t)rd) {
+		wr = splice(pipe_fds[0], NULL, dst_fd, NULL, rd - *out, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (wr > 0)
+			*out += wr;
+		else if (wr == 0 || errno != EINTR)
+			break;
+	}
+	return rd;
+}
+
+/* dst_fd does not take splice: pass on the data stuck in the pipe */
+static int drain_pipe(int pipe_rd, int dst_fd, size_t len,
+		char *buffer, size_t buffer_size)
+{
+	while (len != 0) {
+		ssize_t rd = safe_read(pipe_rd, buffer, MIN(buffer_size, len));
+		if (rd <= 0 || full_write(dst_fd, buffer, rd) != rd)
+			return -1;
+		len -= rd;
+	}
+	return 0;
+}
+#endif
 
 /* Used by NOFORK applets (e.g. cat) - must not use xmalloc */
 
 static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 {
 	int status = -1;
+	int method = COPYFD_READ_WRITE;
+#if ENABLE_FEATURE_USE_SENDFILE
+	int pipe_fds[2] = { -1, -1 };
+#endif
 	off_t total = 0;
 #if CONFIG_FEATURE_COPYBUF_KB <= 4
 	char buffer[CONFIG_FEATURE_COPYBUF_KB * 1024];
@@ -35,6 +147,8 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 	}
 #endif
 
+	memset(bb_copyfd_stats, 0, sizeof(bb_copyfd_stats));
+
 	if (src_fd < 0)
 		goto out;
 
@@ -42,10 +156,54 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 		size = buffer_size;
 		status = 1; /* copy until eof */
 	}
+#if ENABLE_FEATURE_USE_SENDFILE
+	{
+		int need_pipe = 0;
+		method = first_kernel_method(src_fd, dst_fd, &need_pipe);
+		if (need_pipe && pipe(pipe_fds) != 0)
+			method = COPYFD_READ_WRITE;
+	}
+#endif
 
 	while (1) {
 		ssize_t rd;
 
+#if ENABLE_FEATURE_USE_SENDFILE
+		if (method != COPYFD_READ_WRITE) {
+			size_t len = KERNEL_COPY_CHUNK;
+			if (status < 0 && size < len)
+				len = size;
+			if (pipe_fds[0] >= 0) {
+				size_t out;
+
+				rd = splice_via_pipe(pipe_fds, src_fd, dst_fd, len, &out);
+				if (rd > 0 && out < (size_t)rd) {
+					/* Don't try again, use read/write from now on */
+					if (drain_pipe(pipe_fds[0], dst_fd, rd - out, buffer, buffer_size) != 0) {
+						bb_perror_msg(bb_msg_write_error);
+						break;
+					}
+					close(pipe_fds[0]);
+					close(pipe_fds[1]);
+					pipe_fds[0] = -1;
+					method = COPYFD_READ_WRITE;
+					bb_copyfd_stats[COPYFD_SPLICE] += out;
+					bb_copyfd_stats[COPYFD_READ_WRITE] += rd - out;
+					goto counted;
+				}
+			} else
+				rd = kernel_copy(method, src_fd, dst_fd, len);
+			if (rd > 0)
+				goto copied;
+			if (rd < 0 && errno == EINTR)
+				continue;
+			/* copy_file_range failed (e.g. cross-fs on old kernel)?
+			 * sendfile can still do it. Otherwise use read/write */
+			method = (method == COPYFD_COPY_FILE_RANGE)
+					? COPYFD_SENDFILE : COPYFD_READ_WRITE;
+			continue;
+		}
+#endif
 		rd = safe_read(src_fd, buffer, size > buffer_size ? buffer_size : size);
 
 		if (!rd) { /* eof - all done */
@@ -64,6 +222,9 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 				break;
 			}
 		}
+ IF_FEATURE_USE_SENDFILE(copied:)
+		bb_copyfd_stats[method] += rd;
+ IF_FEATURE_USE_SENDFILE(counted:)
 		total += rd;
 		if (status < 0) { /* if we aren't copying till EOF... */
 			size -= rd;
@@ -75,6 +236,12 @@ static off_t bb_full_fd_action(int src_fd, int dst_fd, off_t size)
 		}
 	}
  out:
+#if ENABLE_FEATURE_USE_SENDFILE
+	if (pipe_fds[0] >= 0) {
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+	}
+#endif
 
 #if CONFIG_FEATURE_COPYBUF_KB > 4
 	if (buffer_size != 4 * 1024)
@@ -18,6 +18,14 @@
 
 #include "libbb.h"
 
+#if ENABLE_FEATURE_FAST_CRC32 && defined(__x86_64__) && __GNUC_PREREQ(4,9)
+# define CRC32_PCLMUL 1
+# include <cpuid.h>
+# include <wmmintrin.h>
+#else
+# define CRC32_PCLMUL 0
+#endif
+
 uint32_t* FAST_FUNC crc32_filltable(uint32_t *crc_table, int endian)
 {
 	uint32_t polynomial = endian ? 0x04c11db7 : 0xedb88320;
@@ -40,3 +48,270 @@ uint32_t* FAST_FUNC crc32_filltable(uint32_t *crc_table, int endian)
 
 	return crc_table - 256;
 }
+
+#if ENABLE_FEATURE_FAST_CRC32
+/* Slice-by-8: table k (of 8) holds the crc of a byte followed by k zero
+ * bytes, so 8 input bytes are folded in with 8 independent lookups. */
+static uint32_t *crc32_table8[2];
+smallint crc32_impl;
+
+# if CRC32_PCLMUL
+/* Carry-less multiply folding of the bit-reflected crc (Intel's
+ * "Fast CRC Computation Using PCLMULQDQ", as in zlib and Linux).
+ * len >= 64 and a multiple of 16. */
+static uint32_t __attribute__((target("pclmul")))
+crc32_pclmul(uint32_t crc, const uint8_t *buf, unsigned len)
+{
+	static const uint64_t k1k2[2] ALIGNED(16) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64_t k3k4[2] ALIGNED(16) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64_t k5k0[2] ALIGNED(16) = { 0x0163cd6124ULL, 0 };
+	static const uint64_t poly[2] ALIGNED(16) = { 0x01db710641ULL, 0x01f7011641ULL };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	buf += 64;
+	len -= 64;
+
+	/* Fold four 128-bit lanes in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold the lanes into one */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/* 128 -> 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+# endif
+
+static const uint32_t *crc32_get_table(int endian)
+{
+	uint32_t *t = crc32_table8[endian];
+	uint32_t c;
+	int i;
+
+	if (t)
+		return t;
+	t = crc32_filltable(xmalloc(8 * 256 * sizeof(t[0])), endian);
+	for (i = 256; i < 8 * 256; i++) {
+		c = t[i - 256];
+		t[i] = endian ? (c << 8) ^ t[c >> 24] : (c >> 8) ^ t[c & 0xff];
+	}
+	crc32_table8[endian] = t;
+
+	if (!crc32_impl) {
+		crc32_impl = CRC32_IMPL_SLICE8;
+# if CRC32_PCLMUL
+		{
+			unsigned eax, ebx, ecx, edx;
+			if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL))
+				crc32_impl = CRC32_IMPL_PCLMUL;
+		}
+# endif
+	}
+	return t;
+}
+
+uint32_t FAST_FUNC crc32_block_endian0(uint32_t val, const void *buf, unsigned len)
+{
+	const uint8_t *p = buf;
+	const uint32_t *t = crc32_get_table(0);
+	uint32_t a, b;
+
+# if CRC32_PCLMUL
+	if (crc32_impl == CRC32_IMPL_PCLMUL && len >= 64) {
+		unsigned n = len & ~15;
+		val = crc32_pclmul(val, p, n);
+		p += n;
+		len -= n;
+	}
+# endif
+	if (crc32_impl >= CRC32_IMPL_SLICE8) {
+		while (len >= 8) {
+			move_from_unaligned32(a, p);
+			move_from_unaligned32(b, p + 4);
+			a = SWAP_LE32(a) ^ val;
+			b = SWAP_LE32(b);
+			val = t[7*256 + (a & 0xff)] ^ t[6*256 + ((a >> 8) & 0xff)]
+			    ^ t[5*256 + ((a >> 16) & 0xff)] ^ t[4*256 + (a >> 24)]
+			    ^ t[3*256 + (b & 0xff)] ^ t[2*256 + ((b >> 8) & 0xff)]
+			    ^ t[1*256 + ((b >> 16) & 0xff)] ^ t[b >> 24];
+			p += 8;
+			len -= 8;
+		}
+	}
+	while (len--)
+		val = t[(uint8_t)val ^ *p++] ^ (val >> 8);
+	return val;
+}
+
+uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned len)
+{
+	const uint8_t *p = buf;
+	const uint32_t *t = crc32_get_table(1);
+	uint32_t a, b;
+
+	if (crc32_impl >= CRC32_IMPL_SLICE8) {
+		while (len >= 8) {
+			move_from_unaligned32(a, p);
+			move_from_unaligned32(b, p + 4);
+			a = SWAP_BE32(a) ^ val;
+			b = SWAP_BE32(b);
+			val = t[7*256 + (a >> 24)] ^ t[6*256 + ((a >> 16) & 0xff)]
+			    ^ t[5*256 + ((a >> 8) & 0xff)] ^ t[4*256 + (a & 0xff)]
+			    ^ t[3*256 + (b >> 24)] ^ t[2*256 + ((b >> 16) & 0xff)]
+			    ^ t[1*256 + ((b >> 8) & 0xff)] ^ t[b & 0xff];
+			p += 8;
+			len -= 8;
+		}
+	}
+	while (len--)
+		val = (val << 8) ^ t[(val >> 24) ^ *p++];
+	return val;
+}
+
+#else /* !FEATURE_FAST_CRC32 */
+
+static uint32_t *crc32_table[2];
+
+uint32_t FAST_FUNC crc32_block_endian0(uint32_t val, const void *buf, unsigned len)
+{
+	const uint8_t *p = buf;
+	const uint32_t *t = crc32_table[0];
+
+	if (!t)
+		t = crc32_table[0] = crc32_filltable(NULL, 0);
+	while (len--)
+		val = t[(uint8_t)val ^ *p++] ^ (val >> 8);
+	return val;
+}
+
+uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned len)
+{
+	const uint8_t *p = buf;
+	const uint32_t *t = crc32_table[1];
+
+	if (!t)
+		t = crc32_table[1] = crc32_filltable(NULL, 1);
+	while (len--)
+		val = (val << 8) ^ t[(val >> 24) ^ *p++];
+	return val;
+}
+
+#endif
+
+/* crc32(A+B) from crc32(A), crc32(B) and the length of B, for the
+ * little-endian (gzip) crc: len2 zero bytes are applied to crc1 by
+ * squaring a GF(2) operator matrix, as in zlib */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	while (vec) {
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+uint32_t FAST_FUNC crc32_combine(uint32_t crc1, uint32_t crc2, off_t len2)
+{
+	uint32_t even[32];	/* even-power-of-two zeros operator */
+	uint32_t odd[32];	/* odd-power-of-two zeros operator */
+	uint32_t row;
+	int n;
+
+	if (len2 <= 0)
+		return crc1;
+
+	/* operator for one zero bit */
+	odd[0] = 0xedb88320;
+	row = 1;
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+	gf2_matrix_square(even, odd);	/* two zero bits */
+	gf2_matrix_square(odd, even);	/* four zero bits */
+
+	/* the first square below makes the one-zero-byte operator */
+	while (1) {
+		gf2_matrix_square(even, odd);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if (len2 == 0)
+			break;
+		gf2_matrix_square(odd, even);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+		if (len2 == 0)
+			break;
+	}
+	return crc1 ^ crc2;
+}
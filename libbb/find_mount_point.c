@@ -12,7 +12,6 @@
 
 #ifdef MY_ABC_HERE
 #include "synobusybox.h"
-#include <glob.h>
 #include <syslog.h>
 #include <limits.h>
 #define  SYNO_PROC_PREFIX        "/proc"
@@ -21,9 +20,6 @@
 #else
 #define  SYNO_PROC_PS_NAME       "cmdline"
 #endif
-#define  SYNO_PROC_CWD_PATH      SYNO_PROC_PREFIX"/*/cwd"
-#define  SYNO_PROC_EXE_PATH      SYNO_PROC_PREFIX"/*/exe"
-#define  SYNO_PROC_FD_PATH       SYNO_PROC_PREFIX"/*/fd/*"
 #define SYNO_UNMOUNT_RETRY_KILL_PROCESS	 	30
 #define SYNO_UNMOUNT_RETRY_KILL_ALL		45
 #define SYNO_UNMOUNT_RETRY_MAX			60
@@ -118,112 +114,295 @@ ErrOut:
 	return ret;
 }
 
-static void do_killall(const char *szProcessName, int blSigSendKill)
+/* One process holding a volume: found via exe, cwd, root, an open fd
+ * or a mapped file under the mount point */
+typedef struct proc_holder {
+	struct proc_holder *next;
+	int idx;                /* into snapshot's pid table */
+	char *szPath;           /* what it holds, for the log */
+} proc_holder_t;
+
+/* Result of a single pass over /proc, indexed by mount point */
+typedef struct proc_snapshot {
+	int cPids;
+	pid_t *pids;
+	char **pszNames;        /* comm of every pid, read on first killall */
+	int cVols;
+	char **pszVols;         /* mount points, no trailing '/' */
+	proc_holder_t **pHolders; /* pHolders[i]: who holds pszVols[i] */
+} proc_snapshot_t;
+
+static void snapshot_add_target(proc_snapshot_t *pSnap, int idx, const char *szPath)
 {
-	pid_t *pl;
-	pid_t* pidList;
+	int i;
 
-	pidList = find_pid_by_name(szProcessName);
-	for (pl = pidList; *pl; pl++) {
-		if (0 == *pl) {
-			break;
+	for (i = 0; i < pSnap->cVols; i++) {
+		int dirLen = strlen(pSnap->pszVols[i]);
+		proc_holder_t *pHolder;
+
+		if (strncmp(pSnap->pszVols[i], szPath, dirLen)) {
+			continue;
 		}
-		kill(*pl, blSigSendKill?SIGKILL:SIGTERM);
+		if (('\0' != szPath[dirLen]) && ('/' != szPath[dirLen])) {
+			continue;
+		}
+		/* pids are scanned one by one: a repeat is always at the head */
+		if (pSnap->pHolders[i] && pSnap->pHolders[i]->idx == idx) {
+			continue;
+		}
+		pHolder = xmalloc(sizeof(*pHolder));
+		pHolder->idx = idx;
+		pHolder->szPath = xstrdup(szPath);
+		pHolder->next = pSnap->pHolders[i];
+		pSnap->pHolders[i] = pHolder;
 	}
-	free(pidList);
 }
 
-static int do_kill_process(const char *szDir, const char *szGlobPath, int blKillAll, int blSigSendKill)
+static void snapshot_add_link(proc_snapshot_t *pSnap, int idx, const char *szLink)
 {
-	int           ret = 0;
-	int           killPid = 0;
-	size_t        i = 0;
-	int           dirLen = 0;
-	char          szFilePath[PATH_MAX];
-	char          szProcessName[PATH_MAX];
-	glob_t        globBuff;
-
-	memset(&globBuff, 0, sizeof(globBuff));
-	if (0 != glob(szGlobPath, GLOB_DOOFFS, NULL, &globBuff)) {
-		return ret;
-	}
-	dirLen = strlen(szDir);
-	for (i = 0; i < globBuff.gl_pathc; i++) {
-		memset(&szFilePath, 0, sizeof(szFilePath));
-		if (-1 == readlink(globBuff.gl_pathv[i], szFilePath, sizeof(szFilePath))) {
-			continue;
+	char szPath[PATH_MAX];
+	ssize_t len;
+
+	len = readlink(szLink, szPath, sizeof(szPath) - 1);
+	if (len <= 0) {
+		return;
+	}
+	szPath[len] = '\0';
+	snapshot_add_target(pSnap, idx, szPath);
+}
+
+static void snapshot_scan_pid(proc_snapshot_t *pSnap, int idx)
+{
+	char szProcPath[sizeof(SYNO_PROC_PREFIX"/%u/fd/") + sizeof(int)*3 + sizeof(int)*3];
+	char szLine[PATH_MAX + 128];
+	unsigned pid = pSnap->pids[idx];
+	struct dirent *ent;
+	DIR *dir;
+	FILE *fp;
+	int len;
+
+	sprintf(szProcPath, SYNO_PROC_PREFIX"/%u/exe", pid);
+	snapshot_add_link(pSnap, idx, szProcPath);
+	sprintf(szProcPath, SYNO_PROC_PREFIX"/%u/cwd", pid);
+	snapshot_add_link(pSnap, idx, szProcPath);
+	sprintf(szProcPath, SYNO_PROC_PREFIX"/%u/root", pid);
+	snapshot_add_link(pSnap, idx, szProcPath);
+
+	len = sprintf(szProcPath, SYNO_PROC_PREFIX"/%u/fd/", pid);
+	dir = opendir(szProcPath);
+	if (dir) {
+		while ((ent = readdir(dir)) != NULL) {
+			if (!isdigit(ent->d_name[0]))
+				continue;
+			safe_strncpy(szProcPath + len, ent->d_name, sizeof(szProcPath) - len);
+			snapshot_add_link(pSnap, idx, szProcPath);
 		}
-		if (strncmp(szDir, szFilePath, dirLen)) {
-			continue;
+		closedir(dir);
+	}
+
+	/* mmapped files (libraries, databases) keep the volume busy too */
+	sprintf(szProcPath, SYNO_PROC_PREFIX"/%u/maps", pid);
+	fp = fopen_for_read(szProcPath);
+	if (fp) {
+		while (fgets(szLine, sizeof(szLine), fp)) {
+			char *szFile = strchr(szLine, '/');
+			if (!szFile)
+				continue;
+			strchrnul(szFile, '\n')[0] = '\0';
+			snapshot_add_target(pSnap, idx, szFile);
 		}
-		if (('\0' != szFilePath[dirLen]) && ('/' != szFilePath[dirLen])) {
-			continue;
+		fclose(fp);
+	}
+}
+
+/* Walk /proc once and find out who holds any of the given mount points */
+static proc_snapshot_t *snapshot_scan(const char *const *pszDirs, int cDirs)
+{
+	proc_snapshot_t *pSnap;
+	pid_t self = getpid();
+	struct dirent *ent;
+	DIR *dir;
+	int i;
+
+	pSnap = xzalloc(sizeof(*pSnap));
+	pSnap->cVols = cDirs;
+	pSnap->pszVols = xmalloc(cDirs * sizeof(pSnap->pszVols[0]));
+	pSnap->pHolders = xzalloc(cDirs * sizeof(pSnap->pHolders[0]));
+	for (i = 0; i < cDirs; i++) {
+		int dirLen;
+
+		pSnap->pszVols[i] = xstrdup(pszDirs[i]);
+		dirLen = strlen(pSnap->pszVols[i]);
+		if (dirLen > 1 && '/' == pSnap->pszVols[i][dirLen-1]) {
+			pSnap->pszVols[i][dirLen-1] = '\0';
 		}
-		if (1 != sscanf(globBuff.gl_pathv[i], "/proc/%d/", &killPid)) {
+	}
+
+	dir = opendir(SYNO_PROC_PREFIX);
+	if (!dir) {
+		return pSnap;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		unsigned pid = bb_strtou(ent->d_name, NULL, 10);
+		if (errno || (pid_t)pid == self)
 			continue;
+		pSnap->pids = xrealloc_vector(pSnap->pids, 6, pSnap->cPids);
+		pSnap->pids[pSnap->cPids] = pid;
+		snapshot_scan_pid(pSnap, pSnap->cPids);
+		pSnap->cPids++;
+	}
+	closedir(dir);
+
+	return pSnap;
+}
+
+static void snapshot_free(proc_snapshot_t *pSnap)
+{
+	int i;
+
+	for (i = 0; i < pSnap->cVols; i++) {
+		proc_holder_t *pHolder = pSnap->pHolders[i];
+		while (pHolder) {
+			proc_holder_t *pNext = pHolder->next;
+			free(pHolder->szPath);
+			free(pHolder);
+			pHolder = pNext;
 		}
-		if (0 > get_process_name(killPid, szProcessName, sizeof(szProcessName))) {
-			continue;
+		free(pSnap->pszVols[i]);
+	}
+	if (pSnap->pszNames) {
+		for (i = 0; i < pSnap->cPids; i++) {
+			free(pSnap->pszNames[i]);
+		}
+		free(pSnap->pszNames);
+	}
+	free(pSnap->pHolders);
+	free(pSnap->pszVols);
+	free(pSnap->pids);
+	free(pSnap);
+}
+
+static const char *snapshot_name(proc_snapshot_t *pSnap, int idx)
+{
+	char szProcessName[PATH_MAX];
+
+	if (!pSnap->pszNames) {
+		pSnap->pszNames = xzalloc(pSnap->cPids * sizeof(pSnap->pszNames[0]));
+	}
+	if (!pSnap->pszNames[idx]) {
+		if (0 > get_process_name(pSnap->pids[idx], szProcessName, sizeof(szProcessName))) {
+			return NULL;
+		}
+		pSnap->pszNames[idx] = xstrdup(szProcessName);
+	}
+	return pSnap->pszNames[idx];
+}
+
+/* Names are comm, or argv0 on old kernels */
+#if SYNO_HAVE_KERNEL_VERSION(2,6,38)
+#define SYNO_PS_BASENAME(name)  (name)
+#else
+#define SYNO_PS_BASENAME(name)  bb_basename(name)
+#endif
+
+/*
+ * Kill the processes with the same name, over the snapshot.
+ * Like find_pid_by_name(), comm or the basename of argv0 must
+ * match in full: argv0 prefixes are shared by whole directories
+ * of daemons.
+ */
+static void do_killall(proc_snapshot_t *pSnap, const char *szProcessName, int blSigSendKill)
+{
+	int i;
+	const char *szBase = SYNO_PS_BASENAME(szProcessName);
+
+	for (i = 0; i < pSnap->cPids; i++) {
+		const char *szName = snapshot_name(pSnap, i);
+		if (szName && 0 == strcmp(SYNO_PS_BASENAME(szName), szBase)) {
+			kill(pSnap->pids[i], blSigSendKill?SIGKILL:SIGTERM);
+		}
+	}
+}
+
+static int do_kill_process(proc_snapshot_t *pSnap, int vol, int blKillAll, int blSigSendKill)
+{
+	int ret = 0;
+	proc_holder_t *pHolder;
+
+	for (pHolder = pSnap->pHolders[vol]; pHolder; pHolder = pHolder->next) {
+		const char *szProcessName = snapshot_name(pSnap, pHolder->idx);
+
+		if (!szProcessName) {
+			continue; /* already gone */
 		}
-		if (0 != kill((pid_t)killPid, blSigSendKill?SIGKILL:SIGTERM)) {
-			syslog(LOG_ERR, "Failed to kill the process \"%s\" with %s failed.", szProcessName, szFilePath);
+		if (0 != kill(pSnap->pids[pHolder->idx], blSigSendKill?SIGKILL:SIGTERM)) {
+			syslog(LOG_ERR, "Failed to kill the process \"%s\" with %s failed.", szProcessName, pHolder->szPath);
 		} else {
-			syslog(LOG_ERR, "Kill the process \"%s\" with %s.", szProcessName, szFilePath);
+			syslog(LOG_ERR, "Kill the process \"%s\" with %s.", szProcessName, pHolder->szPath);
 		}
 		if (blKillAll) {
-			do_killall(szProcessName, blSigSendKill);
+			do_killall(pSnap, szProcessName, blSigSendKill);
 		}
 		ret = 1;
 	}
-
-	globfree(&globBuff);
 	return ret;
 }
 
 /**
  * Kill all the processes which get the files
- * on the target volume.
- * It will retry if the volume is still not clean. (max 
- * SYNO_UNMOUNT_MAX_RETRY) 
- * 
- * @param szDir  target volume path
- * 
- * @return 
+ * on the target volumes.
+ * One pass over /proc per retry serves all the volumes.
+ * It will retry if a volume is still not clean. (max
+ * SYNO_UNMOUNT_MAX_RETRY)
+ *
+ * @param pszDirs  target volume paths
+ * @param cDirs    number of volumes
  */
-void FAST_FUNC kill_process_for_umount(const char *szDir)
+void FAST_FUNC kill_process_for_umount_list(const char *const *pszDirs, int cDirs)
 {
 	int cRetry = 0;
 	int blSendKill = 0, blKillall = 0;
-	int dirLen = 0;
-	int ret_exe = 0, ret_cwd = 0, ret_fd = 0;
-	char szVolumePrefix[PATH_MAX];
+	int i, ret;
+	proc_snapshot_t *pSnap;
 
-	if (!szDir) {
+	if (!pszDirs || cDirs <= 0) {
 		return;
 	}
-	dirLen = strlen(szDir);
-	snprintf(szVolumePrefix, sizeof(szVolumePrefix), "%s", szDir);
-	if ('/' == szVolumePrefix[dirLen-1]) {
-		szVolumePrefix[dirLen-1] = '\0';
-	}
 	while (cRetry <= SYNO_UNMOUNT_RETRY_MAX) {
 		if (cRetry == SYNO_UNMOUNT_RETRY_KILL_PROCESS) {
-			syslog(LOG_ERR, "umount %s start to send kill process.", szDir);
+			syslog(LOG_ERR, "umount %s start to send kill process.", pszDirs[0]);
 			blSendKill = 1;
 		}
 		if (cRetry == SYNO_UNMOUNT_RETRY_KILL_ALL) {
-			syslog(LOG_ERR, "umount %s start to send kill all processes.", szDir);
+			syslog(LOG_ERR, "umount %s start to send kill all processes.", pszDirs[0]);
 			blKillall = 1;
 		}
-		ret_exe = do_kill_process(szVolumePrefix, SYNO_PROC_EXE_PATH, blKillall, blSendKill);
-		ret_cwd = do_kill_process(szVolumePrefix, SYNO_PROC_CWD_PATH, blKillall, blSendKill);
-		ret_fd = do_kill_process(szVolumePrefix, SYNO_PROC_FD_PATH, blKillall, blSendKill);
-		if (!(ret_exe || ret_cwd || ret_fd)) {
+		pSnap = snapshot_scan(pszDirs, cDirs);
+		ret = 0;
+		for (i = 0; i < cDirs; i++) {
+			ret |= do_kill_process(pSnap, i, blKillall, blSendKill);
+		}
+		snapshot_free(pSnap);
+		if (!ret) {
 			break;
 		}
 		sleep(1);
 		cRetry++;
 	}
 }
+
+/**
+ * Kill all the processes which get the files
+ * on the target volume.
+ *
+ * @param szDir  target volume path
+ */
+void FAST_FUNC kill_process_for_umount(const char *szDir)
+{
+	if (!szDir) {
+		return;
+	}
+	kill_process_for_umount_list(&szDir, 1);
+}
 #endif
 
@@ -30,6 +30,14 @@
 
 #include "libbb.h"
 
+#if ENABLE_FEATURE_SHA_NI && defined(__x86_64__) && __GNUC_PREREQ(4,9)
+# define SHA_NI 1
+# include <cpuid.h>
+# include <immintrin.h>
+#else
+# define SHA_NI 0
+#endif
+
 #define rotl32(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
 #define rotr32(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
 /* for sha512: */
@@ -307,6 +315,176 @@ static void FAST_FUNC sha512_process_block128(sha512_ctx_t *ctx)
 	ctx->hash[7] += h;
 }
 
+#if SHA_NI
+/* x86-64 SHA extensions (SHA-NI), selected at run time by sha1_begin
+ * and sha256_begin. The round structure follows Intel's reference code.
+ */
+static smallint sha_ni_state; /* 0: not checked yet, 1: have it, -1: don't */
+
+static int have_sha_ni(void)
+{
+	if (!sha_ni_state) {
+		unsigned eax, ebx, ecx, edx;
+
+		sha_ni_state = -1;
+		if (__get_cpuid_max(0, NULL) >= 7) {
+			__cpuid_count(7, 0, eax, ebx, ecx, edx);
+			if (ebx & bit_SHA) {
+				__cpuid(1, eax, ebx, ecx, edx);
+				if ((ecx & bit_SSSE3) && (ecx & bit_SSE4_1))
+					sha_ni_state = 1;
+			}
+		}
+	}
+	return sha_ni_state > 0;
+}
+
+static void FAST_FUNC __attribute__((target("sha,sse4.1")))
+sha1_process_block64_shaNI(sha1_ctx_t *ctx)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	const __m128i *words = (const __m128i *) ctx->wbuffer;
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) ctx->hash), 0x1b);
+	e0 = _mm_set_epi32(ctx->hash[4], 0, 0, 0);
+	abcd_save = abcd;
+	e0_save = e0;
+
+/* Four rounds; m0 holds their W[], its successors are advanced */
+#define QUAD(ea, eb, m0, m1, m2, m3, f) \
+	do { \
+		ea = _mm_sha1nexte_epu32(ea, m0); \
+		eb = abcd; \
+		m1 = _mm_sha1msg2_epu32(m1, m0); \
+		abcd = _mm_sha1rnds4_epu32(abcd, ea, f); \
+		m3 = _mm_sha1msg1_epu32(m3, m0); \
+		m2 = _mm_xor_si128(m2, m0); \
+	} while (0)
+
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(words + 0), mask);
+	e0 = _mm_add_epi32(e0, m0);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(words + 1), mask);
+	e1 = _mm_sha1nexte_epu32(e1, m1);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+	m0 = _mm_sha1msg1_epu32(m0, m1);
+
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(words + 2), mask);
+	e0 = _mm_sha1nexte_epu32(e0, m2);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+	m1 = _mm_sha1msg1_epu32(m1, m2);
+	m0 = _mm_xor_si128(m0, m2);
+
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(words + 3), mask);
+	QUAD(e1, e0, m3, m0, m1, m2, 0);
+	QUAD(e0, e1, m0, m1, m2, m3, 0);
+	QUAD(e1, e0, m1, m2, m3, m0, 1);
+	QUAD(e0, e1, m2, m3, m0, m1, 1);
+	QUAD(e1, e0, m3, m0, m1, m2, 1);
+	QUAD(e0, e1, m0, m1, m2, m3, 1);
+	QUAD(e1, e0, m1, m2, m3, m0, 1);
+	QUAD(e0, e1, m2, m3, m0, m1, 2);
+	QUAD(e1, e0, m3, m0, m1, m2, 2);
+	QUAD(e0, e1, m0, m1, m2, m3, 2);
+	QUAD(e1, e0, m1, m2, m3, m0, 2);
+	QUAD(e0, e1, m2, m3, m0, m1, 2);
+	QUAD(e1, e0, m3, m0, m1, m2, 3);
+	QUAD(e0, e1, m0, m1, m2, m3, 3);
+#undef QUAD
+
+	e1 = _mm_sha1nexte_epu32(e1, m1);
+	e0 = abcd;
+	m2 = _mm_sha1msg2_epu32(m2, m1);
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+	m3 = _mm_xor_si128(m3, m1);
+
+	e0 = _mm_sha1nexte_epu32(e0, m2);
+	e1 = abcd;
+	m3 = _mm_sha1msg2_epu32(m3, m2);
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+	e1 = _mm_sha1nexte_epu32(e1, m3);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+	e0 = _mm_sha1nexte_epu32(e0, e0_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	_mm_storeu_si128((__m128i *) ctx->hash, _mm_shuffle_epi32(abcd, 0x1b));
+	ctx->hash[4] = _mm_extract_epi32(e0, 3);
+}
+
+/* Upper halves of sha_K[], filled by sha256_begin */
+static uint32_t sha256_K[64] ALIGNED(16);
+
+static void FAST_FUNC __attribute__((target("sha,sse4.1")))
+sha256_process_block64_shaNI(sha256_ctx_t *ctx)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	const __m128i *words = (const __m128i *) ctx->wbuffer;
+	const __m128i *K = (const __m128i *) sha256_K;
+	__m128i state0, state1, abef_save, cdgh_save, tmp;
+	__m128i m0, m1, m2, m3;
+	unsigned q;
+
+	/* hash[] is ABCD EFGH, the instructions want ABEF CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &ctx->hash[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &ctx->hash[4]), 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+	abef_save = state0;
+	cdgh_save = state1;
+
+/* Four rounds with message words w */
+#define RNDS4(w, q) \
+	do { \
+		tmp = _mm_add_epi32(w, _mm_load_si128(K + (q))); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, tmp); \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(tmp, 0x0e)); \
+	} while (0)
+/* W[t..t+3] from W[t-16..t-1] in w0..w3, stored over w0 */
+#define SCHED(w0, w1, w2, w3) \
+	(w0 = _mm_sha256msg2_epu32( \
+		_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), \
+		w3))
+
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(words + 0), mask);
+	RNDS4(m0, 0);
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(words + 1), mask);
+	RNDS4(m1, 1);
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(words + 2), mask);
+	RNDS4(m2, 2);
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(words + 3), mask);
+	RNDS4(m3, 3);
+	for (q = 4; q < 16; q += 4) {
+		SCHED(m0, m1, m2, m3);
+		RNDS4(m0, q);
+		SCHED(m1, m2, m3, m0);
+		RNDS4(m1, q + 1);
+		SCHED(m2, m3, m0, m1);
+		RNDS4(m2, q + 2);
+		SCHED(m3, m0, m1, m2);
+		RNDS4(m3, q + 3);
+	}
+#undef RNDS4
+#undef SCHED
+
+	state0 = _mm_add_epi32(state0, abef_save);
+	state1 = _mm_add_epi32(state1, cdgh_save);
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	_mm_storeu_si128((__m128i *) &ctx->hash[0], _mm_blend_epi16(tmp, state1, 0xf0));
+	_mm_storeu_si128((__m128i *) &ctx->hash[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
 
 void FAST_FUNC sha1_begin(sha1_ctx_t *ctx)
 {
@@ -317,6 +495,10 @@ void FAST_FUNC sha1_begin(sha1_ctx_t *ctx)
 	ctx->hash[4] = 0xc3d2e1f0;
 	ctx->total64 = 0;
 	ctx->process_block = sha1_process_block64;
+#if SHA_NI
+	if (have_sha_ni())
+		ctx->process_block = sha1_process_block64_shaNI;
+#endif
 }
 
 static const uint32_t init256[] = {
@@ -347,6 +529,16 @@ void FAST_FUNC sha256_begin(sha256_ctx_t *ctx)
 	memcpy(ctx->hash, init256, sizeof(init256));
 	ctx->total64 = 0;
 	ctx->process_block = sha256_process_block64;
+#if SHA_NI
+	if (have_sha_ni()) {
+		if (!sha256_K[0]) {
+			int i;
+			for (i = 0; i < 64; i++)
+				sha256_K[i] = sha_K[i] >> 32;
+		}
+		ctx->process_block = sha256_process_block64_shaNI;
+	}
+#endif
 }
 
 /* Initialize structure containing state of computation.
@@ -432,7 +624,14 @@ void FAST_FUNC sha1_end(void *resbuf, sha1_ctx_t *ctx)
 			break;
 	}
 
-	in_buf = (ctx->process_block == sha1_process_block64) ? 5 : 8;
+	in_buf = 8;
+	if (ctx->process_block == sha1_process_block64
+#if SHA_NI
+	 || ctx->process_block == sha1_process_block64_shaNI
+#endif
+	) {
+		in_buf = 5;
+	}
 	/* This way we do not impose alignment constraints on resbuf: */
 	if (BB_LITTLE_ENDIAN) {
 		unsigned i;
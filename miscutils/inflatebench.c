@@ -0,0 +1,67 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * inflatebench - compare the table-driven and the classic inflate
+ *
+ * Every .gz FILE is decompressed to /dev/null by both decoders, which
+ * check the gzip CRC and length as usual. Speed is given in megabytes
+ * of compressed input per second.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this tarball for details.
+ */
+#include "libbb.h"
+#include "unarchive.h"
+
+int inflatebench_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
+int inflatebench_main(int argc UNUSED_PARAM, char **argv)
+{
+	static const char impl_names[] ALIGN1 = "fast" "\0" "classic" "\0";
+	unsigned long long t, best[2];
+	struct stat st;
+	int null_fd, fd, impl, i;
+	int rounds = 3;
+	int exitcode = EXIT_SUCCESS;
+
+	opt_complementary = "-1:n+";
+	getopt32(argv, "n:", &rounds);
+	argv += optind;
+
+	null_fd = xopen(bb_dev_null, O_WRONLY);
+	do {
+		fd = xopen(*argv, O_RDONLY);
+		fstat(fd, &st);
+		for (impl = 0; impl <= 1; impl++) {
+			inflate_classic = impl;
+			best[impl] = ULLONG_MAX;
+			for (i = 0; i < rounds; i++) {
+				uint16_t magic;
+				int r;
+
+				xlseek(fd, 0, SEEK_SET);
+				xread(fd, &magic, 2);
+				if (magic != GZIP_MAGIC)
+					bb_error_msg_and_die("%s: not gzip", *argv);
+				t = monotonic_us();
+				r = unpack_gz_stream(fd, null_fd);
+				t = monotonic_us() - t;
+				if (r < 0) {
+					printf("%s %-7s FAILED\n", *argv, nth_string(impl_names, impl));
+					exitcode = EXIT_FAILURE;
+					break;
+				}
+				if (t < best[impl])
+					best[impl] = t;
+			}
+			if (best[impl] != ULLONG_MAX)
+				printf("%s %-7s %6u MB/s\n", *argv, nth_string(impl_names, impl),
+					(unsigned)(st.st_size / (best[impl] ? best[impl] : 1)));
+		}
+		if (best[0] != ULLONG_MAX && best[1] != ULLONG_MAX)
+			printf("%s speedup %u.%02u\n", *argv,
+				(unsigned)(best[1] / (best[0] ? best[0] : 1)),
+				(unsigned)(best[1] * 100 / (best[0] ? best[0] : 1) % 100));
+		close(fd);
+	} while (*++argv);
+	inflate_classic = 0;
+
+	return exitcode;
+}
@@ -51,11 +51,35 @@ struct dns_prop {
 /* element of known name, ip address and reversed ip address */
 struct dns_entry {
 	struct dns_entry *next;
+	struct dns_entry *name_next; /* hash chains, in config file order */
+	struct dns_entry *ip_next;
+	unsigned lineno;        /* first matching line of the file wins */
 	uint32_t ip;
 	char rip[IP_STRING_LEN]; /* length decimal reversed IP */
 	char name[1];
 };
 
+struct globals {
+	/* Zone hashed by lowercased name and by IP */
+	struct dns_entry **name_hash;
+	struct dns_entry **ip_hash;
+	unsigned hash_mask;
+	struct dns_entry *wildcard;     /* first "*" line */
+	/* Statistics, logged on SIGUSR1 */
+	unsigned last_time;
+	unsigned long last_received;
+	unsigned long received;
+	unsigned long answered;
+	unsigned long not_found;
+	unsigned long not_implemented;
+	unsigned long ignored;
+	unsigned long recv_calls;
+};
+#define G (*(struct globals*)&bb_common_bufsiz1)
+struct BUG_G_too_big {
+	char BUG_G_too_big[sizeof(G) <= COMMON_BUFSIZE ? 1 : -1];
+};
+
 #define OPT_verbose (option_mask32)
 
 
@@ -110,6 +134,7 @@ static struct dns_entry *parse_conf_file(const char *fileconf)
 		/*m->next = NULL;*/
 		*nextp = m;
 		nextp = &m->next;
+		m->lineno = parser->lineno;
 
 		m->name[0] = '.';
 		strcpy(m->name + 1, token[0]);
@@ -129,28 +154,107 @@ static struct dns_entry *parse_conf_file(const char *fileconf)
 	return conf_data;
 }
 
+static unsigned hash_name(const char *name)
+{
+	unsigned h = 0;
+
+	while (*name)
+		h = h * 31 + (unsigned char)tolower(*name++);
+	return h & G.hash_mask;
+}
+
+static unsigned hash_ip(uint32_t v32)
+{
+	return (v32 ^ (v32 >> 16)) & G.hash_mask;
+}
+
+static int is_wildcard(struct dns_entry *d)
+{
+	return d->name[0] == 1 && d->name[1] == '*';
+}
+
+/*
+ * Index the records. Chains keep the order of the file,
+ * so that the first of several matching lines is found first.
+ */
+static void hash_conf_data(struct dns_entry *conf_data)
+{
+	struct dns_entry *d;
+	struct dns_entry ***name_tail, ***ip_tail;
+	unsigned count = 0;
+	unsigned size = 16;
+
+	for (d = conf_data; d; d = d->next)
+		count++;
+	while (size < count)
+		size <<= 1;
+	G.hash_mask = size - 1;
+	G.name_hash = xzalloc(size * sizeof(G.name_hash[0]));
+	G.ip_hash = xzalloc(size * sizeof(G.ip_hash[0]));
+	name_tail = xmalloc(size * sizeof(name_tail[0]));
+	ip_tail = xmalloc(size * sizeof(ip_tail[0]));
+	while (size--) {
+		name_tail[size] = &G.name_hash[size];
+		ip_tail[size] = &G.ip_hash[size];
+	}
+
+	for (d = conf_data; d; d = d->next) {
+		unsigned h;
+
+		if (is_wildcard(d)) {
+			/* matches any name, but never an IP */
+			if (!G.wildcard)
+				G.wildcard = d;
+			continue;
+		}
+		h = hash_name(d->name);
+		*name_tail[h] = d;
+		name_tail[h] = &d->name_next;
+		h = hash_ip(ntohl(d->ip));
+		*ip_tail[h] = d;
+		ip_tail[h] = &d->ip_next;
+	}
+	free(name_tail);
+	free(ip_tail);
+}
+
+/*
+ * Parse "4.3.2.1.in-addr.arpa" (in label form) into 1.2.3.4,
+ * host order. Only the first four labels are looked at.
+ */
+static int ptr_query_to_ip(const char *q, uint32_t *v32)
+{
+	int i;
+
+	*v32 = 0;
+	for (i = 0; i < 32; i += 8) {
+		unsigned len = (unsigned char)*q++;
+		unsigned n = 0;
+
+		if (len == 0 || len > 3)
+			return 0;
+		while (len--) {
+			if (!isdigit(*q))
+				return 0;
+			n = n * 10 + (*q++ - '0');
+		}
+		if (n > 255)
+			return 0;
+		*v32 |= n << i;
+	}
+	return 1;
+}
+
 /*
  * Look query up in dns records and return answer if found.
  */
-static char *table_lookup(struct dns_entry *d,
-		uint16_t type,
-		char* query_string)
+static char *table_lookup(uint16_t type, char* query_string)
 {
-	while (d) {
-		unsigned len = d->name[0];
-		/* d->name[len] is the last (non NUL) char */
-#if DEBUG
-		char *p, *q;
-		q = query_string + 1;
-		p = d->name + 1;
-		fprintf(stderr, "%d/%d p:%s q:%s %d\n",
-			(int)strlen(p), len,
-			p, q, (int)strlen(q)
-		);
-#endif
-		if (type == htons(REQ_A)) {
-			/* search by host name */
-			if (len != 1 || d->name[1] != '*') {
+	struct dns_entry *d;
+
+	if (type == htons(REQ_A)) {
+		/* search by host name */
+		for (d = G.name_hash[hash_name(query_string)]; d; d = d->name_next) {
 /* we are lax, hope no name component is ever >64 so that length
  * (which will be represented as 'A','B'...) matches a lowercase letter.
  * Actually, I think false matches are hard to construct.
@@ -160,30 +264,37 @@ static char *table_lookup(struct dns_entry *d,
  * [65+32]<65 same chars>1   <31 same chars>NUL
  * This example seems to be the minimal case when false match occurs.
  */
-				if (strcasecmp(d->name, query_string) != 0)
-					goto next;
-			}
-			return (char *)&d->ip;
+			if (strcasecmp(d->name, query_string) == 0)
+				break;
+		}
+		/* "*" matches everything, unless the name comes first */
+		if (G.wildcard && (!d || G.wildcard->lineno < d->lineno))
+			d = G.wildcard;
+		if (!d)
+			return NULL;
 #if DEBUG
-			fprintf(stderr, "Found IP:%x\n", (int)d->ip);
+		fprintf(stderr, "Found IP:%x\n", (int)d->ip);
 #endif
-			return 0;
-		}
-		/* search by IP-address */
-		if ((len != 1 || d->name[1] != '*')
-		/* we assume (do not check) that query_string
-		 * ends in ".in-addr.arpa" */
-		 && strncmp(d->rip, query_string, strlen(d->rip)) == 0
-		) {
+		return (char *)&d->ip;
+	}
+
+	/* search by IP-address */
+	{
+		uint32_t v32;
+
+		if (!ptr_query_to_ip(query_string, &v32))
+			return NULL;
+		for (d = G.ip_hash[hash_ip(v32)]; d; d = d->ip_next) {
+			/* we assume (do not check) that query_string
+			 * ends in ".in-addr.arpa" */
+			if (strncmp(d->rip, query_string, strlen(d->rip)) == 0) {
 #if DEBUG
-			fprintf(stderr, "Found name:%s\n", d->name);
+				fprintf(stderr, "Found name:%s\n", d->name);
 #endif
-			return d->name;
+				return d->name;
+			}
 		}
- next:
-		d = d->next;
 	}
-
 	return NULL;
 }
 
@@ -347,9 +458,7 @@ Domain name in a message can be represented as either:
    - a pointer
    - a sequence of labels ending with a pointer
  */
-static int process_packet(struct dns_entry *conf_data,
-		uint32_t conf_ttl,
-		uint8_t *buf)
+static int process_packet(uint32_t conf_ttl, uint8_t *buf)
 {
 	char *answstr;
 	struct dns_head *head;
@@ -365,11 +474,13 @@ static int process_packet(struct dns_entry *conf_data,
 	head = (struct dns_head *)buf;
 	if (head->nquer == 0) {
 		bb_error_msg("packet has 0 queries, ignored");
+		G.ignored++;
 		return -1;
 	}
 
 	if (head->flags & htons(0x8000)) { /* QR bit */
 		bb_error_msg("response packet, ignored");
+		G.ignored++;
 		return -1;
 	}
 
@@ -405,7 +516,7 @@ static int process_packet(struct dns_entry *conf_data,
 	/* need to convert lengths to dots before we can use it in non-debug */
 	bb_info_msg("%s", query_string);
 #endif
-	answstr = table_lookup(conf_data, type, query_string);
+	answstr = table_lookup(type, query_string);
 	outr_rlen = 4;
 	if (answstr && type == htons(REQ_PTR)) {
 		/* return a host name */
@@ -418,6 +529,7 @@ static int process_packet(struct dns_entry *conf_data,
 		 * AA = 1 "Authoritative Answer"
 		 * RCODE = 3 "Name Error" */
 		outr_flags = htons(0x8000 | 0x0400 | 3);
+		G.not_found++;
 		goto empty_packet;
 	}
 
@@ -438,8 +550,11 @@ static int process_packet(struct dns_entry *conf_data,
 	outr_flags = htons(0x8000 | 0x0400 | 0);
 	/* we have one answer */
 	head->nansw = htons(1);
+	G.answered++;
 
  empty_packet:
+	if (outr_flags == htons(0x8000 | 4))
+		G.not_implemented++;
 	head->flags |= outr_flags;
 	head->nauth = head->nadd = 0;
 	head->nquer = htons(1); // why???
@@ -447,6 +562,143 @@ static int process_packet(struct dns_entry *conf_data,
 	return answb - buf;
 }
 
+static void log_stats(void)
+{
+	unsigned now = monotonic_sec();
+	unsigned secs = now - G.last_time;
+
+	bb_info_msg("%lu queries in %lu reads: %lu answered, %lu not found,"
+			" %lu not implemented, %lu ignored; %lu queries/s in last %u s",
+			G.received, G.recv_calls,
+			G.answered, G.not_found, G.not_implemented, G.ignored,
+			(G.received - G.last_received) / (secs ? secs : 1), secs);
+	G.last_time = now;
+	G.last_received = G.received;
+}
+
+#if ENABLE_FEATURE_DNSD_BATCH_IO
+/* Queries read (and replies sent) by one syscall */
+enum { BATCH_SIZE = 16 };
+
+struct batch {
+	struct mmsghdr msg[BATCH_SIZE];
+	struct iovec iov[BATCH_SIZE];
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+# if ENABLE_FEATURE_IPV6
+		struct sockaddr_in6 sin6;
+# endif
+	} from[BATCH_SIZE];
+	union {
+		char cmsg[CMSG_SPACE(sizeof(struct in_pktinfo))];
+# if ENABLE_FEATURE_IPV6 && defined(IPV6_PKTINFO)
+		char cmsg6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+# endif
+	} ctl[BATCH_SIZE];
+	uint8_t buf[BATCH_SIZE][MAX_PACK_LEN + 1];
+};
+
+/* Turn the received destination address into the source
+ * address of the reply (see send_to_from() in libbb) */
+static void reply_from_dst(struct msghdr *h)
+{
+	struct cmsghdr *c;
+
+	for (c = CMSG_FIRSTHDR(h); c; c = CMSG_NXTHDR(h, c)) {
+		if (c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO) {
+			struct in_pktinfo pi;
+			/* CMSG_DATA may be unaligned */
+			memcpy(&pi, CMSG_DATA(c), sizeof(pi));
+			pi.ipi_spec_dst = pi.ipi_addr;
+			pi.ipi_ifindex = 0;
+			memcpy(CMSG_DATA(c), &pi, sizeof(pi));
+			break;
+		}
+# if ENABLE_FEATURE_IPV6 && defined(IPV6_PKTINFO)
+		if (c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_PKTINFO) {
+			struct in6_pktinfo pi6;
+			memcpy(&pi6, CMSG_DATA(c), sizeof(pi6));
+			pi6.ipi6_ifindex = 0;
+			memcpy(CMSG_DATA(c), &pi6, sizeof(pi6));
+			break;
+		}
+# endif
+	}
+	if (!c) {
+		h->msg_control = NULL;
+		h->msg_controllen = 0;
+		return;
+	}
+	/* Send only this one */
+	h->msg_control = c;
+	h->msg_controllen = c->cmsg_len;
+}
+
+/* Read up to BATCH_SIZE queries, send all replies at once.
+ * Returns 0 if the kernel can't do it (replies are sent anyway) */
+static int serve_batch(int udps, struct batch *b, uint32_t conf_ttl)
+{
+	int i, n, nreply;
+
+	for (i = 0; i < BATCH_SIZE; i++) {
+		struct msghdr *h = &b->msg[i].msg_hdr;
+
+		b->iov[i].iov_base = b->buf[i];
+		b->iov[i].iov_len = MAX_PACK_LEN + 1;
+		h->msg_name = &b->from[i];
+		h->msg_namelen = sizeof(b->from[i]);
+		h->msg_iov = &b->iov[i];
+		h->msg_iovlen = 1;
+		h->msg_control = &b->ctl[i];
+		h->msg_controllen = sizeof(b->ctl[i]);
+		h->msg_flags = 0;
+	}
+	/* Wait for one query, take all which are already there */
+	n = recvmmsg(udps, b->msg, BATCH_SIZE, MSG_WAITFORONE, NULL);
+	if (n < 0)
+		return errno != ENOSYS;
+	G.recv_calls++;
+
+	nreply = 0;
+	for (i = 0; i < n; i++) {
+		int r = b->msg[i].msg_len;
+
+		G.received++;
+		if (r < 12 || r > MAX_PACK_LEN) {
+			bb_error_msg("packet size %d, ignored", r);
+			G.ignored++;
+			continue;
+		}
+		if (OPT_verbose)
+			bb_info_msg("Got UDP packet");
+		b->buf[i][r] = '\0'; /* paranoia */
+		r = process_packet(conf_ttl, b->buf[i]);
+		if (r <= 0)
+			continue;
+		b->iov[i].iov_len = r;
+		reply_from_dst(&b->msg[i].msg_hdr);
+		b->msg[nreply++] = b->msg[i];
+	}
+
+	for (i = 0; i < nreply; i += n) {
+		n = sendmmsg(udps, b->msg + i, nreply - i, 0);
+		if (n < 0 && errno == ENOSYS) {
+			/* recvmmsg without sendmmsg (Linux 2.6.33..2.6.39):
+			 * send these one by one, stop batching */
+			for (; i < nreply; i++)
+				sendmsg(udps, &b->msg[i].msg_hdr, 0);
+			return 0;
+		}
+		/* Like send_to_from() in the one-by-one loop,
+		 * we don't care about errors: drop the reply */
+		if (n <= 0)
+			n = 1;
+	}
+	return 1;
+}
+#endif
+
 int dnsd_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int dnsd_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -460,6 +712,7 @@ int dnsd_main(int argc UNUSED_PARAM, char **argv)
 	int udps, opts;
 	uint16_t port = 53;
 	uint8_t buf[MAX_PACK_LEN + 1];
+	IF_FEATURE_DNSD_BATCH_IO(struct batch *batch;)
 
 	opts = getopt32(argv, "vi:c:t:p:d", &listen_interface, &fileconf, &sttl, &sport);
 	//if (opts & 0x1) // -v
@@ -478,6 +731,7 @@ int dnsd_main(int argc UNUSED_PARAM, char **argv)
 	option_mask32 &= 1;
 
 	conf_data = parse_conf_file(fileconf);
+	hash_conf_data(conf_data);
 
 	lsa = xdotted2sockaddr(listen_interface, port);
 	udps = xsocket(lsa->u.sa.sa_family, SOCK_DGRAM, 0);
@@ -493,8 +747,26 @@ int dnsd_main(int argc UNUSED_PARAM, char **argv)
 		free(p);
 	}
 
+	G.last_time = monotonic_sec();
+	signal_no_SA_RESTART_empty_mask(SIGUSR1, record_signo);
+	IF_FEATURE_DNSD_BATCH_IO(batch = xmalloc(sizeof(*batch));)
+
 	while (1) {
 		int r;
+
+		if (bb_got_signal) {
+			bb_got_signal = 0;
+			log_stats();
+		}
+#if ENABLE_FEATURE_DNSD_BATCH_IO
+		if (batch) {
+			if (serve_batch(udps, batch, conf_ttl))
+				continue;
+			/* Old kernel, read one by one */
+			free(batch);
+			batch = NULL;
+		}
+#endif
 		/* Try to get *DEST* address (to which of our addresses
 		 * this query was directed), and reply from the same address.
 		 * Or else we can exhibit usual UDP ugliness:
@@ -502,14 +774,19 @@ int dnsd_main(int argc UNUSED_PARAM, char **argv)
 		 * [ip1.multihomed.ip2] => reply from ip2 => peer (confused) */
 		memcpy(to, lsa, lsa_size);
 		r = recv_from_to(udps, buf, MAX_PACK_LEN + 1, 0, &from->u.sa, &to->u.sa, lsa->len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		G.recv_calls++;
+		G.received++;
 		if (r < 12 || r > MAX_PACK_LEN) {
 			bb_error_msg("packet size %d, ignored", r);
+			G.ignored++;
 			continue;
 		}
 		if (OPT_verbose)
 			bb_info_msg("Got UDP packet");
 		buf[r] = '\0'; /* paranoia */
-		r = process_packet(conf_data, conf_ttl, buf);
+		r = process_packet(conf_ttl, buf);
 		if (r <= 0)
 			continue;
 		send_to_from(udps, buf, r, 0, &from->u.sa, &to->u.sa, lsa->len);
@@ -87,9 +87,6 @@ enum {
 
 struct globals {
 	int pasv_listen_fd;
-#if !BB_MMU
-	int root_fd;
-#endif
 	int local_file_fd;
 	unsigned end_time;
 	unsigned timeout;
@@ -103,6 +100,12 @@ struct globals {
 #if ENABLE_FEATURE_FTP_WRITE
 	char *rnfr_filename;
 #endif
+	/* Transfer statistics for STAT, [0] is RETR, [1] is STOR & co */
+	off_t xfer_bytes[2];
+	unsigned long long xfer_usec[2];
+	unsigned xfer_files[2];
+	/* Bytes moved in kernel (sendfile/splice), not via our buffer */
+	off_t xfer_kernel_bytes;
 	/* We need these aligned to uint32_t */
 	char msg_ok [(sizeof("NNN " MSG_OK ) + 3) & 0xfffc];
 	char msg_err[(sizeof("NNN " MSG_ERR) + 3) & 0xfffc];
@@ -281,12 +284,31 @@ handle_cdup(void)
 	handle_cwd();
 }
 
+static unsigned long long
+kib_per_sec(off_t bytes, unsigned long long usec)
+{
+	/* bytes / 1024 / (usec / 1000000) */
+	return usec ? (unsigned long long)bytes * 15625 / 16 / usec : 0;
+}
+
 static void
 handle_stat(void)
 {
-	cmdio_write_raw(STR(FTP_STATOK)"-Server status:\r\n"
+	char *response;
+
+	response = xasprintf(STR(FTP_STATOK)"-Server status:\r\n"
 			" TYPE: BINARY\r\n"
-			STR(FTP_STATOK)" Ok\r\n");
+			" Downloaded %"OFF_FMT"u bytes in %u files, %llu KiB/s\r\n"
+			" Uploaded %"OFF_FMT"u bytes in %u files, %llu KiB/s\r\n"
+			" Zero-copy %"OFF_FMT"u bytes\r\n"
+			STR(FTP_STATOK)" Ok\r\n",
+			G.xfer_bytes[0], G.xfer_files[0],
+			kib_per_sec(G.xfer_bytes[0], G.xfer_usec[0]),
+			G.xfer_bytes[1], G.xfer_files[1],
+			kib_per_sec(G.xfer_bytes[1], G.xfer_usec[1]),
+			G.xfer_kernel_bytes);
+	cmdio_write_raw(response);
+	free(response);
 }
 
 /* Examples of HELP and FEAT:
@@ -326,6 +348,18 @@ handle_feat(unsigned status)
 
 /* Download commands */
 
+static void
+account_transfer(int upload, off_t bytes, unsigned long long start_usec)
+{
+	int m;
+
+	G.xfer_files[upload]++;
+	G.xfer_bytes[upload] += bytes;
+	G.xfer_usec[upload] += monotonic_us() - start_usec;
+	for (m = COPYFD_READ_WRITE + 1; m < COPYFD_NUM_METHODS; m++)
+		G.xfer_kernel_bytes += bb_copyfd_stats[m];
+}
+
 static inline int
 port_active(void)
 {
@@ -558,6 +592,7 @@ handle_retr(void)
 {
 	struct stat statbuf;
 	off_t bytes_transferred;
+	unsigned long long start_usec;
 	int remote_fd;
 	int local_file_fd;
 	off_t offset = G.restart_pos;
@@ -599,12 +634,16 @@ handle_retr(void)
 	if (remote_fd < 0)
 		goto file_close_out;
 
+	/* Uses sendfile if it can */
+	start_usec = monotonic_us();
 	bytes_transferred = bb_copyfd_eof(local_file_fd, remote_fd);
 	close(remote_fd);
 	if (bytes_transferred < 0)
 		WRITE_ERR(FTP_BADSENDFILE);
-	else
+	else {
+		account_transfer(0, bytes_transferred, start_usec);
 		WRITE_OK(FTP_TRANSFEROK);
+	}
 
  file_close_out:
 	close(local_file_fd);
@@ -613,141 +652,204 @@ handle_retr(void)
 
 /* List commands */
 
-static int
-popen_ls(const char *opt)
+/* We produce "ls -l" and "ls -1" output ourself, streaming entries
+ * in directory order, instead of running ls for every LIST */
+
+enum {
+	USE_CTRL_CONN = 1,
+	LONG_LISTING = 2,
+	SHOW_HIDDEN = 4,
+};
+
+enum { LIST_BUFSIZE = 16 * 1024 };
+
+struct lister {
+	int fd; /* data connection, or -1 for STAT <filename> */
+	int opts;
+	unsigned len;
+	time_t now;
+	char buf[LIST_BUFSIZE];
+};
+
+static void
+list_flush(struct lister *l)
 {
-	const char *argv[5];
-	struct fd_pair outfd;
-	pid_t pid;
-
-	argv[0] = "ftpd";
-	argv[1] = opt; /* "-l" or "-1" */
-#if BB_MMU
-	argv[2] = "--";
-#else
-	/* NOMMU ftpd ls helper chdirs to argv[2],
-	 * preventing peer from seeing real root. */
-	argv[2] = xrealloc_getcwd_or_warn(NULL);
-#endif
-	argv[3] = G.ftp_arg;
-	argv[4] = NULL;
+	xwrite(l->fd, l->buf, l->len);
+	l->len = 0;
+}
+
+static void
+list_put(struct lister *l, const char *str, unsigned len)
+{
+	while (len != 0) {
+		unsigned chunk = LIST_BUFSIZE - 1 - l->len;
+
+		if (chunk == 0) {
+			if (l->fd < 0)
+				return; /* too long line on ctrl connection, truncate */
+			list_flush(l);
+			continue;
+		}
+		if (chunk > len)
+			chunk = len;
+		memcpy(l->buf + l->len, str, chunk);
+		if (l->fd >= 0) {
+			/* Embedded LFs are sent as NULs, as in NLST note below.
+			 * (cmdio_write does this for ctrl connection) */
+			char *p = l->buf + l->len;
+			while ((p = memchr(p, '\n', l->buf + l->len + chunk - p)) != NULL)
+				*p++ = '\0';
+		}
+		l->len += chunk;
+		str += chunk;
+		len -= chunk;
+	}
+}
+
+static void
+list_end_line(struct lister *l)
+{
+	if (l->fd < 0) {
+		/* Hack: 0 results in no status at all */
+		/* Note: it's ok that we don't prepend space,
+		 * ftp.kernel.org doesn't do that too */
+		l->buf[l->len] = '\0';
+		cmdio_write(0, l->buf);
+		l->len = 0;
+		return;
+	}
+	/* I've seen clients complaining when they
+	 * are fed with ls output with bare '\n'.
+	 * Pity... that would be much simpler.
+	 */
+	if (l->len > LIST_BUFSIZE - 2)
+		list_flush(l);
+	l->buf[l->len++] = '\r';
+	l->buf[l->len++] = '\n';
+}
+
+/* name is relative to dir_fd (can be AT_FDCWD) */
+static void
+list_entry(struct lister *l, int dir_fd, const char *name)
+{
+	struct stat st;
+	char head[sizeof("drwxrwxrwx  uuuuuuuu gggggggg ") + sizeof(long) * 3
+			+ sizeof(off_t) * 3 + sizeof(" Jun 30  2009 ")];
+	char target[PATH_MAX];
+	const char *filetime;
+	char *p;
+	int n;
+
+	if (!(l->opts & LONG_LISTING)) {
+		list_put(l, name, strlen(name));
+		list_end_line(l);
+		return;
+	}
+
+	if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+		return; /* gone meanwhile */
+
+	p = head + sprintf(head, "%-10s %4lu %-8.8s %-8.8s ",
+			bb_mode_string(st.st_mode),
+			(long) st.st_nlink,
+			get_cached_username(st.st_uid),
+			get_cached_groupname(st.st_gid));
+	if (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode))
+		p += sprintf(p, "%4u, %3u ",
+				(int) major(st.st_rdev),
+				(int) minor(st.st_rdev));
+	else
+		p += sprintf(p, "%9"OFF_FMT"u ", (off_t) st.st_size);
+	/* Same as ls: time for recent files, year for older ones */
+	filetime = ctime(&st.st_mtime);
+	if (l->now - st.st_mtime < 3600L * 24 * 365 / 2
+	 && l->now - st.st_mtime > -15 * 60
+	) {
+		p += sprintf(p, "%.6s %.5s ", filetime + 4, filetime + 11);
+	} else {
+		p += sprintf(p, "%.6s  %.4s ", filetime + 4, filetime + 20);
+	}
+	list_put(l, head, p - head);
+	list_put(l, name, strlen(name));
+
+	if (S_ISLNK(st.st_mode)) {
+		n = readlinkat(dir_fd, name, target, sizeof(target));
+		if (n > 0) {
+			list_put(l, " -> ", 4);
+			list_put(l, target, n);
+		}
+	}
+	list_end_line(l);
+}
+
+static void
+list_path(struct lister *l, const char *path)
+{
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
 
 	/* Improve compatibility with non-RFC conforming FTP clients
 	 * which send e.g. "LIST -l", "LIST -la".
 	 * See https://bugs.kde.org/show_bug.cgi?id=195578 */
 	if (ENABLE_FEATURE_FTPD_ACCEPT_BROKEN_LIST
-	 && G.ftp_arg && G.ftp_arg[0] == '-' && G.ftp_arg[1] == 'l'
+	 && path && path[0] == '-' && path[1] == 'l'
 	) {
-		const char *tmp = strchr(G.ftp_arg, ' ');
-		if (tmp) /* skip the space */
-			tmp++;
-		argv[3] = tmp;
+		const char *tmp = strchrnul(path, ' ');
+		if (memchr(path, 'a', tmp - path))
+			l->opts |= SHOW_HIDDEN;
+		path = *tmp ? tmp + 1 : NULL; /* skip the space */
 	}
+	if (!path || !path[0])
+		path = ".";
 
-	xpiped_pair(outfd);
-
-	/*fflush_all(); - so far we dont use stdio on output */
-	pid = BB_MMU ? fork() : vfork();
-	if (pid < 0)
-		bb_perror_msg_and_die(BB_MMU ? "fork" : "vfork");
-
-	if (pid == 0) {
-		/* child */
-#if !BB_MMU
-		/* On NOMMU, we want to execute a child - copy of ourself.
-		 * In chroot we usually can't do it. Thus we chdir
-		 * out of the chroot back to original root,
-		 * and (see later below) execute bb_busybox_exec_path
-		 * relative to current directory */
-		if (fchdir(G.root_fd) != 0)
-			_exit(127);
-		/*close(G.root_fd); - close_on_exec_on() took care of this */
-#endif
-		/* NB: close _first_, then move fd! */
-		close(outfd.rd);
-		xmove_fd(outfd.wr, STDOUT_FILENO);
-		/* Opening /dev/null in chroot is hard.
-		 * Just making sure STDIN_FILENO is opened
-		 * to something harmless. Paranoia,
-		 * ls won't read it anyway */
-		close(STDIN_FILENO);
-		dup(STDOUT_FILENO); /* copy will become STDIN_FILENO */
-#if BB_MMU
-		/* memset(&G, 0, sizeof(G)); - ls_main does it */
-		exit(ls_main(ARRAY_SIZE(argv) - 1, (char**) argv));
-#else
-		/* + 1: we must use relative path here if in chroot.
-		 * For example, execv("/proc/self/exe") will fail, since
-		 * it looks for "/proc/self/exe" _relative to chroot!_ */
-		execv(bb_busybox_exec_path + 1, (char**) argv);
-		_exit(127);
-#endif
+	/* Like ls: list the contents of a directory, or the file itself */
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		if (lstat(path, &st) == 0)
+			list_entry(l, AT_FDCWD, path);
+		return;
 	}
-
-	/* parent */
-	close(outfd.wr);
-#if !BB_MMU
-	free((char*)argv[2]);
-#endif
-	return outfd.rd;
+	dir = opendir(path);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' && !(l->opts & SHOW_HIDDEN))
+			continue;
+		list_entry(l, dirfd(dir), de->d_name);
+	}
+	closedir(dir);
 }
 
-enum {
-	USE_CTRL_CONN = 1,
-	LONG_LISTING = 2,
-};
-
 static void
 handle_dir_common(int opts)
 {
-	FILE *ls_fp;
-	char *line;
-	int ls_fd;
+	struct lister *l;
 
 	if (!(opts & USE_CTRL_CONN) && !port_or_pasv_was_seen())
 		return; /* port_or_pasv_was_seen emitted error response */
 
-	/* -n prevents user/groupname display,
-	 * which can be problematic in chroot */
-	ls_fd = popen_ls((opts & LONG_LISTING) ? "-l" : "-1");
-	ls_fp = xfdopen_for_read(ls_fd);
+	l = xmalloc(sizeof(*l));
+	l->opts = opts;
+	l->len = 0;
+	l->now = time(NULL);
 
 	if (opts & USE_CTRL_CONN) {
 		/* STAT <filename> */
+		l->fd = -1;
 		cmdio_write_raw(STR(FTP_STATFILE_OK)"-File status:\r\n");
-		while (1) {
-			line = xmalloc_fgetline(ls_fp);
-			if (!line)
-				break;
-			/* Hack: 0 results in no status at all */
-			/* Note: it's ok that we don't prepend space,
-			 * ftp.kernel.org doesn't do that too */
-			cmdio_write(0, line);
-			free(line);
-		}
+		list_path(l, G.ftp_arg);
 		WRITE_OK(FTP_STATFILE_OK);
 	} else {
 		/* LIST/NLST [<filename>] */
-		int remote_fd = get_remote_transfer_fd(" Directory listing");
-		if (remote_fd >= 0) {
-			while (1) {
-				line = xmalloc_fgetline(ls_fp);
-				if (!line)
-					break;
-				/* I've seen clients complaining when they
-				 * are fed with ls output with bare '\n'.
-				 * Pity... that would be much simpler.
-				 */
-/* TODO: need to s/LF/NUL/g here */
-				xwrite_str(remote_fd, line);
-				xwrite(remote_fd, "\r\n", 2);
-				free(line);
-			}
+		l->fd = get_remote_transfer_fd(" Directory listing");
+		if (l->fd >= 0) {
+			list_path(l, G.ftp_arg);
+			list_flush(l);
+			close(l->fd);
 		}
-		close(remote_fd);
 		WRITE_OK(FTP_TRANSFEROK);
 	}
-	fclose(ls_fp); /* closes ls_fd too */
+	free(l);
 }
 static void
 handle_list(void)
@@ -901,6 +1003,7 @@ handle_upload_common(int is_append, int is_unique)
 	struct stat statbuf;
 	char *tempname;
 	off_t bytes_transferred;
+	unsigned long long start_usec;
 	off_t offset;
 	int local_file_fd;
 	int remote_fd;
@@ -945,12 +1048,16 @@ handle_upload_common(int is_append, int is_unique)
 	if (remote_fd < 0)
 		goto close_local_and_bail;
 
+	/* Splices socket -> file if it can */
+	start_usec = monotonic_us();
 	bytes_transferred = bb_copyfd_eof(remote_fd, local_file_fd);
 	close(remote_fd);
 	if (bytes_transferred < 0)
 		WRITE_ERR(FTP_BADSENDFILE);
-	else
+	else {
+		account_transfer(1, bytes_transferred, start_usec);
 		WRITE_OK(FTP_TRANSFEROK);
+	}
 
  close_local_and_bail:
 	close(local_file_fd);
@@ -1095,21 +1202,13 @@ enum {
 	const_TYPE = mk_const4('T', 'Y', 'P', 'E'),
 	const_USER = mk_const4('U', 'S', 'E', 'R'),
 
-#if !BB_MMU
-	OPT_l = (1 << 0),
-	OPT_1 = (1 << 1),
-#endif
-	OPT_v = (1 << ((!BB_MMU) * 2 + 0)),
-	OPT_S = (1 << ((!BB_MMU) * 2 + 1)),
-	OPT_w = (1 << ((!BB_MMU) * 2 + 2)) * ENABLE_FEATURE_FTP_WRITE,
+	OPT_v = (1 << 0),
+	OPT_S = (1 << 1),
+	OPT_w = (1 << 2) * ENABLE_FEATURE_FTP_WRITE,
 };
 
 int ftpd_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
-#if !BB_MMU
-int ftpd_main(int argc, char **argv)
-#else
 int ftpd_main(int argc UNUSED_PARAM, char **argv)
-#endif
 {
 	unsigned abs_timeout;
 	unsigned verbose_S;
@@ -1121,21 +1220,7 @@ int ftpd_main(int argc UNUSED_PARAM, char **argv)
 	verbose_S = 0;
 	G.timeout = 2 * 60;
 	opt_complementary = "t+:T+:vv:SS";
-#if BB_MMU
-	opts = getopt32(argv,   "vS" IF_FEATURE_FTP_WRITE("w") "t:T:", &G.timeout, &abs_timeout, &G.verbose, &verbose_S);
-#else
-	opts = getopt32(argv, "l1vS" IF_FEATURE_FTP_WRITE("w") "t:T:", &G.timeout, &abs_timeout, &G.verbose, &verbose_S);
-	if (opts & (OPT_l|OPT_1)) {
-		/* Our secret backdoor to ls */
-/* TODO: pass -n? It prevents user/group resolution, whicj may not work in chroot anyway */
-/* TODO: pass -A? It shows dot files */
-/* TODO: pass --group-directories-first? would be nice, but ls don't do that yet */
-		xchdir(argv[2]);
-		argv[2] = (char*)"--";
-		/* memset(&G, 0, sizeof(G)); - ls_main does it */
-		return ls_main(argc, argv);
-	}
-#endif
+	opts = getopt32(argv, "vS" IF_FEATURE_FTP_WRITE("w") "t:T:", &G.timeout, &abs_timeout, &G.verbose, &verbose_S);
 	if (G.verbose < verbose_S)
 		G.verbose = verbose_S;
 	if (abs_timeout | G.timeout) {
@@ -1169,11 +1254,6 @@ int ftpd_main(int argc UNUSED_PARAM, char **argv)
 	if (logmode)
 		applet_name = xasprintf("%s[%u]", applet_name, (int)getpid());
 
-#if !BB_MMU
-	G.root_fd = xopen("/", O_RDONLY | O_DIRECTORY);
-	close_on_exec_on(G.root_fd);
-#endif
-
 	if (argv[optind]) {
 		xchdir(argv[optind]);
 		chroot(".");
@@ -101,6 +101,12 @@
 #if ENABLE_FEATURE_HTTPD_USE_SENDFILE
 # include <sys/sendfile.h>
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+# include <setjmp.h>
+# include <sys/epoll.h>
+# include <netinet/tcp.h>
+# include <sys/prctl.h>
+#endif
 
 #define DEBUG 0
 
@@ -115,10 +121,21 @@
 #endif
 
 #define HEADER_READ_TIMEOUT 60
+/* How long an idle persistent connection is kept open */
+#define KEEPALIVE_TIMEOUT 15
+/* A child sending to a peer which does not read gives up after that */
+#define SEND_TIMEOUT 60
+/* Workers hand bigger files to a child, so that a slow
+ * download does not stall the other connections */
+#define WORKER_MAX_FILE_SIZE (256 * 1024)
+/* Files up to this size are kept in the shared file cache */
+#define CACHE_MAX_FILE_SIZE (64 * 1024)
+#define CACHE_DEFAULT_KB 4096
 
 static const char DEFAULT_PATH_HTTPD_CONF[] ALIGN1 = "/etc";
 static const char HTTPD_CONF[] ALIGN1 = "httpd.conf";
 static const char HTTP_200[] ALIGN1 = "HTTP/1.0 200 OK\r\n";
+static const char RFC1123FMT[] ALIGN1 = "%a, %d %b %Y %H:%M:%S GMT";
 
 typedef struct has_next_ptr {
 	struct has_next_ptr *next;
@@ -151,6 +168,7 @@ enum {
 	HTTP_OK = 200,
 	HTTP_PARTIAL_CONTENT = 206,
 	HTTP_MOVED_TEMPORARILY = 302,
+	HTTP_NOT_MODIFIED = 304,
 	HTTP_BAD_REQUEST = 400,       /* malformed syntax */
 	HTTP_UNAUTHORIZED = 401, /* authentication needed, respond with auth hdr */
 	HTTP_NOT_FOUND = 404,
@@ -167,7 +185,6 @@ enum {
 	HTTP_NO_CONTENT = 204,
 	HTTP_MULTIPLE_CHOICES = 300,
 	HTTP_MOVED_PERMANENTLY = 301,
-	HTTP_NOT_MODIFIED = 304,
 	HTTP_PAYMENT_REQUIRED = 402,
 	HTTP_BAD_GATEWAY = 502,
 	HTTP_SERVICE_UNAVAILABLE = 503, /* overload, maintenance */
@@ -181,6 +198,9 @@ static const uint16_t http_response_type[] ALIGN2 = {
 	HTTP_PARTIAL_CONTENT,
 #endif
 	HTTP_MOVED_TEMPORARILY,
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	HTTP_NOT_MODIFIED,
+#endif
 	HTTP_REQUEST_TIMEOUT,
 	HTTP_NOT_IMPLEMENTED,
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
@@ -196,7 +216,6 @@ static const uint16_t http_response_type[] ALIGN2 = {
 	HTTP_NO_CONTENT,
 	HTTP_MULTIPLE_CHOICES,
 	HTTP_MOVED_PERMANENTLY,
-	HTTP_NOT_MODIFIED,
 	HTTP_BAD_GATEWAY,
 	HTTP_SERVICE_UNAVAILABLE,
 #endif
@@ -211,6 +230,9 @@ static const struct {
 	{ "Partial Content", NULL },
 #endif
 	{ "Found", NULL },
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	{ "Not Modified", NULL },
+#endif
 	{ "Request Timeout", "No request appeared within 60 seconds" },
 	{ "Not Implemented", "The requested method is not recognized" },
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
@@ -226,7 +248,6 @@ static const struct {
 	{ "No Content" },
 	{ "Multiple Choices" },
 	{ "Moved Permanently" },
-	{ "Not Modified" },
 	{ "Bad Gateway", "" },
 	{ "Service Unavailable", "" },
 #endif
@@ -234,6 +255,22 @@ static const struct {
 
 static const char index_html[] ALIGN1 = "index.html";
 
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+/* Slot of the file cache. It lives in memory shared by all httpd
+ * processes, so it is guarded by a sequence counter instead of a lock:
+ * the counter is odd while a writer rewrites the slot, readers copy
+ * the data and retry if the counter changed meanwhile */
+struct cache_slot {
+	unsigned seq;
+	unsigned hash;
+	unsigned used;          /* time of the last hit, for eviction */
+	time_t mtime;
+	off_t size;
+	char path[128];
+	char data[CACHE_MAX_FILE_SIZE];
+};
+#endif
+
 
 struct globals {
 	int verbose;            /* must be int (used by getopt32) */
@@ -255,6 +292,8 @@ struct globals {
 
 	IF_FEATURE_HTTPD_BASIC_AUTH(const char *g_realm;)
 	IF_FEATURE_HTTPD_BASIC_AUTH(char *remoteuser;)
+	IF_FEATURE_HTTPD_CGI(char *cookie;)
+	IF_FEATURE_HTTPD_CGI(char *content_type;)
 	IF_FEATURE_HTTPD_CGI(char *referer;)
 	IF_FEATURE_HTTPD_CGI(char *user_agent;)
 	IF_FEATURE_HTTPD_CGI(char *host;)
@@ -279,11 +318,40 @@ struct globals {
 #define hdr_buf bb_common_bufsiz1
 	char *hdr_ptr;
 	int hdr_cnt;
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	smallint keep_alive;    /* another request may follow this response */
+	smallint http11;        /* peer speaks HTTP/1.1 */
+	smallint conf_changed;  /* subdir httpd.conf was read: config is dirty */
+	smallint in_request;    /* log_and_exit() returns to request_done */
+	smallint worker;        /* serving many connections, see worker_loop() */
+	smallint handed_off;    /* worker forked a child for this request */
+	sigjmp_buf request_done;
+	struct conn *conns;     /* worker's open connections */
+	int epoll_fd;
+	int listen_fd;
+	int null_fd;
+	unsigned num_workers;
+	pid_t *worker_pids;
+#endif
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	smallint accept_gzip;   /* peer sent "Accept-Encoding: gzip" */
+	smallint content_gzip;  /* we send FILE.gz for FILE */
+	smallint hold_headers;  /* send_headers() leaves them in iobuf */
+	int held_len;
+	time_t if_modified_since;
+	char *if_none_match;
+	char *gz_name;
+	char etag[64];
+	struct cache_slot *cache;
+	unsigned cache_slots;
+	char *cache_buf;        /* [IOBUF_SIZE + CACHE_MAX_FILE_SIZE] */
+#endif
 #if ENABLE_FEATURE_HTTPD_ERROR_PAGES
 	const char *http_error_page[ARRAY_SIZE(http_response_type)];
 #endif
 #if ENABLE_FEATURE_HTTPD_PROXY
 	Htaccess_Proxy *proxy;
+	IF_FEATURE_HTTPD_KEEPALIVE(char *proxy_header_buf;)
 #endif
 };
 #define G (*ptr_to_globals)
@@ -455,7 +523,8 @@ static int scan_ip_mask(const char *str, unsigned *ipp, unsigned *maskp)
 /*
  * Parse configuration file into in-memory linked list.
  *
- * Any previous IP rules are discarded.
+ * Any previous IP rules are discarded (by SUBDIR_PARSE, only if
+ * the subdir has its own config file).
  * If the flag argument is not SUBDIR_PARSE then all /path and mime rules
  * are also discarded.  That is, previous settings are retained if flag is
  * SUBDIR_PARSE.
@@ -480,10 +549,10 @@ static void parse_conf(const char *path, int flag)
 	char buf[160];
 
 	/* discard old rules */
-	free_Htaccess_IP_list(&ip_a_d);
-	flg_deny_all = 0;
-	/* retain previous auth and mime config only for subdir parse */
 	if (flag != SUBDIR_PARSE) {
+		free_Htaccess_IP_list(&ip_a_d);
+		flg_deny_all = 0;
+		/* retain previous auth and mime config only for subdir parse */
 		free_Htaccess_list(&mime_a);
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
 		free_Htaccess_list(&g_auth);
@@ -514,6 +583,16 @@ static void parse_conf(const char *path, int flag)
 		flag = TRY_CURDIR_PARSE;
 		filename = HTTPD_CONF;
 	}
+	if (flag == SUBDIR_PARSE) {
+		/* Not before we know the subdir has rules: a worker
+		 * goes on serving with the config we leave behind */
+		free_Htaccess_IP_list(&ip_a_d);
+		flg_deny_all = 0;
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+		/* Subdir rules must not leak into the next request */
+		G.conf_changed = 1;
+#endif
+	}
 
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
 	/* in "/file:user:pass" lines, we prepend path in subdirs */
@@ -929,6 +1008,14 @@ static int openServer(void)
 static void log_and_exit(void) NORETURN;
 static void log_and_exit(void)
 {
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* The response is done, the connection loop decides
+	 * whether to close or to wait for the next request */
+	if (G.in_request) {
+		G.in_request = 0;
+		siglongjmp(G.request_done, 1);
+	}
+#endif
 	/* Paranoia. IE said to be buggy. It may send some extra data
 	 * or be confused by us just exiting without SHUT_WR. Oh well. */
 	shutdown(1, SHUT_WR);
@@ -944,6 +1031,90 @@ static void log_and_exit(void)
 	_exit(xfunc_error_retval);
 }
 
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+/* A connection served by worker_loop() */
+struct conn {
+	struct conn *next;
+	int fd;
+	unsigned len;           /* bytes in buf */
+	unsigned last_active;   /* monotonic_sec() */
+	len_and_sockaddr peer;
+	char buf[COMMON_BUFSIZE]; /* request data not yet handled */
+};
+
+/*
+ * Worker only: fork a child which takes over the current connection,
+ * the worker forgets it. Returns in the child, or if fork failed.
+ */
+static int hand_off_connection(void)
+{
+	static const struct timeval send_timeout = { SEND_TIMEOUT, 0 };
+	struct conn *c;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		return pid;
+	if (pid > 0) { /* worker: the child owns the connection now */
+		G.handed_off = 1;
+		log_and_exit();
+	}
+	/* child: from now on it is a plain connection process */
+	G.worker = 0;
+	signal(SIGHUP, SIG_IGN);
+	bb_signals(0
+		+ (1 << SIGTERM)
+		+ (1 << SIGINT)
+		, SIG_DFL);
+	close(G.epoll_fd);
+	close(G.listen_fd);
+	close(G.null_fd);
+	/* our request is on fd 0 and 1; peers of other connections
+	 * must see EOF when the worker closes them */
+	for (c = G.conns; c; c = c->next)
+		close(c->fd);
+	/* We may block now, but not forever */
+	ndelay_off(STDOUT_FILENO);
+	setsockopt(STDOUT_FILENO, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+	return pid;
+}
+
+/*
+ * Worker connections are non-blocking. When the peer does not
+ * keep up with us, a child continues, the worker goes on serving
+ * other connections.
+ */
+static void peer_would_block(void)
+{
+	if (hand_off_connection() < 0) {
+		G.keep_alive = 0;
+		log_and_exit();
+	}
+}
+
+static ssize_t write_response(const void *buf, size_t len)
+{
+	ssize_t total = 0;
+
+	while (len) {
+		ssize_t n = safe_write(STDOUT_FILENO, buf, len);
+		if (n < 0) {
+			if (errno == EAGAIN && G.worker) {
+				peer_would_block();
+				continue;
+			}
+			return total ? total : n;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+		total += n;
+	}
+	return total;
+}
+#else
+# define write_response(buf, len) full_write(STDOUT_FILENO, buf, len)
+#endif
+
 /*
  * Create and send HTTP response headers.
  * The arguments are combined and sent as one write operation.  Note that
@@ -953,7 +1124,9 @@ static void log_and_exit(void)
  */
 static void send_headers(int responseNum)
 {
-	static const char RFC1123FMT[] ALIGN1 = "%a, %d %b %Y %H:%M:%S GMT";
+	static const char info_fmt[] ALIGN1 =
+		"<HTML><HEAD><TITLE>%d %s</TITLE></HEAD>\n"
+		"<BODY><H1>%d %s</H1>\n%s\n</BODY></HTML>\n";
 
 	const char *responseString = "";
 	const char *infoString = NULL;
@@ -965,6 +1138,8 @@ static void send_headers(int responseNum)
 	time_t timer = time(NULL);
 	char tmp_str[80];
 	int len;
+	char minor_version = '0';
+	const char *connection = "close";
 
 	for (i = 0; i < ARRAY_SIZE(http_response_type); i++) {
 		if (http_response_type[i] == responseNum) {
@@ -997,16 +1172,33 @@ static void send_headers(int responseNum)
 	/* error message is HTML */
 	mime_type = responseNum == HTTP_OK ?
 				found_mime_type : "text/html";
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	/* Don't let caches think the file has changed type */
+	if (responseNum == HTTP_NOT_MODIFIED)
+		mime_type = found_mime_type;
+#endif
 
 	if (verbose)
 		bb_error_msg("response:%u", responseNum);
 
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	if (G.http11)
+		minor_version = '1';
+# if ENABLE_FEATURE_HTTPD_ERROR_PAGES
+	/* We don't know how long the error page is */
+	if (error_page && access(error_page, R_OK) == 0)
+		G.keep_alive = 0;
+# endif
+	if (G.keep_alive)
+		connection = "keep-alive";
+#endif
 	/* emit the current date */
 	strftime(tmp_str, sizeof(tmp_str), RFC1123FMT, gmtime(&timer));
 	len = sprintf(iobuf,
-			"HTTP/1.0 %d %s\r\nContent-type: %s\r\n"
-			"Date: %s\r\nConnection: close\r\n",
-			responseNum, responseString, mime_type, tmp_str);
+			"HTTP/1.%c %d %s\r\nContent-type: %s\r\n"
+			"Date: %s\r\nConnection: %s\r\n",
+			minor_version, responseNum, responseString, mime_type,
+			tmp_str, connection);
 
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
 	if (responseNum == HTTP_UNAUTHORIZED) {
@@ -1029,7 +1221,7 @@ static void send_headers(int responseNum)
 
 		if (DEBUG)
 			fprintf(stderr, "headers: '%s'\n", iobuf);
-		full_write(STDOUT_FILENO, iobuf, len);
+		write_response(iobuf, len);
 		if (DEBUG)
 			fprintf(stderr, "writing error page: '%s'\n", error_page);
 		return send_file_and_exit(error_page, SEND_BODY);
@@ -1038,6 +1230,14 @@ static void send_headers(int responseNum)
 
 	if (file_size != -1) {    /* file */
 		strftime(tmp_str, sizeof(tmp_str), RFC1123FMT, gmtime(&last_mod));
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+		len += sprintf(iobuf + len, "ETag: %s\r\nVary: Accept-Encoding\r\n%s",
+				G.etag,
+				G.content_gzip ? "Content-Encoding: gzip\r\n" : "");
+		if (responseNum == HTTP_NOT_MODIFIED) /* no body follows */
+			len += sprintf(iobuf + len, "Last-Modified: %s\r\n", tmp_str);
+		else {
+#endif
 #if ENABLE_FEATURE_HTTPD_RANGES
 		if (responseNum == HTTP_PARTIAL_CONTENT) {
 			len += sprintf(iobuf + len, "Content-Range: bytes %"OFF_FMT"u-%"OFF_FMT"u/%"OFF_FMT"u\r\n",
@@ -1056,19 +1256,35 @@ static void send_headers(int responseNum)
 				"Content-length:",
 				file_size
 		);
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+		}
+#endif
+	}
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	else if (G.keep_alive) {
+		/* The peer must know where this response ends */
+		len += sprintf(iobuf + len, "Content-length: %u\r\n",
+			!infoString ? 0 : snprintf(NULL, 0, info_fmt,
+				responseNum, responseString,
+				responseNum, responseString, infoString));
 	}
+#endif
 	iobuf[len++] = '\r';
 	iobuf[len++] = '\n';
 	if (infoString) {
-		len += sprintf(iobuf + len,
-				"<HTML><HEAD><TITLE>%d %s</TITLE></HEAD>\n"
-				"<BODY><H1>%d %s</H1>\n%s\n</BODY></HTML>\n",
+		len += sprintf(iobuf + len, info_fmt,
 				responseNum, responseString,
 				responseNum, responseString, infoString);
 	}
 	if (DEBUG)
 		fprintf(stderr, "headers: '%s'\n", iobuf);
-	if (full_write(STDOUT_FILENO, iobuf, len) != len) {
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	if (G.hold_headers) { /* caller sends them together with the body */
+		G.held_len = len;
+		return;
+	}
+#endif
+	if (write_response(iobuf, len) != len) {
 		if (verbose > 1)
 			bb_perror_msg("error");
 		log_and_exit();
@@ -1082,6 +1298,26 @@ static void send_headers_and_exit(int responseNum)
 	log_and_exit();
 }
 
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+/*
+ * Called before a response of unknown length (CGI, proxy) or
+ * a long one. The connection will be closed afterwards, and a worker
+ * forks a child to do it, so that other connections are not stalled.
+ * Returns in the child (or in a process serving one connection).
+ */
+static void fork_off_request(void)
+{
+	G.keep_alive = 0;
+	if (!G.worker)
+		return;
+	if (hand_off_connection() < 0)
+		send_headers_and_exit(HTTP_INTERNAL_SERVER_ERROR);
+	G.in_request = 0;
+}
+#else
+# define fork_off_request() ((void)0)
+#endif
+
 /*
  * Read from the socket until '\n' or EOF. '\r' chars are removed.
  * '\n' is replaced with NUL.
@@ -1331,6 +1567,9 @@ static void send_cgi_and_exit(
 	char *script;
 	int pid;
 
+	/* CGI output has no length, and the environment is changed below */
+	fork_off_request();
+
 	/* Make a copy. NB: caller guarantees:
 	 * url[0] == '/', url[1] != '/' */
 	url = xstrdup(url);
@@ -1512,6 +1751,138 @@ static void send_cgi_and_exit(
 
 #endif          /* FEATURE_HTTPD_CGI */
 
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+/*
+ * Send FILE.gz instead of FILE if the peer takes gzip
+ * and FILE.gz is not older. Sets ETag of what we send.
+ */
+static const char *check_gzipped(const char *url)
+{
+	struct stat sb;
+
+	if (G.accept_gzip IF_FEATURE_HTTPD_RANGES(&& !range_start)) {
+		char *gz_name = xasprintf("%s.gz", url);
+		if (stat(gz_name, &sb) == 0 && S_ISREG(sb.st_mode)
+		 && sb.st_mtime >= last_mod
+		) {
+			G.gz_name = gz_name;
+			G.content_gzip = 1;
+			file_size = sb.st_size;
+			last_mod = sb.st_mtime;
+			url = gz_name;
+		} else
+			free(gz_name);
+	}
+	sprintf(G.etag, "\"%lx-%llx%s\"",
+			(unsigned long)last_mod, (unsigned long long)file_size,
+			G.content_gzip ? "-gz" : "");
+	return url;
+}
+
+static int not_modified(void)
+{
+	/* If-None-Match wins over If-Modified-Since */
+	if (G.if_none_match)
+		return strcmp(G.if_none_match, "*") == 0
+			|| strstr(G.if_none_match, G.etag) != NULL;
+	return G.if_modified_since && last_mod <= G.if_modified_since;
+}
+
+static unsigned cache_hash(const char *path)
+{
+	unsigned h = 0;
+	while (*path)
+		h = h * 31 + (unsigned char)*path++;
+	return h;
+}
+
+/* Each file may live in one of two adjacent slots */
+static struct cache_slot *cache_set(unsigned h)
+{
+	return &G.cache[(h % (G.cache_slots / 2)) * 2];
+}
+
+static int cache_slot_is(struct cache_slot *slot, unsigned h, const char *path)
+{
+	return slot->hash == h && strncmp(slot->path, path, sizeof(slot->path)) == 0;
+}
+
+/* On a hit, the file is copied to cache_buf + IOBUF_SIZE */
+static int cache_lookup(const char *path)
+{
+	unsigned h = cache_hash(path);
+	struct cache_slot *slot = cache_set(h);
+	int i;
+
+	for (i = 0; i < 2; i++, slot++) {
+		unsigned seq = slot->seq;
+
+		__sync_synchronize();
+		if ((seq & 1)
+		 || !cache_slot_is(slot, h, path)
+		 || slot->size != file_size
+		 || slot->mtime != last_mod
+		) {
+			continue;
+		}
+		memcpy(G.cache_buf + IOBUF_SIZE, slot->data, file_size);
+		__sync_synchronize();
+		if (slot->seq != seq)
+			continue; /* rewritten while we were copying */
+		slot->used = monotonic_sec();
+		return 1;
+	}
+	return 0;
+}
+
+/* Store the file which is in cache_buf + IOBUF_SIZE */
+static void cache_store(const char *path)
+{
+	unsigned h = cache_hash(path);
+	struct cache_slot *slot = cache_set(h);
+	unsigned seq;
+
+	/* Replace the old copy of this file, else the less recently used one */
+	if (!cache_slot_is(slot, h, path)
+	 && (cache_slot_is(slot + 1, h, path) || slot[1].used < slot->used)
+	) {
+		slot++;
+	}
+	seq = slot->seq;
+	/* If a writer dies mid-way, the slot stays odd and unused: no harm */
+	if ((seq & 1) || !__sync_bool_compare_and_swap(&slot->seq, seq, seq + 1))
+		return; /* someone else is writing it */
+	slot->hash = h;
+	slot->used = monotonic_sec();
+	slot->size = file_size;
+	slot->mtime = last_mod;
+	strcpy(slot->path, path);
+	memcpy(slot->data, G.cache_buf + IOBUF_SIZE, file_size);
+	__sync_synchronize();
+	slot->seq = seq + 2;
+}
+
+/* Send headers and the file in cache_buf with one write */
+static void send_cached_and_exit(void)
+{
+	char *p;
+	ssize_t len;
+
+	G.hold_headers = 1;
+	send_headers(HTTP_OK);
+	G.hold_headers = 0;
+	p = G.cache_buf + IOBUF_SIZE - G.held_len;
+	memcpy(p, iobuf, G.held_len);
+	len = G.held_len + file_size;
+	if (write_response(p, len) != len) {
+		IF_FEATURE_HTTPD_KEEPALIVE(G.keep_alive = 0;)
+		if (verbose > 1)
+			bb_perror_msg("error");
+	}
+	log_and_exit();
+}
+#endif
+
 /*
  * Send a file response to a HTTP request, and exit
  *
@@ -1524,21 +1895,8 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 	char *suffix;
 	int fd;
 	ssize_t count;
-
-	fd = open(url, O_RDONLY);
-	if (fd < 0) {
-		if (DEBUG)
-			bb_perror_msg("can't open '%s'", url);
-		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
-		 * IOW: it is unsafe to call send_headers_and_exit
-		 * if what is SEND_BODY! Can recurse! */
-		if (what != SEND_BODY)
-			send_headers_and_exit(HTTP_NOT_FOUND);
-		log_and_exit();
-	}
-	/* If you want to know about EPIPE below
-	 * (happens if you abort downloads from local httpd): */
-	signal(SIGPIPE, SIG_IGN);
+	IF_FEATURE_HTTPD_KEEPALIVE(off_t sent = 0;)
+	IF_FEATURE_HTTPD_STATIC_CACHE(smallint cacheable = 0;)
 
 	/* If not found, default is "application/octet-stream" */
 	found_mime_type = "application/octet-stream";
@@ -1610,6 +1968,61 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 		bb_error_msg("sending file '%s' content-type: %s",
 			url, found_mime_type);
 
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	/* Type is the one of FILE, even if we send FILE.gz */
+	if ((what & SEND_HEADERS) && file_size != -1) {
+		url = check_gzipped(url);
+		if (not_modified())
+			send_headers_and_exit(HTTP_NOT_MODIFIED);
+		/* Files modified in the last second may change again
+		 * without changing mtime: don't cache them */
+		if (G.cache && what == SEND_HEADERS_AND_BODY
+		 IF_FEATURE_HTTPD_RANGES(&& !range_start)
+		 && file_size <= CACHE_MAX_FILE_SIZE
+		 && strlen(url) < sizeof(G.cache->path)
+		 && last_mod < time(NULL) - 1
+		) {
+			if (!G.cache_buf)
+				G.cache_buf = xmalloc(IOBUF_SIZE + CACHE_MAX_FILE_SIZE);
+			if (cache_lookup(url)) {
+				signal(SIGPIPE, SIG_IGN);
+				send_cached_and_exit();
+			}
+			cacheable = 1;
+		}
+	}
+#endif
+	fd = open(url, O_RDONLY);
+	if (fd < 0) {
+		if (DEBUG)
+			bb_perror_msg("can't open '%s'", url);
+		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
+		 * IOW: it is unsafe to call send_headers_and_exit
+		 * if what is SEND_BODY! Can recurse! */
+		if (what != SEND_BODY) {
+			file_size = -1; /* the 404 page is not this file */
+			send_headers_and_exit(HTTP_NOT_FOUND);
+		}
+		log_and_exit();
+	}
+	/* If you want to know about EPIPE below
+	 * (happens if you abort downloads from local httpd): */
+	signal(SIGPIPE, SIG_IGN);
+
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	if (cacheable) {
+		if (full_read(fd, G.cache_buf + IOBUF_SIZE, file_size) == file_size) {
+			close(fd);
+			cache_store(url);
+			send_cached_and_exit();
+		}
+		lseek(fd, 0, SEEK_SET);
+	}
+#endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	if (G.worker && file_size > WORKER_MAX_FILE_SIZE)
+		fork_off_request();
+#endif
 #if ENABLE_FEATURE_HTTPD_RANGES
 	if (what == SEND_BODY)
 		range_start = 0; /* err pages and ranges don't mix */
@@ -1641,22 +2054,30 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 			IF_FEATURE_HTTPD_RANGES(if (sz > range_len) sz = range_len;)
 			count = sendfile(STDOUT_FILENO, fd, &offset, sz);
 			if (count < 0) {
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+				if (errno == EAGAIN && G.worker) {
+					peer_would_block();
+					continue;
+				}
+#endif
 				if (offset == range_start)
 					break; /* fall back to read/write loop */
 				goto fin;
 			}
-			IF_FEATURE_HTTPD_RANGES(range_len -= sz;)
+			IF_FEATURE_HTTPD_KEEPALIVE(sent += count;)
+			IF_FEATURE_HTTPD_RANGES(range_len -= count;)
 			if (count == 0 || range_len == 0)
-				log_and_exit();
+				goto done;
 		}
 	}
 #endif
 	while ((count = safe_read(fd, iobuf, IOBUF_SIZE)) > 0) {
 		ssize_t n;
 		IF_FEATURE_HTTPD_RANGES(if (count > range_len) count = range_len;)
-		n = full_write(STDOUT_FILENO, iobuf, count);
+		n = write_response(iobuf, count);
 		if (count != n)
 			break;
+		IF_FEATURE_HTTPD_KEEPALIVE(sent += count;)
 		IF_FEATURE_HTTPD_RANGES(range_len -= count;)
 		if (range_len == 0)
 			break;
@@ -1666,6 +2087,14 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 		if (verbose > 1)
 			bb_perror_msg("error");
 	}
+ IF_FEATURE_HTTPD_USE_SENDFILE(done:)
+	close(fd);
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* File changed under us or the peer is gone:
+	 * the length we promised is wrong, close */
+	if (sent != file_size)
+		G.keep_alive = 0;
+#endif
 	log_and_exit();
 }
 
@@ -1813,8 +2242,6 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #if ENABLE_FEATURE_HTTPD_CGI
 	static const char request_HEAD[] ALIGN1 = "HEAD";
 	const char *prequest;
-	char *cookie = NULL;
-	char *content_type = NULL;
 	unsigned long length = 0;
 #elif ENABLE_FEATURE_HTTPD_PROXY
 #define prequest request_GET
@@ -1825,16 +2252,62 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 	smallint ip_allowed;
 	char http_major_version;
-#if ENABLE_FEATURE_HTTPD_PROXY
+#if ENABLE_FEATURE_HTTPD_PROXY || ENABLE_FEATURE_HTTPD_KEEPALIVE
 	char http_minor_version;
+#endif
+#if ENABLE_FEATURE_HTTPD_PROXY
 	char *header_buf = header_buf; /* for gcc */
 	char *header_ptr = header_ptr;
 	Htaccess_Proxy *proxy_entry;
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* -1: "Connection: close", 1: "Connection: keep-alive" */
+	smallint conn_hdr = 0;
+
+	/* Forget what the previous request on this connection left */
+	G.keep_alive = 0;
+	G.http11 = 0;
+	g_query = NULL;
+	found_moved_temporarily = NULL;
+	file_size = -1;
+	last_mod = 0;
+# if ENABLE_FEATURE_HTTPD_RANGES
+	range_start = range_end = 0;
+# endif
+# if ENABLE_FEATURE_HTTPD_BASIC_AUTH
+	free(remoteuser);
+	remoteuser = NULL;
+# endif
+# if ENABLE_FEATURE_HTTPD_CGI
+	free(G.cookie);
+	free(G.content_type);
+	free(referer);
+	free(user_agent);
+	free(host);
+	free(http_accept);
+	free(http_accept_language);
+	G.cookie = G.content_type = referer = user_agent = host = NULL;
+	http_accept = http_accept_language = NULL;
+# endif
+# if ENABLE_FEATURE_HTTPD_PROXY
+	free(G.proxy_header_buf);
+	G.proxy_header_buf = NULL;
+# endif
+# if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+	G.accept_gzip = G.content_gzip = 0;
+	G.if_modified_since = 0;
+	free(G.if_none_match);
+	free(G.gz_name);
+	G.if_none_match = G.gz_name = NULL;
+# endif
+	free(rmt_ip_str);
+	rmt_ip_str = NULL;
+#endif
 
 	/* Allocation of iobuf is postponed until now
 	 * (IOW, server process doesn't need to waste 8k) */
-	iobuf = xmalloc(IOBUF_SIZE);
+	if (!iobuf)
+		iobuf = xmalloc(IOBUF_SIZE);
 
 	rmt_ip = 0;
 	if (fromAddr->u.sa.sa_family == AF_INET) {
@@ -1890,14 +2363,21 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 
 	/* Find end of URL and parse HTTP version, if any */
 	http_major_version = '0';
-	IF_FEATURE_HTTPD_PROXY(http_minor_version = '0';)
+#if ENABLE_FEATURE_HTTPD_PROXY || ENABLE_FEATURE_HTTPD_KEEPALIVE
+	http_minor_version = '0';
+#endif
 	tptr = strchrnul(urlp, ' ');
 	/* Is it " HTTP/"? */
 	if (tptr[0] && strncmp(tptr + 1, HTTP_200, 5) == 0) {
 		http_major_version = tptr[6];
-		IF_FEATURE_HTTPD_PROXY(http_minor_version = tptr[8];)
+#if ENABLE_FEATURE_HTTPD_PROXY || ENABLE_FEATURE_HTTPD_KEEPALIVE
+		http_minor_version = tptr[8];
+#endif
 	}
 	*tptr = '\0';
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	G.http11 = (http_major_version == '1' && http_minor_version >= '1');
+#endif
 
 	/* Copy URL from after "GET "/"POST " to stack-allocated char[] */
 	urlcopy = alloca((tptr - urlp) + 2 + strlen(index_page));
@@ -1978,8 +2458,10 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 
 #if ENABLE_FEATURE_HTTPD_PROXY
 	proxy_entry = find_proxy_entry(urlcopy);
-	if (proxy_entry)
+	if (proxy_entry) {
 		header_buf = header_ptr = xmalloc(IOBUF_SIZE);
+		IF_FEATURE_HTTPD_KEEPALIVE(G.proxy_header_buf = header_buf;)
+	}
 #endif
 
 	if (http_major_version >= '0') {
@@ -2029,9 +2511,9 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 #if ENABLE_FEATURE_HTTPD_CGI
 			else if (STRNCASECMP(iobuf, "Cookie:") == 0) {
-				cookie = xstrdup(skip_whitespace(iobuf + sizeof("Cookie:")-1));
+				G.cookie = xstrdup(skip_whitespace(iobuf + sizeof("Cookie:")-1));
 			} else if (STRNCASECMP(iobuf, "Content-Type:") == 0) {
-				content_type = xstrdup(skip_whitespace(iobuf + sizeof("Content-Type:")-1));
+				G.content_type = xstrdup(skip_whitespace(iobuf + sizeof("Content-Type:")-1));
 			} else if (STRNCASECMP(iobuf, "Referer:") == 0) {
 				referer = xstrdup(skip_whitespace(iobuf + sizeof("Referer:")-1));
 			} else if (STRNCASECMP(iobuf, "User-Agent:") == 0) {
@@ -2059,6 +2541,31 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 				authorized = check_user_passwd(urlcopy, tptr);
 			}
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+			if (STRNCASECMP(iobuf, "Connection:") == 0) {
+				tptr = skip_whitespace(iobuf + sizeof("Connection:")-1);
+				if (strcasestr(tptr, "close"))
+					conn_hdr = -1;
+				else if (strcasestr(tptr, "keep-alive"))
+					conn_hdr = 1;
+			}
+#endif
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE
+			if (STRNCASECMP(iobuf, "Accept-Encoding:") == 0) {
+				/* "gzip;q=0" is not worth the code */
+				if (strstr(iobuf, "gzip"))
+					G.accept_gzip = 1;
+			} else if (STRNCASECMP(iobuf, "If-None-Match:") == 0) {
+				free(G.if_none_match);
+				G.if_none_match = xstrdup(skip_whitespace(iobuf + sizeof("If-None-Match:")-1));
+			} else if (STRNCASECMP(iobuf, "If-Modified-Since:") == 0) {
+				struct tm tm;
+				memset(&tm, 0, sizeof(tm));
+				tptr = skip_whitespace(iobuf + sizeof("If-Modified-Since:")-1);
+				if (strptime(tptr, RFC1123FMT, &tm))
+					G.if_modified_since = timegm(&tm);
+			}
+#endif
 #if ENABLE_FEATURE_HTTPD_RANGES
 			if (STRNCASECMP(iobuf, "Range:") == 0) {
 				/* We know only bytes=NNN-[MMM] */
@@ -2082,6 +2589,17 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	/* We are done reading headers, disable peer timeout */
 	alarm(0);
 
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	/* Only GETs may keep the connection: other requests may carry
+	 * a body, and HEAD responses to errors would have one */
+	if (IF_FEATURE_HTTPD_CGI(prequest == request_GET &&)
+	    !G.conf_changed
+	 && (G.http11 ? conn_hdr >= 0 : conn_hdr > 0)
+	) {
+		G.keep_alive = 1;
+	}
+#endif
+
 	if (strcmp(bb_basename(urlcopy), HTTPD_CONF) == 0 || !ip_allowed) {
 		/* protect listing [/path]/httpd.conf or IP deny */
 		send_headers_and_exit(HTTP_FORBIDDEN);
@@ -2105,6 +2623,7 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		int proxy_fd;
 		len_and_sockaddr *lsa;
 
+		fork_off_request();
 		proxy_fd = socket(AF_INET, SOCK_STREAM, 0);
 		if (proxy_fd < 0)
 			send_headers_and_exit(HTTP_INTERNAL_SERVER_ERROR);
@@ -2142,7 +2661,7 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 			/* protect listing "cgi-bin/" */
 			send_headers_and_exit(HTTP_FORBIDDEN);
 		}
-		send_cgi_and_exit(urlcopy, prequest, length, cookie, content_type);
+		send_cgi_and_exit(urlcopy, prequest, length, G.cookie, G.content_type);
 	}
 #endif
 
@@ -2155,7 +2674,7 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 			Htaccess *cur;
 			for (cur = script_i; cur; cur = cur->next) {
 				if (strcmp(cur->before_colon + 1, suffix) == 0) {
-					send_cgi_and_exit(urlcopy, prequest, length, cookie, content_type);
+					send_cgi_and_exit(urlcopy, prequest, length, G.cookie, G.content_type);
 				}
 			}
 		}
@@ -2171,13 +2690,13 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		if (access("/webman/index.cgi"+1, X_OK) == 0) {
 			urlp[0] = '\0';
 			g_query = urlcopy;
-			send_cgi_and_exit("/webman/index.cgi", prequest, length, cookie, content_type);
+			send_cgi_and_exit("/webman/index.cgi", prequest, length, G.cookie, G.content_type);
 		}
 #else
 		if (access("/cgi-bin/index.cgi"+1, X_OK) == 0) {
 			urlp[0] = '\0';
 			g_query = urlcopy;
-			send_cgi_and_exit("/cgi-bin/index.cgi", prequest, length, cookie, content_type);
+			send_cgi_and_exit("/cgi-bin/index.cgi", prequest, length, G.cookie, G.content_type);
 		}
 #endif
 	}
@@ -2195,6 +2714,306 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 }
 
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+/* Exit unless the connection stays open and the peer sends more */
+static void wait_for_next_request(void)
+{
+	if (!G.keep_alive)
+		log_and_exit();
+	/* Pipelined requests may be buffered already */
+	if (hdr_cnt <= 0) {
+		struct pollfd pfd[1];
+
+		pfd[0].fd = STDIN_FILENO;
+		pfd[0].events = POLLIN;
+		if (safe_poll(pfd, 1, KEEPALIVE_TIMEOUT * 1000) <= 0)
+			log_and_exit();
+		hdr_cnt = safe_read(STDIN_FILENO, hdr_buf, sizeof(hdr_buf));
+		if (hdr_cnt <= 0) /* peer closed */
+			log_and_exit();
+		hdr_ptr = hdr_buf;
+	}
+}
+
+/*
+ * Serve requests arriving on stdin/out until the peer or we decide
+ * to close the connection.
+ */
+static void handle_connection_and_exit(const len_and_sockaddr *fromAddr) NORETURN;
+static void handle_connection_and_exit(const len_and_sockaddr *fromAddr)
+{
+	/* Headers and body go out in separate writes. Without this,
+	 * the body of a small file waits for the peer's delayed ACK */
+	setsockopt(STDIN_FILENO, IPPROTO_TCP, TCP_NODELAY, &const_int_1, sizeof(const_int_1));
+	while (1) {
+		G.in_request = 1;
+		if (sigsetjmp(G.request_done, 1) == 0)
+			handle_incoming_and_exit(fromAddr);
+		wait_for_next_request();
+	}
+}
+
+static void close_conn(struct conn *c)
+{
+	struct conn **pp;
+
+	for (pp = &G.conns; *pp != c; pp = &(*pp)->next)
+		continue;
+	*pp = c->next;
+	/* A child we forked may still have the socket open,
+	 * then close() alone would not take it off the epoll set */
+	epoll_ctl(G.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c);
+}
+
+/*
+ * Do we have the complete header block of the next request?
+ * Returns -1 if it does not fit in c->buf: the rest has to be read
+ * from the socket while handling the request.
+ */
+static int request_is_complete(const struct conn *c)
+{
+	const char *eol;
+
+	eol = memchr(c->buf, '\n', c->len);
+	if (eol) {
+		/* "GET /url" without " HTTP/n.n" has no headers */
+		if (!memmem(c->buf, eol - c->buf, " HTTP/", 6))
+			return 1;
+		if (memmem(c->buf, c->len, "\n\r\n", 3) || memmem(c->buf, c->len, "\n\n", 2))
+			return 1;
+	}
+	return -(c->len == sizeof(c->buf));
+}
+
+/*
+ * Run requests buffered for connection c. Request handling code talks
+ * to stdin/out, which stay non-blocking: where we would block reading
+ * or writing, a child takes the connection over.
+ */
+static void serve_conn(struct conn *c)
+{
+	int r;
+
+	while ((r = request_is_complete(c)) != 0) {
+		memcpy(hdr_buf, c->buf, c->len);
+		hdr_ptr = hdr_buf;
+		hdr_cnt = c->len;
+		xdup2(c->fd, STDIN_FILENO);
+		xdup2(c->fd, STDOUT_FILENO);
+
+		G.in_request = 1;
+		G.handed_off = 0;
+		if (sigsetjmp(G.request_done, 1) == 0) {
+			/* Huge header block: get_line() will have to wait for it */
+			if (r < 0)
+				peer_would_block();
+			handle_incoming_and_exit(&c->peer);
+		}
+		if (!G.worker) {
+			/* We are the child which took the connection over */
+			wait_for_next_request();
+			handle_connection_and_exit(&c->peer);
+		}
+		/* Error replies may leave get_line()'s timer running */
+		alarm(0);
+
+		xdup2(G.null_fd, STDIN_FILENO);
+		xdup2(G.null_fd, STDOUT_FILENO);
+		if (!G.keep_alive || G.handed_off) {
+			/* Paranoia, see log_and_exit(). Not if a child
+			 * is still sending the response */
+			if (!G.handed_off)
+				shutdown(c->fd, SHUT_WR);
+			close_conn(c);
+			/* Subdir config is now merged into ours, start afresh */
+			if (G.conf_changed)
+				_exit(0);
+			return;
+		}
+		if (hdr_cnt < 0)
+			hdr_cnt = 0;
+		memcpy(c->buf, hdr_ptr, hdr_cnt);
+		c->len = hdr_cnt;
+	}
+}
+
+static void accept_conns(void)
+{
+	while (1) {
+		struct conn *c;
+		struct epoll_event ev;
+		len_and_sockaddr fromAddr;
+		int n;
+
+		fromAddr.len = LSA_SIZEOF_SA;
+		n = accept(G.listen_fd, &fromAddr.u.sa, &fromAddr.len);
+		if (n < 0) /* EAGAIN: other worker was faster, or no more */
+			return;
+		ndelay_on(n);
+		close_on_exec_on(n);
+		setsockopt(n, SOL_SOCKET, SO_KEEPALIVE, &const_int_1, sizeof(const_int_1));
+		/* see handle_connection_and_exit() */
+		setsockopt(n, IPPROTO_TCP, TCP_NODELAY, &const_int_1, sizeof(const_int_1));
+
+		c = xzalloc(sizeof(*c));
+		c->fd = n;
+		c->last_active = monotonic_sec();
+		memcpy(&c->peer, &fromAddr, sizeof(fromAddr));
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, n, &ev) < 0) {
+			close(n);
+			free(c);
+			continue;
+		}
+		c->next = G.conns;
+		G.conns = c;
+	}
+}
+
+/*
+ * A prefork worker: one epoll loop over the shared listening socket
+ * and all connections this process has accepted. Idle persistent
+ * connections cost nothing but a bit of memory.
+ * Exits on SIGHUP, the parent starts a new one with fresh config.
+ */
+static void worker_loop(int server_socket) NORETURN;
+static void worker_loop(int server_socket)
+{
+	struct epoll_event ev[16];
+
+	G.worker = 1;
+	G.listen_fd = server_socket;
+	bb_signals(0
+		+ (1 << SIGHUP)
+		+ (1 << SIGTERM)
+		+ (1 << SIGINT)
+		, record_signo);
+	/* Don't outlive the parent, even if it was SIGKILLed */
+	prctl(PR_SET_PDEATHSIG, SIGTERM, 0, 0, 0);
+	if (getppid() == 1)
+		_exit(0);
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+	G.null_fd = xopen(bb_dev_null, O_RDWR);
+	G.epoll_fd = epoll_create(64);
+	if (G.epoll_fd < 0)
+		bb_perror_msg_and_die("epoll_create");
+	close_on_exec_on(G.epoll_fd);
+	ev[0].events = EPOLLIN;
+	ev[0].data.ptr = NULL;
+	if (epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, server_socket, &ev[0]) < 0)
+		bb_perror_msg_and_die("epoll_ctl");
+
+	while (!bb_got_signal) {
+		struct conn *c, *next;
+		unsigned now;
+		int i, n;
+
+		n = epoll_wait(G.epoll_fd, ev, ARRAY_SIZE(ev), 1000);
+		now = monotonic_sec();
+		for (i = 0; i < n; i++) {
+			int r;
+
+			c = ev[i].data.ptr;
+			if (!c) {
+				accept_conns();
+				continue;
+			}
+			r = safe_read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+			if (r <= 0) {
+				if (r < 0 && errno == EAGAIN)
+					continue;
+				close_conn(c);
+				continue;
+			}
+			c->len += r;
+			c->last_active = now;
+			serve_conn(c);
+		}
+
+		/* Drop idle connections and those which send headers too slowly */
+		for (c = G.conns; c; c = next) {
+			next = c->next;
+			if (now - c->last_active >= (c->len ? HEADER_READ_TIMEOUT : KEEPALIVE_TIMEOUT))
+				close_conn(c);
+		}
+	}
+	_exit(0);
+}
+
+static void kill_workers(int sig)
+{
+	unsigned i;
+
+	for (i = 0; i < G.num_workers; i++)
+		if (G.worker_pids[i])
+			kill(G.worker_pids[i], sig);
+}
+
+static void prefork_sighup_handler(int sig)
+{
+	parse_conf(DEFAULT_PATH_HTTPD_CONF, SIGNALED_PARSE);
+	/* Workers finish what they are doing and exit, new ones
+	 * get the new config */
+	kill_workers(sig);
+}
+
+static void prefork_sigterm_handler(int sig)
+{
+	kill_workers(SIGTERM);
+	kill_myself_with_sig(sig);
+}
+
+/*
+ * Keep num_workers worker processes running on server_socket.
+ * Never returns.
+ */
+static void mini_httpd_prefork(int server_socket, unsigned num_workers) NORETURN;
+static void mini_httpd_prefork(int server_socket, unsigned num_workers)
+{
+	G.num_workers = num_workers;
+	G.worker_pids = xzalloc(num_workers * sizeof(G.worker_pids[0]));
+	/* Workers race for new connections, the losers get EAGAIN */
+	ndelay_on(server_socket);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGHUP, prefork_sighup_handler);
+	bb_signals(0
+		+ (1 << SIGTERM)
+		+ (1 << SIGINT)
+		, prefork_sigterm_handler);
+
+	while (1) {
+		unsigned i;
+		pid_t pid;
+
+		for (i = 0; i < num_workers; i++) {
+			if (G.worker_pids[i])
+				continue;
+			pid = fork();
+			if (pid == 0)
+				worker_loop(server_socket);
+			if (pid < 0)
+				break;
+			G.worker_pids[i] = pid;
+		}
+		pid = wait(NULL);
+		if (pid <= 0) {
+			if (errno == ECHILD) /* fork failed, try later */
+				sleep(1);
+			continue;
+		}
+		for (i = 0; i < num_workers; i++)
+			if (G.worker_pids[i] == pid)
+				G.worker_pids[i] = 0;
+	}
+}
+#else
+# define handle_connection_and_exit(fromAddr) handle_incoming_and_exit(fromAddr)
+#endif
+
 /*
  * The main http server function.
  * Given a socket, listen for new connections and farm out
@@ -2231,7 +3050,7 @@ static void mini_httpd(int server_socket)
 			xmove_fd(n, 0);
 			xdup2(0, 1);
 
-			handle_incoming_and_exit(&fromAddr);
+			handle_connection_and_exit(&fromAddr);
 		}
 		/* parent, or fork failed */
 		close(n);
@@ -2297,7 +3116,7 @@ static void mini_httpd_inetd(void)
 	fromAddr.len = LSA_SIZEOF_SA;
 	/* NB: can fail if user runs it by hand and types in http cmds */
 	getpeername(0, &fromAddr.u.sa, &fromAddr.len);
-	handle_incoming_and_exit(&fromAddr);
+	handle_connection_and_exit(&fromAddr);
 }
 
 static void sighup_handler(int sig UNUSED_PARAM)
@@ -2313,6 +3132,8 @@ enum {
 	IF_FEATURE_HTTPD_BASIC_AUTH(    r_opt_realm     ,)
 	IF_FEATURE_HTTPD_AUTH_MD5(      m_opt_md5       ,)
 	IF_FEATURE_HTTPD_SETUID(        u_opt_setuid    ,)
+	IF_FEATURE_HTTPD_KEEPALIVE(     P_opt_prefork   ,)
+	IF_FEATURE_HTTPD_STATIC_CACHE(  C_opt_cache     ,)
 	p_opt_port      ,
 	p_opt_inetd     ,
 	p_opt_foreground,
@@ -2324,6 +3145,8 @@ enum {
 	OPT_REALM       = IF_FEATURE_HTTPD_BASIC_AUTH(    (1 << r_opt_realm     )) + 0,
 	OPT_MD5         = IF_FEATURE_HTTPD_AUTH_MD5(      (1 << m_opt_md5       )) + 0,
 	OPT_SETUID      = IF_FEATURE_HTTPD_SETUID(        (1 << u_opt_setuid    )) + 0,
+	OPT_PREFORK     = IF_FEATURE_HTTPD_KEEPALIVE(     (1 << P_opt_prefork   )) + 0,
+	OPT_CACHE       = IF_FEATURE_HTTPD_STATIC_CACHE(  (1 << C_opt_cache     )) + 0,
 	OPT_PORT        = 1 << p_opt_port,
 	OPT_INETD       = 1 << p_opt_inetd,
 	OPT_FOREGROUND  = 1 << p_opt_foreground,
@@ -2341,6 +3164,8 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 	IF_FEATURE_HTTPD_SETUID(const char *s_ugid = NULL;)
 	IF_FEATURE_HTTPD_SETUID(struct bb_uidgid_t ugid;)
 	IF_FEATURE_HTTPD_AUTH_MD5(const char *pass;)
+	IF_FEATURE_HTTPD_KEEPALIVE(unsigned num_workers = 0;)
+	IF_FEATURE_HTTPD_STATIC_CACHE(unsigned cache_kb = CACHE_DEFAULT_KB;)
 
 	INIT_G();
 
@@ -2351,7 +3176,8 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 
 	home_httpd = xrealloc_getcwd_or_warn(NULL);
 	/* -v counts, -i implies -f */
-	opt_complementary = "vv:if";
+	opt_complementary = "vv:if" IF_FEATURE_HTTPD_KEEPALIVE(":P+")
+			IF_FEATURE_HTTPD_STATIC_CACHE(":C+");
 	/* We do not "absolutize" path given by -h (home) opt.
 	 * If user gives relative path in -h,
 	 * $SCRIPT_FILENAME will not be set. */
@@ -2360,12 +3186,16 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_BASIC_AUTH("r:")
 			IF_FEATURE_HTTPD_AUTH_MD5("m:")
 			IF_FEATURE_HTTPD_SETUID("u:")
+			IF_FEATURE_HTTPD_KEEPALIVE("P:")
+			IF_FEATURE_HTTPD_STATIC_CACHE("C:")
 			"p:ifv",
 			&opt_c_configFile, &url_for_decode, &home_httpd
 			IF_FEATURE_HTTPD_ENCODE_URL_STR(, &url_for_encode)
 			IF_FEATURE_HTTPD_BASIC_AUTH(, &g_realm)
 			IF_FEATURE_HTTPD_AUTH_MD5(, &pass)
 			IF_FEATURE_HTTPD_SETUID(, &s_ugid)
+			IF_FEATURE_HTTPD_KEEPALIVE(, &num_workers)
+			IF_FEATURE_HTTPD_STATIC_CACHE(, &cache_kb)
 			, &bind_addr_or_port
 			, &verbose
 		);
@@ -2444,9 +3274,25 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 	xfunc_error_retval = 0;
 	if (opt & OPT_INETD)
 		mini_httpd_inetd();
+#if ENABLE_FEATURE_HTTPD_STATIC_CACHE && BB_MMU
+	/* Shared by all processes we fork from now on */
+	G.cache_slots = (cache_kb * 1024ULL / sizeof(G.cache[0])) & ~1U;
+	if (G.cache_slots) {
+		G.cache = mmap(NULL, G.cache_slots * sizeof(G.cache[0]),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (G.cache == MAP_FAILED) {
+			bb_perror_msg("can't allocate file cache");
+			G.cache = NULL;
+		}
+	}
+#endif
 #if BB_MMU
 	if (!(opt & OPT_FOREGROUND))
 		bb_daemonize(0); /* don't change current directory */
+#if ENABLE_FEATURE_HTTPD_KEEPALIVE
+	if (num_workers)
+		mini_httpd_prefork(server_socket, num_workers); /* never returns */
+#endif
 	mini_httpd(server_socket); /* never returns */
 #else
 	mini_httpd_nommu(server_socket, argc, argv); /* never returns */
@@ -36,32 +36,34 @@ enum {
 	ARP_MSG_SIZE = 0x2a
 };
 
-/* Returns 1 if no reply received */
-int FAST_FUNC arpping(uint32_t test_nip,
-		const uint8_t *safe_mac,
-		uint32_t from_ip,
-		uint8_t *from_mac,
-		const char *interface)
+/* Open a raw socket for ARP requests and replies, -1 on error */
+int FAST_FUNC arp_socket(void)
 {
-	int timeout_ms;
-	struct pollfd pfd[1];
-#define s (pfd[0].fd)           /* socket */
-	int rv = 1;             /* "no reply received" yet */
-	struct sockaddr addr;   /* for interface name */
-	struct arpMsg arp;
+	int s;
 
 	s = socket(PF_PACKET, SOCK_PACKET, htons(ETH_P_ARP));
 	if (s == -1) {
 		bb_perror_msg(bb_msg_can_not_create_raw_socket);
 		return -1;
 	}
-
 	if (setsockopt_broadcast(s) == -1) {
 		bb_perror_msg("can't enable bcast on raw socket");
-		goto ret;
+		close(s);
+		return -1;
 	}
+	return s;
+}
+
+/* Broadcast "who has test_nip?" */
+int FAST_FUNC arp_send_request(int s,
+		uint32_t test_nip,
+		uint32_t from_ip,
+		uint8_t *from_mac,
+		const char *interface)
+{
+	struct sockaddr addr;   /* for interface name */
+	struct arpMsg arp;
 
-	/* send arp request */
 	memset(&arp, 0, sizeof(arp));
 	memset(arp.h_dest, 0xff, 6);                    /* MAC DA */
 	memcpy(arp.h_source, from_mac, 6);              /* MAC SA */
@@ -78,14 +80,58 @@ int FAST_FUNC arpping(uint32_t test_nip,
 
 	memset(&addr, 0, sizeof(addr));
 	safe_strncpy(addr.sa_data, interface, sizeof(addr.sa_data));
-	if (sendto(s, &arp, sizeof(arp), 0, &addr, sizeof(addr)) < 0) {
+	return sendto(s, &arp, sizeof(arp), 0, &addr, sizeof(addr));
+}
+
+/* Read one packet. Returns 1 if it is an ARP reply,
+ * and stores who sent it. 0 if it is something else, -1 on error */
+int FAST_FUNC arp_read_reply(int s, uint32_t *sender_nip, uint8_t *sender_mac)
+{
+	struct arpMsg arp;
+	int r;
+
+	r = safe_read(s, &arp, sizeof(arp));
+	if (r < 0)
+		return -1;
+
+	//log3("sHaddr %02x:%02x:%02x:%02x:%02x:%02x",
+	//	arp.sHaddr[0], arp.sHaddr[1], arp.sHaddr[2],
+	//	arp.sHaddr[3], arp.sHaddr[4], arp.sHaddr[5]);
+
+	if (r < ARP_MSG_SIZE || arp.operation != htons(ARPOP_REPLY))
+		return 0;
+	/* don't check it: Linux doesn't return proper tHaddr (fixed in 2.6.24?) */
+	/* && memcmp(arp.tHaddr, from_mac, 6) == 0 */
+	move_from_unaligned32(*sender_nip, arp.sInaddr);
+	memcpy(sender_mac, arp.sHaddr, 6);
+	return 1;
+}
+
+/* Returns 1 if no reply received */
+int FAST_FUNC arpping(uint32_t test_nip,
+		const uint8_t *safe_mac,
+		uint32_t from_ip,
+		uint8_t *from_mac,
+		const char *interface)
+{
+	int timeout_ms;
+	struct pollfd pfd[1];
+#define s (pfd[0].fd)           /* socket */
+	int rv = 1;             /* "no reply received" yet */
+
+	s = arp_socket();
+	if (s == -1)
+		return -1;
+
+	/* send arp request */
+	if (arp_send_request(s, test_nip, from_ip, from_mac, interface) < 0) {
 		// TODO: error message? caller didn't expect us to fail,
 		// just returning 1 "no reply received" misleads it.
 		goto ret;
 	}
 
 	/* wait for arp reply, and check it */
-	timeout_ms = 2000;
+	timeout_ms = ARP_REPLY_TIMEOUT_MS;
 	do {
 		int r;
 		unsigned prevTime = monotonic_ms();
@@ -95,25 +141,18 @@ int FAST_FUNC arpping(uint32_t test_nip,
 		if (r < 0)
 			break;
 		if (r) {
-			r = safe_read(s, &arp, sizeof(arp));
+			uint32_t sender_nip;
+			uint8_t sender_mac[6];
+
+			r = arp_read_reply(s, &sender_nip, sender_mac);
 			if (r < 0)
 				break;
-
-			//log3("sHaddr %02x:%02x:%02x:%02x:%02x:%02x",
-			//	arp.sHaddr[0], arp.sHaddr[1], arp.sHaddr[2],
-			//	arp.sHaddr[3], arp.sHaddr[4], arp.sHaddr[5]);
-
-			if (r >= ARP_MSG_SIZE
-			 && arp.operation == htons(ARPOP_REPLY)
-			 /* don't check it: Linux doesn't return proper tHaddr (fixed in 2.6.24?) */
-			 /* && memcmp(arp.tHaddr, from_mac, 6) == 0 */
-			 && *((uint32_t *) arp.sInaddr) == test_nip
-			) {
+			if (r && sender_nip == test_nip) {
 				/* if ARP source MAC matches safe_mac
 				 * (which is client's MAC), then it's not a conflict
 				 * (client simply already has this IP and replies to ARPs!)
 				 */
-				if (!safe_mac || memcmp(safe_mac, arp.sHaddr, 6) != 0)
+				if (!safe_mac || memcmp(safe_mac, sender_mac, 6) != 0)
 					rv = 0;
 				//else log2("sHaddr == safe_mac");
 				break;
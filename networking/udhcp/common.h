@@ -92,6 +92,15 @@ int udhcp_sp_read(const fd_set *rfds) FAST_FUNC;
 int udhcp_read_interface(const char *interface, int *ifindex, uint32_t *nip, uint8_t *mac) FAST_FUNC;
 int udhcp_raw_socket(int ifindex) FAST_FUNC;
 int udhcp_listen_socket(/*uint32_t ip,*/ int port, const char *inf) FAST_FUNC;
+/* How long we wait for somebody to claim an address */
+#define ARP_REPLY_TIMEOUT_MS 2000
+int arp_socket(void) FAST_FUNC;
+int arp_send_request(int s,
+		uint32_t test_nip,
+		uint32_t from_ip,
+		uint8_t *from_mac,
+		const char *interface) FAST_FUNC;
+int arp_read_reply(int s, uint32_t *sender_nip, uint8_t *sender_mac) FAST_FUNC;
 /* Returns 1 if no reply received */
 int arpping(uint32_t test_nip,
 		const uint8_t *safe_mac,
@@ -96,7 +96,7 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 		server_config.max_leases = num_ips;
 	}
 
-	g_leases = xzalloc(server_config.max_leases * sizeof(g_leases[0]));
+	init_leases();
 	read_leases(server_config.lease_file);
 
 	if (udhcp_read_interface(server_config.interface,
@@ -114,7 +114,8 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 	timeout_end = monotonic_sec() + server_config.auto_time;
 	while (1) { /* loop until universe collapses */
 		int bytes;
-		struct timeval tv;
+		int probe_ms;
+		struct timeval tv, *tv_p;
 
 		if (server_socket < 0) {
 			server_socket = udhcp_listen_socket(/*INADDR_ANY,*/ SERVER_PORT,
@@ -122,20 +123,35 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 		}
 
 		max_sock = udhcp_sp_fd_set(&rfds, server_socket);
+		max_sock = arp_probe_fd_set(&rfds, max_sock);
+		tv_p = NULL;
 		if (server_config.auto_time) {
-			tv.tv_sec = timeout_end - monotonic_sec();
+			tv.tv_sec = (int)(timeout_end - monotonic_sec());
 			tv.tv_usec = 0;
+			tv_p = &tv;
+		}
+		/* Wake up when an ARP probe ends, too */
+		probe_ms = arp_probe_timeout_ms();
+		if (probe_ms >= 0 && (!tv_p || probe_ms < tv.tv_sec * 1000)) {
+			tv.tv_sec = probe_ms / 1000;
+			tv.tv_usec = (probe_ms % 1000) * 1000;
+			tv_p = &tv;
 		}
 		retval = 0;
-		if (!server_config.auto_time || tv.tv_sec > 0) {
-			retval = select(max_sock + 1, &rfds, NULL, NULL,
-					server_config.auto_time ? &tv : NULL);
+		if (!tv_p || tv.tv_sec > 0 || tv.tv_usec > 0) {
+			retval = select(max_sock + 1, &rfds, NULL, NULL, tv_p);
 		}
-		if (retval == 0) {
+		if (retval <= 0)
+			FD_ZERO(&rfds);
+		handle_arp_probes(&rfds);
+		if (server_config.auto_time
+		 && (int)(timeout_end - monotonic_sec()) <= 0
+		) {
 			write_leases();
 			timeout_end = monotonic_sec() + server_config.auto_time;
-			continue;
 		}
+		if (retval == 0)
+			continue;
 		if (retval < 0 && errno != EINTR) {
 			log1("Error on select");
 			continue;
@@ -152,6 +168,8 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 			bb_info_msg("Received a SIGTERM");
 			goto ret0;
 		case 0:	/* no signal: read a packet */
+			if (!FD_ISSET(server_socket, &rfds))
+				continue; /* it was an ARP reply */
 			break;
 		default: /* signal or error (probably EINTR): back to select */
 			continue;
@@ -197,6 +215,10 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 		case DHCPDISCOVER:
 			log1("Received DISCOVER");
 
+			if (!static_lease_ip && arp_probe_pending(&packet)) {
+				log1("Still probing an address for it");
+				break;
+			}
 			if (send_offer(&packet) < 0) {
 				bb_error_msg("send OFFER failed");
 			}
@@ -247,7 +269,7 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 				if (lease) {
 					if (is_expired_lease(lease)) {
 						/* probably best if we drop this lease */
-						memset(lease->lease_mac, 0, sizeof(lease->lease_mac));
+						forget_lease_mac(lease);
 					} else {
 						/* make some contention for this address */
 						send_NAK(&packet);
@@ -270,14 +292,14 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 		case DHCPDECLINE:
 			log1("Received DECLINE");
 			if (lease) {
-				memset(lease->lease_mac, 0, sizeof(lease->lease_mac));
-				lease->expires = time(NULL) + server_config.decline_time;
+				forget_lease_mac(lease);
+				set_lease_expires(lease, time(NULL) + server_config.decline_time);
 			}
 			break;
 		case DHCPRELEASE:
 			log1("Received RELEASE");
 			if (lease)
-				lease->expires = time(NULL);
+				set_lease_expires(lease, time(NULL));
 			break;
 		case DHCPINFORM:
 			log1("Received INFORM");
@@ -96,15 +96,25 @@ struct dyn_lease {
 
 extern struct dyn_lease *g_leases;
 
+void init_leases(void) FAST_FUNC;
 struct dyn_lease *add_lease(
 		const uint8_t *chaddr, uint32_t yiaddr,
 		leasetime_t leasetime,
 		const char *hostname, int hostname_len
 		) FAST_FUNC;
+/* Use these to change lease_mac and expires of leases from the table */
+void forget_lease_mac(struct dyn_lease *lease) FAST_FUNC;
+void set_lease_expires(struct dyn_lease *lease, leasetime_t expires) FAST_FUNC;
 int is_expired_lease(struct dyn_lease *lease) FAST_FUNC;
 struct dyn_lease *find_lease_by_mac(const uint8_t *mac) FAST_FUNC;
 struct dyn_lease *find_lease_by_nip(uint32_t nip) FAST_FUNC;
-uint32_t find_free_or_expired_nip(const uint8_t *safe_mac) FAST_FUNC;
+uint32_t find_free_or_expired_nip(const uint8_t *safe_mac, int probe_later) FAST_FUNC;
+int arp_probe_possible(void) FAST_FUNC;
+void start_arp_probe(struct dhcp_packet *discover, uint32_t nip) FAST_FUNC;
+int arp_probe_pending(struct dhcp_packet *discover) FAST_FUNC;
+int arp_probe_fd_set(fd_set *rfds, int max_fd) FAST_FUNC;
+int arp_probe_timeout_ms(void) FAST_FUNC;
+void handle_arp_probes(fd_set *rfds) FAST_FUNC;
 
 
 /*** static_leases.h ***/
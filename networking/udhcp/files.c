@@ -343,40 +343,44 @@ void FAST_FUNC read_config(const char *file)
 void FAST_FUNC write_leases(void)
 {
 	int fd;
-	unsigned i;
+	unsigned i, n;
 	leasetime_t curr;
 	int64_t written_at;
+	char *buf;
+	struct dyn_lease *lease;
 
 	fd = open_or_warn(server_config.lease_file, O_WRONLY|O_CREAT|O_TRUNC);
 	if (fd < 0)
 		return;
 
+	/* Build the whole file in memory and write it at once:
+	 * with many leases, a write per lease is slow */
+	buf = xmalloc(sizeof(written_at) + server_config.max_leases * sizeof(g_leases[0]));
+
 	curr = written_at = time(NULL);
 
 	written_at = hton64(written_at);
-	full_write(fd, &written_at, sizeof(written_at));
+	memcpy(buf, &written_at, sizeof(written_at));
 
+	/* dyn_lease is PACKED, no alignment needed */
+	lease = (void*)(buf + sizeof(written_at));
+	n = 0;
 	for (i = 0; i < server_config.max_leases; i++) {
-		leasetime_t tmp_time;
-
 		if (g_leases[i].lease_nip == 0)
 			continue;
 
-		/* Screw with the time in the struct, for easier writing */
-		tmp_time = g_leases[i].expires;
-
-		g_leases[i].expires -= curr;
-		if ((signed_leasetime_t) g_leases[i].expires < 0)
-			g_leases[i].expires = 0;
-		g_leases[i].expires = htonl(g_leases[i].expires);
-
-		/* No error check. If the file gets truncated,
-		 * we lose some leases on restart. Oh well. */
-		full_write(fd, &g_leases[i], sizeof(g_leases[i]));
-
-		/* Then restore it when done */
-		g_leases[i].expires = tmp_time;
+		lease[n] = g_leases[i];
+		lease[n].expires -= curr;
+		if ((signed_leasetime_t) lease[n].expires < 0)
+			lease[n].expires = 0;
+		lease[n].expires = htonl(lease[n].expires);
+		n++;
 	}
+
+	/* No error check. If the file gets truncated,
+	 * we lose some leases on restart. Oh well. */
+	full_write(fd, buf, sizeof(written_at) + n * sizeof(g_leases[0]));
+	free(buf);
 	close(fd);
 
 	if (server_config.notify_file) {
@@ -9,40 +9,287 @@
 #include "common.h"
 #include "dhcpd.h"
 
+/* Leases live in g_leases[], which is also what we save to the lease
+ * file. Next to it we keep indices, so that nothing has to scan
+ * the whole table or the whole address range:
+ * - hash chains by MAC and by IP (a used lease always has an IP,
+ *   it may have a blank MAC if the address is just reserved),
+ * - a min-heap of used leases by expiry time,
+ * - a stack of unused slots,
+ * - a bitmap of addresses in start_ip..end_ip which have a lease.
+ * Lease fields which are index keys must be changed only here.
+ */
+struct lease_links {
+	uint32_t mac_next;      /* next slot + 1 in the hash chain, 0: end */
+	uint32_t nip_next;
+	uint32_t heap_pos;
+};
+
+static struct {
+	uint32_t *mac_hash;     /* first slot + 1 of the chain */
+	uint32_t *nip_hash;
+	uint32_t hash_mask;
+	struct lease_links *links;
+	uint32_t *heap;         /* slots of used leases, earliest expiry first */
+	uint32_t heap_len;
+	uint32_t *free_slot;
+	uint32_t free_cnt;
+	unsigned long *busy;    /* addresses we must not hand out */
+	uint32_t cursor;        /* where the next free address search starts */
+} idx;
+
+#define BUSY_BITS (sizeof(long) * 8)
+
+static ALWAYS_INLINE int blank_mac(const uint8_t *mac)
+{
+	return (mac[0] | mac[1] | mac[2] | mac[3] | mac[4] | mac[5]) == 0;
+}
 
-/* Find the oldest expired lease, NULL if there are no expired leases */
-static struct dyn_lease *oldest_expired_lease(void)
+static unsigned hash_mac(const uint8_t *mac)
 {
-	struct dyn_lease *oldest_lease = NULL;
-	leasetime_t oldest_time = time(NULL);
-	unsigned i;
+	unsigned h = 0;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		h = h * 31 + mac[i];
+	return h & idx.hash_mask;
+}
+
+static unsigned hash_nip(uint32_t nip)
+{
+	/* Pools are ranges of consecutive addresses: this spreads them perfectly */
+	return ntohl(nip) & idx.hash_mask;
+}
+
+/* Bit number of nip in the busy bitmap, -1 if not in the pool */
+static int busy_bit(uint32_t nip)
+{
+	uint32_t addr = ntohl(nip);
+
+	if (addr < server_config.start_ip || addr > server_config.end_ip)
+		return -1;
+	return addr - server_config.start_ip;
+}
+
+static void set_busy(uint32_t nip, int busy)
+{
+	int bit = busy_bit(nip);
+	unsigned long mask;
+
+	if (bit < 0)
+		return;
+	mask = 1UL << (bit % BUSY_BITS);
+	if (busy)
+		idx.busy[bit / BUSY_BITS] |= mask;
+	else
+		idx.busy[bit / BUSY_BITS] &= ~mask;
+}
+
+static int is_busy(unsigned bit)
+{
+	return (idx.busy[bit / BUSY_BITS] >> (bit % BUSY_BITS)) & 1;
+}
+
 
-	/* Unexpired leases have g_leases[i].expires >= current time
-	 * and therefore can't ever match */
-	for (i = 0; i < server_config.max_leases; i++) {
-		if (g_leases[i].expires < oldest_time) {
-			oldest_time = g_leases[i].expires;
-			oldest_lease = &g_leases[i];
+/* Expiry heap */
+
+static void heap_set(unsigned pos, uint32_t slot)
+{
+	idx.heap[pos] = slot;
+	idx.links[slot].heap_pos = pos;
+}
+
+static void heap_sift_up(unsigned pos)
+{
+	uint32_t slot = idx.heap[pos];
+	leasetime_t expires = g_leases[slot].expires;
+
+	while (pos) {
+		unsigned parent = (pos - 1) / 2;
+		if (g_leases[idx.heap[parent]].expires <= expires)
+			break;
+		heap_set(pos, idx.heap[parent]);
+		pos = parent;
+	}
+	heap_set(pos, slot);
+}
+
+static void heap_sift_down(unsigned pos)
+{
+	uint32_t slot = idx.heap[pos];
+	leasetime_t expires = g_leases[slot].expires;
+
+	while (1) {
+		unsigned child = pos * 2 + 1;
+		if (child >= idx.heap_len)
+			break;
+		if (child + 1 < idx.heap_len
+		 && g_leases[idx.heap[child + 1]].expires < g_leases[idx.heap[child]].expires
+		) {
+			child++;
 		}
+		if (expires <= g_leases[idx.heap[child]].expires)
+			break;
+		heap_set(pos, idx.heap[child]);
+		pos = child;
 	}
-	return oldest_lease;
+	heap_set(pos, slot);
+}
+
+static void heap_fix(unsigned pos)
+{
+	heap_sift_up(pos);
+	heap_sift_down(idx.links[idx.heap[pos]].heap_pos);
+}
+
+
+/* Hash chains */
+
+static void chain_remove(uint32_t *head, uint32_t slot, int by_mac)
+{
+	uint32_t *pp = head;
+
+	while (*pp) {
+		struct lease_links *l = &idx.links[*pp - 1];
+		if (*pp - 1 == slot) {
+			*pp = by_mac ? l->mac_next : l->nip_next;
+			return;
+		}
+		pp = by_mac ? &l->mac_next : &l->nip_next;
+	}
+}
+
+static void unhash_mac(uint32_t slot)
+{
+	if (!blank_mac(g_leases[slot].lease_mac))
+		chain_remove(&idx.mac_hash[hash_mac(g_leases[slot].lease_mac)], slot, 1);
+}
+
+static void hash_in_mac(uint32_t slot)
+{
+	uint32_t *head;
+
+	if (blank_mac(g_leases[slot].lease_mac))
+		return;
+	head = &idx.mac_hash[hash_mac(g_leases[slot].lease_mac)];
+	idx.links[slot].mac_next = *head;
+	*head = slot + 1;
+}
+
+
+/* Put a filled-in slot into all indices */
+static void link_lease(uint32_t slot)
+{
+	uint32_t *head;
+
+	hash_in_mac(slot);
+	head = &idx.nip_hash[hash_nip(g_leases[slot].lease_nip)];
+	idx.links[slot].nip_next = *head;
+	*head = slot + 1;
+	heap_set(idx.heap_len, slot);
+	heap_sift_up(idx.heap_len++);
+	set_busy(g_leases[slot].lease_nip, 1);
+}
+
+/* Take a used slot out of all indices and free it */
+static void unlink_lease(uint32_t slot)
+{
+	unsigned pos;
+
+	unhash_mac(slot);
+	chain_remove(&idx.nip_hash[hash_nip(g_leases[slot].lease_nip)], slot, 0);
+	pos = idx.links[slot].heap_pos;
+	if (--idx.heap_len != pos) {
+		heap_set(pos, idx.heap[idx.heap_len]);
+		heap_fix(pos);
+	}
+	set_busy(g_leases[slot].lease_nip, 0);
+	memset(&g_leases[slot], 0, sizeof(g_leases[slot]));
+	idx.free_slot[idx.free_cnt++] = slot;
+}
+
+/* Slot number of a lease, -1 if it is not in g_leases[]
+ * (dhcpd.c makes up leases for static addresses) */
+static int lease_slot(struct dyn_lease *lease)
+{
+	uintptr_t ofs = (uintptr_t)lease - (uintptr_t)g_leases;
+
+	if (ofs >= server_config.max_leases * sizeof(g_leases[0]))
+		return -1;
+	return ofs / sizeof(g_leases[0]);
+}
+
+
+void FAST_FUNC init_leases(void)
+{
+	unsigned nbuckets, i;
+	uint32_t num_ips = server_config.end_ip - server_config.start_ip + 1;
+	struct static_lease *st;
+
+	g_leases = xzalloc(server_config.max_leases * sizeof(g_leases[0]));
+
+	nbuckets = 16;
+	while (nbuckets < server_config.max_leases)
+		nbuckets <<= 1;
+	idx.hash_mask = nbuckets - 1;
+	idx.mac_hash = xzalloc(nbuckets * sizeof(idx.mac_hash[0]));
+	idx.nip_hash = xzalloc(nbuckets * sizeof(idx.nip_hash[0]));
+	idx.links = xzalloc(server_config.max_leases * sizeof(idx.links[0]));
+	idx.heap = xzalloc(server_config.max_leases * sizeof(idx.heap[0]));
+	idx.free_slot = xmalloc(server_config.max_leases * sizeof(idx.free_slot[0]));
+	/* Hand out slot 0 first */
+	for (i = 0; i < server_config.max_leases; i++)
+		idx.free_slot[i] = server_config.max_leases - 1 - i;
+	idx.free_cnt = server_config.max_leases;
+
+	idx.busy = xzalloc((num_ips / BUSY_BITS + 1) * sizeof(idx.busy[0]));
+	/* Addresses which are never ours to give. They are checked
+	 * when we pick an address anyway, this only skips them faster.
+	 * A lease on one of them (static lease) may clear its bit. */
+	for (i = 0; i < num_ips; i++) {
+		/* ie, 192.168.55.0 and 192.168.55.255 */
+		uint8_t lsb = server_config.start_ip + i;
+		if (lsb == 0 || lsb == 0xff)
+			set_busy(htonl(server_config.start_ip + i), 1);
+	}
+	for (st = server_config.static_leases; st; st = st->next)
+		set_busy(st->nip, 1);
+}
+
+
+/* Find an unused slot, else the slot of the oldest expired lease.
+ * -1 if all leases are in use */
+static int free_lease_slot(void)
+{
+	uint32_t slot;
+
+	if (idx.free_cnt == 0) {
+		/* Unexpired leases have expires >= current time
+		 * and therefore can't ever match */
+		if (idx.heap_len == 0 || !is_expired_lease(&g_leases[idx.heap[0]]))
+			return -1;
+		unlink_lease(idx.heap[0]);
+	}
+	slot = idx.free_slot[--idx.free_cnt];
+	return slot;
 }
 
 
 /* Clear every lease out that chaddr OR yiaddr matches and is nonzero */
 static void clear_lease(const uint8_t *chaddr, uint32_t yiaddr)
 {
-	unsigned i, j;
-
-	for (j = 0; j < 16 && !chaddr[j]; j++)
-		continue;
+	struct dyn_lease *lease;
 
-	for (i = 0; i < server_config.max_leases; i++) {
-		if ((j != 16 && memcmp(g_leases[i].lease_mac, chaddr, 6) == 0)
-		 || (yiaddr && g_leases[i].lease_nip == yiaddr)
-		) {
-			memset(&g_leases[i], 0, sizeof(g_leases[i]));
-		}
+	/* chaddr is 16 bytes, but only 6 are used (see struct dyn_lease) */
+	if (!blank_mac(chaddr)) {
+		lease = find_lease_by_mac(chaddr);
+		if (lease)
+			unlink_lease(lease - g_leases);
+	}
+	if (yiaddr) {
+		lease = find_lease_by_nip(yiaddr);
+		if (lease)
+			unlink_lease(lease - g_leases);
 	}
 }
 
@@ -54,35 +301,59 @@ struct dyn_lease* FAST_FUNC add_lease(
 		const char *hostname, int hostname_len)
 {
 	struct dyn_lease *oldest;
+	int slot;
 
 	/* clean out any old ones */
 	clear_lease(chaddr, yiaddr);
 
-	oldest = oldest_expired_lease();
-
-	if (oldest) {
-		oldest->hostname[0] = '\0';
-		if (hostname) {
-			char *p;
-			if (hostname_len > sizeof(oldest->hostname))
-				hostname_len = sizeof(oldest->hostname);
-			p = safe_strncpy(oldest->hostname, hostname, hostname_len);
-			/* sanitization (s/non-ASCII/^/g) */
-			while (*p) {
-				if (*p < ' ' || *p > 126)
-					*p = '^';
-				p++;
-			}
+	slot = free_lease_slot();
+	if (slot < 0)
+		return NULL;
+	oldest = &g_leases[slot];
+
+	oldest->hostname[0] = '\0';
+	if (hostname) {
+		char *p;
+		if (hostname_len > sizeof(oldest->hostname))
+			hostname_len = sizeof(oldest->hostname);
+		p = safe_strncpy(oldest->hostname, hostname, hostname_len);
+		/* sanitization (s/non-ASCII/^/g) */
+		while (*p) {
+			if (*p < ' ' || *p > 126)
+				*p = '^';
+			p++;
 		}
-		memcpy(oldest->lease_mac, chaddr, 6);
-		oldest->lease_nip = yiaddr;
-		oldest->expires = time(NULL) + leasetime;
 	}
+	memcpy(oldest->lease_mac, chaddr, 6);
+	oldest->lease_nip = yiaddr;
+	oldest->expires = time(NULL) + leasetime;
+	link_lease(slot);
 
 	return oldest;
 }
 
 
+/* The address stays taken, but no longer by this MAC */
+void FAST_FUNC forget_lease_mac(struct dyn_lease *lease)
+{
+	int slot = lease_slot(lease);
+
+	if (slot >= 0)
+		unhash_mac(slot);
+	memset(lease->lease_mac, 0, sizeof(lease->lease_mac));
+}
+
+
+void FAST_FUNC set_lease_expires(struct dyn_lease *lease, leasetime_t expires)
+{
+	int slot = lease_slot(lease);
+
+	lease->expires = expires;
+	if (slot >= 0)
+		heap_fix(idx.links[slot].heap_pos);
+}
+
+
 /* True if a lease has expired */
 int FAST_FUNC is_expired_lease(struct dyn_lease *lease)
 {
@@ -90,40 +361,51 @@ int FAST_FUNC is_expired_lease(struct dyn_lease *lease)
 }
 
 
-/* Find the first lease that matches MAC, NULL if no match */
+/* Find the lease that matches MAC, NULL if no match */
 struct dyn_lease* FAST_FUNC find_lease_by_mac(const uint8_t *mac)
 {
-	unsigned i;
+	uint32_t n;
 
-	for (i = 0; i < server_config.max_leases; i++)
-		if (memcmp(g_leases[i].lease_mac, mac, 6) == 0)
-			return &g_leases[i];
+	if (blank_mac(mac))
+		return NULL;
+	for (n = idx.mac_hash[hash_mac(mac)]; n; n = idx.links[n - 1].mac_next)
+		if (memcmp(g_leases[n - 1].lease_mac, mac, 6) == 0)
+			return &g_leases[n - 1];
 
 	return NULL;
 }
 
 
-/* Find the first lease that matches IP, NULL is no match */
+/* Find the lease that matches IP, NULL is no match */
 struct dyn_lease* FAST_FUNC find_lease_by_nip(uint32_t nip)
 {
-	unsigned i;
+	uint32_t n;
 
-	for (i = 0; i < server_config.max_leases; i++)
-		if (g_leases[i].lease_nip == nip)
-			return &g_leases[i];
+	for (n = idx.nip_hash[hash_nip(nip)]; n; n = idx.links[n - 1].nip_next)
+		if (g_leases[n - 1].lease_nip == nip)
+			return &g_leases[n - 1];
 
 	return NULL;
 }
 
 
 /* Check if the IP is taken; if it is, add it to the lease table */
-static int nobody_responds_to_arp(uint32_t nip, const uint8_t *safe_mac)
+static void reserve_conflicting_nip(uint32_t nip)
 {
 	/* 16 zero bytes */
 	static const uint8_t blank_chaddr[16] = { 0 };
 	/* = { 0 } helps gcc to put it in rodata, not bss */
 
 	struct in_addr temp;
+
+	temp.s_addr = nip;
+	bb_info_msg("%s belongs to someone, reserving it for %u seconds",
+		inet_ntoa(temp), (unsigned)server_config.conflict_time);
+	add_lease(blank_chaddr, nip, server_config.conflict_time, NULL, 0);
+}
+
+static int nobody_responds_to_arp(uint32_t nip, const uint8_t *safe_mac)
+{
 	int r;
 
 	r = arpping(nip, safe_mac,
@@ -133,25 +415,41 @@ static int nobody_responds_to_arp(uint32_t nip, const uint8_t *safe_mac)
 	if (r)
 		return r;
 
-	temp.s_addr = nip;
-	bb_info_msg("%s belongs to someone, reserving it for %u seconds",
-		inet_ntoa(temp), (unsigned)server_config.conflict_time);
-	add_lease(blank_chaddr, nip, server_config.conflict_time, NULL, 0);
+	reserve_conflicting_nip(nip);
 	return 0;
 }
 
 
-/* Find a new usable (we think) address */
-uint32_t FAST_FUNC find_free_or_expired_nip(const uint8_t *safe_mac)
+/* Find a new usable (we think) address.
+ * If probe_later is set, the caller will ARP-probe it with start_arp_probe() */
+uint32_t FAST_FUNC find_free_or_expired_nip(const uint8_t *safe_mac, int probe_later)
 {
-	uint32_t addr;
-	struct dyn_lease *oldest_lease = NULL;
-
-	addr = server_config.start_ip; /* addr is in host order here */
-	for (; addr <= server_config.end_ip; addr++) {
-		uint32_t nip;
-		struct dyn_lease *lease;
+	uint32_t num_ips = server_config.end_ip - server_config.start_ip + 1;
+	uint32_t left, bit;
+	struct dyn_lease *oldest_lease;
+
+	/* Rotate through the pool, so that a just freed address
+	 * is not given to the next client right away */
+	bit = idx.cursor;
+	for (left = num_ips; left; left--, bit++) {
+		uint32_t addr, nip;
+
+		if (bit >= num_ips)
+			bit = 0;
+		/* Skip fully used words */
+		if (bit % BUSY_BITS == 0
+		 && idx.busy[bit / BUSY_BITS] == ~0UL
+		 && left > BUSY_BITS
+		 && bit + BUSY_BITS <= num_ips
+		) {
+			bit += BUSY_BITS - 1;
+			left -= BUSY_BITS - 1;
+			continue;
+		}
+		if (is_busy(bit))
+			continue;
 
+		addr = server_config.start_ip + bit; /* addr is in host order here */
 		/* ie, 192.168.55.0 */
 		if ((addr & 0xff) == 0)
 			continue;
@@ -163,21 +461,158 @@ uint32_t FAST_FUNC find_free_or_expired_nip(const uint8_t *safe_mac)
 		if (is_nip_reserved(server_config.static_leases, nip))
 			continue;
 
-		lease = find_lease_by_nip(nip);
-		if (!lease) {
-			if (nobody_responds_to_arp(nip, safe_mac))
-				return nip;
-		} else {
-			if (!oldest_lease || lease->expires < oldest_lease->expires)
-				oldest_lease = lease;
+		if (probe_later || nobody_responds_to_arp(nip, safe_mac)) {
+			idx.cursor = bit + 1;
+			return nip;
 		}
 	}
 
+	/* Every address has a lease. Take the oldest one if it expired */
+	oldest_lease = idx.heap_len ? &g_leases[idx.heap[0]] : NULL;
 	if (oldest_lease && is_expired_lease(oldest_lease)
-	 && nobody_responds_to_arp(oldest_lease->lease_nip, safe_mac)
+	 && busy_bit(oldest_lease->lease_nip) >= 0
+	 && !is_nip_reserved(server_config.static_leases, oldest_lease->lease_nip)
+	 && (probe_later || nobody_responds_to_arp(oldest_lease->lease_nip, safe_mac))
 	) {
 		return oldest_lease->lease_nip;
 	}
 
 	return 0;
 }
+
+
+/* Asynchronous ARP probes.
+ * An address picked by find_free_or_expired_nip() is offered only after
+ * ARP_REPLY_TIMEOUT_MS without a reply. Meanwhile we serve other clients.
+ * The DISCOVER is kept, and answered by calling send_offer() again:
+ * it finds the reservation made for the client, or picks another
+ * address if the probed one turned out to be taken.
+ */
+#define MAX_ARP_PROBES 16
+
+struct arp_probe {
+	unsigned deadline;      /* monotonic_ms() */
+	uint32_t nip;
+	struct dhcp_packet packet;
+};
+
+static struct arp_probe *probes;
+static unsigned num_probes;
+static int arp_fd = -1;         /* -2: can't open it, use arpping() */
+
+/* Can we start one more probe? */
+int FAST_FUNC arp_probe_possible(void)
+{
+	if (arp_fd == -1) {
+		arp_fd = arp_socket();
+		if (arp_fd < 0) {
+			arp_fd = -2;
+			return 0;
+		}
+		close_on_exec_on(arp_fd);
+		probes = xmalloc(MAX_ARP_PROBES * sizeof(probes[0]));
+	}
+	return arp_fd >= 0 && num_probes < MAX_ARP_PROBES;
+}
+
+void FAST_FUNC start_arp_probe(struct dhcp_packet *discover, uint32_t nip)
+{
+	struct arp_probe *p = &probes[num_probes++];
+
+	p->deadline = monotonic_ms() + ARP_REPLY_TIMEOUT_MS;
+	p->nip = nip;
+	memcpy(&p->packet, discover, sizeof(p->packet));
+	arp_send_request(arp_fd, nip,
+			server_config.server_nip,
+			server_config.server_mac,
+			server_config.interface);
+}
+
+/* If we are probing an address for this client, remember the new
+ * DISCOVER (it may have a new xid) and return 1 */
+int FAST_FUNC arp_probe_pending(struct dhcp_packet *discover)
+{
+	unsigned i;
+
+	for (i = 0; i < num_probes; i++) {
+		if (memcmp(probes[i].packet.chaddr, discover->chaddr, 6) == 0) {
+			memcpy(&probes[i].packet, discover, sizeof(probes[i].packet));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int FAST_FUNC arp_probe_fd_set(fd_set *rfds, int max_fd)
+{
+	if (arp_fd < 0)
+		return max_fd;
+	FD_SET(arp_fd, rfds);
+	return arp_fd > max_fd ? arp_fd : max_fd;
+}
+
+/* Milliseconds until the next probe ends, -1 if there are none */
+int FAST_FUNC arp_probe_timeout_ms(void)
+{
+	unsigned i;
+	int timeout = -1;
+	unsigned now = monotonic_ms();
+
+	for (i = 0; i < num_probes; i++) {
+		int t = probes[i].deadline - now;
+		if (t < 0)
+			t = 0;
+		if (timeout < 0 || t < timeout)
+			timeout = t;
+	}
+	return timeout;
+}
+
+static void finish_arp_probe(unsigned i)
+{
+	struct dhcp_packet discover;
+
+	memcpy(&discover, &probes[i].packet, sizeof(discover));
+	probes[i] = probes[--num_probes];
+	/* Sends OFFER, or starts a probe of another address */
+	if (send_offer(&discover) < 0)
+		bb_error_msg("send OFFER failed");
+}
+
+/* Read ARP replies, answer DISCOVERs whose probes have ended */
+void FAST_FUNC handle_arp_probes(fd_set *rfds)
+{
+	unsigned i;
+	unsigned now;
+
+	if (arp_fd >= 0 && FD_ISSET(arp_fd, rfds)) {
+		uint32_t sender_nip;
+		uint8_t sender_mac[6];
+
+		if (arp_read_reply(arp_fd, &sender_nip, sender_mac) > 0) {
+			for (i = 0; i < num_probes; i++) {
+				if (probes[i].nip != sender_nip)
+					continue;
+				/* The client itself already has this IP? Not a conflict */
+				if (memcmp(probes[i].packet.chaddr, sender_mac, 6) == 0)
+					break;
+				/* Also drops the reservation we made for the client */
+				reserve_conflicting_nip(sender_nip);
+				finish_arp_probe(i);
+				break;
+			}
+		}
+	}
+
+	now = monotonic_ms();
+	i = 0;
+	while (i < num_probes) {
+		if ((int)(probes[i].deadline - now) <= 0) {
+			log1("No arp reply received for this address");
+			finish_arp_probe(i);
+			/* slot i now holds another probe, look at it too */
+			continue;
+		}
+		i++;
+	}
+}
@@ -142,6 +142,7 @@ int FAST_FUNC send_offer(struct dhcp_packet *oldpacket)
 	/* ADDME: if static, short circuit */
 	if (!static_lease_ip) {
 		struct dyn_lease *lease;
+		int probe = 0;
 
 		lease = find_lease_by_mac(oldpacket->chaddr);
 		/* The client is in our lease/offered table */
@@ -167,7 +168,9 @@ int FAST_FUNC send_offer(struct dhcp_packet *oldpacket)
 		}
 		/* Otherwise, find a free IP */
 		else {
-			packet.yiaddr = find_free_or_expired_nip(oldpacket->chaddr);
+			/* Don't stall other clients while we ARP-probe it */
+			probe = arp_probe_possible();
+			packet.yiaddr = find_free_or_expired_nip(oldpacket->chaddr, probe);
 		}
 
 		if (!packet.yiaddr) {
@@ -184,6 +187,11 @@ int FAST_FUNC send_offer(struct dhcp_packet *oldpacket)
 			bb_error_msg("lease pool is full - OFFER abandoned");
 			return -1;
 		}
+		if (probe) {
+			/* handle_arp_probes() calls us again when it's done */
+			start_arp_probe(oldpacket, packet.yiaddr);
+			return 0;
+		}
 		lease_time_sec = select_lease_time(oldpacket);
 	} else {
 		/* It is a static lease... use it */
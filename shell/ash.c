@@ -81,9 +81,10 @@
 
 /* ============ Hash table sizes. Configurable. */
 
-#define VTABSIZE 39
+/* Initial sizes, powers of 2. These two grow as needed */
+#define VTABSIZE 64
+#define CMDTABLESIZE 32
 #define ATABSIZE 39
-#define CMDTABLESIZE 31         /* should be prime */
 
 
 /* ============ Shell options */
@@ -1800,7 +1801,9 @@ struct globals_var {
 	struct redirtab *redirlist;
 	int g_nullredirs;
 	int preverrout_fd;   /* save fd2 before print debug if xflag is set. */
-	struct var *vartab[VTABSIZE];
+	struct var **vartab;
+	unsigned vartab_size;
+	unsigned vartab_count;
 	struct var varinit[ARRAY_SIZE(varinit_data)];
 };
 extern struct globals_var *const ash_ptr_to_globals_var;
@@ -1810,11 +1813,15 @@ extern struct globals_var *const ash_ptr_to_globals_var;
 #define g_nullredirs  (G_var.g_nullredirs )
 #define preverrout_fd (G_var.preverrout_fd)
 #define vartab        (G_var.vartab       )
+#define vartab_size   (G_var.vartab_size  )
+#define vartab_count  (G_var.vartab_count )
 #define varinit       (G_var.varinit      )
 #define INIT_G_var() do { \
 	unsigned i; \
 	(*(struct globals_var**)&ash_ptr_to_globals_var) = xzalloc(sizeof(G_var)); \
 	barrier(); \
+	vartab_size = VTABSIZE; \
+	vartab = xzalloc(VTABSIZE * sizeof(vartab[0])); \
 	for (i = 0; i < ARRAY_SIZE(varinit_data); i++) { \
 		varinit[i].flags = varinit_data[i].flags; \
 		varinit[i].text  = varinit_data[i].text; \
@@ -1929,15 +1936,46 @@ varequal(const char *a, const char *b)
 /*
  * Find the appropriate entry in the hash table from the name.
  */
+static unsigned
+hashname(const char *p)
+{
+	unsigned hashval = 0;
+
+	while (*p && *p != '=')
+		hashval = hashval * 31 + (unsigned char) *p++;
+	return hashval ^ (hashval >> 16);
+}
+
 static struct var **
 hashvar(const char *p)
 {
-	unsigned hashval;
+	return &vartab[hashname(p) & (vartab_size - 1)];
+}
 
-	hashval = ((unsigned char) *p) << 4;
-	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+/*
+ * Called after a variable is added. Chains are kept short by doubling
+ * the table. Pointers returned by hashvar() before are no longer valid.
+ */
+static void
+growvartab(void)
+{
+	struct var **old = vartab;
+	struct var *vp, *next;
+	unsigned i, oldsize = vartab_size;
+
+	if (++vartab_count <= vartab_size * 2)
+		return;
+	vartab_size *= 2;
+	vartab = ckzalloc(vartab_size * sizeof(vartab[0]));
+	for (i = 0; i < oldsize; i++) {
+		for (vp = old[i]; vp; vp = next) {
+			struct var **vpp = hashvar(vp->text);
+			next = vp->next;
+			vp->next = *vpp;
+			*vpp = vp;
+		}
+	}
+	free(old);
 }
 
 static int
@@ -1971,6 +2009,7 @@ initvar(void)
 		vpp = hashvar(vp->text);
 		vp->next = *vpp;
 		*vpp = vp;
+		growvartab();
 	} while (++vp < end);
 }
 
@@ -2069,11 +2108,14 @@ setvareq(char *s, int flags)
 		vp->next = *vpp;
 		/*vp->func = NULL; - ckzalloc did it */
 		*vpp = vp;
+		vpp = NULL;
 	}
 	if (!(flags & (VTEXTFIXED|VSTACK|VNOSAVE)))
 		s = ckstrdup(s);
 	vp->text = s;
 	vp->flags = flags;
+	if (!vpp)
+		growvartab();
 }
 
 /*
@@ -2173,6 +2215,7 @@ unsetvar(const char *s)
 				free((char*)vp->text);
 			*vpp = vp->next;
 			free(vp);
+			vartab_count--;
 			INT_ON;
 		} else {
 			setvar(s, 0, 0);
@@ -2225,7 +2268,7 @@ listvars(int on, int off, char ***end)
 				*ep++ = (char *) vp->text;
 			}
 		}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vartab_size);
 	if (ep == stackstrend())
 		ep = growstackstr();
 	if (end)
@@ -7165,7 +7208,10 @@ struct tblentry {
 };
 
 static struct tblentry **cmdtable;
+static unsigned cmdtable_size;  /* power of 2 */
+static unsigned cmdtable_count;
 #define INIT_G_cmdtable() do { \
+	cmdtable_size = CMDTABLESIZE; \
 	cmdtable = xzalloc(CMDTABLESIZE * sizeof(cmdtable[0])); \
 } while (0)
 
@@ -7306,7 +7352,7 @@ clearcmdentry(int firstchange)
 	struct tblentry *cmdp;
 
 	INT_OFF;
-	for (tblp = cmdtable; tblp < &cmdtable[CMDTABLESIZE]; tblp++) {
+	for (tblp = cmdtable; tblp < &cmdtable[cmdtable_size]; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if ((cmdp->cmdtype == CMDNORMAL &&
@@ -7316,6 +7362,7 @@ clearcmdentry(int firstchange)
 			) {
 				*pp = cmdp->next;
 				free(cmdp);
+				cmdtable_count--;
 			} else {
 				pp = &cmdp->next;
 			}
@@ -7335,20 +7382,42 @@ clearcmdentry(int firstchange)
  */
 static struct tblentry **lastcmdentry;
 
+/*
+ * Double the command table once chains average more than two entries.
+ * Done before a lookup which may add, so that lastcmdentry stays valid.
+ */
+static void
+growcmdtable(void)
+{
+	struct tblentry **old = cmdtable;
+	struct tblentry *cmdp, *next;
+	unsigned i, oldsize = cmdtable_size;
+
+	if (cmdtable_count < cmdtable_size * 2)
+		return;
+	cmdtable_size *= 2;
+	cmdtable = ckzalloc(cmdtable_size * sizeof(cmdtable[0]));
+	for (i = 0; i < oldsize; i++) {
+		for (cmdp = old[i]; cmdp; cmdp = next) {
+			struct tblentry **pp;
+			next = cmdp->next;
+			pp = &cmdtable[hashname(cmdp->cmdname) & (cmdtable_size - 1)];
+			cmdp->next = *pp;
+			*pp = cmdp;
+		}
+	}
+	free(old);
+}
+
 static struct tblentry *
 cmdlookup(const char *name, int add)
 {
-	unsigned int hashval;
-	const char *p;
 	struct tblentry *cmdp;
 	struct tblentry **pp;
 
-	p = name;
-	hashval = (unsigned char)*p << 4;
-	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+	if (add)
+		growcmdtable();
+	pp = &cmdtable[hashname(name) & (cmdtable_size - 1)];
 	for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 		if (strcmp(cmdp->cmdname, name) == 0)
 			break;
@@ -7362,6 +7431,7 @@ cmdlookup(const char *name, int add)
 		/*cmdp->next = NULL; - ckzalloc did it */
 		cmdp->cmdtype = CMDUNKNOWN;
 		strcpy(cmdp->cmdname, name);
+		cmdtable_count++;
 	}
 	lastcmdentry = pp;
 	return cmdp;
@@ -7381,6 +7451,7 @@ delete_cmd_entry(void)
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	free(cmdp);
+	cmdtable_count--;
 	INT_ON;
 }
 
@@ -7402,6 +7473,353 @@ addcmdentry(char *name, struct cmdentry *entry)
 	cmdp->rehash = 0;
 }
 
+#if ENABLE_ASH_PATH_CACHE
+/*
+ * On-disk cache of PATH lookups, used when $ASH_PATHCACHE names a file.
+ * It maps each name found in the PATH directories to the index of the
+ * first directory containing it, so that a new shell can find commands
+ * with a single stat instead of probing every directory. The cache is
+ * tied to the exact PATH string and is rebuilt when any directory's
+ * dev/inode/mtime changes; a hit is only used while the directories
+ * before the one it names are unchanged. Layout (native byte order):
+ *   header, dirs[ndirs], ents[nnames] (sorted by name), PATH, names
+ */
+#define PATHCACHE_MAGIC "ASHPC001"
+struct pathcache_hdr {
+	char magic[8];
+	uint32_t path_len;      /* without NUL */
+	uint32_t ndirs;
+	uint32_t nnames;
+	uint32_t names_len;
+};
+struct pathcache_dir {
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime;
+};
+struct pathcache_ent {
+	uint32_t name_off;
+	uint32_t idx;
+};
+
+static struct pathcache_hdr *pathcache;  /* mapped or malloced */
+static size_t pathcache_size;
+static smallint pathcache_mapped;
+static smallint pathcache_state;        /* 0: not loaded, 1: usable, -1: not used */
+
+#define pathcache_dirs() ((struct pathcache_dir *)(pathcache + 1))
+#define pathcache_ents() ((struct pathcache_ent *)(pathcache_dirs() + pathcache->ndirs))
+#define pathcache_path() ((char *)(pathcache_ents() + pathcache->nnames))
+#define pathcache_names() (pathcache_path() + pathcache->path_len + 1)
+
+static void
+pathcache_drop(void)
+{
+	if (pathcache) {
+		if (pathcache_mapped)
+			munmap(pathcache, pathcache_size);
+		else
+			free(pathcache);
+		pathcache = NULL;
+	}
+	pathcache_state = 0;
+}
+
+/* Only absolute directories: no %builtin, no empty (current dir) entries */
+static int
+pathcache_usable_path(const char *path, unsigned *ndirs)
+{
+	unsigned n = 1;
+
+	if (*path != '/' || strchr(path, '%'))
+		return 0;
+	while ((path = strchr(path, ':')) != NULL) {
+		if (*++path != '/')
+			return 0;
+		n++;
+	}
+	*ndirs = n;
+	return 1;
+}
+
+static void
+pathcache_stat_dir(const char *path, unsigned idx, struct pathcache_dir *d)
+{
+	struct stat st;
+	const char *p = path;
+	char *dir;
+
+	while (idx--)
+		p = strchr(p, ':') + 1;
+	dir = ckstrdup(p);
+	*strchrnul(dir, ':') = '\0';
+	memset(d, 0, sizeof(*d));
+	if (stat(dir, &st) == 0 && S_ISDIR(st.st_mode)) {
+		d->dev = st.st_dev;
+		d->ino = st.st_ino;
+		d->mtime = st.st_mtime;
+	}
+	free(dir);
+}
+
+static int
+pathcache_valid(const char *path, unsigned ndirs)
+{
+	struct pathcache_dir d;
+	unsigned i;
+	size_t need;
+
+	if (pathcache_size < sizeof(*pathcache)
+	 || memcmp(pathcache->magic, PATHCACHE_MAGIC, 8) != 0
+	 || pathcache->ndirs != ndirs
+	) {
+		return 0;
+	}
+	need = sizeof(*pathcache)
+		+ (size_t)pathcache->ndirs * sizeof(struct pathcache_dir)
+		+ (size_t)pathcache->nnames * sizeof(struct pathcache_ent)
+		+ (size_t)pathcache->path_len + 1
+		+ pathcache->names_len;
+	if (need != pathcache_size
+	 || pathcache->path_len != strlen(path)
+	 || memcmp(pathcache_path(), path, pathcache->path_len + 1) != 0
+	 || (pathcache->names_len && pathcache_names()[pathcache->names_len - 1] != '\0')
+	) {
+		return 0;
+	}
+	for (i = 0; i < ndirs; i++) {
+		pathcache_stat_dir(path, i, &d);
+		if (memcmp(&d, &pathcache_dirs()[i], sizeof(d)) != 0)
+			return 0;
+	}
+	for (i = 0; i < pathcache->nnames; i++) {
+		if (pathcache_ents()[i].name_off >= pathcache->names_len
+		 || pathcache_ents()[i].idx >= ndirs
+		) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+struct pathcache_name {
+	char *name;
+	unsigned idx;
+};
+
+static int
+pathcache_name_cmp(const void *a, const void *b)
+{
+	const struct pathcache_name *x = a, *y = b;
+	int r = strcmp(x->name, y->name);
+	return r ? r : (int)(x->idx - y->idx);
+}
+
+/* Read all PATH directories and build a new cache in malloced memory */
+static void
+pathcache_build(const char *path, unsigned ndirs, int *racy)
+{
+	struct pathcache_dir *dirs;
+	struct pathcache_name *list = NULL;
+	struct pathcache_ent *ent;
+	unsigned nlist = 0, nnames = 0, i;
+	size_t names_len = 0, path_len = strlen(path);
+	time_t now = time(NULL);
+	char *p, *names;
+
+	dirs = ckmalloc(ndirs * sizeof(dirs[0]));
+	*racy = 0;
+	for (i = 0; i < ndirs; i++) {
+		const char *dirname = path;
+		char *dir;
+		DIR *dp;
+		struct dirent *de;
+		unsigned j = i;
+
+		pathcache_stat_dir(path, i, &dirs[i]);
+		/* A directory modified within the last second may change
+		 * again without a visible mtime change */
+		if (dirs[i].mtime >= now - 1)
+			*racy = 1;
+		while (j--)
+			dirname = strchr(dirname, ':') + 1;
+		dir = ckstrdup(dirname);
+		*strchrnul(dir, ':') = '\0';
+		dp = opendir(dir);
+		free(dir);
+		if (!dp)
+			continue;
+		while ((de = readdir(dp)) != NULL) {
+			if (DOT_OR_DOTDOT(de->d_name))
+				continue;
+			if ((nlist & 0xff) == 0)
+				list = ckrealloc(list, (nlist + 0x100) * sizeof(list[0]));
+			list[nlist].name = ckstrdup(de->d_name);
+			list[nlist].idx = i;
+			nlist++;
+		}
+		closedir(dp);
+	}
+
+	/* Keep only the first directory for each name */
+	if (nlist)
+		qsort(list, nlist, sizeof(list[0]), pathcache_name_cmp);
+	for (i = 0; i < nlist; i++) {
+		if (nnames && strcmp(list[nnames - 1].name, list[i].name) == 0) {
+			free(list[i].name);
+			continue;
+		}
+		list[nnames++] = list[i];
+		names_len += strlen(list[i].name) + 1;
+	}
+
+	pathcache_size = sizeof(*pathcache)
+		+ ndirs * sizeof(struct pathcache_dir)
+		+ nnames * sizeof(struct pathcache_ent)
+		+ path_len + 1
+		+ names_len;
+	pathcache = ckzalloc(pathcache_size);
+	pathcache_mapped = 0;
+	memcpy(pathcache->magic, PATHCACHE_MAGIC, 8);
+	pathcache->path_len = path_len;
+	pathcache->ndirs = ndirs;
+	pathcache->nnames = nnames;
+	pathcache->names_len = names_len;
+	memcpy(pathcache_dirs(), dirs, ndirs * sizeof(dirs[0]));
+	free(dirs);
+	strcpy(pathcache_path(), path);
+	ent = pathcache_ents();
+	names = p = pathcache_names();
+	for (i = 0; i < nnames; i++) {
+		ent[i].name_off = p - names;
+		ent[i].idx = list[i].idx;
+		p = stpcpy(p, list[i].name) + 1;
+		free(list[i].name);
+	}
+	free(list);
+}
+
+static void
+pathcache_save(const char *fname)
+{
+	char *tmp = xasprintf("%s.XXXXXX", fname);
+	int fd = mkstemp(tmp);
+
+	if (fd < 0) {
+		free(tmp);
+		return;
+	}
+	if (full_write(fd, pathcache, pathcache_size) != (ssize_t)pathcache_size
+	 || close(fd) != 0
+	 || rename(tmp, fname) != 0
+	) {
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+static void
+pathcache_load(const char *path)
+{
+	const char *fname;
+	struct stat st;
+	unsigned ndirs;
+	int fd, racy;
+
+	pathcache_state = -1;
+	fname = lookupvar("ASH_PATHCACHE");
+	if (!fname || !*fname || !pathcache_usable_path(path, &ndirs))
+		return;
+
+	fd = open(fname, O_RDONLY);
+	if (fd >= 0) {
+		/* Do not trust a file someone else can change */
+		if (fstat(fd, &st) == 0
+		 && S_ISREG(st.st_mode)
+		 && (st.st_uid == geteuid() || st.st_uid == 0)
+		 && !(st.st_mode & (S_IWGRP|S_IWOTH))
+		 && st.st_size > 0
+		) {
+			pathcache_size = st.st_size;
+			pathcache = mmap(NULL, pathcache_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (pathcache == MAP_FAILED)
+				pathcache = NULL;
+			pathcache_mapped = 1;
+		}
+		close(fd);
+		if (pathcache && pathcache_valid(path, ndirs)) {
+			pathcache_state = 1;
+			return;
+		}
+		pathcache_drop();
+	}
+
+	pathcache_build(path, ndirs, &racy);
+	pathcache_state = 1;
+	if (!racy)
+		pathcache_save(fname);
+}
+
+/*
+ * Return the PATH index of the directory which has the command,
+ * or -1 if the cache does not know (caller does the full search).
+ * path_advance() leaves the full name on the stack.
+ */
+static int
+pathcache_find(const char *name)
+{
+	const struct pathcache_ent *ent;
+	const char *names, *path;
+	char *fullname;
+	struct stat statb;
+	unsigned lo, hi, idx;
+
+	if (pathcache_state == 0)
+		pathcache_load(pathval());
+	if (pathcache_state < 0)
+		return -1;
+
+	ent = pathcache_ents();
+	names = pathcache_names();
+	lo = 0;
+	hi = pathcache->nnames;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		int r = strcmp(name, names + ent[mid].name_off);
+		if (r == 0) {
+			struct pathcache_dir d;
+			unsigned i;
+
+			path = pathval();
+			idx = ent[mid].idx;
+			/* The cache was checked when loaded: since then,
+			 * an earlier directory may have got this name too */
+			for (i = 0; i < idx; i++) {
+				pathcache_stat_dir(path, i, &d);
+				if (memcmp(&d, &pathcache_dirs()[i], sizeof(d)) != 0) {
+					pathcache_drop();
+					return -1;
+				}
+			}
+			do {
+				fullname = path_advance(&path, name);
+				stunalloc(fullname);
+			} while (idx--);
+			if (stat(fullname, &statb) == 0 && S_ISREG(statb.st_mode))
+				return ent[mid].idx;
+			return -1;
+		}
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+#else
+# define pathcache_drop() ((void)0)
+#endif
+
 static int FAST_FUNC
 hashcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 {
@@ -7413,11 +7831,12 @@ hashcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 
 	if (nextopt("r") != '\0') {
 		clearcmdentry(0);
+		pathcache_drop();
 		return 0;
 	}
 
 	if (*argptr == NULL) {
-		for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+		for (pp = cmdtable; pp < &cmdtable[cmdtable_size]; pp++) {
 			for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -7453,7 +7872,7 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+	for (pp = cmdtable; pp < &cmdtable[cmdtable_size]; pp++) {
 		for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL
 			 || (cmdp->cmdtype == CMDBUILTIN
@@ -7506,6 +7925,7 @@ changepath(const char *new)
 		firstchange = 0;
 	clearcmdentry(firstchange);
 	builtinloc = idx_bltin;
+	pathcache_drop();
 }
 
 #define TEOF 0
@@ -8716,7 +9136,8 @@ mklocal(char *name)
 				setvareq(name, VSTRFIXED);
 			else
 				setvar(name, NULL, VSTRFIXED);
-			vp = *vpp;      /* the new variable */
+			/* the new variable (the table may have grown) */
+			vp = *findvar(hashvar(name), name);
 			lvp->flags = VUNSET;
 		} else {
 			lvp->text = vp->text;
@@ -12134,6 +12555,21 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 
 	e = ENOENT;
 	idx = -1;
+#if ENABLE_ASH_PATH_CACHE
+	if (prev < 0 && updatetbl) {
+		INT_OFF;
+		idx = pathcache_find(name);
+		if (idx >= 0) {
+			cmdp = cmdlookup(name, 1);
+			cmdp->cmdtype = CMDNORMAL;
+			cmdp->param.index = idx;
+			INT_ON;
+			goto success;
+		}
+		INT_ON;
+		idx = -1;
+	}
+#endif
  loop:
 	while ((fullname = path_advance(&path, name)) != NULL) {
 		stunalloc(fullname);
@@ -7,14 +7,28 @@
 int killps_main(int argc, char* argv[]);
 int killps_main(int argc, char* argv[])
 {
-	char *const path = xmalloc(PATH_MAX + 2); /* to save stack */
-	
-	if (2 != argc) {
+	int i, n;
+	char **paths;
+
+	if (2 > argc) {
 		return EXIT_FAILURE;
 	}
-	
-	realpath(argv[1], path);
-	kill_process_for_umount(path);
-	
+
+	/* All directories are served by one scan of /proc per retry */
+	paths = xzalloc(argc * sizeof(paths[0]));
+	n = 0;
+	for (i = 1; i < argc; i++) {
+		if (!paths[n])
+			paths[n] = xmalloc(PATH_MAX + 2); /* to save stack */
+		if (!realpath(argv[i], paths[n])) {
+			bb_simple_perror_msg(argv[i]);
+			continue;
+		}
+		n++;
+	}
+	if (n == 0)
+		return EXIT_FAILURE;
+	kill_process_for_umount_list((const char *const *)paths, n);
+
 	return EXIT_SUCCESS;
 }
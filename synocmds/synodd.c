@@ -1,44 +1,98 @@
 // Copyright (c) 2008-2008 Synology Inc. All rights reserved.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <linux/aio_abi.h>
 
-#define COUNTS_TO_CHECK 100 //check device every 200MB.
 #define BOOL int
 #define FALSE 0
 #define TRUE 1
 
 #define BS 1048576 // 1M
-char gszBuf[BS];
+#define ALIGNMENT 4096 // O_DIRECT buffer alignment, enough for 4Kn disks
+#define DEFAULT_QUEUE_DEPTH 8
+#define MAX_QUEUE_DEPTH 64
+#define PROGRESS_INTERVAL 1 // seconds between progress/checkpoint writes
+
+typedef struct _tag_SYNODD_SLOT {
+	struct iocb cb;
+	char *pBuf;
+	BOOL blBusy;
+} SYNODD_SLOT;
+
+typedef struct _tag_SYNODD_ARGS {
+	BOOL blRead;
+	int queueDepth;
+	const char *szCheckpointDir;
+} SYNODD_ARGS;
 
 static void usage(void)
 {
 	printf("Copyright (c) 2008-2012 Synology Inc. All rights reserved.\n");
-	printf("Usage: synodd [-r] [-w] device_list\n");
+	printf("Usage: synodd [-r] [-w] [-q depth] [-c checkpoint_dir] device_list\n");
 	printf("   -r: dd read\n");
 	printf("   -w: dd write, which is default\n");
+	printf("   -q: number of 1M I/Os in flight per device, default %d\n", DEFAULT_QUEUE_DEPTH);
+	printf("   -c: keep a checkpoint per device in this directory and\n");
+	printf("       resume an interrupted sweep from it\n");
 	printf("\n");
 	printf("Example 1: synodd /dev/hda\n");
 	printf("Example 2: synodd /dev/sda1 /dev/sdb2 ...\n");
 	printf("Example 3: synodd -r /dev/md2 ...\n");
-	printf("Example 4: synodd -w /dev/md2 ...\n");
+	printf("Example 4: synodd -w -q 16 -c /var/lib/synodd /dev/sda /dev/sdb\n");
 	printf("\n");
 }
 
-static int OpenDevice(const char *szDevPath, BOOL blRead, off_t offset)
+static long IoSetup(unsigned nr, aio_context_t *pCtx)
+{
+	return syscall(__NR_io_setup, nr, pCtx);
+}
+
+static long IoDestroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static long IoSubmit(aio_context_t ctx, long nr, struct iocb **ppIocb)
+{
+	return syscall(__NR_io_submit, ctx, nr, ppIocb);
+}
+
+static long IoGetEvents(aio_context_t ctx, long minNr, long maxNr, struct io_event *pEvents)
+{
+	return syscall(__NR_io_getevents, ctx, minNr, maxNr, pEvents, NULL);
+}
+
+static const char *DevName(const char *szDev)
+{
+	const char *pch = NULL;
+
+	if (NULL == (pch = strrchr(szDev, '/'))) {
+		return szDev;
+	}
+	return pch + 1;
+}
+
+static int OpenDevice(const char *szDevPath, BOOL blRead, BOOL *pblDirect)
 {
 	int fd = -1;
-	int err = -1;
 	int flags = O_WRONLY;
-	
-	if (!szDevPath) {
+
+	if (!szDevPath || !pblDirect) {
 		return -1;
 	}
 
@@ -48,24 +102,15 @@ static int OpenDevice(const char *szDevPath, BOOL blRead, off_t offset)
 		flags = O_WRONLY;
 	}
 
-	if (0 > (fd = open(szDevPath, flags, 0666))) {
-		syslog(LOG_ERR, "%s(%d) open [%s](off:%llu) failed, errno=%d(%s)", __FILE__, __LINE__,
-			szDevPath, (unsigned long long)offset, errno, strerror(errno));
-		goto Err;
-	}
-
-	if ((off_t)-1 == lseek(fd, offset, SEEK_SET)) {
-		syslog(LOG_ERR, "%s(%d) lseek %llu failed, errno=%s", __FILE__, __LINE__, (unsigned long long)offset, strerror(errno));
-		goto Err;
+	// Bypass page cache: a sweep touches every block exactly once
+	*pblDirect = TRUE;
+	if (0 > (fd = open(szDevPath, flags | O_DIRECT, 0666)) && EINVAL == errno) {
+		*pblDirect = FALSE;
+		fd = open(szDevPath, flags, 0666);
 	}
-
-	err = 0;
-Err:
-	if (err) {
-		if (fd >= 0) {
-			close(fd);
-			fd = -1;
-		}
+	if (0 > fd) {
+		syslog(LOG_ERR, "%s(%d) open [%s] failed, errno=%d(%s)", __FILE__, __LINE__,
+			szDevPath, errno, strerror(errno));
 	}
 	return fd;
 }
@@ -73,19 +118,13 @@ Err:
 static FILE * OpenProgress(const char *szDev)
 {
 	FILE *fp = NULL;
-	const char *pch = NULL;
 	char szFile[64];
 
 	if (!szDev) {
 		return NULL;
 	}
 
-	if (NULL == (pch = strrchr(szDev, '/'))) {
-		pch = szDev;
-	} else {
-		pch++;
-	}
-	snprintf(szFile, sizeof(szFile), "/tmp/synodd.%s.%u", pch, getpid());
+	snprintf(szFile, sizeof(szFile), "/tmp/synodd.%s.%u", DevName(szDev), getpid());
 	if (NULL == (fp = fopen(szFile, "w"))) {
 		syslog(LOG_ERR, "%s(%d) fopen [%s] failed, errno=%d(%s)", __FILE__, __LINE__,
 			szFile, errno, strerror(errno));
@@ -100,6 +139,65 @@ static void WriteProgress(FILE *fp, unsigned long long ullWritedBytes, unsigned
 {
 	rewind(fp);
 	fprintf(fp, "%llu/%llu\n", ullWritedBytes, ullTotalBytes);
+	fflush(fp);
+}
+
+/**
+ * Checkpoint file holds "<completed offset>/<device size>".
+ * Fixed width, so it can be rewritten in place.
+ *
+ * @return fd of checkpoint file, -1 on error.
+ *         *pUllOffset is where the sweep should start.
+ */
+static int OpenCheckpoint(const char *szDir, const char *szDev, unsigned long long ullTotalBytes, unsigned long long *pUllOffset)
+{
+	int fd = -1;
+	ssize_t len = 0;
+	unsigned long long ullOffset = 0;
+	unsigned long long ullSize = 0;
+	char szFile[256];
+	char szLine[64];
+
+	*pUllOffset = 0;
+	snprintf(szFile, sizeof(szFile), "%s/synodd.%s.checkpoint", szDir, DevName(szDev));
+	if (0 > (fd = open(szFile, O_RDWR | O_CREAT, 0600))) {
+		syslog(LOG_ERR, "%s(%d) open [%s] failed, errno=%d(%s)", __FILE__, __LINE__,
+			szFile, errno, strerror(errno));
+		return -1;
+	}
+	if (0 < (len = pread(fd, szLine, sizeof(szLine) - 1, 0))) {
+		szLine[len] = '\0';
+		// A checkpoint of another (or resized) device is useless
+		if (2 == sscanf(szLine, "%llu/%llu", &ullOffset, &ullSize)
+		 && ullSize == ullTotalBytes && ullOffset < ullTotalBytes) {
+			*pUllOffset = ullOffset - (ullOffset % BS);
+			syslog(LOG_INFO, "%s(%d) resume [%s] from %llu", __FILE__, __LINE__,
+				szDev, *pUllOffset);
+		}
+	}
+	return fd;
+}
+
+static void WriteCheckpoint(int fd, unsigned long long ullOffset, unsigned long long ullTotalBytes)
+{
+	char szLine[64];
+	int len;
+
+	if (0 > fd) {
+		return;
+	}
+	len = snprintf(szLine, sizeof(szLine), "%020llu/%020llu\n", ullOffset, ullTotalBytes);
+	if (len != pwrite(fd, szLine, len, 0) || 0 > fdatasync(fd)) {
+		syslog(LOG_ERR, "%s(%d) write checkpoint failed, errno=%m", __FILE__, __LINE__);
+	}
+}
+
+static void RemoveCheckpoint(const char *szDir, const char *szDev)
+{
+	char szFile[256];
+
+	snprintf(szFile, sizeof(szFile), "%s/synodd.%s.checkpoint", szDir, DevName(szDev));
+	unlink(szFile);
 }
 
 static int CheckDevice(int fd, unsigned long long *pUllTotalBytes)
@@ -138,24 +236,183 @@ static int CheckDevice(int fd, unsigned long long *pUllTotalBytes)
 
 	err = 0;
 Err:
-	return err;	
+	return err;
+}
+
+/**
+ * Lowest offset not yet known to be done: everything below it
+ * has completed, so this is what progress and checkpoint report.
+ */
+static unsigned long long CompletedOffset(SYNODD_SLOT *pSlots, int cSlots, unsigned long long ullNext)
+{
+	int i;
+	unsigned long long ullDone = ullNext;
+
+	for (i = 0; i < cSlots; i++) {
+		if (pSlots[i].blBusy && pSlots[i].cb.aio_offset < ullDone) {
+			ullDone = pSlots[i].cb.aio_offset;
+		}
+	}
+	return ullDone;
+}
+
+static void PrepareSlot(SYNODD_SLOT *pSlot, int fd, BOOL blRead, int idx,
+		unsigned long long ullOffset, unsigned long long ullTotalBytes)
+{
+	unsigned long long ullLen = ullTotalBytes - ullOffset;
+
+	memset(&pSlot->cb, 0, sizeof(pSlot->cb));
+	pSlot->cb.aio_data = idx;
+	pSlot->cb.aio_fildes = fd;
+	pSlot->cb.aio_lio_opcode = blRead ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+	pSlot->cb.aio_buf = (uintptr_t)pSlot->pBuf;
+	pSlot->cb.aio_nbytes = (BS < ullLen) ? BS : ullLen;
+	pSlot->cb.aio_offset = ullOffset;
+	pSlot->blBusy = TRUE;
 }
 
-static int SynoddOne(char *szDev, BOOL blRead)
+/**
+ * Sweep [ullOffset, ullTotalBytes) keeping up to cSlots I/Os in flight.
+ * Falls back to one synchronous I/O at a time if kernel has no AIO.
+ */
+static int SweepDevice(int fd, const char *szDev, BOOL blRead, SYNODD_SLOT *pSlots, int cSlots,
+		unsigned long long ullOffset, unsigned long long ullTotalBytes, FILE *fp, int fdCheckpoint)
+{
+	int err = -1;
+	int i, cSubmit;
+	int cInflight = 0;
+	long ret;
+	BOOL blAio = TRUE;
+	aio_context_t ctx = 0;
+	time_t tLastReport = 0;
+	time_t tNow;
+	unsigned long long ullNext = ullOffset;
+	unsigned long long ullDone = ullOffset;
+	struct iocb *rgpIocb[MAX_QUEUE_DEPTH];
+	struct io_event rgEvents[MAX_QUEUE_DEPTH];
+
+	if (0 > IoSetup(cSlots, &ctx)) {
+		syslog(LOG_WARNING, "%s(%d) io_setup failed, errno=%m, use synchronous I/O", __FILE__, __LINE__);
+		blAio = FALSE;
+		cSlots = 1;
+	}
+
+	while (ullDone < ullTotalBytes) {
+		// Fill every idle slot with the next block
+		cSubmit = 0;
+		for (i = 0; i < cSlots && ullNext < ullTotalBytes; i++) {
+			if (pSlots[i].blBusy) {
+				continue;
+			}
+			PrepareSlot(&pSlots[i], fd, blRead, i, ullNext, ullTotalBytes);
+			ullNext += pSlots[i].cb.aio_nbytes;
+			rgpIocb[cSubmit++] = &pSlots[i].cb;
+		}
+
+		if (blAio) {
+			if (0 < cSubmit) {
+				if (0 > (ret = IoSubmit(ctx, cSubmit, rgpIocb))) {
+					if (EAGAIN != errno || 0 == cInflight) {
+						syslog(LOG_ERR, "%s(%d) io_submit [%s] failed, errno=%m", __FILE__, __LINE__, szDev);
+						err = errno;
+						goto END;
+					}
+					ret = 0;
+				}
+				// Whatever kernel didn't take is the tail, give it back
+				if (ret < cSubmit) {
+					ullNext = rgpIocb[ret]->aio_offset;
+				}
+				for (i = ret; i < cSubmit; i++) {
+					pSlots[rgpIocb[i]->aio_data].blBusy = FALSE;
+				}
+				cInflight += ret;
+			}
+			if (0 > (ret = IoGetEvents(ctx, 1, cSlots, rgEvents))) {
+				if (EINTR == errno) {
+					continue;
+				}
+				syslog(LOG_ERR, "%s(%d) io_getevents [%s] failed, errno=%m", __FILE__, __LINE__, szDev);
+				err = errno;
+				goto END;
+			}
+			cInflight -= ret;
+		} else {
+			if (blRead) {
+				ret = pread(fd, pSlots[0].pBuf, pSlots[0].cb.aio_nbytes, pSlots[0].cb.aio_offset);
+			} else {
+				ret = pwrite(fd, pSlots[0].pBuf, pSlots[0].cb.aio_nbytes, pSlots[0].cb.aio_offset);
+			}
+			rgEvents[0].data = 0;
+			rgEvents[0].res = (0 > ret) ? -errno : ret;
+			ret = 1;
+		}
+
+		for (i = 0; i < ret; i++) {
+			SYNODD_SLOT *pSlot = &pSlots[rgEvents[i].data];
+
+			pSlot->blBusy = FALSE;
+			if (0 >= rgEvents[i].res) {
+				err = rgEvents[i].res ? -rgEvents[i].res : EIO;
+				syslog(LOG_ERR, "(%s/%d) %s [%s] at %llu failed, errno=%s"
+					   ,__FILE__ ,__LINE__ , blRead?"read":"write", szDev,
+					   (unsigned long long)pSlot->cb.aio_offset, strerror(err));
+				goto END;
+			}
+			if ((unsigned long long)rgEvents[i].res < pSlot->cb.aio_nbytes) {
+				// Short transfer: requeue the rest of this block
+				struct iocb *pIocb = &pSlot->cb;
+
+				pIocb->aio_offset += rgEvents[i].res;
+				pIocb->aio_buf += rgEvents[i].res;
+				pIocb->aio_nbytes -= rgEvents[i].res;
+				if (!blAio) {
+					ullNext = pIocb->aio_offset;
+				} else if (1 != IoSubmit(ctx, 1, &pIocb)) {
+					syslog(LOG_ERR, "%s(%d) io_submit [%s] failed, errno=%m", __FILE__, __LINE__, szDev);
+					err = errno;
+					goto END;
+				} else {
+					pSlot->blBusy = TRUE;
+					cInflight++;
+				}
+			}
+		}
+
+		ullDone = CompletedOffset(pSlots, cSlots, ullNext);
+		tNow = time(NULL);
+		if (tNow - tLastReport >= PROGRESS_INTERVAL || ullDone >= ullTotalBytes) {
+			tLastReport = tNow;
+			WriteProgress(fp, ullDone, ullTotalBytes);
+			WriteCheckpoint(fdCheckpoint, ullDone, ullTotalBytes);
+		}
+	}
+
+	err = 0;
+END:
+	if (blAio) {
+		IoDestroy(ctx); // waits for anything still in flight
+	}
+	return err;
+}
+
+static int SynoddOne(char *szDev, const SYNODD_ARGS *pArgs)
 {
 	int err = -1;
 	int fd = -1;
-	int counts = 0;
-	ssize_t lProgressBytes = 0;
-	unsigned long long ullProgTotalBytes = 0;
+	int fdCheckpoint = -1;
+	int i;
+	BOOL blDirect = FALSE;
+	unsigned long long ullStartBytes = 0;
 	unsigned long long ullTotalBytes = 0;
+	SYNODD_SLOT *pSlots = NULL;
 	FILE *fp = NULL;
 
-	if (!szDev) {
+	if (!szDev || !pArgs) {
 		return -1;
 	}
-	
-	if (0 > (fd = OpenDevice(szDev, blRead, 0))){
+
+	if (0 > (fd = OpenDevice(szDev, pArgs->blRead, &blDirect))){
 		err = errno;
 		goto END;
 	}
@@ -171,42 +428,43 @@ static int SynoddOne(char *szDev, BOOL blRead)
 		goto END;
 	}
 
-	err = 0;
-	while(1) {
-		if (COUNTS_TO_CHECK == counts) {
-			counts = 0;
-			
-			if (fd >= 0) {
-				close(fd);
-			}
-			if (0 > (fd = OpenDevice(szDev, blRead, ullProgTotalBytes))){
-				err = errno;
-				goto END;
-			}
-		}
-		if (blRead) {
-			lProgressBytes = read(fd, gszBuf, sizeof(gszBuf));
-		} else {
-			lProgressBytes = write(fd, gszBuf, sizeof(gszBuf));
-		}
-		if (0 > lProgressBytes) {
-			if (ENOSPC != errno) {
-				syslog(LOG_ERR, "(%s/%d) %s [%s] failed, errno=%m"
-					   ,__FILE__ ,__LINE__ , blRead?"read":"write", szDev);
-				err = errno;
-			}
-			goto END;
-		}
-		ullProgTotalBytes += lProgressBytes;
+	if (pArgs->szCheckpointDir &&
+		0 > (fdCheckpoint = OpenCheckpoint(pArgs->szCheckpointDir, szDev, ullTotalBytes, &ullStartBytes))) {
+		err = errno;
+		goto END;
+	}
 
-		WriteProgress(fp, ullProgTotalBytes, ullTotalBytes);
-		if (ullTotalBytes <= ullProgTotalBytes) {
-			break;
+	// O_DIRECT needs aligned buffers; write sweeps write zeroes
+	if (NULL == (pSlots = calloc(pArgs->queueDepth, sizeof(*pSlots)))) {
+		err = ENOMEM;
+		goto END;
+	}
+	for (i = 0; i < pArgs->queueDepth; i++) {
+		if (0 != posix_memalign((void **)&pSlots[i].pBuf, ALIGNMENT, BS)) {
+			err = ENOMEM;
+			goto END;
 		}
+		memset(pSlots[i].pBuf, 0, BS);
+	}
 
-		counts++;
+	WriteProgress(fp, ullStartBytes, ullTotalBytes);
+	err = SweepDevice(fd, szDev, pArgs->blRead, pSlots, pArgs->queueDepth,
+			ullStartBytes, ullTotalBytes, fp, fdCheckpoint);
+	if (0 == err && !blDirect && !pArgs->blRead && 0 > fsync(fd)) {
+		syslog(LOG_ERR, "(%s/%d) fsync [%s] failed, errno=%m", __FILE__, __LINE__, szDev);
+		err = errno;
+	}
+	if (0 == err && pArgs->szCheckpointDir) {
+		RemoveCheckpoint(pArgs->szCheckpointDir, szDev);
 	}
 END:
+	if (pSlots) {
+		for (i = 0; i < pArgs->queueDepth; i++) {
+			free(pSlots[i].pBuf);
+		}
+		free(pSlots);
+	}
+	if (0 <= fdCheckpoint) close(fdCheckpoint);
 	if (0 <= fd) close(fd);
 	if (NULL != fp) fclose(fp);
 	return err;
@@ -217,46 +475,66 @@ int synodd_main(int argc, char **argv)
 {
 	int err = -1;
 	int i, *status = NULL;
-	int devShift = 1; //skip binary
+	int opt;
 	int devCount = 0;
 	pid_t *pid = NULL;
-	BOOL blRead = FALSE;
+	SYNODD_ARGS args = { FALSE, DEFAULT_QUEUE_DEPTH, NULL };
 
 	if (argc < 2 || !strcmp(argv[1], "-h")) {
 		usage();
 		exit(1);
 	}
 
-	if (!strcmp(argv[1], "-r")) {
-		blRead = TRUE;
-		devShift++;
-	} else if (!strcmp(argv[1], "-w")) {
-		blRead = FALSE;
-		devShift++;
+	while (-1 != (opt = getopt(argc, argv, "rwq:c:h"))) {
+		switch (opt) {
+		case 'r':
+			args.blRead = TRUE;
+			break;
+		case 'w':
+			args.blRead = FALSE;
+			break;
+		case 'q':
+			args.queueDepth = atoi(optarg);
+			if (args.queueDepth < 1 || args.queueDepth > MAX_QUEUE_DEPTH) {
+				fprintf(stderr, "queue depth must be 1..%d\n", MAX_QUEUE_DEPTH);
+				exit(1);
+			}
+			break;
+		case 'c':
+			args.szCheckpointDir = optarg;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
 	}
 
 	setpriority(PRIO_PROCESS, 0, -1);
-	bzero(&gszBuf, sizeof(gszBuf));
-	devCount = argc - devShift;
-	pid = calloc(devCount, sizeof(int));
+	devCount = argc - optind;
+	if (devCount <= 0) {
+		usage();
+		exit(1);
+	}
+	pid = calloc(devCount, sizeof(pid_t));
 	status = calloc(devCount, sizeof(int));
 
+	// One child per device: devices are swept concurrently
 	for (i = 0; i < devCount; i++) {
 		if (0 > (pid[i] = fork())) {
 			syslog(LOG_ERR, "(%s/%d) fork failed! errno=%m", __FILE__, __LINE__);
 			goto END;
 		}
 		if (0 == pid[i]) { // child
-			err = SynoddOne(argv[i + devShift], blRead);
+			err = SynoddOne(argv[i + optind], &args);
 			goto END;
 		}
 	}
 
 	err = 0;
 	for (i = 0; i < devCount; i++) {
-		printf("waitpid: %d, synodd[%s]:%s\n"
-			   , pid[i], argv[i + devShift], strerror(WEXITSTATUS(status[i])));
 		waitpid(pid[i], &status[i], 0);
+		printf("waitpid: %d, synodd[%s]:%s\n"
+			   , pid[i], argv[i + optind], strerror(WEXITSTATUS(status[i])));
 		if (0 != WEXITSTATUS(status[i])) {
 			err = -1;
 		}
@@ -267,4 +545,3 @@ END:
 	if (status) free(status);
 	exit(err);
 }
-
@@ -10,8 +10,8 @@
  */
 
 #include "libbb.h"
+#include <syslog.h>
 #include <sys/ipc.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
 
 #define DEBUG 0
@@ -19,46 +19,36 @@
 /* our shared key (syslogd.c and logread.c must be in sync) */
 enum { KEY_ID = 0x414e4547 }; /* "GENA" */
 
+/* See syslogd.c for the description of the ring */
 struct shbuf_ds {
-	int32_t size;           // size of data - 1
-	int32_t tail;           // end of message list
-	char data[1];           // messages
+	uint32_t magic;
+	uint32_t size;          // size of data, multiple of SHREC_ALIGN
+	volatile uint32_t head; // where the next record goes
+	volatile uint32_t tail; // oldest record
+	char data[1];           // records
 };
 
-static const struct sembuf init_sem[3] = {
-	{0, -1, IPC_NOWAIT | SEM_UNDO},
-	{1, 0}, {0, +1, SEM_UNDO}
+struct shrec {
+	uint32_t len;           // whole record, multiple of SHREC_ALIGN
+	uint32_t time;
+	uint16_t pri;           // facility | priority, or SHREC_PAD
+	uint16_t msglen;        // formatted message, without NUL
+	char msg[1];
 };
 
-struct globals {
-	struct sembuf SMrup[1]; // {0, -1, IPC_NOWAIT | SEM_UNDO},
-	struct sembuf SMrdn[2]; // {1, 0}, {0, +1, SEM_UNDO}
-	struct shbuf_ds *shbuf;
+enum {
+	SHBUF_MAGIC = 0x53424732, /* "SBG2" */
+	SHREC_ALIGN = 16,
+	SHREC_PAD = 0xffff,
 };
-#define G (*(struct globals*)&bb_common_bufsiz1)
-#define SMrup (G.SMrup)
-#define SMrdn (G.SMrdn)
-#define shbuf (G.shbuf)
-#define INIT_G() do { \
-	memcpy(SMrup, init_sem, sizeof(init_sem)); \
-} while (0)
-
-static void error_exit(const char *str) NORETURN;
-static void error_exit(const char *str)
-{
-	//release all acquired resources
-	shmdt(shbuf);
-	bb_perror_msg_and_die(str);
-}
 
-/*
- * sem_up - up()'s a semaphore.
- */
-static void sem_up(int semid)
-{
-	if (semop(semid, SMrup, 1) == -1)
-		error_exit("semop[SMrup]");
-}
+enum {
+	OPT_f = 1 << 0, /* follow */
+	OPT_s = 1 << 1, /* since */
+	OPT_p = 1 << 2, /* priority */
+};
+
+#define shbuf (*(struct shbuf_ds **)&bb_common_bufsiz1)
 
 static void interrupted(int sig UNUSED_PARAM)
 {
@@ -67,15 +57,57 @@ static void interrupted(int sig UNUSED_PARAM)
 	exit(EXIT_SUCCESS);
 }
 
+/* @SECONDS, -N[smhd] (ago), or anything date -d takes */
+static time_t parse_since(const char *str)
+{
+	static const struct suffix_mult ago_suffixes[] = {
+		{ "s", 1 },
+		{ "m", 60 },
+		{ "h", 60 * 60 },
+		{ "d", 24 * 60 * 60 },
+		{ "", 0 }
+	};
+	time_t now = time(NULL);
+	struct tm tm;
+
+	if (str[0] == '@')
+		return xatoul(str + 1);
+	if (str[0] == '-')
+		return now - xatoul_sfx(str + 1, ago_suffixes);
+	localtime_r(&now, &tm);
+	tm.tm_sec = 0;
+	parse_datestr(str, &tm);
+	return validate_tm_time(str, &tm);
+}
+
 int logread_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int logread_main(int argc UNUSED_PARAM, char **argv)
 {
-	unsigned cur;
-	int log_semid; /* ipc semaphore id */
+	static const char prio_names[] ALIGN1 =
+		"emerg\0""alert\0""crit\0""err\0""warning\0""notice\0""info\0""debug\0";
+	char *str_s, *str_p;
+	char *copy;
+	time_t since = 0;
+	int maxprio = LOG_DEBUG;
+	uint32_t cur, size;
 	int log_shmid; /* ipc shared memory id */
-	smallint follow = getopt32(argv, "f");
-
-	INIT_G();
+	unsigned opts;
+
+#if ENABLE_LONG_OPTS
+	applet_long_options =
+		"follow\0" No_argument       "f"
+		"since\0"  Required_argument "s"
+		"prio\0"   Required_argument "p"
+		;
+#endif
+	opts = getopt32(argv, "fs:p:", &str_s, &str_p);
+	if (opts & OPT_s)
+		since = parse_since(str_s);
+	if (opts & OPT_p) {
+		maxprio = index_in_strings(prio_names, str_p);
+		if (maxprio < 0)
+			maxprio = xatou_range(str_p, 0, LOG_DEBUG);
+	}
 
 	log_shmid = shmget(KEY_ID, 0, 0);
 	if (log_shmid == -1)
@@ -83,103 +115,75 @@ int logread_main(int argc UNUSED_PARAM, char **argv)
 
 	/* Attach shared memory to our char* */
 	shbuf = shmat(log_shmid, NULL, SHM_RDONLY);
-	if (shbuf == NULL)
+	if (shbuf == (void*) -1L) /* shmat has bizarre error return */
 		bb_perror_msg_and_die("can't access syslogd buffer");
-
-	log_semid = semget(KEY_ID, 0, 0);
-	if (log_semid == -1)
-		error_exit("can't get access to semaphores for syslogd buffer");
+	if (shbuf->magic != SHBUF_MAGIC)
+		bb_error_msg_and_die("syslogd buffer has unknown format");
 
 	signal(SIGINT, interrupted);
 
-	/* Suppose atomic memory read */
-	/* Max possible value for tail is shbuf->size - 1 */
+	size = shbuf->size;
+	copy = xmalloc(size);
+	/* Everything there is, or (logread -f) only what comes next.
+	 * -s and -p look at record headers only, not at the text */
 	cur = shbuf->tail;
+	if ((opts & (OPT_f|OPT_s)) == OPT_f)
+		cur = shbuf->head;
 
 	/* Loop for logread -f, one pass if there was no -f */
-	do {
-		unsigned shbuf_size;
-		unsigned shbuf_tail;
-		const char *shbuf_data;
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		int i;
-		int len_first_part;
-		int len_total = len_total; /* for gcc */
-		char *copy = copy; /* for gcc */
-#endif
-		if (semop(log_semid, SMrdn, 2) == -1)
-			error_exit("semop[SMrdn]");
-
-		/* Copy the info, helps gcc to realize that it doesn't change */
-		shbuf_size = shbuf->size;
-		shbuf_tail = shbuf->tail;
-		shbuf_data = shbuf->data; /* pointer! */
+	for (;;) {
+		uint32_t head = shbuf->head;
 
+		/* records up to head are complete once we see it */
+		__sync_synchronize();
 		if (DEBUG)
-			printf("cur:%d tail:%i size:%i\n",
-					cur, shbuf_tail, shbuf_size);
-
-		if (!follow) {
-			/* advance to oldest complete message */
-			/* find NUL */
-			cur += strlen(shbuf_data + cur);
-			if (cur >= shbuf_size) { /* last byte in buffer? */
-				cur = strnlen(shbuf_data, shbuf_tail);
-				if (cur == shbuf_tail)
-					goto unlock; /* no complete messages */
+			printf("cur:%u head:%u tail:%u\n", cur, head, shbuf->tail);
+
+		while ((int32_t)(head - cur) > 0) {
+			struct shrec *rec;
+			uint32_t pos, len;
+			uint32_t tail = shbuf->tail;
+
+			/* Fell behind, the writer overwrote what we didn't read */
+			if ((int32_t)(cur - tail) < 0)
+				cur = tail;
+			pos = cur % size;
+			rec = (struct shrec *)(shbuf->data + pos);
+			len = rec->len;
+			if (len < offsetof(struct shrec, msg) || len > size - pos
+			 || (len & (SHREC_ALIGN - 1))
+			) {
+				len = 0; /* being overwritten? */
+			} else {
+				memcpy(copy, rec, len);
 			}
-			/* advance to first byte of the message */
-			cur++;
-			if (cur >= shbuf_size) /* last byte in buffer? */
-				cur = 0;
-		} else { /* logread -f */
-			if (cur == shbuf_tail) {
-				sem_up(log_semid);
-				fflush_all();
-				sleep(1); /* TODO: replace me with a sleep_on */
+			/* The copy is intact if tail is still not past it */
+			__sync_synchronize();
+			if ((int32_t)(cur - shbuf->tail) < 0)
+				continue;
+			if (!len)
+				bb_error_msg_and_die("syslogd buffer is corrupted");
+			cur += len;
+
+			rec = (struct shrec *)copy;
+			if (rec->pri == SHREC_PAD
+			 || (time_t)rec->time < since
+			 || LOG_PRI(rec->pri) > maxprio
+			) {
 				continue;
 			}
+			fwrite(rec->msg, 1, rec->msglen, stdout);
 		}
+		if (!(opts & OPT_f))
+			break;
+		fflush_all();
+		usleep(250 * 1000); /* TODO: replace me with a sleep_on */
+	}
 
-		/* Read from cur to tail */
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		len_first_part = len_total = shbuf_tail - cur;
-		if (len_total < 0) {
-			/* message wraps: */
-			/* [SECOND PART.........FIRST PART] */
-			/*  ^data      ^tail    ^cur      ^size */
-			len_total += shbuf_size;
-		}
-		copy = xmalloc(len_total + 1);
-		if (len_first_part < 0) {
-			/* message wraps (see above) */
-			len_first_part = shbuf_size - cur;
-			memcpy(copy + len_first_part, shbuf_data, shbuf_tail);
-		}
-		memcpy(copy, shbuf_data + cur, len_first_part);
-		copy[len_total] = '\0';
-		cur = shbuf_tail;
-#else
-		while (cur != shbuf_tail) {
-			fputs(shbuf_data + cur, stdout);
-			cur += strlen(shbuf_data + cur) + 1;
-			if (cur >= shbuf_size)
-				cur = 0;
-		}
-#endif
- unlock:
-		/* release the lock on the log chain */
-		sem_up(log_semid);
-
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		for (i = 0; i < len_total; i += strlen(copy + i) + 1) {
-			fputs(copy + i, stdout);
-		}
+	if (ENABLE_FEATURE_CLEAN_UP) {
 		free(copy);
-#endif
-	} while (follow);
-
-	shmdt(shbuf);
+		shmdt(shbuf);
+	}
 
 	fflush_stdout_and_exit(EXIT_SUCCESS);
 }
@@ -31,7 +31,6 @@
 
 #if ENABLE_FEATURE_IPC_SYSLOG
 #include <sys/ipc.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
 #endif
 
@@ -50,8 +49,8 @@ static int gCountLog = 0;
 #define DEBUG 0
 
 /* MARK code is not very useful, is bloat, and broken:
- * can deadlock if alarmed to make MARK while writing to IPC buffer
- * (semaphores are down but do_mark routine tries to down them again) */
+ * can corrupt IPC buffer if alarmed to make MARK while writing to it
+ * (do_mark routine would write a record in the middle of another) */
 #undef SYSLOGD_MARK
 
 /* Write locking does not seem to be useful either */
@@ -62,11 +61,34 @@ enum {
 	DNS_WAIT_SEC = 2 * 60,
 };
 
-/* Semaphore operation structures */
+/* Shared memory ring (syslogd.c and logread.c must be in sync).
+ * syslogd is the only writer, readers never lock anything.
+ * head and tail are byte counters which only grow (wrapping around
+ * at 2^32); the record at counter X lives at data[X % size].
+ * The writer first moves tail past the records it is going to
+ * overwrite, then writes, then moves head. A reader which copied
+ * a record and still sees tail not past it has an intact copy.
+ */
 struct shbuf_ds {
-	int32_t size;   /* size of data - 1 */
-	int32_t tail;   /* end of message list */
-	char data[1];   /* data/messages */
+	uint32_t magic;
+	uint32_t size;          /* size of data, multiple of SHREC_ALIGN */
+	volatile uint32_t head; /* where the next record goes */
+	volatile uint32_t tail; /* oldest record */
+	char data[1];           /* records */
+};
+
+struct shrec {
+	uint32_t len;           /* whole record, multiple of SHREC_ALIGN */
+	uint32_t time;
+	uint16_t pri;           /* facility | priority, or SHREC_PAD */
+	uint16_t msglen;        /* formatted message, without NUL */
+	char msg[1];
+};
+
+enum {
+	SHBUF_MAGIC = 0x53424732, /* "SBG2" */
+	SHREC_ALIGN = 16,
+	SHREC_PAD = 0xffff,     /* rest of data is unused, go to data[0] */
 };
 
 /* Allows us to have smaller initializer. Ugly. */
@@ -92,10 +114,7 @@ IF_FEATURE_REMOTE_LOG( \
 ) \
 IF_FEATURE_IPC_SYSLOG( \
 	int shmid; /* ipc shared memory id */   \
-	int s_semid; /* ipc semaphore id */     \
 	int shm_size;                           \
-	struct sembuf SMwup[1];                 \
-	struct sembuf SMwdn[3];                 \
 )
 
 struct init_globals {
@@ -149,10 +168,7 @@ static const struct init_globals init_data = {
 #endif
 #if ENABLE_FEATURE_IPC_SYSLOG
 	.shmid = -1,
-	.s_semid = -1,
 	.shm_size = ((CONFIG_FEATURE_IPC_SYSLOG_BUFFER_SIZE)*1024), // default shm size
-	.SMwup = { {1, -1, IPC_NOWAIT} },
-	.SMwdn = { {0, 0}, {1, 0}, {1, +1} },
 #endif
 };
 
@@ -225,9 +241,6 @@ static void ipcsyslog_cleanup(void)
 	if (G.shmid != -1) {
 		shmctl(G.shmid, IPC_RMID, NULL);
 	}
-	if (G.s_semid != -1) {
-		semctl(G.s_semid, 0, IPC_RMID, 0);
-	}
 }
 
 static void ipcsyslog_init(void)
@@ -246,64 +259,68 @@ static void ipcsyslog_init(void)
 	}
 
 	memset(G.shbuf, 0, G.shm_size);
-	G.shbuf->size = G.shm_size - offsetof(struct shbuf_ds, data) - 1;
-	/*G.shbuf->tail = 0;*/
-
-	// we'll trust the OS to set initial semval to 0 (let's hope)
-	G.s_semid = semget(KEY_ID, 2, IPC_CREAT | IPC_EXCL | 1023);
-	if (G.s_semid == -1) {
-		if (errno == EEXIST) {
-			G.s_semid = semget(KEY_ID, 2, 0);
-			if (G.s_semid != -1)
-				return;
-		}
-		bb_perror_msg_and_die("semget");
-	}
+	G.shbuf->size = (G.shm_size - offsetof(struct shbuf_ds, data)) & ~(SHREC_ALIGN - 1);
+	/*G.shbuf->head = G.shbuf->tail = 0;*/
+	__sync_synchronize();
+	G.shbuf->magic = SHBUF_MAGIC;
 }
 
-/* Write message to shared mem buffer */
-static void log_to_shmem(const char *msg, int len)
+/* Drop the oldest records until data up to upto can be written */
+static void shbuf_evict(uint32_t upto)
 {
-	int old_tail, new_tail;
+	uint32_t tail = G.shbuf->tail;
 
-	if (semop(G.s_semid, G.SMwdn, 3) == -1) {
-		bb_perror_msg_and_die("SMwdn");
-	}
+	while ((int32_t)(upto - tail) > (int32_t)G.shbuf->size)
+		tail += ((struct shrec *)(G.shbuf->data + tail % G.shbuf->size))->len;
+	G.shbuf->tail = tail;
+	/* readers must see the new tail before any of the new data */
+	__sync_synchronize();
+}
 
-	/* Circular Buffer Algorithm:
-	 * --------------------------
-	 * tail == position where to store next syslog message.
-	 * tail's max value is (shbuf->size - 1)
-	 * Last byte of buffer is never used and remains NUL.
-	 */
-	len++; /* length with NUL included */
- again:
-	old_tail = G.shbuf->tail;
-	new_tail = old_tail + len;
-	if (new_tail < G.shbuf->size) {
-		/* store message, set new tail */
-		memcpy(G.shbuf->data + old_tail, msg, len);
-		G.shbuf->tail = new_tail;
+/* Write message to shared mem buffer */
+static void log_to_shmem(const char *msg, int len, int pri, time_t now)
+{
+	struct shbuf_ds *sh = G.shbuf;
+	struct shrec *rec;
+	uint32_t head = sh->head;
+	uint32_t pos = head % sh->size;
+	uint32_t need;
+
+	if (len > (int)(sh->size / 2))
+		len = sh->size / 2;
+	if (len > 0xfffe)
+		len = 0xfffe;
+	need = (offsetof(struct shrec, msg) + len + 1 + SHREC_ALIGN - 1) & ~(SHREC_ALIGN - 1);
+	if (pos + need > sh->size) {
+		/* Doesn't fit before the end: pad, continue at data[0] */
+		uint32_t pad = sh->size - pos;
+
+		shbuf_evict(head + pad + need);
+		rec = (struct shrec *)(sh->data + pos);
+		rec->len = pad;
+		rec->pri = SHREC_PAD;
+		head += pad;
+		pos = 0;
 	} else {
-		/* k == available buffer space ahead of old tail */
-		int k = G.shbuf->size - old_tail;
-		/* copy what fits to the end of buffer, and repeat */
-		memcpy(G.shbuf->data + old_tail, msg, k);
-		msg += k;
-		len -= k;
-		G.shbuf->tail = 0;
-		goto again;
-	}
-	if (semop(G.s_semid, G.SMwup, 1) == -1) {
-		bb_perror_msg_and_die("SMwup");
+		shbuf_evict(head + need);
 	}
+	rec = (struct shrec *)(sh->data + pos);
+	rec->len = need;
+	rec->time = now;
+	rec->pri = pri;
+	rec->msglen = len;
+	memcpy(rec->msg, msg, len);
+	rec->msg[len] = '\0';
+	/* the record must be complete before readers can see it */
+	__sync_synchronize();
+	sh->head = head + need;
 	if (DEBUG)
-		printf("tail:%d\n", G.shbuf->tail);
+		printf("head:%u tail:%u\n", sh->head, sh->tail);
 }
 #else
 void ipcsyslog_cleanup(void);
 void ipcsyslog_init(void);
-void log_to_shmem(const char *msg);
+void log_to_shmem(const char *msg, int len, int pri, time_t now);
 #endif /* FEATURE_IPC_SYSLOG */
 
 #ifdef MY_ABC_HERE
@@ -355,7 +372,7 @@ static void RotateMessages(void)
 #endif
 
 /* Print a message to the log file. */
-static void log_locally(time_t now, char *msg)
+static void log_locally(time_t now, char *msg, int pri UNUSED_PARAM)
 {
 #ifdef SYSLOGD_WRLOCK
 	struct flock fl;
@@ -364,7 +381,7 @@ static void log_locally(time_t now, char *msg)
 
 #if ENABLE_FEATURE_IPC_SYSLOG
 	if ((option_mask32 & OPT_circularlog) && G.shbuf) {
-		log_to_shmem(msg, len);
+		log_to_shmem(msg, len, pri, now ? now : time(NULL));
 		return;
 	}
 #endif
@@ -521,7 +538,7 @@ static void timestamp_and_log(int pri, char *msg, int len)
 	}
 
 	/* Log message locally (to file or shared mem) */
-	log_locally(now, G.printbuf);
+	log_locally(now, G.printbuf, pri);
 }
 
 static void timestamp_and_log_internal(const char *msg)
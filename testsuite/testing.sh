@@ -26,12 +26,12 @@
 # number of failed tests.
 
 # The "optional" function is used to skip certain tests, ala:
-#   optional CONFIG_FEATURE_THINGY
+#   optional CONFIG_FEATURE_THINGY [CONFIG_FEATURE_OTHER_THINGY...]
 #
 # The "optional" function checks the environment variable "OPTIONFLAGS",
 # which is either empty (in which case it always clears SKIP) or
 # else contains a colon-separated list of features (in which case the function
-# clears SKIP if the flag was found, or sets it to 1 if the flag was not found).
+# clears SKIP if all flags were found, or sets it to 1 if one was not found).
 
 export FAILCOUNT=0
 export SKIP=
@@ -54,14 +54,18 @@ test x"$ECHO" != x"" || {
 
 optional()
 {
-  option=`echo ":$OPTIONFLAGS:" | grep ":$1:"`
-  # Not set?
-  if [ -z "$1" ] || [ -z "$OPTIONFLAGS" ] || [ ${#option} -ne 0 ]
-  then
-    SKIP=
-    return
-  fi
-  SKIP=1
+  SKIP=
+  while [ -n "$1" ] && [ -n "$OPTIONFLAGS" ]
+  do
+    option=`echo ":$OPTIONFLAGS:" | grep ":$1:"`
+    # Not set?
+    if [ ${#option} -eq 0 ]
+    then
+      SKIP=1
+      return
+    fi
+    shift
+  done
 }
 
 # The testing function
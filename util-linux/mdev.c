@@ -9,6 +9,9 @@
  */
 #include "libbb.h"
 #include "xregex.h"
+#if ENABLE_FEATURE_MDEV_DAEMON
+# include <linux/netlink.h>
+#endif
 
 /* "mdev -s" scans /sys/class/xxx, looking for directories which have dev
  * file (it is of the form "M:m\n"). Example: /sys/class/tty/tty0/dev
@@ -59,11 +62,39 @@
  * Then "command args..." is executed (via sh -c 'command args...').
  * @:execute on creation, $:on deletion, *:on both.
  * This happens regardless of /sys/class/.../dev existence.
+ *
+ * /etc/mdev.conf is parsed and its regexes are compiled only once
+ * per mdev run (and re-read by the daemon when its mtime changes),
+ * "mdev -s" and every event served by "mdev -d" use the compiled rules.
+ *
+ * "mdev -d" is a daemon which listens to kernel uevents on netlink
+ * socket instead of being forked by kernel for every event. It does
+ * "mdev -s" coldplug scan after the socket is open, so that no event
+ * falls between the two. Events which arrived together are handled
+ * as a batch.
  */
 
+struct rule {
+	bool keep_matching;
+	bool match_path;        /* regex has '/': match "subsystem/device" */
+	mode_t mode;
+	int maj, min0, min1;    /* "@maj,min0[-min1]" if maj >= 0 */
+	struct bb_uidgid_t ugid;
+	char *envvar;           /* "$envvar=regex" */
+	char *ren_mov;          /* ">path" or "=path" */
+	IF_FEATURE_MDEV_EXEC(char *r_cmd;) /* "@cmd", "$cmd" or "*cmd" */
+	regex_t match;
+};
+
 struct globals {
 	int root_major, root_minor;
 	char *subsystem;
+#if ENABLE_FEATURE_MDEV_CONF
+	struct rule *rules;
+	unsigned rule_cnt;
+	time_t conf_mtime;
+	off_t conf_size;
+#endif
 };
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define root_major (G.root_major)
@@ -101,6 +132,136 @@ static char *build_alias(char *alias, const char *device_name)
 	return alias;
 }
 
+#if ENABLE_FEATURE_MDEV_CONF
+static void free_rules(void)
+{
+	unsigned i;
+
+	for (i = 0; i < G.rule_cnt; i++) {
+		struct rule *rule = &G.rules[i];
+		if (rule->maj < 0)
+			regfree(&rule->match);
+		free(rule->envvar);
+		free(rule->ren_mov);
+		IF_FEATURE_MDEV_EXEC(free(rule->r_cmd);)
+	}
+	free(G.rules);
+	G.rules = NULL;
+	G.rule_cnt = 0;
+}
+
+/* Parse /etc/mdev.conf into G.rules, compiling the regexes.
+ * Does nothing if file did not change since last call.
+ */
+static void load_rules(void)
+{
+	struct stat st;
+	parser_t *parser;
+	char *tokens[4];
+
+	if (stat("/etc/mdev.conf", &st) != 0)
+		st.st_mtime = st.st_size = 0;
+	if (G.rules && st.st_mtime == G.conf_mtime && st.st_size == G.conf_size)
+		return;
+	free_rules();
+	G.conf_mtime = st.st_mtime;
+	G.conf_size = st.st_size;
+
+	parser = config_open2("/etc/mdev.conf", fopen_for_read);
+	while (config_read(parser, tokens, 4, 3, "# \t", PARSE_NORMAL)) {
+		struct rule *rule;
+		char *val;
+		int sc;
+
+		G.rules = xrealloc_vector(G.rules, 4, G.rule_cnt);
+		rule = &G.rules[G.rule_cnt];
+		memset(rule, 0, sizeof(*rule));
+		rule->maj = -1;
+		rule->mode = 0660;
+
+		val = tokens[0];
+		rule->keep_matching = ('-' == val[0]);
+		val += rule->keep_matching; /* swallow leading dash */
+
+		/* Fields: regex uid:gid mode [alias] [cmd] */
+
+		if (val[0] == '@') {
+			/* @major,minor[-minor2] */
+			/* (useful when name is ambiguous:
+			 * "/sys/class/usb/lp0" and
+			 * "/sys/class/printer/lp0") */
+			sc = sscanf(val, "@%u,%u-%u", &rule->maj, &rule->min0, &rule->min1);
+			if (sc < 1) {
+				bb_error_msg("bad @maj,min on line %d", parser->lineno);
+				continue;
+			}
+			if (sc == 1)
+				rule->min0 = -1; /* any minor */
+			if (sc < 3)
+				rule->min1 = rule->min0;
+		} else {
+			if (val[0] == '$') {
+				/* regex to match an environment variable:
+				 * "envvar=regex" is matched against "envvar=value" */
+				char *eq = strchr(++val, '=');
+				if (!eq) {
+					bb_error_msg("bad $envvar=regex on line %d", parser->lineno);
+					continue;
+				}
+				rule->envvar = xstrndup(val, eq - val);
+			}
+			/* else: regex to match [subsystem/]device_name */
+			rule->match_path = (strchr(val, '/') != NULL);
+			xregcomp(&rule->match, val, REG_EXTENDED);
+		}
+
+		/* 2nd field: uid:gid - device ownership */
+		if (get_uidgid(&rule->ugid, tokens[1], 1) == 0)
+			bb_error_msg("unknown user/group %s on line %d", tokens[1], parser->lineno);
+
+		/* 3rd field: mode - device permissions */
+		/* mode = strtoul(tokens[2], NULL, 8); */
+		bb_parse_mode(tokens[2], &rule->mode);
+
+		val = tokens[3];
+		/* 4th field (opt): >|=alias */
+
+		if (ENABLE_FEATURE_MDEV_RENAME && val) {
+			if (val[0] == '>' || val[0] == '=') {
+				char *s, *t;
+
+				s = strchrnul(val, ' ');
+				t = strchrnul(val, '\t');
+				if (t < s)
+					s = t;
+				rule->ren_mov = xstrndup(val, s - val);
+				val = (s[0] && s[1]) ? s+1 : NULL;
+			}
+		}
+
+		if (ENABLE_FEATURE_MDEV_EXEC && val) {
+			if (!strchr("$@*", val[0])) {
+				/* Such line never did anything, drop it */
+				bb_error_msg("bad line %u", parser->lineno);
+				if (rule->maj < 0)
+					regfree(&rule->match);
+				free(rule->envvar);
+				free(rule->ren_mov);
+				continue;
+			}
+			IF_FEATURE_MDEV_EXEC(rule->r_cmd = xstrdup(val);)
+		}
+
+		G.rule_cnt++;
+	}
+	config_close(parser);
+
+	/* Even empty rule set is "loaded" */
+	if (!G.rules)
+		G.rules = xzalloc(sizeof(G.rules[0]));
+}
+#endif
+
 /* mknod in /dev based on a path like "/sys/block/hda/hda1"
  * NB1: path parameter needs to have SCRATCH_SIZE scratch bytes
  * after NUL, but we promise to not mangle (IOW: to restore if needed)
@@ -111,8 +272,8 @@ static void make_device(char *path, int delete)
 {
 	char *device_name;
 	int major, minor, type, len;
+	unsigned rule_idx;
 	mode_t mode;
-	parser_t *parser;
 
 	/* Try to read major/minor string.  Note that the kernel puts \n after
 	 * the data, so we don't need to worry about null terminating the string
@@ -153,13 +314,10 @@ static void make_device(char *path, int delete)
 		path += sizeof("/sys/class/") - 1;
 
 	/* If we have config file, look up user settings */
-	if (ENABLE_FEATURE_MDEV_CONF)
-		parser = config_open2("/etc/mdev.conf", fopen_for_read);
-
+	rule_idx = 0;
 	do {
 		int keep_matching;
 		struct bb_uidgid_t ugid;
-		char *tokens[4];
 		char *command = NULL;
 		char *alias = NULL;
 		char aliaslink = aliaslink; /* for compiler */
@@ -169,155 +327,94 @@ static void make_device(char *path, int delete)
 		keep_matching = 0;
 		mode = 0660;
 
-		if (ENABLE_FEATURE_MDEV_CONF
-		 && config_read(parser, tokens, 4, 3, "# \t", PARSE_NORMAL)
-		) {
-			char *val;
+#if ENABLE_FEATURE_MDEV_CONF
+		if (rule_idx < G.rule_cnt) {
+			const struct rule *rule = &G.rules[rule_idx++];
 			char *str_to_match;
 			regmatch_t off[1 + 9 * ENABLE_FEATURE_MDEV_RENAME_REGEXP];
 
-			val = tokens[0];
-			keep_matching = ('-' == val[0]);
-			val += keep_matching; /* swallow leading dash */
-
 			/* Match against either "subsystem/device_name"
 			 * or "device_name" alone */
-			str_to_match = strchr(val, '/') ? path : device_name;
+			str_to_match = rule->match_path ? path : device_name;
 
-			/* Fields: regex uid:gid mode [alias] [cmd] */
-
-			if (val[0] == '@') {
-				/* @major,minor[-minor2] */
-				/* (useful when name is ambiguous:
-				 * "/sys/class/usb/lp0" and
-				 * "/sys/class/printer/lp0") */
-				int cmaj, cmin0, cmin1, sc;
+			if (rule->maj >= 0) {
 				if (major < 0)
 					continue; /* no dev, no match */
-				sc = sscanf(val, "@%u,%u-%u", &cmaj, &cmin0, &cmin1);
-				if (sc < 1 || major != cmaj
-				 || (sc == 2 && minor != cmin0)
-				 || (sc == 3 && (minor < cmin0 || minor > cmin1))
+				if (major != rule->maj
+				 || (rule->min0 >= 0 && (minor < rule->min0 || minor > rule->min1))
 				) {
 					continue; /* this line doesn't match */
 				}
 				goto line_matches;
 			}
-			if (val[0] == '$') {
-				/* regex to match an environment variable */
-				char *eq = strchr(++val, '=');
-				if (!eq)
-					continue;
-				*eq = '\0';
-				str_to_match = getenv(val);
+			if (rule->envvar) {
+				str_to_match = getenv(rule->envvar);
 				if (!str_to_match)
 					continue;
-				str_to_match -= strlen(val) + 1;
-				*eq = '=';
+				/* regex is "envvar=regex", point to "envvar=value" */
+				str_to_match -= strlen(rule->envvar) + 1;
 			}
 			/* else: regex to match [subsystem/]device_name */
 
-			{
-				regex_t match;
-				int result;
-
-				xregcomp(&match, val, REG_EXTENDED);
-				result = regexec(&match, str_to_match, ARRAY_SIZE(off), off, 0);
-				regfree(&match);
-				//bb_error_msg("matches:");
-				//for (int i = 0; i < ARRAY_SIZE(off); i++) {
-				//	if (off[i].rm_so < 0) continue;
-				//	bb_error_msg("match %d: '%.*s'\n", i,
-				//		(int)(off[i].rm_eo - off[i].rm_so),
-				//		device_name + off[i].rm_so);
-				//}
-
-				/* If no match, skip rest of line */
-				/* (regexec returns whole pattern as "range" 0) */
-				if (result || off[0].rm_so
-				 || ((int)off[0].rm_eo != (int)strlen(str_to_match))
-				) {
-					continue; /* this line doesn't match */
-				}
+			/* If no match, skip rest of line */
+			/* (regexec returns whole pattern as "range" 0) */
+			if (regexec(&rule->match, str_to_match, ARRAY_SIZE(off), off, 0)
+			 || off[0].rm_so
+			 || ((int)off[0].rm_eo != (int)strlen(str_to_match))
+			) {
+				continue; /* this line doesn't match */
 			}
  line_matches:
-			/* This line matches. Stop parsing after parsing
-			 * the rest the line unless keep_matching == 1 */
-
-			/* 2nd field: uid:gid - device ownership */
-			if (get_uidgid(&ugid, tokens[1], 1) == 0)
-				bb_error_msg("unknown user/group %s on line %d", tokens[1], parser->lineno);
-
-			/* 3rd field: mode - device permissions */
-			/* mode = strtoul(tokens[2], NULL, 8); */
-			bb_parse_mode(tokens[2], &mode);
-
-			val = tokens[3];
-			/* 4th field (opt): >|=alias */
-
-			if (ENABLE_FEATURE_MDEV_RENAME && val) {
-				aliaslink = val[0];
-				if (aliaslink == '>' || aliaslink == '=') {
-					char *a, *s, *st;
+			/* This line matches. Stop after executing it
+			 * unless keep_matching == 1 */
+			keep_matching = rule->keep_matching;
+			ugid = rule->ugid;
+			mode = rule->mode;
+
+			if (ENABLE_FEATURE_MDEV_RENAME && rule->ren_mov) {
+				aliaslink = rule->ren_mov[0];
+				if (ENABLE_FEATURE_MDEV_RENAME_REGEXP) {
 					char *p;
+					const char *s;
 					unsigned i, n;
 
-					a = val;
-					s = strchrnul(val, ' ');
-					st = strchrnul(val, '\t');
-					if (st < s)
-						s = st;
-					val = (s[0] && s[1]) ? s+1 : NULL;
-					s[0] = '\0';
-
-					if (ENABLE_FEATURE_MDEV_RENAME_REGEXP) {
-						/* substitute %1..9 with off[1..9], if any */
-						n = 0;
-						s = a;
-						while (*s)
-							if (*s++ == '%')
-								n++;
-
-						p = alias = xzalloc(strlen(a) + n * strlen(str_to_match));
-						s = a + 1;
-						while (*s) {
-							*p = *s;
-							if ('%' == *s) {
-								i = (s[1] - '0');
-								if (i <= 9 && off[i].rm_so >= 0) {
-									n = off[i].rm_eo - off[i].rm_so;
-									strncpy(p, str_to_match + off[i].rm_so, n);
-									p += n - 1;
-									s++;
-								}
+					/* substitute %1..9 with off[1..9], if any */
+					n = 0;
+					s = rule->ren_mov;
+					while (*s)
+						if (*s++ == '%')
+							n++;
+
+					p = alias = xzalloc(strlen(rule->ren_mov) + n * strlen(str_to_match));
+					s = rule->ren_mov + 1;
+					while (*s) {
+						*p = *s;
+						if ('%' == *s) {
+							i = (s[1] - '0');
+							if (i <= 9 && off[i].rm_so >= 0) {
+								n = off[i].rm_eo - off[i].rm_so;
+								strncpy(p, str_to_match + off[i].rm_so, n);
+								p += n - 1;
+								s++;
 							}
-							p++;
-							s++;
 						}
-					} else {
-						alias = xstrdup(a + 1);
+						p++;
+						s++;
 					}
+				} else {
+					alias = xstrdup(rule->ren_mov + 1);
 				}
 			}
 
-			if (ENABLE_FEATURE_MDEV_EXEC && val) {
-				const char *s = "$@*";
-				const char *s2 = strchr(s, val[0]);
-
-				if (!s2) {
-					bb_error_msg("bad line %u", parser->lineno);
-					if (ENABLE_FEATURE_MDEV_RENAME)
-						free(alias);
-					continue;
-				}
-
-				/* Are we running this command now?
-				 * Run $cmd on delete, @cmd on create, *cmd on both
-				 */
-				if (s2-s != delete)
-					command = xstrdup(val + 1);
-			}
+#if ENABLE_FEATURE_MDEV_EXEC
+			/* Are we running this command now?
+			 * Run $cmd on delete, @cmd on create, *cmd on both
+			 */
+			if (rule->r_cmd && strchr("$@*", rule->r_cmd[0]) - "$@*" != delete)
+				command = xstrdup(rule->r_cmd + 1);
+#endif
 		}
+#endif
 
 		/* End of field parsing */
 
@@ -376,11 +473,8 @@ static void make_device(char *path, int delete)
 		if (ENABLE_FEATURE_MDEV_CONF && !keep_matching)
 			break;
 
-	/* end of "while line is read from /etc/mdev.conf" */
+	/* end of "while there are rules from /etc/mdev.conf" */
 	} while (ENABLE_FEATURE_MDEV_CONF);
-
-	if (ENABLE_FEATURE_MDEV_CONF)
-		config_close(parser);
 }
 
 /* File callback for /sys/ traversal */
@@ -479,9 +573,204 @@ static void load_firmware(const char *firmware, const char *sysfs_path)
 	}
 }
 
+/* Scan /sys and populate /dev ("mdev -s") */
+static void coldplug(char *temp)
+{
+	struct stat st;
+
+	xstat("/", &st);
+	root_major = major(st.st_dev);
+	root_minor = minor(st.st_dev);
+
+	/* ACTION_FOLLOWLINKS is needed since in newer kernels
+	 * /sys/block/loop* (for example) are symlinks to dirs,
+	 * not real directories.
+	 * (kernel's CONFIG_SYSFS_DEPRECATED makes them real dirs,
+	 * but we can't enforce that on users)
+	 */
+	if (access("/sys/class/block", F_OK) != 0) {
+		/* Scan obsolete /sys/block only if /sys/class/block
+		 * doesn't exist. Otherwise we'll have dupes.
+		 * Also, do not complain if it doesn't exist.
+		 * Some people configure kernel to have no blockdevs.
+		 */
+		recursive_action("/sys/block",
+			ACTION_RECURSE | ACTION_FOLLOWLINKS | ACTION_QUIET,
+			fileAction, dirAction, temp, 0);
+	}
+	recursive_action("/sys/class",
+		ACTION_RECURSE | ACTION_FOLLOWLINKS,
+		fileAction, dirAction, temp, 0);
+}
+
+/* Handle one event described by ACTION, DEVPATH, SUBSYSTEM etc
+ * in environment. Returns 0 if the event is not for us.
+ * If use_seq, synchronize with parallel instances via /dev/mdev.seq.
+ */
+static int hotplug(char *temp, int use_seq)
+{
+	char *fw;
+	char *seq;
+	char *action;
+	char *env_path;
+	static const char keywords[] ALIGN1 = "remove\0add\0";
+	enum { OP_remove = 0, OP_add };
+	smalluint op;
+
+	/* Hotplug:
+	 * env ACTION=... DEVPATH=... SUBSYSTEM=... [SEQNUM=...] mdev
+	 * ACTION can be "add" or "remove"
+	 * DEVPATH is like "/block/sda" or "/class/input/mice"
+	 */
+	action = getenv("ACTION");
+	env_path = getenv("DEVPATH");
+	subsystem = getenv("SUBSYSTEM");
+	if (!action || !env_path /*|| !subsystem*/)
+		return 0;
+	fw = getenv("FIRMWARE");
+	op = index_in_strings(keywords, action);
+	/* If it exists, does /dev/mdev.seq match $SEQNUM?
+	 * If it does not match, earlier mdev is running
+	 * in parallel, and we need to wait */
+	seq = use_seq ? getenv("SEQNUM") : NULL;
+	if (seq) {
+		int timeout = 2000 / 32; /* 2000 msec */
+		do {
+			int seqlen;
+			char seqbuf[sizeof(int)*3 + 2];
+
+			seqlen = open_read_close("mdev.seq", seqbuf, sizeof(seqbuf-1));
+			if (seqlen < 0) {
+				seq = NULL;
+				break;
+			}
+			seqbuf[seqlen] = '\0';
+			if (seqbuf[0] == '\n' /* seed file? */
+			 || strcmp(seq, seqbuf) == 0 /* correct idx? */
+			) {
+				break;
+			}
+			usleep(32*1000);
+		} while (--timeout);
+	}
+
+	snprintf(temp, PATH_MAX, "/sys%s", env_path);
+	if (op == OP_remove) {
+		/* Ignoring "remove firmware". It was reported
+		 * to happen and to cause erroneous deletion
+		 * of device nodes. */
+		if (!fw)
+			make_device(temp, 1);
+	}
+	else if (op == OP_add) {
+		make_device(temp, 0);
+		if (ENABLE_FEATURE_MDEV_LOAD_FIRMWARE) {
+			if (fw)
+				load_firmware(fw, temp);
+		}
+	}
+
+	if (seq) {
+		xopen_xwrite_close("mdev.seq", utoa(xatou(seq) + 1));
+	}
+	return 1;
+}
+
+#if ENABLE_FEATURE_MDEV_DAEMON
+/* Kernel's uevent message is "ACTION@DEVPATH\0KEY=VAL\0KEY=VAL\0..." */
+#define UEVENT_BUFSIZE (16 * 1024)
+
+static int open_uevent_socket(void)
+{
+	struct sockaddr_nl sa;
+	int fd;
+	int rcvbuf = 2 * 1024 * 1024;
+
+	fd = xsocket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	/* A JBOD full of disks produces a lot of events at once */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = 1; /* kernel uevents */
+	xbind(fd, (struct sockaddr *)&sa, sizeof(sa));
+	close_on_exec_on(fd);
+	return fd;
+}
+
+/* Put KEY=VAL pairs of the message into environment (or take them
+ * back out) so that hotplug() and commands from mdev.conf see them */
+static void uevent_env(char *msg, char *end, int set)
+{
+	for (; msg < end; msg += strlen(msg) + 1) {
+		char *eq = strchr(msg, '=');
+		if (!eq)
+			continue;
+		if (set) {
+			putenv(msg);
+		} else {
+			*eq = '\0';
+			unsetenv(msg);
+			*eq = '=';
+		}
+	}
+}
+
+static void NORETURN daemon_loop(int fd, char *temp)
+{
+	char *buf = xmalloc(UEVENT_BUFSIZE);
+
+	for (;;) {
+		int flags = 0;
+		ssize_t len;
+
+		/* Wait for the first event, then take everything
+		 * which is already queued as one batch */
+		while ((len = recv(fd, buf, UEVENT_BUFSIZE - 1, flags)) != 0) {
+			char *end;
+
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN)
+					break;
+				if (errno == ENOBUFS) {
+					/* We lost events. /sys knows the truth */
+					bb_error_msg("uevent queue overflow, rescanning /sys");
+					IF_FEATURE_MDEV_CONF(load_rules();)
+					coldplug(temp);
+					break;
+				}
+				bb_perror_msg_and_die("recv");
+			}
+			if (!flags) {
+				/* We may have slept for long, reread mdev.conf
+				 * if it was changed meanwhile */
+				IF_FEATURE_MDEV_CONF(load_rules();)
+				flags = MSG_DONTWAIT;
+			}
+			end = buf + len;
+			*end = '\0';
+			/* "libudev" messages are not from kernel */
+			if (!strchr(buf, '@'))
+				continue;
+			uevent_env(buf + strlen(buf) + 1, end, 1);
+			hotplug(temp, 0);
+			uevent_env(buf + strlen(buf) + 1, end, 0);
+		}
+	}
+}
+#endif
+
 int mdev_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int mdev_main(int argc UNUSED_PARAM, char **argv)
 {
+	enum {
+		OPT_s = 1 << 0,
+		OPT_d = (1 << 1) * ENABLE_FEATURE_MDEV_DAEMON,
+		OPT_f = (1 << 2) * ENABLE_FEATURE_MDEV_DAEMON,
+	};
+	unsigned opt;
 	RESERVE_CONFIG_BUFFER(temp, PATH_MAX + SCRATCH_SIZE);
 
 	/* We can be called as hotplug helper */
@@ -493,100 +782,34 @@ int mdev_main(int argc UNUSED_PARAM, char **argv)
 
 	xchdir("/dev");
 
-	if (argv[1] && strcmp(argv[1], "-s") == 0) {
-		/* Scan:
-		 * mdev -s
-		 */
-		struct stat st;
+	opt = getopt32(argv, "s" IF_FEATURE_MDEV_DAEMON("df"));
+
+#if ENABLE_FEATURE_MDEV_CONF
+	/* Parse the rules once, not for every device */
+	load_rules();
+#endif
+
+#if ENABLE_FEATURE_MDEV_DAEMON
+	if (opt & OPT_d) {
+		/* Open socket before the scan: events which happen
+		 * during the scan are queued, not lost */
+		int fd = open_uevent_socket();
 
-		xstat("/", &st);
-		root_major = major(st.st_dev);
-		root_minor = minor(st.st_dev);
+		if (!(opt & OPT_f))
+			bb_daemonize_or_rexec(0, argv);
+		coldplug(temp);
+		daemon_loop(fd, temp);
+	}
+#endif
 
-		/* ACTION_FOLLOWLINKS is needed since in newer kernels
-		 * /sys/block/loop* (for example) are symlinks to dirs,
-		 * not real directories.
-		 * (kernel's CONFIG_SYSFS_DEPRECATED makes them real dirs,
-		 * but we can't enforce that on users)
+	if (opt & OPT_s) {
+		/* Scan:
+		 * mdev -s
 		 */
-		if (access("/sys/class/block", F_OK) != 0) {
-			/* Scan obsolete /sys/block only if /sys/class/block
-			 * doesn't exist. Otherwise we'll have dupes.
-			 * Also, do not complain if it doesn't exist.
-			 * Some people configure kernel to have no blockdevs.
-			 */
-			recursive_action("/sys/block",
-				ACTION_RECURSE | ACTION_FOLLOWLINKS | ACTION_QUIET,
-				fileAction, dirAction, temp, 0);
-		}
-		recursive_action("/sys/class",
-			ACTION_RECURSE | ACTION_FOLLOWLINKS,
-			fileAction, dirAction, temp, 0);
+		coldplug(temp);
 	} else {
-		char *fw;
-		char *seq;
-		char *action;
-		char *env_path;
-		static const char keywords[] ALIGN1 = "remove\0add\0";
-		enum { OP_remove = 0, OP_add };
-		smalluint op;
-
-		/* Hotplug:
-		 * env ACTION=... DEVPATH=... SUBSYSTEM=... [SEQNUM=...] mdev
-		 * ACTION can be "add" or "remove"
-		 * DEVPATH is like "/block/sda" or "/class/input/mice"
-		 */
-		action = getenv("ACTION");
-		env_path = getenv("DEVPATH");
-		subsystem = getenv("SUBSYSTEM");
-		if (!action || !env_path /*|| !subsystem*/)
+		if (!hotplug(temp, 1))
 			bb_show_usage();
-		fw = getenv("FIRMWARE");
-		op = index_in_strings(keywords, action);
-		/* If it exists, does /dev/mdev.seq match $SEQNUM?
-		 * If it does not match, earlier mdev is running
-		 * in parallel, and we need to wait */
-		seq = getenv("SEQNUM");
-		if (seq) {
-			int timeout = 2000 / 32; /* 2000 msec */
-			do {
-				int seqlen;
-				char seqbuf[sizeof(int)*3 + 2];
-
-				seqlen = open_read_close("mdev.seq", seqbuf, sizeof(seqbuf-1));
-				if (seqlen < 0) {
-					seq = NULL;
-					break;
-				}
-				seqbuf[seqlen] = '\0';
-				if (seqbuf[0] == '\n' /* seed file? */
-				 || strcmp(seq, seqbuf) == 0 /* correct idx? */
-				) {
-					break;
-				}
-				usleep(32*1000);
-			} while (--timeout);
-		}
-
-		snprintf(temp, PATH_MAX, "/sys%s", env_path);
-		if (op == OP_remove) {
-			/* Ignoring "remove firmware". It was reported
-			 * to happen and to cause erroneous deletion
-			 * of device nodes. */
-			if (!fw)
-				make_device(temp, 1);
-		}
-		else if (op == OP_add) {
-			make_device(temp, 0);
-			if (ENABLE_FEATURE_MDEV_LOAD_FIRMWARE) {
-				if (fw)
-					load_firmware(fw, temp);
-			}
-		}
-
-		if (seq) {
-			xopen_xwrite_close("mdev.seq", utoa(xatou(seq) + 1));
-		}
 	}
 
 	if (ENABLE_FEATURE_CLEAN_UP)